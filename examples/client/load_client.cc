@@ -0,0 +1,325 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+// Load generator of the consul selector: fibers call `GreeterServiceProxy::SayHello` through the consul selector at a
+// target rate and report the latency of the calls, split by a client filter into the time before the request is sent
+// (selector and the filters in front of it) and the time on the wire. See run_load.sh.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "gflags/gflags.h"
+
+#include "trpc/client/client_context.h"
+#include "trpc/client/make_client_context.h"
+#include "trpc/client/trpc_client.h"
+#include "trpc/common/runtime_manager.h"
+#include "trpc/common/status.h"
+#include "trpc/common/trpc_plugin.h"
+#include "trpc/coroutine/fiber.h"
+#include "trpc/coroutine/fiber_latch.h"
+#include "trpc/filter/filter.h"
+#include "trpc/naming/consul/consul_select_metrics.h"
+#include "trpc/naming/consul/consul_selector.h"
+#include "trpc/naming/consul/consul_selector_api.h"
+#include "trpc/naming/selector_factory.h"
+
+#include "examples/server/helloworld.trpc.pb.h"
+
+DEFINE_string(config, "examples/client/trpc_cpp_fiber.yaml", "yaml");
+DEFINE_string(target, "trpc.test.helloworld.Greeter", "callee service name");
+DEFINE_uint32(fibernum, 64, "calling fibers, each has one call in flight");
+DEFINE_uint32(qps, 10000, "target rate of all fibers together, zero calls back to back");
+DEFINE_uint32(duration_s, 30, "duration of the run in seconds");
+DEFINE_uint32(report_interval_s, 5, "interval of the intermediate reports, zero disables them");
+DEFINE_uint32(timeout_ms, 1000, "timeout of a call");
+DEFINE_string(msg, "test", "the msg to send");
+
+namespace {
+
+using trpc::consul::HistogramSnapshot;
+using trpc::consul::LatencyHistogram;
+
+constexpr char kTimingFilterName[] = "consul_load_timing";
+
+uint64_t NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Timestamps of the call a fiber has in flight, filled in by `TimingFilter`
+struct CallTimes {
+  uint64_t send_ns{0};
+  uint64_t recv_ns{0};
+};
+
+// Calls in flight by their context, so that the filter finds the timestamps of the call it runs for
+class CallRegistry {
+ public:
+  void Add(const trpc::ClientContext* context, CallTimes* times) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    calls_[context] = times;
+  }
+
+  void Remove(const trpc::ClientContext* context) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    calls_.erase(context);
+  }
+
+  // Under the lock, since a late response of a timed out call may still arrive after the call was removed
+  void Stamp(const trpc::ClientContext* context, bool send) {
+    uint64_t now_ns = NowNs();
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = calls_.find(context);
+    if (it != calls_.end()) {
+      (send ? it->second->send_ns : it->second->recv_ns) = now_ns;
+    }
+  }
+
+ private:
+  std::mutex mutex_;
+  std::unordered_map<const trpc::ClientContext*, CallTimes*> calls_;
+};
+
+CallRegistry call_registry;
+
+// Stamps the calls when their request is handed to the transport and when their response arrives. The selector runs
+// at CLIENT_PRE_RPC_INVOKE, so the time up to the first stamp is the select plus the filters around it.
+class TimingFilter : public trpc::MessageClientFilter {
+ public:
+  std::string Name() override { return kTimingFilterName; }
+
+  std::vector<trpc::FilterPoint> GetFilterPoint() override {
+    return {trpc::FilterPoint::CLIENT_PRE_SEND_MSG, trpc::FilterPoint::CLIENT_POST_RECV_MSG};
+  }
+
+  void operator()(trpc::FilterStatus& status, trpc::FilterPoint point, const trpc::ClientContextPtr& context) override {
+    status = trpc::FilterStatus::CONTINUE;
+    call_registry.Stamp(context.get(), point == trpc::FilterPoint::CLIENT_PRE_SEND_MSG);
+  }
+};
+
+// Histograms of one fiber, merged when reported
+struct FiberStats {
+  // From the call to its return
+  LatencyHistogram call_ns;
+  // From the call until the request is sent
+  LatencyHistogram pre_send_ns;
+  // From sending the request until the response arrives
+  LatencyHistogram wire_ns;
+  // How much later than scheduled calls start, the fiber falling behind the target rate
+  LatencyHistogram schedule_lag_ns;
+  std::atomic<uint64_t> failures{0};
+};
+
+void Merge(const HistogramSnapshot& from, HistogramSnapshot* to) {
+  for (size_t i = 0; i < from.buckets.size(); ++i) {
+    to->buckets[i] += from.buckets[i];
+  }
+  to->count += from.count;
+  to->sum += from.sum;
+  to->max = std::max(to->max, from.max);
+}
+
+HistogramSnapshot MergeAll(const std::vector<std::unique_ptr<FiberStats>>& stats,
+                           LatencyHistogram FiberStats::*member) {
+  HistogramSnapshot merged;
+  for (const auto& fiber : stats) {
+    HistogramSnapshot snapshot;
+    ((*fiber).*member).Snapshot(&snapshot);
+    Merge(snapshot, &merged);
+  }
+  return merged;
+}
+
+void PrintHistogram(const char* name, const HistogramSnapshot& histogram) {
+  printf("  %-13s mean:%.1fus p50:%.1fus p99:%.1fus p999:%.1fus max:%.1fus\n", name, histogram.Mean() / 1000.0,
+         histogram.Percentile(50) / 1000.0, histogram.Percentile(99) / 1000.0, histogram.Percentile(99.9) / 1000.0,
+         histogram.max / 1000.0);
+}
+
+// Prints the calls since `previous`, which is then advanced to the current totals
+void Report(const std::vector<std::unique_ptr<FiberStats>>& stats, double seconds, HistogramSnapshot* previous_calls) {
+  HistogramSnapshot calls = MergeAll(stats, &FiberStats::call_ns);
+  uint64_t failures = 0;
+  for (const auto& fiber : stats) {
+    failures += fiber->failures.load(std::memory_order_relaxed);
+  }
+  HistogramSnapshot interval = calls;
+  interval.Subtract(*previous_calls);
+  *previous_calls = calls;
+  printf("calls:%llu qps:%.0f failures:%llu\n", static_cast<unsigned long long>(interval.count),
+         interval.count / seconds, static_cast<unsigned long long>(failures));
+  PrintHistogram("call", interval);
+}
+
+void PrintSelectorMetrics() {
+  auto selector = trpc::SelectorFactory::GetInstance()->Get(trpc::kConsulPluginName);
+  if (selector == nullptr) {
+    return;
+  }
+  std::vector<trpc::consul::CalleeMetricsSnapshot> select_metrics;
+  static_cast<trpc::ConsulSelector*>(selector.get())->GetSelectMetrics(&select_metrics);
+  std::vector<trpc::consul::CalleeRefreshSnapshot> refresh_metrics;
+  static_cast<trpc::ConsulSelector*>(selector.get())->GetRefreshMetrics(&refresh_metrics);
+  for (const auto& callee : select_metrics) {
+    printf("selector %s selects:%llu cache_misses:%llu failures:%llu snapshot_age:%lldms\n", callee.name.c_str(),
+           static_cast<unsigned long long>(callee.selects), static_cast<unsigned long long>(callee.cache_misses),
+           static_cast<unsigned long long>(callee.failures), static_cast<long long>(callee.snapshot_age_ms));
+    PrintHistogram("select", callee.select_latency_ns);
+  }
+  for (const auto& callee : refresh_metrics) {
+    printf("selector %s refreshes:%llu failures:%llu endpoint changes:%llu\n", callee.name.c_str(),
+           static_cast<unsigned long long>(callee.refreshes), static_cast<unsigned long long>(callee.failures),
+           static_cast<unsigned long long>(callee.changes));
+  }
+}
+
+void RunFiber(const std::shared_ptr<::trpc::test::helloworld::GreeterServiceProxy>& prx, uint32_t index,
+              std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end,
+              FiberStats* stats) {
+  ::trpc::test::helloworld::HelloRequest request;
+  request.set_msg(FLAGS_msg);
+  // Each fiber sends at its share of the target rate, the fibers being offset evenly within one interval
+  std::chrono::nanoseconds interval{0};
+  auto scheduled = begin;
+  if (FLAGS_qps > 0) {
+    interval = std::chrono::nanoseconds(1000000000ull * FLAGS_fibernum / FLAGS_qps);
+    scheduled += interval * index / FLAGS_fibernum;
+  }
+  CallTimes times;
+  while (scheduled < end) {
+    if (FLAGS_qps > 0) {
+      ::trpc::FiberSleepUntil(scheduled);
+    }
+    auto context = ::trpc::MakeClientContext(prx);
+    context->SetTimeout(FLAGS_timeout_ms);
+    times = CallTimes{};
+    call_registry.Add(context.get(), &times);
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t start_ns = NowNs();
+    ::trpc::test::helloworld::HelloReply reply;
+    ::trpc::Status status = prx->SayHello(context, request, &reply);
+    uint64_t done_ns = NowNs();
+    call_registry.Remove(context.get());
+
+    if (FLAGS_qps > 0) {
+      auto lag = std::chrono::duration_cast<std::chrono::nanoseconds>(start - scheduled);
+      stats->schedule_lag_ns.Record(std::max<int64_t>(lag.count(), 0));
+      scheduled += interval;
+    } else {
+      scheduled = std::chrono::steady_clock::now();
+    }
+    if (!status.OK()) {
+      stats->failures.fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+    stats->call_ns.Record(done_ns - start_ns);
+    if (times.send_ns >= start_ns) {
+      stats->pre_send_ns.Record(times.send_ns - start_ns);
+      if (times.recv_ns >= times.send_ns) {
+        stats->wire_ns.Record(times.recv_ns - times.send_ns);
+      }
+    }
+  }
+}
+
+int Run() {
+  ::trpc::ServiceProxyOption option;
+
+  option.name = FLAGS_target;
+  option.codec_name = "trpc";
+  option.network = "tcp";
+  option.conn_type = "long";
+  option.timeout = FLAGS_timeout_ms;
+  option.selector_name = "consul";
+  option.target = FLAGS_target;
+  option.service_filters.push_back(kTimingFilterName);
+
+  auto prx = ::trpc::GetTrpcClient()->GetProxy<::trpc::test::helloworld::GreeterServiceProxy>(FLAGS_target, &option);
+
+  std::vector<std::unique_ptr<FiberStats>> stats;
+  for (uint32_t i = 0; i < FLAGS_fibernum; ++i) {
+    stats.push_back(std::make_unique<FiberStats>());
+  }
+  auto begin = std::chrono::steady_clock::now();
+  auto end = begin + std::chrono::seconds(FLAGS_duration_s);
+  ::trpc::FiberLatch latch(FLAGS_fibernum);
+  for (uint32_t i = 0; i < FLAGS_fibernum; ++i) {
+    ::trpc::StartFiberDetached([&, i] {
+      RunFiber(prx, i, begin, end, stats[i].get());
+      latch.CountDown();
+    });
+  }
+
+  HistogramSnapshot reported;
+  auto last_report = begin;
+  while (FLAGS_report_interval_s > 0 && !latch.WaitFor(std::chrono::seconds(FLAGS_report_interval_s))) {
+    auto now = std::chrono::steady_clock::now();
+    Report(stats, std::chrono::duration<double>(now - last_report).count(), &reported);
+    last_report = now;
+  }
+  latch.Wait();
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+  HistogramSnapshot calls = MergeAll(stats, &FiberStats::call_ns);
+  uint64_t failures = 0;
+  for (const auto& fiber : stats) {
+    failures += fiber->failures.load(std::memory_order_relaxed);
+  }
+  printf("--- target:%s fibers:%u target qps:%u duration:%.1fs\n", FLAGS_target.c_str(), FLAGS_fibernum, FLAGS_qps,
+         seconds);
+  printf("calls:%llu qps:%.0f failures:%llu\n", static_cast<unsigned long long>(calls.count), calls.count / seconds,
+         static_cast<unsigned long long>(failures));
+  PrintHistogram("call", calls);
+  PrintHistogram("pre_send", MergeAll(stats, &FiberStats::pre_send_ns));
+  PrintHistogram("wire", MergeAll(stats, &FiberStats::wire_ns));
+  if (FLAGS_qps > 0) {
+    PrintHistogram("schedule_lag", MergeAll(stats, &FiberStats::schedule_lag_ns));
+  }
+  PrintSelectorMetrics();
+  return failures == 0 ? 0 : -1;
+}
+
+void ParseClientConfig(int argc, char* argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  if (FLAGS_fibernum == 0) {
+    std::cerr << "--fibernum must be positive" << std::endl;
+    exit(-1);
+  }
+  int ret = ::trpc::TrpcConfig::GetInstance()->Init(FLAGS_config);
+  if (ret != 0) {
+    std::cerr << "load config failed." << std::endl;
+    exit(-1);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  ParseClientConfig(argc, argv);
+
+  ::trpc::consul::selector::Init();
+  ::trpc::TrpcPlugin::GetInstance()->RegisterClientFilter(std::make_shared<TimingFilter>());
+
+  return ::trpc::RunInTrpcRuntime([]() { return Run(); });
+}
@@ -0,0 +1,44 @@
+#!/bin/bash
+# Load test of the consul selector: several helloworld_server instances register in the fake consul agent, or in the
+# consul agent on 127.0.0.1:8500 if LOCAL_CONSUL=1, and load_client calls them through the consul selector.
+#
+# Usage: ./run_load.sh [servers] [qps] [duration_s] [churn_interval_ms]
+#   churn_interval_ms flips the health of 10% of the instances per interval, fake agent only, zero disables it.
+#   Further flags of load_client can be passed in LOAD_CLIENT_FLAGS, e.g. LOAD_CLIENT_FLAGS="--fibernum=256".
+
+servers=${1:-4}
+qps=${2:-10000}
+duration_s=${3:-30}
+churn_interval_ms=${4:-0}
+
+bazel build //examples/... //trpc/naming/consul/testing:fake_consul || exit -1
+
+workdir=$(mktemp -d /tmp/consul_load.XXXXXX)
+pids=()
+cleanup() {
+  kill "${pids[@]}" 2>/dev/null
+  wait
+}
+trap cleanup EXIT
+
+if [ "${LOCAL_CONSUL}" != "1" ]; then
+  ./bazel-bin/trpc/naming/consul/testing/fake_consul --port=8500 --churn_interval_ms="${churn_interval_ms}" \
+      --churn_fraction=0.1 > "${workdir}/fake_consul.log" 2>&1 &
+  pids+=($!)
+  sleep 1
+fi
+
+for ((i = 0; i < servers; i++)); do
+  sed -e "s/port: 10001/port: $((10001 + i))/" -e "s/admin_port: 8888/admin_port: $((8888 + i))/" \
+      -e "s/filename: trpc.log/filename: ${workdir//\//\\/}\/server_${i}.log/" \
+      examples/server/trpc_cpp_fiber.yaml > "${workdir}/server_${i}.yaml"
+  ./bazel-bin/examples/server/helloworld_server --config="${workdir}/server_${i}.yaml" > /dev/null 2>&1 &
+  pids+=($!)
+done
+sleep 3
+
+./bazel-bin/examples/client/load_client --config=examples/client/trpc_cpp_fiber.yaml --qps="${qps}" \
+    --duration_s="${duration_s}" ${LOAD_CLIENT_FLAGS}
+ret=$?
+echo "logs in ${workdir}"
+exit ${ret}
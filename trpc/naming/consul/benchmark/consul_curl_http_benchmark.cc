@@ -0,0 +1,124 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#include <cstdlib>
+#include <new>
+#include <string>
+
+#include "benchmark/benchmark.h"
+
+#include "trpc/naming/consul/benchmark/consul_loopback_server.h"
+#include "trpc/transport/common/http/curl_http.h"
+
+// Heap allocations of the benchmark thread: operator new covers the wrapper, malloc covers libcurl as well
+namespace {
+
+thread_local uint64_t new_count = 0;
+thread_local uint64_t malloc_count = 0;
+
+}  // namespace
+
+void* operator new(size_t size) {
+  ++new_count;
+  void* ptr = std::malloc(size);
+  if (ptr == nullptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+
+#if defined(__GLIBC__)
+extern "C" {
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t num, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size) {
+  ++malloc_count;
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t num, size_t size) {
+  ++malloc_count;
+  return __libc_calloc(num, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+  ++malloc_count;
+  return __libc_realloc(ptr, size);
+}
+
+}  // extern "C"
+#endif
+
+namespace {
+
+constexpr char kServiceName[] = "trpc.test.helloworld.Greeter";
+
+// A health response of a few instances, about the size Consul returns for them
+trpc::consul::LoopbackConsul* GetServer() {
+  static auto* server = new trpc::consul::LoopbackConsul(kServiceName, 8);
+  return server;
+}
+
+void ReportAllocations(benchmark::State& state, uint64_t news, uint64_t mallocs) {
+  state.counters["new_per_request"] = benchmark::Counter(static_cast<double>(news) / state.iterations());
+  state.counters["malloc_per_request"] = benchmark::Counter(static_cast<double>(mallocs) / state.iterations());
+}
+
+trpc::curl_http::CurlHttp* MakeClient() {
+  auto* curl = new trpc::curl_http::CurlHttp();
+  curl->Init();
+  curl->SetRequestHeader("Cache-Control", "max-age=30");
+  return curl;
+}
+
+// Response allocated per request, as the shared_ptr API does.
+void BM_GetNewResponse(benchmark::State& state) {
+  std::string url = GetServer()->Url();
+  auto* curl = MakeClient();
+  curl->Get(url);
+  uint64_t news = new_count;
+  uint64_t mallocs = malloc_count;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(curl->Get(url));
+  }
+  ReportAllocations(state, new_count - news, malloc_count - mallocs);
+  delete curl;
+}
+
+// Response and url reused across requests, as the refresh worker does. The wrapper should allocate nothing, what
+// is left of malloc_per_request is libcurl.
+void BM_GetReusedResponse(benchmark::State& state) {
+  std::string url = GetServer()->Url();
+  auto* curl = MakeClient();
+  trpc::curl_http::CurlHttpResponse response;
+  curl->Get(url, &response);
+  uint64_t news = new_count;
+  uint64_t mallocs = malloc_count;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(curl->Get(url, &response));
+  }
+  ReportAllocations(state, new_count - news, malloc_count - mallocs);
+  delete curl;
+}
+
+}  // namespace
+
+BENCHMARK(BM_GetNewResponse)->UseRealTime();
+BENCHMARK(BM_GetReusedResponse)->UseRealTime();
+
+BENCHMARK_MAIN();
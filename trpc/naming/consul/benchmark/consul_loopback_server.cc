@@ -0,0 +1,111 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#include "trpc/naming/consul/benchmark/consul_loopback_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <thread>
+
+namespace trpc::consul {
+
+namespace {
+
+bool WriteAll(int fd, const std::string& data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t n = write(fd, data.data() + written, data.size() - written);
+    if (n <= 0) return false;
+    written += n;
+  }
+  return true;
+}
+
+}  // namespace
+
+std::string MakeHealthResponseBody(const std::string& service_name, int endpoint_num, bool variant) {
+  std::string body = "[";
+  for (int i = 0; i < endpoint_num; ++i) {
+    if (i > 0) body += ",";
+    std::string address = "10." + std::to_string((i >> 16) & 0xFF) + "." + std::to_string((i >> 8) & 0xFF) + "." +
+                          std::to_string(i & 0xFF);
+    std::string status = variant && i == 0 ? "critical" : "passing";
+    body += R"({"Node":{"Node":"node)" + std::to_string(i) + R"(","Address":")" + address + R"("},)";
+    body += R"("Service":{"ID":")" + service_name + "-" + std::to_string(i) + R"(","Service":")" + service_name +
+            R"(","Address":")" + address + R"(","Port":)" + std::to_string(8000 + i % 1000) + "},";
+    body += R"("Checks":[{"Name":"Serf Health Status","Status":"passing"},)";
+    body += R"({"Name":")" + service_name + R"(","Status":")" + status + R"("}]})";
+  }
+  return body + "]";
+}
+
+LoopbackConsul::LoopbackConsul(const std::string& service_name, int endpoint_num, bool alternate)
+    : service_name_(service_name), alternate_(alternate) {
+  for (int variant = 0; variant < 2; ++variant) {
+    std::string body = MakeHealthResponseBody(service_name, endpoint_num, variant == 1);
+    responses_[variant] = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nX-Consul-Index: " +
+                          std::to_string(42 + variant) +
+                          "\r\nX-Consul-KnownLeader: true\r\nX-Consul-LastContact: 0\r\nContent-Length: " +
+                          std::to_string(body.size()) + "\r\n\r\n" + body;
+  }
+  listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+  socklen_t len = sizeof(addr);
+  getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&addr), &len);
+  port_ = ntohs(addr.sin_port);
+  listen(listen_fd_, 64);
+  std::thread([this]() { Serve(); }).detach();
+}
+
+std::string LoopbackConsul::Address() const { return "127.0.0.1:" + std::to_string(port_); }
+
+std::string LoopbackConsul::Url() const { return "http://" + Address() + "/v1/health/service/" + service_name_; }
+
+void LoopbackConsul::Serve() {
+  while (true) {
+    int fd = accept(listen_fd_, nullptr, nullptr);
+    if (fd < 0) return;
+    std::thread([this, fd]() { ServeConnection(fd); }).detach();
+  }
+}
+
+void LoopbackConsul::ServeConnection(int fd) {
+  char buf[4096];
+  size_t used = 0;
+  while (true) {
+    ssize_t n = read(fd, buf + used, sizeof(buf) - used);
+    if (n <= 0) break;
+    used += n;
+    // Requests carry no body, answer each complete header block
+    char* end;
+    while ((end = static_cast<char*>(memmem(buf, used, "\r\n\r\n", 4))) != nullptr) {
+      size_t consumed = end + 4 - buf;
+      memmove(buf, buf + consumed, used - consumed);
+      used -= consumed;
+      uint64_t request = requests_.fetch_add(1, std::memory_order_relaxed);
+      const std::string& response = responses_[alternate_ ? request % 2 : 0];
+      if (!WriteAll(fd, response)) break;
+    }
+    if (used == sizeof(buf)) break;
+  }
+  close(fd);
+}
+
+}  // namespace trpc::consul
@@ -0,0 +1,59 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#pragma once
+
+#include <atomic>
+#include <string>
+
+namespace trpc::consul {
+
+/// @brief Health response of `endpoint_num` instances of `service_name` as the Consul agent returns it. With
+/// `variant` set the first instance is critical, so that the two variants are different endpoint tables.
+std::string MakeHealthResponseBody(const std::string& service_name, int endpoint_num, bool variant = false);
+
+/// @brief Keep-alive HTTP/1.1 server on the loopback interface standing in for the Consul agent. Every request is
+/// answered with the health response of `endpoint_num` instances, whatever its path.
+/// @note Its threads are never joined, it is meant to live until the benchmark process exits.
+class LoopbackConsul {
+ public:
+  /// @param alternate answer the requests with the two variants of the response in turn, so that every refresh
+  ///        publishes a changed table.
+  LoopbackConsul(const std::string& service_name, int endpoint_num, bool alternate = false);
+
+  LoopbackConsul(const LoopbackConsul&) = delete;
+  LoopbackConsul& operator=(const LoopbackConsul&) = delete;
+
+  /// @brief "127.0.0.1:port", the address to configure in `naming::ConsulConfig::address_`.
+  std::string Address() const;
+
+  /// @brief Url of the health query of the service.
+  std::string Url() const;
+
+  /// @brief Requests answered so far.
+  uint64_t Requests() const { return requests_.load(std::memory_order_relaxed); }
+
+ private:
+  void Serve();
+
+  void ServeConnection(int fd);
+
+  std::string service_name_;
+  std::string responses_[2];
+  bool alternate_;
+  std::atomic<uint64_t> requests_{0};
+  int listen_fd_{-1};
+  int port_{0};
+};
+
+}  // namespace trpc::consul
@@ -0,0 +1,102 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include "benchmark/benchmark.h"
+
+#include "trpc/naming/consul/benchmark/consul_loopback_server.h"
+#include "trpc/naming/consul/consul_refresh_worker.h"
+#include "trpc/naming/consul/consul_transport.h"
+
+namespace {
+
+constexpr char kServiceName[] = "trpc.test.helloworld.Greeter";
+
+// Parse of a health response into the endpoint table. The body is parsed in situ, so every iteration copies it into
+// the response first, which is included in the time.
+void BM_ParseResponse(benchmark::State& state) {
+  int endpoint_num = static_cast<int>(state.range(0));
+  std::string body = trpc::consul::MakeHealthResponseBody(kServiceName, endpoint_num);
+  trpc::consul::HostInterner interner;
+  trpc::consul::ConsulRefreshWorker worker;
+  worker.Init();
+  for (auto _ : state) {
+    worker.MutableResponse()->body.assign(body);
+    if (worker.ParseResponse(kServiceName, &interner) != 0) {
+      state.SkipWithError("parse failed");
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * body.size());
+  state.SetItemsProcessed(state.iterations() * endpoint_num);
+  worker.Destroy();
+}
+
+// Fetch and parse of a health response from a loopback agent over a kept-alive connection
+void BM_Refresh(benchmark::State& state) {
+  int endpoint_num = static_cast<int>(state.range(0));
+  // Servers are kept, a benchmark function is run several times to find its iteration count
+  static std::map<int, trpc::consul::LoopbackConsul*> servers;
+  auto& server = servers[endpoint_num];
+  if (server == nullptr) {
+    server = new trpc::consul::LoopbackConsul(kServiceName, endpoint_num);
+  }
+  trpc::consul::ConsulQueryOptions options;
+  options.http.base_url = "http://" + server->Address();
+  trpc::consul::HostInterner interner;
+  trpc::consul::ConsulRefreshWorker worker;
+  worker.Init(options);
+  for (auto _ : state) {
+    if (worker.Refresh(kServiceName, &interner) != 0) {
+      state.SkipWithError("refresh failed");
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+  worker.Destroy();
+}
+
+// Refresh over the in-memory transport: the whole refresh path without sockets, so the difference to BM_Refresh is
+// the cost of the HTTP round trip
+void BM_RefreshInMemory(benchmark::State& state) {
+  int endpoint_num = static_cast<int>(state.range(0));
+  std::string body = trpc::consul::MakeHealthResponseBody(kServiceName, endpoint_num);
+  auto transport = std::make_unique<trpc::consul::InMemoryTransport>(
+      [&body](const std::string& method, const std::string& url, const std::string& request_body,
+              trpc::curl_http::CurlHttpResponse* response) {
+        response->headers = "X-Consul-Index: 1\r\nX-Consul-KnownLeader: true\r\nX-Consul-LastContact: 0\r\n";
+        response->body.assign(body);
+      });
+  trpc::consul::HostInterner interner;
+  trpc::consul::ConsulRefreshWorker worker;
+  worker.Init(trpc::consul::ConsulQueryOptions(), std::move(transport));
+  for (auto _ : state) {
+    if (worker.Refresh(kServiceName, &interner) != 0) {
+      state.SkipWithError("refresh failed");
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+  worker.Destroy();
+}
+
+}  // namespace
+
+BENCHMARK(BM_ParseResponse)->ArgName("endpoints")->Arg(1)->Arg(10)->Arg(100)->Arg(1000)->Arg(10000);
+BENCHMARK(BM_Refresh)->ArgName("endpoints")->Arg(10)->Arg(1000)->UseRealTime();
+BENCHMARK(BM_RefreshInMemory)->ArgName("endpoints")->Arg(10)->Arg(1000);
+
+BENCHMARK_MAIN();
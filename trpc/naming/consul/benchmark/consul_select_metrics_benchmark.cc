@@ -0,0 +1,55 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#include <atomic>
+#include <chrono>
+
+#include "benchmark/benchmark.h"
+
+#include "trpc/naming/consul/consul_select_metrics.h"
+
+namespace {
+
+trpc::consul::CalleeSelectMetrics* metrics = new trpc::consul::CalleeSelectMetrics();
+
+// What ConsulSelector::Select adds per call: the sampling decision, the select counter, and for every sampled call
+// two clock reads and a histogram update. All threads record into the same callee.
+void BM_SelectMetrics(benchmark::State& state) {
+  for (auto _ : state) {
+    bool timed = trpc::consul::CalleeSelectMetrics::SampleLatency();
+    auto begin_time = timed ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+    metrics->RecordSelect(false);
+    if (timed) {
+      auto latency = std::chrono::steady_clock::now() - begin_time;
+      metrics->RecordSelectLatency(std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count());
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// The same counter without sharding, for comparison: all threads increment one cache line.
+std::atomic<uint64_t> unsharded{0};
+
+void BM_UnshardedCounter(benchmark::State& state) {
+  for (auto _ : state) {
+    unsharded.fetch_add(1, std::memory_order_relaxed);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+}  // namespace
+
+BENCHMARK(BM_SelectMetrics)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(BM_UnshardedCounter)->ThreadRange(1, 16)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,151 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "trpc/naming/consul/benchmark/consul_loopback_server.h"
+#include "trpc/naming/consul/consul_refresh_metrics.h"
+#include "trpc/naming/consul/consul_selector.h"
+
+namespace {
+
+constexpr char kServiceName[] = "trpc.test.helloworld.Greeter";
+
+// One selector per endpoint count, each looking its callee up from its own loopback agent. The callee is resolved
+// before the first measurement, so the benchmarks measure the warm path. With `alternate` set every refresh
+// publishes a changed table.
+trpc::ConsulSelector* GetSelector(int endpoint_num, bool alternate = false) {
+  static std::mutex mutex;
+  static std::map<std::pair<int, bool>, trpc::ConsulSelector*> selectors;
+  std::lock_guard<std::mutex> lock(mutex);
+  auto& selector = selectors[{endpoint_num, alternate}];
+  if (selector == nullptr) {
+    auto* server = new trpc::consul::LoopbackConsul(kServiceName, endpoint_num, alternate);
+    trpc::naming::ConsulConfig config;
+    config.address_ = server->Address();
+    config.rate_limit_ = 0;
+    selector = new trpc::ConsulSelector();
+    selector->Init(config);
+    trpc::SelectorInfo info;
+    info.name = kServiceName;
+    trpc::TrpcEndpointInfo endpoint;
+    if (selector->Select(&info, &endpoint) != 0) {
+      std::abort();
+    }
+  }
+  return selector;
+}
+
+void BM_Select(benchmark::State& state) {
+  trpc::ConsulSelector* selector = GetSelector(static_cast<int>(state.range(0)));
+  trpc::SelectorInfo info;
+  info.name = kServiceName;
+  trpc::TrpcEndpointInfo endpoint;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(selector->Select(&info, &endpoint));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Copies all endpoints out of the cached list
+void BM_SelectBatchAll(benchmark::State& state) {
+  trpc::ConsulSelector* selector = GetSelector(static_cast<int>(state.range(0)));
+  trpc::SelectorInfo info;
+  info.name = kServiceName;
+  info.policy = trpc::SelectorPolicy::ALL;
+  std::vector<trpc::TrpcEndpointInfo> endpoints;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(selector->SelectBatch(&info, &endpoints));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_SelectBatchMultiple(benchmark::State& state) {
+  trpc::ConsulSelector* selector = GetSelector(static_cast<int>(state.range(0)));
+  trpc::SelectorInfo info;
+  info.name = kServiceName;
+  info.policy = trpc::SelectorPolicy::MULTIPLE;
+  info.select_num = static_cast<int>(state.range(1));
+  std::vector<trpc::TrpcEndpointInfo> endpoints;
+  for (auto _ : state) {
+    endpoints.clear();
+    benchmark::DoNotOptimize(selector->SelectBatch(&info, &endpoints));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Hands out the cached list by reference count, the baseline of the batch selections
+void BM_SelectBatchShared(benchmark::State& state) {
+  trpc::ConsulSelector* selector = GetSelector(static_cast<int>(state.range(0)));
+  trpc::SelectorInfo info;
+  info.name = kServiceName;
+  trpc::ConsulEndpointListPtr endpoints;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(selector->SelectBatchShared(&info, &endpoints));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Thread 0 refreshes the callee in a loop, every refresh publishing a changed table, while the other threads
+// select. Reports the select and refresh rates, and the publishing stages of the refreshes (RefreshDomainInfo) from
+// the refresh stage histograms.
+void BM_RefreshUnderReaders(benchmark::State& state) {
+  trpc::ConsulSelector* selector = GetSelector(static_cast<int>(state.range(0)), true);
+  trpc::SelectorInfo info;
+  info.name = kServiceName;
+  trpc::RouterInfo router_info;
+  router_info.name = kServiceName;
+  router_info.info.resize(1);
+  router_info.info[0].host = kServiceName;
+  trpc::TrpcEndpointInfo endpoint;
+
+  if (state.thread_index() != 0) {
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(selector->Select(&info, &endpoint));
+    }
+    state.counters["selects"] = benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+    return;
+  }
+
+  auto before = std::make_unique<trpc::consul::RefreshStageSnapshot>();
+  trpc::consul::GetRefreshStageStats(before.get());
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(selector->SetEndpoints(&router_info));
+  }
+  state.counters["refreshes"] = benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+  auto after = std::make_unique<trpc::consul::RefreshStageSnapshot>();
+  trpc::consul::GetRefreshStageStats(after.get());
+  for (auto stage : {trpc::consul::RefreshStage::kAssignIds, trpc::consul::RefreshStage::kPublish,
+                     trpc::consul::RefreshStage::kLoadBalance}) {
+    trpc::consul::HistogramSnapshot& histogram = after->stage_us[static_cast<size_t>(stage)];
+    histogram.Subtract(before->stage_us[static_cast<size_t>(stage)]);
+    state.counters[std::string(trpc::consul::RefreshStageName(stage)) + "_mean_us"] = histogram.Mean();
+  }
+}
+
+}  // namespace
+
+BENCHMARK(BM_Select)->ArgName("endpoints")->Arg(8)->Arg(1024)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_SelectBatchAll)->ArgName("endpoints")->Arg(8)->Arg(64)->Arg(1024);
+BENCHMARK(BM_SelectBatchMultiple)->ArgNames({"endpoints", "select_num"})->Args({64, 3})->Args({1024, 3});
+BENCHMARK(BM_SelectBatchShared)->ArgName("endpoints")->Arg(8)->Arg(1024);
+BENCHMARK(BM_RefreshUnderReaders)->ArgName("endpoints")->Arg(64)->Arg(1024)->ThreadRange(2, 8)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,331 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+// Stress and scalability harness of the consul selector: reader threads run a mix of Select, SelectBatch and
+// AsyncSelect while the in-process fake agent churns the endpoints and a driver thread forces refreshes. Reports the
+// throughput and latency percentiles per operation, and the staleness of the served endpoints. Meant to be run
+// under TSan as well, e.g.
+//   bazel run --config=tsan //trpc/naming/consul/benchmark:consul_selector_stress -- --threads=16 --duration_s=30
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gflags/gflags.h"
+
+#include "trpc/naming/consul/consul_selector.h"
+#include "trpc/naming/consul/testing/fake_consul_server.h"
+
+DEFINE_uint32(threads, 8, "reader threads");
+DEFINE_uint32(duration_s, 10, "duration of the run in seconds");
+DEFINE_uint32(callees, 4, "called services, the readers pick one at random per call");
+DEFINE_uint32(endpoints, 100, "instances per called service");
+DEFINE_string(mix, "8:1:1", "relative weights of Select, SelectBatch and AsyncSelect");
+DEFINE_uint32(refresh_interval_ms, 100, "interval of the forced refreshes of every callee, zero disables them");
+DEFINE_uint32(churn_interval_ms, 50, "interval of the endpoint churn of the fake agent, zero disables it");
+DEFINE_double(churn_fraction, 0.05, "share of the instances changed per churn interval");
+DEFINE_bool(churn_replace, false, "replace churned instances instead of flipping their health");
+DEFINE_uint32(probe_interval_ms, 20, "interval of the changes of the probe endpoint measuring staleness");
+DEFINE_uint32(consul_latency_ms, 0, "delay of every response of the fake agent");
+DEFINE_string(transport, "curl", "transport of the selector: curl or curl_multi");
+
+namespace {
+
+using trpc::consul::HistogramSnapshot;
+using trpc::consul::LatencyHistogram;
+
+constexpr char kProbeService[] = "trpc.stress.Probe";
+constexpr char kProbeHost[] = "127.0.0.2";
+
+enum Operation { kSelect, kSelectBatch, kAsyncSelect, kOperationNum };
+
+const char* const kOperationNames[kOperationNum] = {"Select", "SelectBatch", "AsyncSelect"};
+
+uint64_t NowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void Merge(const HistogramSnapshot& from, HistogramSnapshot* to) {
+  for (size_t i = 0; i < from.buckets.size(); ++i) {
+    to->buckets[i] += from.buckets[i];
+  }
+  to->count += from.count;
+  to->sum += from.sum;
+  to->max = std::max(to->max, from.max);
+}
+
+// Latencies and failures of one reader thread, merged once the run is over
+struct ReaderStats {
+  LatencyHistogram latency_ns[kOperationNum];
+  uint64_t failures[kOperationNum]{};
+};
+
+// Changes of the probe endpoint: its port is the sequence number of the change, so a reader seeing port `n` knows the
+// endpoints it was served miss the changes after `n`
+class Probe {
+ public:
+  explicit Probe(trpc::consul::FakeConsulServer* server) : server_(server) {}
+
+  void Change() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    trpc::consul::FakeConsulInstance instance;
+    instance.id = "probe";
+    instance.service = kProbeService;
+    instance.address = kProbeHost;
+    instance.port = static_cast<int>(change_us_.size()) + 1;
+    change_us_.push_back(NowUs());
+    server_->Register(instance);
+  }
+
+  // Time since the first change the endpoint of `port` misses, zero if it is the latest
+  uint64_t StalenessUs(int port, uint64_t now_us) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t next = static_cast<size_t>(port);
+    return next < change_us_.size() && now_us > change_us_[next] ? now_us - change_us_[next] : 0;
+  }
+
+ private:
+  trpc::consul::FakeConsulServer* server_;
+  std::mutex mutex_;
+  std::deque<uint64_t> change_us_;
+};
+
+bool ParseMix(const std::string& mix, uint32_t weights[kOperationNum]) {
+  std::stringstream stream(mix);
+  std::string item;
+  int i = 0;
+  while (std::getline(stream, item, ':')) {
+    if (i == kOperationNum) {
+      return false;
+    }
+    weights[i++] = static_cast<uint32_t>(std::stoul(item));
+  }
+  return i == kOperationNum && weights[0] + weights[1] + weights[2] > 0;
+}
+
+void RunReader(trpc::ConsulSelector* selector, const std::vector<std::string>& callees,
+               const uint32_t weights[kOperationNum], const std::atomic<bool>* stop, ReaderStats* stats) {
+  std::mt19937 random(std::random_device{}());
+  uint32_t total_weight = weights[0] + weights[1] + weights[2];
+  trpc::SelectorInfo info;
+  info.policy = trpc::SelectorPolicy::ALL;
+  trpc::TrpcEndpointInfo endpoint;
+  std::vector<trpc::TrpcEndpointInfo> endpoints;
+  while (!stop->load(std::memory_order_relaxed)) {
+    info.name = callees[random() % callees.size()];
+    uint32_t pick = random() % total_weight;
+    Operation operation = pick < weights[0] ? kSelect : pick < weights[0] + weights[1] ? kSelectBatch : kAsyncSelect;
+    auto begin = std::chrono::steady_clock::now();
+    bool ok = false;
+    switch (operation) {
+      case kSelect:
+        ok = selector->Select(&info, &endpoint) == 0;
+        break;
+      case kSelectBatch:
+        endpoints.clear();
+        ok = selector->SelectBatch(&info, &endpoints) == 0;
+        break;
+      default: {
+        auto future = selector->AsyncSelect(&info);
+        ok = !future.IsFailed();
+        break;
+      }
+    }
+    auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin);
+    stats->latency_ns[operation].Record(latency.count());
+    if (!ok) {
+      stats->failures[operation]++;
+    }
+  }
+}
+
+void RunRefreshDriver(trpc::ConsulSelector* selector, const std::vector<std::string>& callees,
+                      const std::atomic<bool>* stop, uint64_t* refreshes, uint64_t* failures) {
+  while (!stop->load(std::memory_order_relaxed)) {
+    for (const auto& callee : callees) {
+      trpc::RouterInfo router_info;
+      router_info.name = callee;
+      router_info.info.resize(1);
+      router_info.info[0].host = callee;
+      ++*refreshes;
+      if (selector->SetEndpoints(&router_info) != 0) {
+        ++*failures;
+      }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(FLAGS_refresh_interval_ms));
+  }
+}
+
+// Samples the probe endpoint served by the selector every millisecond
+void RunStalenessSampler(trpc::ConsulSelector* selector, Probe* probe, const std::atomic<bool>* stop,
+                         LatencyHistogram* staleness_us) {
+  trpc::SelectorInfo info;
+  info.name = kProbeService;
+  trpc::ConsulEndpointListPtr endpoints;
+  while (!stop->load(std::memory_order_relaxed)) {
+    if (selector->SelectBatchShared(&info, &endpoints) == 0) {
+      for (const auto& endpoint : *endpoints) {
+        if (endpoint.host == kProbeHost) {
+          staleness_us->Record(probe->StalenessUs(endpoint.port, NowUs()));
+          break;
+        }
+      }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+void PrintHistogram(const char* name, const char* unit, const HistogramSnapshot& histogram) {
+  printf("  %-12s p50:%llu%s p99:%llu%s p999:%llu%s max:%llu%s\n", name,
+         static_cast<unsigned long long>(histogram.Percentile(50)), unit,
+         static_cast<unsigned long long>(histogram.Percentile(99)), unit,
+         static_cast<unsigned long long>(histogram.Percentile(99.9)), unit,
+         static_cast<unsigned long long>(histogram.max), unit);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  uint32_t weights[kOperationNum];
+  if (!ParseMix(FLAGS_mix, weights) || FLAGS_callees == 0 || FLAGS_threads == 0) {
+    fprintf(stderr, "invalid flags, --mix is select:batch:async, e.g. 8:1:1\n");
+    return -1;
+  }
+
+  trpc::consul::FakeConsulServer server;
+  if (server.Start() != 0) {
+    fprintf(stderr, "fake consul failed to start\n");
+    return -1;
+  }
+  std::vector<std::string> callees;
+  for (uint32_t i = 0; i < FLAGS_callees; ++i) {
+    callees.push_back("trpc.stress.Greeter" + std::to_string(i));
+    server.AddInstances(callees.back(), FLAGS_endpoints);
+  }
+  Probe probe(&server);
+  probe.Change();
+  trpc::consul::FakeConsulFaults faults;
+  faults.min_latency_ms = FLAGS_consul_latency_ms;
+  faults.max_latency_ms = FLAGS_consul_latency_ms;
+  server.SetFaults(faults);
+
+  trpc::naming::ConsulConfig config;
+  config.address_ = server.Address();
+  config.rate_limit_ = 0;
+  config.transport_ = FLAGS_transport;
+  trpc::ConsulSelector selector;
+  if (selector.Init(config) != 0) {
+    fprintf(stderr, "selector failed to init\n");
+    return -1;
+  }
+  // Resolved up front, so that the run measures the warm path
+  trpc::SelectorInfo info;
+  trpc::TrpcEndpointInfo endpoint;
+  for (const auto& name : callees) {
+    info.name = name;
+    if (selector.Select(&info, &endpoint) != 0) {
+      fprintf(stderr, "first select of %s failed\n", name.c_str());
+      return -1;
+    }
+  }
+
+  trpc::consul::FakeConsulChurn churn;
+  churn.interval_ms = FLAGS_churn_interval_ms;
+  churn.fraction = FLAGS_churn_fraction;
+  churn.replace = FLAGS_churn_replace;
+  server.SetChurn(churn);
+
+  std::atomic<bool> stop{false};
+  std::vector<std::unique_ptr<ReaderStats>> reader_stats;
+  std::vector<std::thread> threads;
+  for (uint32_t i = 0; i < FLAGS_threads; ++i) {
+    reader_stats.push_back(std::make_unique<ReaderStats>());
+    threads.emplace_back(RunReader, &selector, std::cref(callees), weights, &stop, reader_stats.back().get());
+  }
+  uint64_t refreshes = 0;
+  uint64_t refresh_failures = 0;
+  std::vector<std::string> refreshed = callees;
+  refreshed.push_back(kProbeService);
+  if (FLAGS_refresh_interval_ms > 0) {
+    threads.emplace_back(RunRefreshDriver, &selector, std::cref(refreshed), &stop, &refreshes, &refresh_failures);
+  }
+  LatencyHistogram staleness_us;
+  threads.emplace_back(RunStalenessSampler, &selector, &probe, &stop, &staleness_us);
+
+  auto begin = std::chrono::steady_clock::now();
+  auto end = begin + std::chrono::seconds(FLAGS_duration_s);
+  while (std::chrono::steady_clock::now() < end) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(std::max<uint32_t>(FLAGS_probe_interval_ms, 1)));
+    probe.Change();
+  }
+  stop = true;
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+  printf("threads:%u callees:%u endpoints:%u mix:%s transport:%s duration:%.1fs\n", FLAGS_threads, FLAGS_callees,
+         FLAGS_endpoints, FLAGS_mix.c_str(), FLAGS_transport.c_str(), seconds);
+  uint64_t total_ops = 0;
+  for (int operation = 0; operation < kOperationNum; ++operation) {
+    HistogramSnapshot merged;
+    uint64_t failures = 0;
+    for (const auto& stats : reader_stats) {
+      HistogramSnapshot snapshot;
+      stats->latency_ns[operation].Snapshot(&snapshot);
+      Merge(snapshot, &merged);
+      failures += stats->failures[operation];
+    }
+    if (merged.count == 0) {
+      continue;
+    }
+    total_ops += merged.count;
+    printf("%s ops:%llu throughput:%.0f/s failures:%llu\n", kOperationNames[operation],
+           static_cast<unsigned long long>(merged.count), merged.count / seconds,
+           static_cast<unsigned long long>(failures));
+    PrintHistogram("latency", "ns", merged);
+  }
+  printf("total throughput:%.0f/s, %.0f/s per thread\n", total_ops / seconds, total_ops / seconds / FLAGS_threads);
+
+  HistogramSnapshot staleness;
+  staleness_us.Snapshot(&staleness);
+  printf("staleness samples:%llu\n", static_cast<unsigned long long>(staleness.count));
+  PrintHistogram("staleness", "us", staleness);
+
+  std::vector<trpc::consul::CalleeRefreshSnapshot> refresh_metrics;
+  selector.GetRefreshMetrics(&refresh_metrics);
+  uint64_t changes = 0;
+  for (const auto& callee : refresh_metrics) {
+    changes += callee.changes;
+  }
+  trpc::consul::FakeConsulStats server_stats = server.GetStats();
+  printf("forced refreshes:%llu failed:%llu, published changes:%llu, consul requests:%llu\n",
+         static_cast<unsigned long long>(refreshes), static_cast<unsigned long long>(refresh_failures),
+         static_cast<unsigned long long>(changes), static_cast<unsigned long long>(server_stats.requests));
+
+  selector.Stop();
+  selector.Destroy();
+  server.Stop();
+  return 0;
+}
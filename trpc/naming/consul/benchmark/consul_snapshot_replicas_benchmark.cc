@@ -0,0 +1,63 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "trpc/naming/consul/consul_snapshot_replicas.h"
+
+namespace {
+
+constexpr char kServiceName[] = "trpc.test.helloworld.Greeter";
+
+trpc::ConsulEndpointListPtr MakeEndpoints(int endpoint_num) {
+  auto endpoints = std::make_shared<std::vector<trpc::TrpcEndpointInfo>>();
+  for (int i = 0; i < endpoint_num; ++i) {
+    trpc::TrpcEndpointInfo endpoint;
+    endpoint.host = "10.0." + std::to_string(i / 256) + "." + std::to_string(i % 256);
+    endpoint.port = 8000;
+    endpoint.id = i;
+    endpoints->push_back(std::move(endpoint));
+  }
+  return endpoints;
+}
+
+// Select throughput with one replica shared by all threads, against one replica per NUMA node.
+// Items per second should scale close to linearly with the thread count in the replicated case.
+void BM_ReplicaSelect(benchmark::State& state) {
+  static trpc::consul::SnapshotReplicas* replicas = nullptr;
+  if (state.thread_index() == 0) {
+    replicas = new trpc::consul::SnapshotReplicas();
+    replicas->Init(static_cast<uint32_t>(state.range(0)));
+    replicas->Publish(kServiceName, MakeEndpoints(64));
+  }
+  trpc::TrpcEndpointInfo endpoint;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(replicas->SelectOne(kServiceName, &endpoint));
+  }
+  state.SetItemsProcessed(state.iterations());
+  if (state.thread_index() == 0) {
+    delete replicas;
+    replicas = nullptr;
+  }
+}
+
+}  // namespace
+
+// range(0): replica num, 0 means one per NUMA node
+BENCHMARK(BM_ReplicaSelect)->Arg(1)->Arg(0)->ThreadRange(1, 64)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,28 @@
+#!/bin/bash
+#
+# Runs all consul benchmarks and writes the JSON report of each benchmark binary into an output directory, so that
+# the results of two releases can be compared, e.g. with tools/compare.py of Google Benchmark:
+#
+#   bazel run -c opt //trpc/naming/consul/benchmark -- /tmp/consul_benchmark [--benchmark_filter=BM_Select ...]
+#
+# Arguments after the output directory are passed to every benchmark.
+
+out_dir=${1:-consul_benchmark_results}
+[ $# -gt 0 ] && shift
+# bazel run executes in the runfiles tree, a relative output directory is taken from where bazel was invoked
+if [[ "${out_dir}" != /* && -n "${BUILD_WORKING_DIRECTORY}" ]]; then
+  out_dir="${BUILD_WORKING_DIRECTORY}/${out_dir}"
+fi
+mkdir -p "${out_dir}"
+
+bin_dir=$(dirname "$0")
+for name in consul_selector_benchmark consul_refresh_worker_benchmark consul_curl_http_benchmark \
+            consul_select_metrics_benchmark consul_snapshot_replicas_benchmark; do
+  echo "running ${name}"
+  "${bin_dir}/${name}" --benchmark_out="${out_dir}/${name}.json" --benchmark_out_format=json "$@"
+  if [ $? -ne 0 ]; then
+    echo "${name} failed"
+    exit 1
+  fi
+done
+echo "reports written to ${out_dir}"
@@ -20,6 +20,46 @@ void ConsulConfig::Display() const {
   TRPC_LOG_DEBUG("--------------------------------");
 
   TRPC_LOG_DEBUG("address:" << address_);
+  TRPC_LOG_DEBUG("replicate_snapshot:" << replicate_snapshot_);
+  TRPC_LOG_DEBUG("snapshot_replica_num:" << snapshot_replica_num_);
+  TRPC_LOG_DEBUG("negative_cache_ttl:" << negative_cache_ttl_);
+  TRPC_LOG_DEBUG("max_staleness:" << max_staleness_);
+  TRPC_LOG_DEBUG("prefetch_services:" << prefetch_services_.size());
+  TRPC_LOG_DEBUG("warmup_wait:" << warmup_wait_);
+  TRPC_LOG_DEBUG("warmup_timeout:" << warmup_timeout_);
+  TRPC_LOG_DEBUG("warmup_concurrency:" << warmup_concurrency_);
+  TRPC_LOG_DEBUG("cold_lookup_timeout:" << cold_lookup_timeout_);
+  TRPC_LOG_DEBUG("static_endpoints:" << static_endpoints_.size());
+  TRPC_LOG_DEBUG("rate_limit:" << rate_limit_);
+  TRPC_LOG_DEBUG("rate_burst:" << rate_burst_);
+  TRPC_LOG_DEBUG("refresh_jitter:" << refresh_jitter_);
+  TRPC_LOG_DEBUG("max_backoff:" << max_backoff_);
+  TRPC_LOG_DEBUG("consistency_mode:" << consistency_mode_);
+  TRPC_LOG_DEBUG("max_stale:" << max_stale_);
+  TRPC_LOG_DEBUG("cache_max_age:" << cache_max_age_);
+  TRPC_LOG_DEBUG("tls_enable:" << tls_enable_);
+  TRPC_LOG_DEBUG("tls_ca_file:" << tls_ca_file_);
+  TRPC_LOG_DEBUG("tls_cert_file:" << tls_cert_file_);
+  TRPC_LOG_DEBUG("tls_key_file:" << tls_key_file_);
+  TRPC_LOG_DEBUG("tls_server_name:" << tls_server_name_);
+  TRPC_LOG_DEBUG("tcp_keepalive_idle:" << tcp_keepalive_idle_);
+  TRPC_LOG_DEBUG("request_timeout:" << request_timeout_);
+  TRPC_LOG_DEBUG("transport:" << transport_);
+  TRPC_LOG_DEBUG("shm_cache_enable:" << shm_cache_enable_);
+  TRPC_LOG_DEBUG("shm_cache_path:" << shm_cache_path_);
+  TRPC_LOG_DEBUG("shm_cache_slots:" << shm_cache_slots_);
+  TRPC_LOG_DEBUG("shm_cache_slot_endpoints:" << shm_cache_slot_endpoints_);
+  TRPC_LOG_DEBUG("metrics_plugin:" << metrics_plugin_);
+  TRPC_LOG_DEBUG("metrics_report_interval:" << metrics_report_interval_);
+  TRPC_LOG_DEBUG("idle_ttl:" << idle_ttl_);
+  TRPC_LOG_DEBUG("max_callees:" << max_callees_);
+  TRPC_LOG_DEBUG("slow_start_window:" << slow_start_window_);
+  TRPC_LOG_DEBUG("slow_start_min_weight:" << slow_start_min_weight_);
+  TRPC_LOG_DEBUG("flap_half_life:" << flap_half_life_);
+  TRPC_LOG_DEBUG("flap_suppress_threshold:" << flap_suppress_threshold_);
+  TRPC_LOG_DEBUG("flap_reuse_threshold:" << flap_reuse_threshold_);
+  TRPC_LOG_DEBUG("min_up_dwell:" << min_up_dwell_);
+  TRPC_LOG_DEBUG("min_down_dwell:" << min_down_dwell_);
 
   TRPC_LOG_DEBUG("--------------------------------");
 }
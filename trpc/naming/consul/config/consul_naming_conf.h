@@ -13,6 +13,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <map>
 #include <string>
 #include <vector>
@@ -26,6 +27,132 @@ namespace trpc::naming {
 struct ConsulConfig {
   std::string address_;
 
+  // Replicate the read-only endpoint snapshots per NUMA node or scheduling group, selector only
+  bool replicate_snapshot_{false};
+
+  // Number of snapshot replicas, zero means one per NUMA node
+  uint32_t snapshot_replica_num_{0};
+
+  // Lifetime in milliseconds of a cached lookup failure of an unknown or empty service
+  uint32_t negative_cache_ttl_{3000};
+
+  // Maximum age in milliseconds of the last good endpoints served while revalidation fails, zero means no limit
+  uint32_t max_staleness_{0};
+
+  // Callees to resolve at Start in addition to the client services using the consul selector
+  std::vector<std::string> prefetch_services_;
+
+  // Block Start until the warm-up finished or `warmup_timeout_` expired
+  bool warmup_wait_{false};
+
+  // Maximum time in milliseconds Start waits for the warm-up
+  uint32_t warmup_timeout_{3000};
+
+  // Number of concurrent lookups of the warm-up
+  uint32_t warmup_concurrency_{8};
+
+  // Upper bound in milliseconds of the wait of a cold select for its lookup, which is also bounded by the caller
+  // timeout, zero means only the caller timeout
+  uint32_t cold_lookup_timeout_{1000};
+
+  // Static "host:port" endpoints of a callee, served if Consul has no endpoints of it or does not answer its cold
+  // lookup in time
+  std::map<std::string, std::vector<std::string>> static_endpoints_;
+
+  // Requests per second of the process to Consul, shared by the selector and registry, zero means unlimited. If both
+  // plugins set it, the stricter limit applies. A plugin leaving it at the default does not override the other
+  uint32_t rate_limit_{20};
+
+  // Requests which may be sent at once within the rate limit, merged like `rate_limit_`
+  uint32_t rate_burst_{40};
+
+  // Set if `rate_limit_` or `rate_burst_` was configured rather than left at its default, not a config key
+  bool rate_limit_configured_{false};
+
+  // Each refresh interval is randomized by up to this fraction, so that processes started together spread out
+  double refresh_jitter_{0.2};
+
+  // Upper bound in milliseconds of the exponential backoff of a callee whose refreshes fail
+  uint32_t max_backoff_{60000};
+
+  // Consistency mode of the health queries: default, stale or cached
+  std::string consistency_mode_{"default"};
+
+  // Stale reads lagging more than this behind the leader, in milliseconds, are repeated in default mode, the stale
+  // read is kept if that fails. Zero means no bound
+  uint32_t max_stale_{5000};
+
+  // max-age in seconds of the Cache-Control header of cached reads, zero leaves it to the agent
+  uint32_t cache_max_age_{0};
+
+  // Talk to the agent over HTTPS
+  bool tls_enable_{false};
+
+  // CA bundle verifying the agent, empty means the system default
+  std::string tls_ca_file_;
+
+  // Client certificate and key in PEM, for agents verifying incoming connections
+  std::string tls_cert_file_;
+  std::string tls_key_file_;
+
+  // Name the certificate of the agent is verified against, and sent as SNI, empty means the host of `address_`
+  std::string tls_server_name_;
+
+  // Idle time in seconds before TCP keep-alive probes on the connections to the agent, zero disables them
+  uint32_t tcp_keepalive_idle_{60};
+
+  // Longest time in milliseconds of one request to the agent, connecting included. It also bounds how long a hung
+  // agent keeps a cold lookup thread busy, zero leaves the limit to libcurl
+  uint32_t request_timeout_{3000};
+
+  // How requests are sent to the agent: "curl" does the I/O on the calling thread, "curl_multi" does the I/O of all
+  // transfers of the plugin on one event loop thread. The plugins call the blocking methods, so the calling thread
+  // waits for the response with either transport
+  std::string transport_{"curl"};
+
+  // Share the endpoint tables with the other processes of the host through a memory mapped file, only one of them
+  // polls Consul
+  bool shm_cache_enable_{false};
+
+  // File of the shared endpoint tables, all processes sharing it have to use the same Consul
+  std::string shm_cache_path_{"/dev/shm/trpc_consul_selector"};
+
+  // Callees the shared file holds
+  uint32_t shm_cache_slots_{1024};
+
+  // Endpoints a callee may have in the shared file, larger callees are polled by each process
+  uint32_t shm_cache_slot_endpoints_{256};
+
+  // Metrics plugin the select metrics are reported to, empty disables the report
+  std::string metrics_plugin_;
+
+  // Interval of the metrics report in milliseconds
+  uint32_t metrics_report_interval_{60000};
+
+  // Callees not selected for this many milliseconds are dropped and no longer refreshed, zero keeps them forever
+  uint32_t idle_ttl_{0};
+
+  // Callees kept at most, the least recently selected ones are dropped beyond it, zero means no limit
+  uint32_t max_callees_{0};
+
+  // Endpoints joining a callee, or turning healthy again, ramp their weight up over this many milliseconds, zero
+  // gives them full traffic at once
+  uint32_t slow_start_window_{0};
+
+  // Weight of an endpoint at the start of the slow-start window, in percent of the full weight
+  uint32_t slow_start_min_weight_{10};
+
+  // Half-life in milliseconds of the penalty an endpoint accumulates by changing its status, zero disables it
+  uint32_t flap_half_life_{0};
+
+  // An endpoint whose penalty reaches it is served as unhealthy until the penalty decays below the reuse threshold
+  double flap_suppress_threshold_{3.0};
+  double flap_reuse_threshold_{1.5};
+
+  // Minimum milliseconds an endpoint is served as healthy, or as unhealthy, before its new status is published
+  uint32_t min_up_dwell_{0};
+  uint32_t min_down_dwell_{0};
+
   void Display() const;
 };
 
@@ -39,6 +166,46 @@ struct convert<trpc::naming::ConsulConfig> {
     YAML::Node node;
 
     node["address"] = config.address_;
+    node["replicate_snapshot"] = config.replicate_snapshot_;
+    node["snapshot_replica_num"] = config.snapshot_replica_num_;
+    node["negative_cache_ttl"] = config.negative_cache_ttl_;
+    node["max_staleness"] = config.max_staleness_;
+    node["prefetch_services"] = config.prefetch_services_;
+    node["warmup_wait"] = config.warmup_wait_;
+    node["warmup_timeout"] = config.warmup_timeout_;
+    node["warmup_concurrency"] = config.warmup_concurrency_;
+    node["cold_lookup_timeout"] = config.cold_lookup_timeout_;
+    node["static_endpoints"] = config.static_endpoints_;
+    node["rate_limit"] = config.rate_limit_;
+    node["rate_burst"] = config.rate_burst_;
+    node["refresh_jitter"] = config.refresh_jitter_;
+    node["max_backoff"] = config.max_backoff_;
+    node["consistency_mode"] = config.consistency_mode_;
+    node["max_stale"] = config.max_stale_;
+    node["cache_max_age"] = config.cache_max_age_;
+    node["tls_enable"] = config.tls_enable_;
+    node["tls_ca_file"] = config.tls_ca_file_;
+    node["tls_cert_file"] = config.tls_cert_file_;
+    node["tls_key_file"] = config.tls_key_file_;
+    node["tls_server_name"] = config.tls_server_name_;
+    node["tcp_keepalive_idle"] = config.tcp_keepalive_idle_;
+    node["request_timeout"] = config.request_timeout_;
+    node["transport"] = config.transport_;
+    node["shm_cache_enable"] = config.shm_cache_enable_;
+    node["shm_cache_path"] = config.shm_cache_path_;
+    node["shm_cache_slots"] = config.shm_cache_slots_;
+    node["shm_cache_slot_endpoints"] = config.shm_cache_slot_endpoints_;
+    node["metrics_plugin"] = config.metrics_plugin_;
+    node["metrics_report_interval"] = config.metrics_report_interval_;
+    node["idle_ttl"] = config.idle_ttl_;
+    node["max_callees"] = config.max_callees_;
+    node["slow_start_window"] = config.slow_start_window_;
+    node["slow_start_min_weight"] = config.slow_start_min_weight_;
+    node["flap_half_life"] = config.flap_half_life_;
+    node["flap_suppress_threshold"] = config.flap_suppress_threshold_;
+    node["flap_reuse_threshold"] = config.flap_reuse_threshold_;
+    node["min_up_dwell"] = config.min_up_dwell_;
+    node["min_down_dwell"] = config.min_down_dwell_;
 
     return node;
   }
@@ -47,6 +214,128 @@ struct convert<trpc::naming::ConsulConfig> {
     if (node["address"]) {
       config.address_ = node["address"].as<std::string>();
     }
+    if (node["replicate_snapshot"]) {
+      config.replicate_snapshot_ = node["replicate_snapshot"].as<bool>();
+    }
+    if (node["snapshot_replica_num"]) {
+      config.snapshot_replica_num_ = node["snapshot_replica_num"].as<uint32_t>();
+    }
+    if (node["negative_cache_ttl"]) {
+      config.negative_cache_ttl_ = node["negative_cache_ttl"].as<uint32_t>();
+    }
+    if (node["max_staleness"]) {
+      config.max_staleness_ = node["max_staleness"].as<uint32_t>();
+    }
+    if (node["prefetch_services"]) {
+      config.prefetch_services_ = node["prefetch_services"].as<std::vector<std::string>>();
+    }
+    if (node["warmup_wait"]) {
+      config.warmup_wait_ = node["warmup_wait"].as<bool>();
+    }
+    if (node["warmup_timeout"]) {
+      config.warmup_timeout_ = node["warmup_timeout"].as<uint32_t>();
+    }
+    if (node["warmup_concurrency"]) {
+      config.warmup_concurrency_ = node["warmup_concurrency"].as<uint32_t>();
+    }
+    if (node["cold_lookup_timeout"]) {
+      config.cold_lookup_timeout_ = node["cold_lookup_timeout"].as<uint32_t>();
+    }
+    if (node["static_endpoints"]) {
+      config.static_endpoints_ = node["static_endpoints"].as<std::map<std::string, std::vector<std::string>>>();
+    }
+    if (node["rate_limit"]) {
+      config.rate_limit_ = node["rate_limit"].as<uint32_t>();
+      config.rate_limit_configured_ = true;
+    }
+    if (node["rate_burst"]) {
+      config.rate_burst_ = node["rate_burst"].as<uint32_t>();
+      config.rate_limit_configured_ = true;
+    }
+    if (node["refresh_jitter"]) {
+      config.refresh_jitter_ = node["refresh_jitter"].as<double>();
+    }
+    if (node["max_backoff"]) {
+      config.max_backoff_ = node["max_backoff"].as<uint32_t>();
+    }
+    if (node["consistency_mode"]) {
+      config.consistency_mode_ = node["consistency_mode"].as<std::string>();
+    }
+    if (node["max_stale"]) {
+      config.max_stale_ = node["max_stale"].as<uint32_t>();
+    }
+    if (node["cache_max_age"]) {
+      config.cache_max_age_ = node["cache_max_age"].as<uint32_t>();
+    }
+    if (node["tls_enable"]) {
+      config.tls_enable_ = node["tls_enable"].as<bool>();
+    }
+    if (node["tls_ca_file"]) {
+      config.tls_ca_file_ = node["tls_ca_file"].as<std::string>();
+    }
+    if (node["tls_cert_file"]) {
+      config.tls_cert_file_ = node["tls_cert_file"].as<std::string>();
+    }
+    if (node["tls_key_file"]) {
+      config.tls_key_file_ = node["tls_key_file"].as<std::string>();
+    }
+    if (node["tls_server_name"]) {
+      config.tls_server_name_ = node["tls_server_name"].as<std::string>();
+    }
+    if (node["tcp_keepalive_idle"]) {
+      config.tcp_keepalive_idle_ = node["tcp_keepalive_idle"].as<uint32_t>();
+    }
+    if (node["request_timeout"]) {
+      config.request_timeout_ = node["request_timeout"].as<uint32_t>();
+    }
+    if (node["transport"]) {
+      config.transport_ = node["transport"].as<std::string>();
+    }
+    if (node["shm_cache_enable"]) {
+      config.shm_cache_enable_ = node["shm_cache_enable"].as<bool>();
+    }
+    if (node["shm_cache_path"]) {
+      config.shm_cache_path_ = node["shm_cache_path"].as<std::string>();
+    }
+    if (node["shm_cache_slots"]) {
+      config.shm_cache_slots_ = node["shm_cache_slots"].as<uint32_t>();
+    }
+    if (node["shm_cache_slot_endpoints"]) {
+      config.shm_cache_slot_endpoints_ = node["shm_cache_slot_endpoints"].as<uint32_t>();
+    }
+    if (node["metrics_plugin"]) {
+      config.metrics_plugin_ = node["metrics_plugin"].as<std::string>();
+    }
+    if (node["metrics_report_interval"]) {
+      config.metrics_report_interval_ = node["metrics_report_interval"].as<uint32_t>();
+    }
+    if (node["idle_ttl"]) {
+      config.idle_ttl_ = node["idle_ttl"].as<uint32_t>();
+    }
+    if (node["max_callees"]) {
+      config.max_callees_ = node["max_callees"].as<uint32_t>();
+    }
+    if (node["slow_start_window"]) {
+      config.slow_start_window_ = node["slow_start_window"].as<uint32_t>();
+    }
+    if (node["slow_start_min_weight"]) {
+      config.slow_start_min_weight_ = node["slow_start_min_weight"].as<uint32_t>();
+    }
+    if (node["flap_half_life"]) {
+      config.flap_half_life_ = node["flap_half_life"].as<uint32_t>();
+    }
+    if (node["flap_suppress_threshold"]) {
+      config.flap_suppress_threshold_ = node["flap_suppress_threshold"].as<double>();
+    }
+    if (node["flap_reuse_threshold"]) {
+      config.flap_reuse_threshold_ = node["flap_reuse_threshold"].as<double>();
+    }
+    if (node["min_up_dwell"]) {
+      config.min_up_dwell_ = node["min_up_dwell"].as<uint32_t>();
+    }
+    if (node["min_down_dwell"]) {
+      config.min_down_dwell_ = node["min_down_dwell"].as<uint32_t>();
+    }
 
     return true;
   }
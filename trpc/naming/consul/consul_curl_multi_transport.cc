@@ -0,0 +1,232 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#include "trpc/naming/consul/consul_curl_multi_transport.h"
+
+#include <cstring>
+#include <utility>
+
+#include "trpc/naming/consul/consul_probes.h"
+#include "trpc/util/log/logging.h"
+
+namespace trpc::consul {
+
+namespace {
+
+// Longest wait of the loop for socket activity, a submit or stop wakes it up earlier
+constexpr int kPollTimeoutMs = 1000;
+
+}  // namespace
+
+int CurlMultiLoop::Start(const ConsulHttpOptions& options) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (started_) {
+    return running_ ? 0 : -1;
+  }
+  multi_ = curl_multi_init();
+  if (multi_ == nullptr) {
+    return -1;
+  }
+  options_ = options;
+  started_ = true;
+  running_ = true;
+  thread_ = std::thread([this]() { Run(); });
+  return 0;
+}
+
+void CurlMultiLoop::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!running_) {
+      return;
+    }
+    running_ = false;
+  }
+  curl_multi_wakeup(multi_);
+  thread_.join();
+  idle_handles_.clear();
+  curl_multi_cleanup(multi_);
+  multi_ = nullptr;
+}
+
+int CurlMultiLoop::Submit(const char* method, const std::string& url, const std::string& body,
+                          const curl_http::CurlHttpHeaders& headers, Callback callback) {
+  auto transfer = std::make_unique<Transfer>();
+  transfer->handle = AcquireHandle();
+  if (transfer->handle.http == nullptr) {
+    return -1;
+  }
+  // A handle keeps its headers, so the ones of the transport which used it before are cleared, an empty value is
+  // not sent
+  curl_http::CurlHttp* http = transfer->handle.http.get();
+  if (transfer->handle.headers != headers) {
+    for (const auto& [name, value] : transfer->handle.headers) {
+      http->SetRequestHeader(name, "");
+    }
+    for (const auto& [name, value] : headers) {
+      http->SetRequestHeader(name, value);
+    }
+    transfer->handle.headers = headers;
+  }
+  transfer->response = std::make_shared<curl_http::CurlHttpResponse>();
+  transfer->body = body;
+  transfer->callback = std::move(callback);
+  bool get = strcmp(method, "GET") == 0;
+  transfer->easy = get ? http->PrepareGet(url, transfer->response.get())
+                       : http->PreparePut(url, transfer->body, transfer->response.get());
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!running_) {
+      return -1;
+    }
+    pending_.push_back(std::move(transfer));
+    // Under the lock, so that Stop does not clean the multi handle up meanwhile
+    curl_multi_wakeup(multi_);
+  }
+  return 0;
+}
+
+CurlMultiLoop::Handle CurlMultiLoop::AcquireHandle() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!running_) {
+      return Handle();
+    }
+    if (!idle_handles_.empty()) {
+      Handle handle = std::move(idle_handles_.back());
+      idle_handles_.pop_back();
+      return handle;
+    }
+  }
+  Handle handle;
+  handle.http = std::make_unique<curl_http::CurlHttp>();
+  if (handle.http->Init() != curl_http::kOk || ConfigureConsulHttp(options_, handle.http.get()) != 0) {
+    TRPC_LOG_ERROR("init curl handle of the consul transport failed");
+    return Handle();
+  }
+  return handle;
+}
+
+void CurlMultiLoop::Run() {
+  std::vector<std::unique_ptr<Transfer>> submitted;
+  while (true) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!running_) {
+        submitted.swap(pending_);
+        break;
+      }
+      submitted.swap(pending_);
+    }
+    for (auto& transfer : submitted) {
+      TRPC_CONSUL_PROBE1(curl_perform_start, transfer->easy);
+      curl_multi_add_handle(multi_, transfer->easy);
+      active_.emplace(transfer->easy, std::move(transfer));
+    }
+    submitted.clear();
+
+    int running_handles = 0;
+    curl_multi_perform(multi_, &running_handles);
+    int queued = 0;
+    while (CURLMsg* message = curl_multi_info_read(multi_, &queued)) {
+      if (message->msg != CURLMSG_DONE) {
+        continue;
+      }
+      // The message is freed by removing its handle
+      CURL* easy = message->easy_handle;
+      CURLcode result = message->data.result;
+      curl_multi_remove_handle(multi_, easy);
+      auto iter = active_.find(easy);
+      if (iter == active_.end()) {
+        continue;
+      }
+      std::unique_ptr<Transfer> transfer = std::move(iter->second);
+      active_.erase(iter);
+      transfer->handle.http->Finish(result, transfer->response.get());
+      TRPC_CONSUL_PROBE4(curl_perform_done, easy, transfer->response->code, transfer->response->response_code,
+                         transfer->response->total_us);
+      transfer->callback(std::move(transfer->response));
+      std::lock_guard<std::mutex> lock(mutex_);
+      idle_handles_.push_back(std::move(transfer->handle));
+    }
+    curl_multi_poll(multi_, nullptr, 0, kPollTimeoutMs, nullptr);
+  }
+
+  // Nobody waits in vain once the loop is gone
+  for (auto& [easy, transfer] : active_) {
+    curl_multi_remove_handle(multi_, easy);
+    submitted.push_back(std::move(transfer));
+  }
+  active_.clear();
+  for (auto& transfer : submitted) {
+    transfer->response->code = CURLE_ABORTED_BY_CALLBACK;
+    transfer->response->err_msg = "consul transport stopped";
+    transfer->callback(std::move(transfer->response));
+  }
+}
+
+int CurlMultiTransport::Get(const std::string& url, curl_http::CurlHttpResponse* response) {
+  return Send("GET", url, "", response);
+}
+
+int CurlMultiTransport::Put(const std::string& url, const std::string& body, curl_http::CurlHttpResponse* response) {
+  return Send("PUT", url, body, response);
+}
+
+Future<curl_http::CurlHttpResponsePtr> CurlMultiTransport::AsyncGet(const std::string& url) {
+  return AsyncSend("GET", url, "");
+}
+
+Future<curl_http::CurlHttpResponsePtr> CurlMultiTransport::AsyncPut(const std::string& url, const std::string& body) {
+  return AsyncSend("PUT", url, body);
+}
+
+int CurlMultiTransport::Send(const char* method, const std::string& url, const std::string& body,
+                             curl_http::CurlHttpResponse* response) {
+  std::mutex mutex;
+  std::condition_variable done;
+  curl_http::CurlHttpResponsePtr result;
+  auto callback = [&](curl_http::CurlHttpResponsePtr finished) {
+    std::lock_guard<std::mutex> lock(mutex);
+    result = std::move(finished);
+    done.notify_one();
+  };
+  if (loop_->Submit(method, url, body, headers_, std::move(callback)) != 0) {
+    response->Reset();
+    response->err_msg = "consul transport not running";
+    return curl_http::kError;
+  }
+  std::unique_lock<std::mutex> lock(mutex);
+  done.wait(lock, [&]() { return result != nullptr; });
+  *response = std::move(*result);
+  return response->code == CURLE_OK ? curl_http::kOk : curl_http::kError;
+}
+
+Future<curl_http::CurlHttpResponsePtr> CurlMultiTransport::AsyncSend(const char* method, const std::string& url,
+                                                                     const std::string& body) {
+  auto promise = std::make_shared<Promise<curl_http::CurlHttpResponsePtr>>();
+  auto future = promise->GetFuture();
+  auto callback = [promise](curl_http::CurlHttpResponsePtr response) { promise->SetValue(std::move(response)); };
+  if (loop_->Submit(method, url, body, headers_, std::move(callback)) != 0) {
+    return MakeExceptionFuture<curl_http::CurlHttpResponsePtr>(CommonException("consul transport not running"));
+  }
+  return future;
+}
+
+ConsulTransportFactory MakeCurlMultiTransportFactory() {
+  auto loop = std::make_shared<CurlMultiLoop>();
+  return [loop]() -> ConsulTransportPtr { return std::make_unique<CurlMultiTransport>(loop); };
+}
+
+}  // namespace trpc::consul
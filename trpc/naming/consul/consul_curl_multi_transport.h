@@ -0,0 +1,123 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#pragma once
+
+#include <curl/curl.h>
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "trpc/naming/consul/consul_transport.h"
+
+namespace trpc::consul {
+
+/// @brief Event loop driving the transfers of many libcurl easy handles on one thread through a multi handle. Only
+/// callers of the asynchronous methods are spared a blocked thread, a blocking call waits for the loop to finish its
+/// transfer. Shared by the multi transports of a plugin.
+///
+/// Reference: https://curl.se/libcurl/c/libcurl-multi.html
+class CurlMultiLoop {
+ public:
+  using Callback = std::function<void(curl_http::CurlHttpResponsePtr)>;
+
+  ~CurlMultiLoop() { Stop(); }
+
+  /// @brief Starts the loop thread, the handles are configured with `options`. Only the first call starts it.
+  int Start(const ConsulHttpOptions& options);
+
+  /// @brief Fails the requests in flight with a transport error and joins the loop thread.
+  void Stop();
+
+  /// @brief Sends a request, `callback` is run on the loop thread once it is done. `headers` are sent with it.
+  /// @return -1 if the loop is not running, the callback is not run then.
+  int Submit(const char* method, const std::string& url, const std::string& body,
+             const curl_http::CurlHttpHeaders& headers, Callback callback);
+
+ private:
+  // Easy handle with the request headers it was last used with
+  struct Handle {
+    std::unique_ptr<curl_http::CurlHttp> http;
+    curl_http::CurlHttpHeaders headers;
+  };
+
+  struct Transfer {
+    Handle handle;
+    CURL* easy{nullptr};
+    curl_http::CurlHttpResponsePtr response;
+    // Sent by libcurl from here, it does not copy the body
+    std::string body;
+    Callback callback;
+  };
+
+  void Run();
+
+  // Returns an idle handle configured for the agent, or a new one
+  Handle AcquireHandle();
+
+ private:
+  ConsulHttpOptions options_;
+  CURLM* multi_{nullptr};
+  std::thread thread_;
+
+  std::mutex mutex_;
+  bool started_{false};
+  bool running_{false};
+  // Submitted, not yet added to the multi handle
+  std::vector<std::unique_ptr<Transfer>> pending_;
+  // Handles of finished transfers, kept for their connections and buffers
+  std::vector<Handle> idle_handles_;
+
+  // In flight, only touched by the loop thread
+  std::unordered_map<CURL*, std::unique_ptr<Transfer>> active_;
+};
+
+/// @brief Requests sent through a `CurlMultiLoop`. The asynchronous methods return at once, the blocking ones wait
+/// for the loop, as the registry and the refresh workers of the selector do.
+class CurlMultiTransport : public ConsulTransport {
+ public:
+  explicit CurlMultiTransport(std::shared_ptr<CurlMultiLoop> loop) : loop_(std::move(loop)) {}
+
+  /// @brief Starts the loop unless another transport of it did.
+  int Init(const ConsulHttpOptions& options) override { return loop_->Start(options); }
+
+  void SetRequestHeader(const std::string& name, const std::string& value) override { headers_[name] = value; }
+
+  int Get(const std::string& url, curl_http::CurlHttpResponse* response) override;
+
+  int Put(const std::string& url, const std::string& body, curl_http::CurlHttpResponse* response) override;
+
+  Future<curl_http::CurlHttpResponsePtr> AsyncGet(const std::string& url) override;
+
+  Future<curl_http::CurlHttpResponsePtr> AsyncPut(const std::string& url, const std::string& body) override;
+
+ private:
+  int Send(const char* method, const std::string& url, const std::string& body, curl_http::CurlHttpResponse* response);
+
+  Future<curl_http::CurlHttpResponsePtr> AsyncSend(const char* method, const std::string& url, const std::string& body);
+
+ private:
+  std::shared_ptr<CurlMultiLoop> loop_;
+  curl_http::CurlHttpHeaders headers_;
+};
+
+/// @brief Factory of multi transports sharing one loop, which the first transport initialized starts.
+ConsulTransportFactory MakeCurlMultiTransportFactory();
+
+}  // namespace trpc::consul
@@ -0,0 +1,219 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#include "trpc/naming/consul/consul_endpoint_table.h"
+
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+namespace trpc::consul {
+
+namespace {
+
+uint64_t LoadUint64(const uint8_t* src) {
+  uint64_t value;
+  memcpy(&value, src, sizeof(value));
+  return value;
+}
+
+}  // namespace
+
+uint32_t HostInterner::Intern(std::string_view host) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto iter = index_.find(host);
+  if (iter != index_.end()) {
+    return iter->second;
+  }
+  uint32_t index = static_cast<uint32_t>(hosts_.size());
+  const std::string& stored = hosts_.emplace_back(host);
+  index_.emplace(stored, index);
+  return index;
+}
+
+const std::string& HostInterner::Get(uint32_t index) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return hosts_[index];
+}
+
+size_t HostInterner::Size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return hosts_.size();
+}
+
+uint64_t CompactEndpointIdGenerator::GetEndpointId(const EndpointKey& key) {
+  auto [iter, inserted] = ids_.try_emplace(key, next_id_);
+  if (inserted) {
+    ++next_id_;
+  }
+  return iter->second;
+}
+
+void ConsulEndpointTable::Clear() {
+  addresses_.clear();
+  families_.clear();
+  ports_.clear();
+  statuses_.clear();
+  ids_.clear();
+}
+
+void ConsulEndpointTable::Reserve(size_t size) {
+  addresses_.reserve(size);
+  families_.reserve(size);
+  ports_.reserve(size);
+  statuses_.reserve(size);
+  ids_.reserve(size);
+}
+
+bool ConsulEndpointTable::Add(std::string_view host, int port, int status, HostInterner* interner) {
+  if (port < 0 || port > UINT16_MAX) {
+    return false;
+  }
+
+  std::array<uint8_t, 16> address{};
+  uint8_t family = kFamilyHostName;
+  // inet_pton needs a terminated string, hosts longer than an IPv6 literal are names anyway
+  char buf[INET6_ADDRSTRLEN];
+  if (host.size() < sizeof(buf)) {
+    memcpy(buf, host.data(), host.size());
+    buf[host.size()] = '\0';
+    if (host.find(':') != std::string_view::npos) {
+      if (inet_pton(AF_INET6, buf, address.data()) == 1) {
+        family = kFamilyIpv6;
+      }
+    } else if (inet_pton(AF_INET, buf, address.data()) == 1) {
+      family = kFamilyIpv4;
+    }
+  }
+  if (family == kFamilyHostName) {
+    address.fill(0);
+    uint32_t index = interner->Intern(host);
+    memcpy(address.data(), &index, sizeof(index));
+  }
+
+  addresses_.push_back(address);
+  families_.push_back(family);
+  ports_.push_back(static_cast<uint16_t>(port));
+  statuses_.push_back(static_cast<int8_t>(status));
+  ids_.push_back(kInvalidEndpointId);
+  return true;
+}
+
+EndpointKey ConsulEndpointTable::Key(size_t index) const {
+  EndpointKey key;
+  key.high = LoadUint64(addresses_[index].data());
+  key.low = LoadUint64(addresses_[index].data() + 8);
+  key.family_port = (static_cast<uint32_t>(families_[index]) << 16) | ports_[index];
+  return key;
+}
+
+void ConsulEndpointTable::AssignIds(CompactEndpointIdGenerator* generator) {
+  for (size_t i = 0; i < ids_.size(); ++i) {
+    ids_[i] = generator->GetEndpointId(Key(i));
+  }
+}
+
+bool ConsulEndpointTable::Equals(const ConsulEndpointTable& other) const {
+  return addresses_ == other.addresses_ && families_ == other.families_ && ports_ == other.ports_ &&
+         statuses_ == other.statuses_;
+}
+
+EndpointChurn ConsulEndpointTable::Diff(const ConsulEndpointTable& previous, EndpointChangeIndexes* indexes) const {
+  // Merges the (id, status, index) entries of both tables sorted by id, the buffers are kept for the next refresh
+  struct IdEntry {
+    uint64_t id;
+    int8_t status;
+    uint32_t index;
+
+    bool operator<(const IdEntry& other) const { return id < other.id; }
+  };
+  thread_local std::vector<IdEntry> current_ids;
+  thread_local std::vector<IdEntry> previous_ids;
+  auto collect = [](const ConsulEndpointTable& table, std::vector<IdEntry>* ids) {
+    ids->clear();
+    for (size_t i = 0; i < table.Size(); ++i) {
+      ids->push_back(IdEntry{table.ids_[i], table.statuses_[i], static_cast<uint32_t>(i)});
+    }
+    std::sort(ids->begin(), ids->end());
+  };
+  collect(*this, &current_ids);
+  collect(previous, &previous_ids);
+  if (indexes != nullptr) {
+    indexes->Clear();
+  }
+
+  EndpointChurn churn;
+  size_t i = 0;
+  size_t j = 0;
+  while (i < current_ids.size() || j < previous_ids.size()) {
+    if (j == previous_ids.size() || (i < current_ids.size() && current_ids[i].id < previous_ids[j].id)) {
+      churn.added++;
+      if (indexes != nullptr) indexes->added.push_back(current_ids[i].index);
+      i++;
+    } else if (i == current_ids.size() || previous_ids[j].id < current_ids[i].id) {
+      churn.removed++;
+      if (indexes != nullptr) indexes->removed.push_back(previous_ids[j].index);
+      j++;
+    } else {
+      if (current_ids[i].status != previous_ids[j].status) {
+        churn.status_changed++;
+        if (indexes != nullptr) indexes->status_changed.push_back(current_ids[i].index);
+      }
+      i++;
+      j++;
+    }
+  }
+  return churn;
+}
+
+void ConsulEndpointTable::Materialize(const HostInterner& interner, std::vector<TrpcEndpointInfo>* endpoints) const {
+  size_t offset = endpoints->size();
+  endpoints->resize(offset + Size());
+  for (size_t i = 0; i < Size(); ++i) {
+    MaterializeOne(interner, i, &(*endpoints)[offset + i]);
+  }
+}
+
+void ConsulEndpointTable::MaterializeOne(const HostInterner& interner, size_t index, TrpcEndpointInfo* endpoint) const {
+  const auto& address = addresses_[index];
+  switch (families_[index]) {
+    case kFamilyIpv4:
+    case kFamilyIpv6: {
+      // Formatted into a stack buffer: IPv4 hosts fit in the small string buffer and do not allocate
+      char buf[INET6_ADDRSTRLEN];
+      int af = families_[index] == kFamilyIpv4 ? AF_INET : AF_INET6;
+      endpoint->host.assign(inet_ntop(af, address.data(), buf, sizeof(buf)));
+      break;
+    }
+    default: {
+      uint32_t host_index;
+      memcpy(&host_index, address.data(), sizeof(host_index));
+      endpoint->host = interner.Get(host_index);
+      break;
+    }
+  }
+  endpoint->port = ports_[index];
+  endpoint->is_ipv6 = families_[index] == kFamilyIpv6;
+  endpoint->status = statuses_[index];
+  endpoint->id = ids_[index];
+}
+
+size_t ConsulEndpointTable::MemoryUsage() const {
+  return addresses_.capacity() * sizeof(addresses_[0]) + families_.capacity() * sizeof(families_[0]) +
+         ports_.capacity() * sizeof(ports_[0]) + statuses_.capacity() * sizeof(statuses_[0]) +
+         ids_.capacity() * sizeof(ids_[0]);
+}
+
+}  // namespace trpc::consul
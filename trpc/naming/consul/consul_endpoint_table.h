@@ -0,0 +1,189 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "trpc/naming/common/common_defines.h"
+
+namespace trpc {
+
+/// @brief Immutable endpoint list of a callee, shared between the selector cache and batch selection callers.
+using ConsulEndpointListPtr = std::shared_ptr<const std::vector<TrpcEndpointInfo>>;
+
+}  // namespace trpc
+
+namespace trpc::consul {
+
+/// @brief Interns host names, so that a host shared by many endpoints, callees and refreshes is stored once.
+/// @note Thread-safe. Interned hosts are never released, which is fine for the host names of a deployment.
+class HostInterner {
+ public:
+  /// @brief Returns the index of `host`, inserting it on first use.
+  uint32_t Intern(std::string_view host);
+
+  /// @brief Returns the host of `index`, the reference stays valid for the lifetime of the interner.
+  const std::string& Get(uint32_t index) const;
+
+  size_t Size() const;
+
+ private:
+  // deque keeps references stable while growing
+  std::deque<std::string> hosts_;
+  std::unordered_map<std::string_view, uint32_t> index_;
+  mutable std::mutex mutex_;
+};
+
+/// @brief Integer key of an endpoint: packed address, family and port.
+struct EndpointKey {
+  uint64_t high{0};
+  uint64_t low{0};
+  // family << 16 | port
+  uint32_t family_port{0};
+
+  bool operator==(const EndpointKey& other) const {
+    return high == other.high && low == other.low && family_port == other.family_port;
+  }
+};
+
+struct EndpointKeyHash {
+  size_t operator()(const EndpointKey& key) const {
+    uint64_t h = key.high * 0x9E3779B97F4A7C15ULL;
+    h ^= key.low + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+    h ^= key.family_port + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+    return static_cast<size_t>(h);
+  }
+};
+
+/// @brief Endpoint id generator keyed by `EndpointKey`, ids of known endpoints are stable across refreshes.
+/// @note Not thread-safe, each callee owns one and it is only used while publishing the callee's table.
+class CompactEndpointIdGenerator {
+ public:
+  uint64_t GetEndpointId(const EndpointKey& key);
+
+  size_t Size() const { return ids_.size(); }
+
+ private:
+  std::unordered_map<EndpointKey, uint64_t, EndpointKeyHash> ids_;
+  uint64_t next_id_{0};
+};
+
+/// @brief Endpoint changes between two tables of a callee.
+struct EndpointChurn {
+  uint32_t added{0};
+  uint32_t removed{0};
+  // Endpoints in both tables whose status changed
+  uint32_t status_changed{0};
+};
+
+/// @brief Positions of the endpoints counted by `ConsulEndpointTable::Diff`.
+struct EndpointChangeIndexes {
+  // Indexes into the current table
+  std::vector<uint32_t> added;
+  std::vector<uint32_t> status_changed;
+  // Indexes into the previous table
+  std::vector<uint32_t> removed;
+
+  void Clear() {
+    added.clear();
+    status_changed.clear();
+    removed.clear();
+  }
+
+  bool Empty() const { return added.empty() && status_changed.empty() && removed.empty(); }
+};
+
+/// @brief Endpoint changes of one callee published by one refresh, see `ConsulSelector::SubscribeEndpointChanges`.
+struct EndpointChangeEvent {
+  // Called service
+  std::string name;
+  std::vector<TrpcEndpointInfo> added;
+  std::vector<TrpcEndpointInfo> removed;
+  // Endpoints whose status changed, with their new status
+  std::vector<TrpcEndpointInfo> updated;
+};
+
+using EndpointChangeListener = std::function<void(const EndpointChangeEvent&)>;
+
+/// @brief Compact struct-of-arrays endpoint table of one callee.
+///
+/// IP literals are stored as packed IPv4/IPv6 bytes, any other host is interned in a `HostInterner` and referenced
+/// by index. `TrpcEndpointInfo` is only materialized from the table at the API boundary.
+class ConsulEndpointTable {
+ public:
+  // Family of an entry whose host is not an IP literal, the address holds the interned host index.
+  static constexpr uint8_t kFamilyHostName = 0;
+  static constexpr uint8_t kFamilyIpv4 = 4;
+  static constexpr uint8_t kFamilyIpv6 = 6;
+
+  /// @brief Removes all endpoints, keeping the capacity for the next refresh.
+  void Clear();
+
+  void Reserve(size_t size);
+
+  /// @brief Appends an endpoint.
+  /// @return false if the port is out of range.
+  bool Add(std::string_view host, int port, int status, HostInterner* interner);
+
+  size_t Size() const { return ports_.size(); }
+
+  bool Empty() const { return ports_.empty(); }
+
+  EndpointKey Key(size_t index) const;
+
+  uint64_t Id(size_t index) const { return ids_[index]; }
+
+  int Status(size_t index) const { return statuses_[index]; }
+
+  /// @brief Overrides the status of the endpoint at `index`.
+  void SetStatus(size_t index, int status) { statuses_[index] = static_cast<int8_t>(status); }
+
+  /// @brief Assigns the endpoint ids from `generator`.
+  void AssignIds(CompactEndpointIdGenerator* generator);
+
+  /// @brief Returns true if both tables hold the same endpoints with the same status in the same order.
+  bool Equals(const ConsulEndpointTable& other) const;
+
+  /// @brief Counts the endpoints added, removed and changed in status since `previous`. Endpoints are matched by id,
+  /// so the ids of both tables must be assigned by the same generator.
+  /// @param indexes if not nullptr, set to the positions of the changed endpoints
+  EndpointChurn Diff(const ConsulEndpointTable& previous, EndpointChangeIndexes* indexes = nullptr) const;
+
+  /// @brief Appends the `TrpcEndpointInfo` form of all endpoints to `endpoints`.
+  void Materialize(const HostInterner& interner, std::vector<TrpcEndpointInfo>* endpoints) const;
+
+  /// @brief Converts the endpoint at `index` to `endpoint`.
+  void MaterializeOne(const HostInterner& interner, size_t index, TrpcEndpointInfo* endpoint) const;
+
+  /// @brief Heap bytes held by the table.
+  size_t MemoryUsage() const;
+
+ private:
+  std::vector<std::array<uint8_t, 16>> addresses_;
+  std::vector<uint8_t> families_;
+  std::vector<uint16_t> ports_;
+  std::vector<int8_t> statuses_;
+  std::vector<uint64_t> ids_;
+};
+
+}  // namespace trpc::consul
@@ -0,0 +1,164 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#include "trpc/naming/consul/consul_endpoint_table.h"
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace trpc::consul {
+
+TEST(ConsulEndpointTableTest, materialize_test) {
+  HostInterner interner;
+  ConsulEndpointTable table;
+  ASSERT_TRUE(table.Add("127.0.0.1", 80, 0, &interner));
+  ASSERT_TRUE(table.Add("::1", 8080, -1, &interner));
+  ASSERT_TRUE(table.Add("consul.service.local", 9090, 0, &interner));
+  EXPECT_FALSE(table.Add("127.0.0.1", 70000, 0, &interner));
+  EXPECT_EQ(3, table.Size());
+  // Only host names are interned
+  EXPECT_EQ(1, interner.Size());
+
+  CompactEndpointIdGenerator id_generator;
+  table.AssignIds(&id_generator);
+
+  std::vector<TrpcEndpointInfo> endpoints;
+  table.Materialize(interner, &endpoints);
+  ASSERT_EQ(3, endpoints.size());
+  EXPECT_EQ("127.0.0.1", endpoints[0].host);
+  EXPECT_EQ(80, endpoints[0].port);
+  EXPECT_FALSE(endpoints[0].is_ipv6);
+  EXPECT_EQ(0, endpoints[0].status);
+  EXPECT_EQ("::1", endpoints[1].host);
+  EXPECT_TRUE(endpoints[1].is_ipv6);
+  EXPECT_EQ(-1, endpoints[1].status);
+  EXPECT_EQ("consul.service.local", endpoints[2].host);
+  EXPECT_FALSE(endpoints[2].is_ipv6);
+  for (const auto& endpoint : endpoints) {
+    EXPECT_NE(kInvalidEndpointId, endpoint.id);
+  }
+  EXPECT_NE(endpoints[0].id, endpoints[1].id);
+  EXPECT_NE(endpoints[1].id, endpoints[2].id);
+}
+
+TEST(ConsulEndpointTableTest, stable_id_test) {
+  HostInterner interner;
+  CompactEndpointIdGenerator id_generator;
+
+  ConsulEndpointTable first;
+  first.Add("10.0.0.1", 80, 0, &interner);
+  first.Add("10.0.0.2", 80, 0, &interner);
+  first.AssignIds(&id_generator);
+
+  // Same endpoints in another order with a new one, known endpoints keep their ids
+  ConsulEndpointTable second;
+  second.Add("10.0.0.3", 80, 0, &interner);
+  second.Add("10.0.0.2", 80, 0, &interner);
+  second.Add("10.0.0.1", 80, 0, &interner);
+  second.AssignIds(&id_generator);
+  EXPECT_EQ(first.Id(0), second.Id(2));
+  EXPECT_EQ(first.Id(1), second.Id(1));
+  EXPECT_NE(first.Id(0), second.Id(0));
+  EXPECT_NE(first.Id(1), second.Id(0));
+  EXPECT_EQ(3, id_generator.Size());
+
+  // Same address with another port is another endpoint
+  ConsulEndpointTable third;
+  third.Add("10.0.0.1", 81, 0, &interner);
+  third.AssignIds(&id_generator);
+  EXPECT_NE(first.Id(0), third.Id(0));
+}
+
+TEST(ConsulEndpointTableTest, equals_test) {
+  HostInterner interner;
+  ConsulEndpointTable first;
+  first.Add("10.0.0.1", 80, 0, &interner);
+  first.Add("backend.local", 80, 0, &interner);
+  ConsulEndpointTable second;
+  second.Add("10.0.0.1", 80, 0, &interner);
+  second.Add("backend.local", 80, 0, &interner);
+  EXPECT_TRUE(first.Equals(second));
+
+  ConsulEndpointTable unhealthy;
+  unhealthy.Add("10.0.0.1", 80, -1, &interner);
+  unhealthy.Add("backend.local", 80, 0, &interner);
+  EXPECT_FALSE(first.Equals(unhealthy));
+
+  // Clear keeps the capacity for the next refresh
+  size_t memory = first.MemoryUsage();
+  first.Clear();
+  EXPECT_TRUE(first.Empty());
+  EXPECT_EQ(memory, first.MemoryUsage());
+}
+
+TEST(ConsulEndpointTableTest, diff_test) {
+  HostInterner interner;
+  CompactEndpointIdGenerator id_generator;
+  ConsulEndpointTable previous;
+  previous.Add("10.0.0.1", 80, 0, &interner);
+  previous.Add("10.0.0.2", 80, 0, &interner);
+  previous.Add("10.0.0.3", 80, 0, &interner);
+  previous.AssignIds(&id_generator);
+
+  // Order does not matter, 10.0.0.1 became unhealthy, 10.0.0.2 left and 10.0.0.4 joined
+  ConsulEndpointTable current;
+  current.Add("10.0.0.4", 80, 0, &interner);
+  current.Add("10.0.0.3", 80, 0, &interner);
+  current.Add("10.0.0.1", 80, -1, &interner);
+  current.AssignIds(&id_generator);
+
+  EndpointChurn churn = current.Diff(previous);
+  EXPECT_EQ(1, churn.added);
+  EXPECT_EQ(1, churn.removed);
+  EXPECT_EQ(1, churn.status_changed);
+
+  churn = current.Diff(current);
+  EXPECT_EQ(0, churn.added + churn.removed + churn.status_changed);
+  churn = current.Diff(ConsulEndpointTable());
+  EXPECT_EQ(3, churn.added);
+
+  EndpointChangeIndexes indexes;
+  current.Diff(previous, &indexes);
+  ASSERT_EQ(1, indexes.added.size());
+  EXPECT_EQ(0, indexes.added[0]);
+  ASSERT_EQ(1, indexes.removed.size());
+  EXPECT_EQ(1, indexes.removed[0]);
+  ASSERT_EQ(1, indexes.status_changed.size());
+  EXPECT_EQ(2, indexes.status_changed[0]);
+  current.Diff(current, &indexes);
+  EXPECT_TRUE(indexes.Empty());
+}
+
+TEST(ConsulEndpointTableTest, memory_usage_test) {
+  constexpr size_t kEndpointNum = 100000;
+  HostInterner interner;
+  ConsulEndpointTable table;
+  table.Reserve(kEndpointNum);
+  for (size_t i = 0; i < kEndpointNum; ++i) {
+    std::string host = "10." + std::to_string((i >> 16) & 0xFF) + "." + std::to_string((i >> 8) & 0xFF) + "." +
+                       std::to_string(i & 0xFF);
+    table.Add(host, 8000 + i % 1000, 0, &interner);
+  }
+  CompactEndpointIdGenerator id_generator;
+  table.AssignIds(&id_generator);
+
+  std::vector<TrpcEndpointInfo> endpoints;
+  table.Materialize(interner, &endpoints);
+  // Lower bound of the materialized form: the heap bytes of the hosts and meta are not counted
+  size_t materialized_bytes = endpoints.capacity() * sizeof(TrpcEndpointInfo);
+  EXPECT_LT(table.MemoryUsage() * 2, materialized_bytes);
+}
+
+}  // namespace trpc::consul
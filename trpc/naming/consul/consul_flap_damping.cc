@@ -0,0 +1,90 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+
+#include "trpc/naming/consul/consul_flap_damping.h"
+
+#include <cmath>
+
+namespace trpc::consul {
+
+const ConsulEndpointTable& EndpointFlapDamper::Apply(const ConsulEndpointTable& table,
+                                                     const FlapDampingOptions& options, uint64_t now,
+                                                     ConsulEndpointTable* damped) {
+  generation_++;
+  bool copied = false;
+  for (size_t i = 0; i < table.Size(); ++i) {
+    int8_t status = static_cast<int8_t>(table.Status(i));
+    auto [iter, inserted] = states_.try_emplace(table.Key(i));
+    EndpointState& state = iter->second;
+    state.generation = generation_;
+    if (inserted) {
+      // A new endpoint is published as reported, it has no history to damp
+      state.observed = status;
+      state.published = status;
+      state.published_ms = now;
+      state.penalty_ms = now;
+      if (status != 0) state.down_status = status;
+      continue;
+    }
+
+    if (options.half_life_ms > 0) {
+      if (state.penalty > 0 && now > state.penalty_ms) {
+        state.penalty *= std::exp2(-static_cast<double>(now - state.penalty_ms) / options.half_life_ms);
+      }
+      state.penalty_ms = now;
+    }
+    bool changed = status != state.observed;
+    if (changed) {
+      state.observed = status;
+      if (options.half_life_ms > 0) state.penalty += 1;
+    }
+    if (status != 0) state.down_status = status;
+    if (state.suppressed && state.penalty < options.reuse_threshold) {
+      state.suppressed = false;
+    } else if (options.half_life_ms > 0 && state.penalty >= options.suppress_threshold) {
+      state.suppressed = true;
+    }
+
+    int8_t wanted = state.suppressed ? state.down_status : status;
+    if (wanted != state.published) {
+      uint32_t dwell = state.published == 0 ? options.min_up_ms : options.min_down_ms;
+      if (now >= state.published_ms + dwell) {
+        state.published = wanted;
+        state.published_ms = now;
+      }
+    }
+    if (state.published != status) {
+      held_changes_ += changed;
+      if (!copied) {
+        *damped = table;
+        copied = true;
+      }
+      damped->SetStatus(i, state.published);
+    }
+  }
+
+  // Forget the endpoints gone from the callee, a returning endpoint starts without history
+  if (states_.size() > table.Size()) {
+    for (auto iter = states_.begin(); iter != states_.end();) {
+      if (iter->second.generation != generation_) {
+        iter = states_.erase(iter);
+      } else {
+        ++iter;
+      }
+    }
+  }
+  return copied ? *damped : table;
+}
+
+}  // namespace trpc::consul
@@ -0,0 +1,81 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+
+#include "trpc/naming/consul/consul_endpoint_table.h"
+
+namespace trpc::consul {
+
+/// @brief Damping of endpoints whose health check oscillates, see `EndpointFlapDamper`.
+struct FlapDampingOptions {
+  // Half-life of the flap penalty in milliseconds, zero disables the penalty
+  uint32_t half_life_ms{0};
+  // An endpoint whose penalty reaches it is kept unhealthy, each status change adds one
+  double suppress_threshold{3.0};
+  // A suppressed endpoint is released once its penalty decayed below it
+  double reuse_threshold{1.5};
+  // Minimum time an endpoint stays healthy, or unhealthy, before the other status is published
+  uint32_t min_up_ms{0};
+  uint32_t min_down_ms{0};
+
+  bool Enabled() const { return half_life_ms > 0 || min_up_ms > 0 || min_down_ms > 0; }
+};
+
+/// @brief Hysteresis on the statuses of the endpoints of one callee.
+///
+/// Each status change reported by Consul adds one to the penalty of the endpoint, which halves every `half_life_ms`.
+/// An endpoint whose penalty reaches `suppress_threshold` is published as unhealthy until the penalty decays below
+/// `reuse_threshold`. Independently, a published status is kept for at least `min_up_ms` or `min_down_ms`. A
+/// flapping endpoint therefore changes its published status rarely, and the refreshes in between find the table
+/// unchanged and publish nothing.
+/// @note Not thread-safe, each callee owns one and it is only used while publishing the callee's table.
+class EndpointFlapDamper {
+ public:
+  /// @brief Damps the statuses of `table`, observed at `now`.
+  /// @param damped receives a copy of `table` with the statuses held back, if there are any
+  /// @return `table` if every status is published as observed, `*damped` otherwise
+  const ConsulEndpointTable& Apply(const ConsulEndpointTable& table, const FlapDampingOptions& options, uint64_t now,
+                                   ConsulEndpointTable* damped);
+
+  /// @brief Status changes reported by Consul which were not published when they were reported.
+  uint64_t HeldChanges() const { return held_changes_; }
+
+  /// @brief Number of tracked endpoints.
+  size_t Size() const { return states_.size(); }
+
+ private:
+  struct EndpointState {
+    // Last status reported by Consul, and the last unhealthy one
+    int8_t observed{0};
+    int8_t down_status{-1};
+    // Status in the published table and since when
+    int8_t published{0};
+    uint64_t published_ms{0};
+    double penalty{0};
+    uint64_t penalty_ms{0};
+    bool suppressed{false};
+    // Generation of the last `Apply` which saw the endpoint
+    uint64_t generation{0};
+  };
+
+  std::unordered_map<EndpointKey, EndpointState, EndpointKeyHash> states_;
+  uint64_t generation_{0};
+  uint64_t held_changes_{0};
+};
+
+}  // namespace trpc::consul
@@ -0,0 +1,104 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+
+#include "trpc/naming/consul/consul_flap_damping.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace trpc::consul {
+
+namespace {
+
+class FlapDampingTest : public ::testing::Test {
+ protected:
+  // Statuses published for a refresh reporting `statuses` for the endpoints 10.0.0.0, 10.0.0.1, ... at `now`
+  std::vector<int> Refresh(const std::vector<int>& statuses, uint64_t now) {
+    ConsulEndpointTable table;
+    for (size_t i = 0; i < statuses.size(); ++i) {
+      table.Add("10.0.0." + std::to_string(i), 8000, statuses[i], &interner_);
+    }
+    ConsulEndpointTable damped;
+    const ConsulEndpointTable& published = damper_.Apply(table, options_, now, &damped);
+    std::vector<int> result;
+    for (size_t i = 0; i < published.Size(); ++i) {
+      result.push_back(published.Status(i));
+    }
+    return result;
+  }
+
+  HostInterner interner_;
+  FlapDampingOptions options_;
+  EndpointFlapDamper damper_;
+};
+
+}  // namespace
+
+TEST_F(FlapDampingTest, disabled_test) {
+  EXPECT_FALSE(options_.Enabled());
+  EXPECT_EQ(std::vector<int>({0, 0}), Refresh({0, 0}, 1000));
+  EXPECT_EQ(std::vector<int>({-1, 0}), Refresh({-1, 0}, 2000));
+  EXPECT_EQ(std::vector<int>({0, 0}), Refresh({0, 0}, 3000));
+  EXPECT_EQ(0, damper_.HeldChanges());
+}
+
+TEST_F(FlapDampingTest, suppress_test) {
+  options_.half_life_ms = 10000;
+  options_.suppress_threshold = 3;
+  options_.reuse_threshold = 1.5;
+  ASSERT_TRUE(options_.Enabled());
+
+  // The first flaps pass, the third change suppresses the endpoint as unhealthy
+  EXPECT_EQ(std::vector<int>({0, 0}), Refresh({0, 0}, 1000));
+  EXPECT_EQ(std::vector<int>({-1, 0}), Refresh({-1, 0}, 1100));
+  EXPECT_EQ(std::vector<int>({0, 0}), Refresh({0, 0}, 1200));
+  EXPECT_EQ(std::vector<int>({-1, 0}), Refresh({-1, 0}, 1300));
+  EXPECT_EQ(std::vector<int>({-1, 0}), Refresh({0, 0}, 1400));
+  EXPECT_EQ(std::vector<int>({-1, 0}), Refresh({-1, 0}, 1500));
+  EXPECT_EQ(std::vector<int>({-1, 0}), Refresh({0, 0}, 1600));
+  EXPECT_EQ(2, damper_.HeldChanges());
+
+  // Released once the penalty decayed below the reuse threshold
+  EXPECT_EQ(std::vector<int>({-1, 0}), Refresh({0, 0}, 20000));
+  EXPECT_EQ(std::vector<int>({0, 0}), Refresh({0, 0}, 30000));
+}
+
+TEST_F(FlapDampingTest, dwell_test) {
+  options_.min_up_ms = 5000;
+  options_.min_down_ms = 2000;
+
+  EXPECT_EQ(std::vector<int>({0}), Refresh({0}, 1000));
+  // Healthy since 1000, the failure is published at 6000
+  EXPECT_EQ(std::vector<int>({0}), Refresh({-1}, 3000));
+  EXPECT_EQ(std::vector<int>({0}), Refresh({-1}, 5999));
+  EXPECT_EQ(std::vector<int>({-1}), Refresh({-1}, 6000));
+  // Unhealthy since 6000, a short recovery is not published
+  EXPECT_EQ(std::vector<int>({-1}), Refresh({0}, 7000));
+  EXPECT_EQ(std::vector<int>({-1}), Refresh({-1}, 7500));
+  EXPECT_EQ(std::vector<int>({0}), Refresh({0}, 8000));
+  EXPECT_EQ(2, damper_.HeldChanges());
+}
+
+TEST_F(FlapDampingTest, removed_endpoint_test) {
+  options_.half_life_ms = 10000;
+  Refresh({0, 0}, 1000);
+  EXPECT_EQ(2, damper_.Size());
+  Refresh({0}, 2000);
+  EXPECT_EQ(1, damper_.Size());
+  // A new endpoint is published as reported
+  EXPECT_EQ(std::vector<int>({0, -1}), Refresh({0, -1}, 3000));
+}
+
+}  // namespace trpc::consul
@@ -0,0 +1,506 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "trpc/naming/consul/consul_refresh_metrics.h"
+#include "trpc/naming/consul/consul_registry.h"
+#include "trpc/naming/consul/consul_selector.h"
+#include "trpc/naming/consul/testing/fake_consul_server.h"
+#include "trpc/runtime/common/periphery_task_scheduler.h"
+#include "trpc/util/time.h"
+
+namespace trpc {
+
+namespace {
+
+constexpr char kService[] = "trpc.test.hermetic.Greeter";
+
+class ConsulHermeticTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_EQ(0, server_.Start());
+    config_.address_ = server_.Address();
+    config_.rate_limit_ = 0;
+    ASSERT_EQ(0, registry_.Init(config_));
+    ASSERT_EQ(0, selector_.Init(config_));
+  }
+
+  void TearDown() override {
+    selector_.Stop();
+    selector_.Destroy();
+    registry_.Destroy();
+    server_.Stop();
+  }
+
+  // Revalidates the callee now instead of waiting for the periodic task
+  int Refresh() {
+    RouterInfo router_info;
+    router_info.name = kService;
+    router_info.info.resize(1);
+    router_info.info[0].host = kService;
+    return selector_.SetEndpoints(&router_info);
+  }
+
+  consul::FakeConsulServer server_;
+  naming::ConsulConfig config_;
+  ConsulRegistry registry_;
+  ConsulSelector selector_;
+};
+
+}  // namespace
+
+TEST_F(ConsulHermeticTest, register_and_select_test) {
+  RegistryInfo register_info;
+  register_info.name = kService;
+  register_info.host = "127.0.0.1";
+  register_info.port = 10001;
+  ASSERT_EQ(0, registry_.Register(&register_info));
+  ASSERT_EQ(1, server_.InstanceCount(kService));
+
+  SelectorInfo info;
+  info.name = kService;
+  TrpcEndpointInfo endpoint;
+  ASSERT_EQ(0, selector_.Select(&info, &endpoint));
+  EXPECT_EQ("127.0.0.1", endpoint.host);
+  EXPECT_EQ(10001, endpoint.port);
+
+  server_.AddInstances(kService, 2, 10002);
+  ASSERT_EQ(0, Refresh());
+  ConsulEndpointListPtr endpoints;
+  ASSERT_EQ(0, selector_.SelectBatchShared(&info, &endpoints));
+  EXPECT_EQ(3, endpoints->size());
+
+  // An instance whose check fails stays in the list, marked unhealthy
+  ASSERT_TRUE(server_.SetStatus(std::string(kService) + "-0", "critical"));
+  ASSERT_EQ(0, Refresh());
+  ASSERT_EQ(0, selector_.SelectBatchShared(&info, &endpoints));
+  int unhealthy = 0;
+  for (const auto& item : *endpoints) {
+    unhealthy += item.status != 0;
+  }
+  EXPECT_EQ(1, unhealthy);
+
+  std::vector<consul::CalleeRefreshSnapshot> metrics;
+  selector_.GetRefreshMetrics(&metrics);
+  ASSERT_EQ(1, metrics.size());
+  // The first publish counts the registered instance as added, the refresh the two new ones
+  EXPECT_EQ(3, metrics[0].endpoints_added);
+  EXPECT_EQ(1, metrics[0].status_changes);
+
+  ASSERT_EQ(0, registry_.Unregister(&register_info));
+  EXPECT_EQ(2, server_.InstanceCount(kService));
+}
+
+TEST_F(ConsulHermeticTest, register_instances_test) {
+  // Instances of one service register under their own IDs instead of replacing each other
+  RegistryInfo register_info;
+  register_info.name = kService;
+  register_info.host = "127.0.0.1";
+  for (int port = 10001; port <= 10003; ++port) {
+    register_info.port = port;
+    ASSERT_EQ(0, registry_.Register(&register_info));
+  }
+  EXPECT_EQ(3, server_.InstanceCount(kService));
+
+  SelectorInfo info;
+  info.name = kService;
+  ConsulEndpointListPtr endpoints;
+  ASSERT_EQ(0, selector_.SelectBatchShared(&info, &endpoints));
+  EXPECT_EQ(3, endpoints->size());
+
+  register_info.port = 10002;
+  ASSERT_EQ(0, registry_.Unregister(&register_info));
+  EXPECT_EQ(2, server_.InstanceCount(kService));
+  ASSERT_EQ(0, Refresh());
+  ASSERT_EQ(0, selector_.SelectBatchShared(&info, &endpoints));
+  ASSERT_EQ(2, endpoints->size());
+  for (const auto& endpoint : *endpoints) {
+    EXPECT_NE(10002, endpoint.port);
+  }
+}
+
+TEST_F(ConsulHermeticTest, consul_failure_test) {
+  server_.AddInstances(kService, 2);
+  SelectorInfo info;
+  info.name = kService;
+  TrpcEndpointInfo endpoint;
+  ASSERT_EQ(0, selector_.Select(&info, &endpoint));
+
+  // A failed revalidation keeps the published endpoints
+  server_.FailNextRequests(10, 500);
+  EXPECT_NE(0, Refresh());
+  EXPECT_EQ(0, selector_.Select(&info, &endpoint));
+
+  RegistryInfo register_info;
+  register_info.name = kService;
+  register_info.host = "127.0.0.1";
+  register_info.port = 10001;
+  server_.FailNextRequests(1, 503);
+  EXPECT_EQ(-1, registry_.Register(&register_info));
+  EXPECT_EQ(2, server_.InstanceCount(kService));
+}
+
+TEST_F(ConsulHermeticTest, unchanged_refresh_test) {
+  server_.AddInstances(kService, 2);
+  SelectorInfo info;
+  info.name = kService;
+  ConsulEndpointListPtr endpoints;
+  ASSERT_EQ(0, selector_.SelectBatchShared(&info, &endpoints));
+  auto load_balance_updates = []() {
+    consul::RefreshStageSnapshot stages;
+    consul::GetRefreshStageStats(&stages);
+    return stages.stage_us[static_cast<size_t>(consul::RefreshStage::kLoadBalance)].count;
+  };
+  uint64_t updates = load_balance_updates();
+
+  // A revalidation finding the same endpoints keeps the snapshot and leaves the loadbalance alone
+  ASSERT_EQ(0, Refresh());
+  ConsulEndpointListPtr current;
+  ASSERT_EQ(0, selector_.SelectBatchShared(&info, &current));
+  EXPECT_EQ(endpoints.get(), current.get());
+  EXPECT_EQ(updates, load_balance_updates());
+
+  // A changed one publishes a new snapshot, the previous one stays valid for its holders
+  server_.AddInstances(kService, 1);
+  ASSERT_EQ(0, Refresh());
+  ASSERT_EQ(0, selector_.SelectBatchShared(&info, &current));
+  EXPECT_NE(endpoints.get(), current.get());
+  EXPECT_EQ(3, current->size());
+  EXPECT_EQ(2, endpoints->size());
+  EXPECT_EQ(updates + 1, load_balance_updates());
+}
+
+TEST_F(ConsulHermeticTest, idle_eviction_test) {
+  server_.AddInstances("trpc.test.hermetic.A", 1);
+  server_.AddInstances("trpc.test.hermetic.B", 1);
+  naming::ConsulConfig config = config_;
+  config.idle_ttl_ = 3000;
+  ConsulSelector selector;
+  ASSERT_EQ(0, selector.Init(config));
+
+  SelectorInfo info_a;
+  info_a.name = "trpc.test.hermetic.A";
+  SelectorInfo info_b;
+  info_b.name = "trpc.test.hermetic.B";
+  TrpcEndpointInfo endpoint;
+  ASSERT_EQ(0, selector.Select(&info_a, &endpoint));
+  ASSERT_EQ(0, selector.Select(&info_b, &endpoint));
+
+  // Time is passed in, so the test does not have to wait for the ttl
+  uint64_t now = trpc::time::GetMilliSeconds();
+  EXPECT_EQ(0, selector.EvictCallees(now));
+  EXPECT_EQ(0, selector.EvictCallees(now + 1000));
+  ASSERT_EQ(0, selector.Select(&info_b, &endpoint));
+  EXPECT_EQ(1, selector.EvictCallees(now + 4000));
+  EXPECT_EQ(1, selector.GetEvictedCalleeCount());
+
+  std::vector<consul::CalleeMetricsSnapshot> metrics;
+  selector.GetSelectMetrics(&metrics);
+  ASSERT_EQ(1, metrics.size());
+  EXPECT_EQ("trpc.test.hermetic.B", metrics[0].name);
+
+  // A dropped callee is looked up again by its next select
+  ASSERT_EQ(0, selector.Select(&info_a, &endpoint));
+  selector.GetSelectMetrics(&metrics);
+  EXPECT_EQ(2, metrics.size());
+  selector.Destroy();
+}
+
+TEST_F(ConsulHermeticTest, max_callees_test) {
+  server_.AddInstances("trpc.test.hermetic.A", 1);
+  server_.AddInstances("trpc.test.hermetic.B", 1);
+  naming::ConsulConfig config = config_;
+  config.max_callees_ = 1;
+  ConsulSelector selector;
+  ASSERT_EQ(0, selector.Init(config));
+
+  SelectorInfo info_a;
+  info_a.name = "trpc.test.hermetic.A";
+  SelectorInfo info_b;
+  info_b.name = "trpc.test.hermetic.B";
+  TrpcEndpointInfo endpoint;
+  uint64_t now = trpc::time::GetMilliSeconds();
+  ASSERT_EQ(0, selector.Select(&info_a, &endpoint));
+  EXPECT_EQ(0, selector.EvictCallees(now));
+  EXPECT_EQ(0, selector.EvictCallees(now + 1000));
+  ASSERT_EQ(0, selector.Select(&info_b, &endpoint));
+
+  // The least recently selected callee goes first
+  EXPECT_EQ(1, selector.EvictCallees(now + 1000));
+  std::vector<consul::CalleeMetricsSnapshot> metrics;
+  selector.GetSelectMetrics(&metrics);
+  ASSERT_EQ(1, metrics.size());
+  EXPECT_EQ("trpc.test.hermetic.B", metrics[0].name);
+
+  // Callees selected within the current epoch are kept even beyond the bound
+  ASSERT_EQ(0, selector.Select(&info_a, &endpoint));
+  EXPECT_EQ(0, selector.EvictCallees(now + 1000));
+  selector.GetSelectMetrics(&metrics);
+  EXPECT_EQ(2, metrics.size());
+  selector.Destroy();
+}
+
+TEST_F(ConsulHermeticTest, replica_select_metrics_test) {
+  server_.AddInstances("trpc.test.hermetic.A", 2);
+  naming::ConsulConfig config = config_;
+  config.replicate_snapshot_ = true;
+  config.snapshot_replica_num_ = 2;
+  ConsulSelector selector;
+  ASSERT_EQ(0, selector.Init(config));
+
+  SelectorInfo info;
+  info.name = "trpc.test.hermetic.A";
+  TrpcEndpointInfo endpoint;
+  constexpr int kSelectNum = 1000;
+  for (int i = 0; i < kSelectNum; ++i) {
+    ASSERT_EQ(0, selector.Select(&info, &endpoint));
+  }
+  // The first select looks the callee up, the others are served by the replicas
+  EXPECT_EQ(kSelectNum - 1, selector.GetReplicaSelectCount());
+
+  // Selects served by the replicas are counted and timed for the callee as well
+  std::vector<consul::CalleeMetricsSnapshot> metrics;
+  selector.GetSelectMetrics(&metrics);
+  ASSERT_EQ(1, metrics.size());
+  EXPECT_EQ(kSelectNum, metrics[0].selects);
+  EXPECT_EQ(0, metrics[0].failures);
+  EXPECT_GE(metrics[0].select_latency_ns.count, kSelectNum / consul::CalleeSelectMetrics::kLatencySampleRate - 1);
+  selector.Destroy();
+}
+
+TEST_F(ConsulHermeticTest, endpoint_change_subscription_test) {
+  std::vector<consul::EndpointChangeEvent> events;
+  uint64_t id = selector_.SubscribeEndpointChanges(kService, [&events](const consul::EndpointChangeEvent& event) {
+    events.push_back(event);
+  });
+  int other_events = 0;
+  selector_.SubscribeEndpointChanges("trpc.test.hermetic.Other",
+                                     [&other_events](const consul::EndpointChangeEvent&) { other_events++; });
+
+  server_.AddInstances(kService, 2, 10001);
+  SelectorInfo info;
+  info.name = kService;
+  TrpcEndpointInfo endpoint;
+  ASSERT_EQ(0, selector_.Select(&info, &endpoint));
+  ASSERT_EQ(1, events.size());
+  EXPECT_EQ(kService, events[0].name);
+  EXPECT_EQ(2, events[0].added.size());
+  EXPECT_TRUE(events[0].removed.empty());
+
+  // An unchanged refresh delivers nothing
+  ASSERT_EQ(0, Refresh());
+  EXPECT_EQ(1, events.size());
+
+  ASSERT_TRUE(server_.SetStatus(std::string(kService) + "-0", "critical"));
+  ASSERT_EQ(0, Refresh());
+  ASSERT_EQ(2, events.size());
+  ASSERT_EQ(1, events[1].updated.size());
+  EXPECT_EQ("10.0.0.0", events[1].updated[0].host);
+  EXPECT_NE(0, events[1].updated[0].status);
+  EXPECT_TRUE(events[1].added.empty());
+
+  ASSERT_TRUE(server_.Deregister(std::string(kService) + "-1"));
+  ASSERT_EQ(0, Refresh());
+  ASSERT_EQ(3, events.size());
+  ASSERT_EQ(1, events[2].removed.size());
+  EXPECT_EQ("10.0.0.1", events[2].removed[0].host);
+
+  selector_.UnsubscribeEndpointChanges(id);
+  server_.AddInstances(kService, 1, 10003);
+  ASSERT_EQ(0, Refresh());
+  EXPECT_EQ(3, events.size());
+  EXPECT_EQ(0, other_events);
+}
+
+TEST_F(ConsulHermeticTest, slow_start_test) {
+  server_.AddInstances(kService, 2);
+  naming::ConsulConfig config = config_;
+  config.slow_start_window_ = 60000;
+  config.slow_start_min_weight_ = 10;
+  ConsulSelector selector;
+  ASSERT_EQ(0, selector.Init(config));
+
+  // The endpoints known when the callee is first selected get full traffic at once
+  SelectorInfo info;
+  info.name = kService;
+  ConsulEndpointListPtr endpoints;
+  ASSERT_EQ(0, selector.SelectBatchShared(&info, &endpoints));
+  ASSERT_EQ(2, endpoints->size());
+  for (const auto& endpoint : *endpoints) {
+    EXPECT_EQ(consul::FullEndpointWeight(), endpoint.weight);
+  }
+
+  server_.AddInstances(kService, 1);
+  RouterInfo router_info;
+  router_info.name = kService;
+  router_info.info.resize(1);
+  router_info.info[0].host = kService;
+  ASSERT_EQ(0, selector.SetEndpoints(&router_info));
+  ASSERT_EQ(0, selector.SelectBatchShared(&info, &endpoints));
+  ASSERT_EQ(3, endpoints->size());
+  int ramping = 0;
+  for (const auto& endpoint : *endpoints) {
+    if (endpoint.host == "10.0.0.2") {
+      EXPECT_EQ(consul::FullEndpointWeight() / 10, endpoint.weight);
+      ramping++;
+    } else {
+      EXPECT_EQ(consul::FullEndpointWeight(), endpoint.weight);
+    }
+  }
+  EXPECT_EQ(1, ramping);
+
+  // Round robin picks the ramping endpoint far less often than the others
+  int picks = 0;
+  TrpcEndpointInfo endpoint;
+  for (int i = 0; i < 3000; ++i) {
+    ASSERT_EQ(0, selector.Select(&info, &endpoint));
+    picks += endpoint.host == "10.0.0.2";
+  }
+  EXPECT_LT(picks, 500);
+  selector.Destroy();
+}
+
+TEST_F(ConsulHermeticTest, slow_start_first_batch_select_test) {
+  PeripheryTaskScheduler::GetInstance()->Init();
+  PeripheryTaskScheduler::GetInstance()->Start();
+  server_.AddInstances(kService, 2);
+  naming::ConsulConfig config = config_;
+  config.slow_start_window_ = 1000;
+  config.slow_start_min_weight_ = 10;
+  ConsulSelector selector;
+  ASSERT_EQ(0, selector.Init(config));
+
+  SelectorInfo info;
+  info.name = kService;
+  TrpcEndpointInfo endpoint;
+  ASSERT_EQ(0, selector.Select(&info, &endpoint));
+  server_.AddInstances(kService, 1);
+  RouterInfo router_info;
+  router_info.name = kService;
+  router_info.info.resize(1);
+  router_info.info[0].host = kService;
+  ASSERT_EQ(0, selector.SetEndpoints(&router_info));
+  selector.Start();
+
+  // The first batch selection materializes the list of a snapshot whose ramp is running
+  ConsulEndpointListPtr endpoints;
+  ASSERT_EQ(0, selector.SelectBatchShared(&info, &endpoints));
+  ASSERT_EQ(3, endpoints->size());
+  for (const auto& item : *endpoints) {
+    if (item.host == "10.0.0.2") {
+      EXPECT_GT(consul::FullEndpointWeight(), item.weight);
+    }
+  }
+
+  // The periodic task keeps advancing the ramp to the full weight
+  bool finished = false;
+  for (int i = 0; i < 50 && !finished; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    ASSERT_EQ(0, selector.SelectBatchShared(&info, &endpoints));
+    finished = true;
+    for (const auto& item : *endpoints) {
+      finished = finished && item.weight == consul::FullEndpointWeight();
+    }
+  }
+  EXPECT_TRUE(finished);
+  selector.Stop();
+  selector.Destroy();
+}
+
+TEST_F(ConsulHermeticTest, flap_damping_test) {
+  server_.AddInstances(kService, 2);
+  naming::ConsulConfig config = config_;
+  config.flap_half_life_ = 60000;
+  config.flap_suppress_threshold_ = 2;
+  config.flap_reuse_threshold_ = 1;
+  ConsulSelector selector;
+  ASSERT_EQ(0, selector.Init(config));
+  SelectorInfo info;
+  info.name = kService;
+  ConsulEndpointListPtr endpoints;
+  ASSERT_EQ(0, selector.SelectBatchShared(&info, &endpoints));
+
+  RouterInfo router_info;
+  router_info.name = kService;
+  router_info.info.resize(1);
+  router_info.info[0].host = kService;
+  std::string flapping = std::string(kService) + "-0";
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_TRUE(server_.SetStatus(flapping, "critical"));
+    ASSERT_EQ(0, selector.SetEndpoints(&router_info));
+    ASSERT_TRUE(server_.SetStatus(flapping, "passing"));
+    ASSERT_EQ(0, selector.SetEndpoints(&router_info));
+  }
+
+  // Only the first failure is published, from the second change on the endpoint is kept unhealthy
+  ASSERT_EQ(0, selector.SelectBatchShared(&info, &endpoints));
+  for (const auto& endpoint : *endpoints) {
+    EXPECT_EQ(endpoint.host == "10.0.0.0" ? -1 : 0, endpoint.status);
+  }
+  std::vector<consul::CalleeRefreshSnapshot> metrics;
+  selector.GetRefreshMetrics(&metrics);
+  ASSERT_EQ(1, metrics.size());
+  EXPECT_EQ(1, metrics[0].status_changes);
+  EXPECT_EQ(3, selector.GetDampedStatusChangeCount());
+  selector.Destroy();
+}
+
+TEST_F(ConsulHermeticTest, cold_lookup_stalled_agent_test) {
+  server_.AddInstances("trpc.test.hermetic.A", 1);
+  server_.AddInstances("trpc.test.hermetic.B", 1);
+  server_.AddInstances("trpc.test.hermetic.C", 1);
+  naming::ConsulConfig config = config_;
+  config.request_timeout_ = 300;
+  config.cold_lookup_timeout_ = 2000;
+  ConsulSelector selector;
+  ASSERT_EQ(0, selector.Init(config));
+
+  // The agent hangs while both cold lookup threads wait for it
+  consul::FakeConsulFaults faults;
+  faults.min_latency_ms = 60000;
+  faults.max_latency_ms = 60000;
+  server_.SetFaults(faults);
+  std::vector<std::thread> callers;
+  for (const char* name : {"trpc.test.hermetic.A", "trpc.test.hermetic.B"}) {
+    callers.emplace_back([&selector, name]() {
+      SelectorInfo info;
+      info.name = name;
+      TrpcEndpointInfo endpoint;
+      selector.Select(&info, &endpoint);
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  server_.SetFaults(consul::FakeConsulFaults());
+
+  // The stalled requests give up after their timeout, so the threads are free again long before the caller gives up
+  SelectorInfo info;
+  info.name = "trpc.test.hermetic.C";
+  TrpcEndpointInfo endpoint;
+  uint64_t begin = trpc::time::GetMilliSeconds();
+  EXPECT_EQ(0, selector.Select(&info, &endpoint));
+  EXPECT_EQ("10.0.0.2", endpoint.host);
+  EXPECT_LT(trpc::time::GetMilliSeconds() - begin, 1500);
+  for (auto& caller : callers) {
+    caller.join();
+  }
+  selector.Destroy();
+}
+
+}  // namespace trpc
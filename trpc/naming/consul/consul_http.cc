@@ -0,0 +1,182 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#include "trpc/naming/consul/consul_http.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+#include "trpc/util/log/logging.h"
+
+namespace trpc::consul {
+
+namespace {
+
+std::atomic<uint64_t> request_count{0};
+std::atomic<uint64_t> connect_count{0};
+std::atomic<uint64_t> tls_handshake_count{0};
+std::atomic<uint64_t> transport_error_count{0};
+std::atomic<uint64_t> status_2xx_count{0};
+std::atomic<uint64_t> status_4xx_count{0};
+std::atomic<uint64_t> status_5xx_count{0};
+std::atomic<uint64_t> status_other_count{0};
+std::atomic<uint64_t> retry_count{0};
+std::atomic<uint64_t> response_bytes{0};
+
+// Requests to the agent are rare compared to selects, plain histograms are fine
+struct RoundTripHistograms {
+  LatencyHistogram name_lookup_us;
+  LatencyHistogram connect_us;
+  LatencyHistogram tls_handshake_us;
+  LatencyHistogram first_byte_us;
+  LatencyHistogram total_us;
+  LatencyHistogram response_size;
+};
+
+RoundTripHistograms* GetHistograms() {
+  static RoundTripHistograms* histograms = new RoundTripHistograms();
+  return histograms;
+}
+
+// Duration between two points of the libcurl timeline, zero if the later one was not reached
+uint64_t PhaseDuration(int64_t start_us, int64_t end_us) {
+  return end_us > start_us ? static_cast<uint64_t>(end_us - start_us) : 0;
+}
+
+// Share of all handles of the process talking to the agent, never destroyed as handles may outlive any owner
+curl_http::CurlHttpShare* GetShare() {
+  static curl_http::CurlHttpShare* share = []() {
+    auto* share = new curl_http::CurlHttpShare();
+    if (share->Init() != curl_http::kOk) {
+      TRPC_LOG_ERROR("init curl share of consul failed");
+      delete share;
+      return static_cast<curl_http::CurlHttpShare*>(nullptr);
+    }
+    return share;
+  }();
+  return share;
+}
+
+}  // namespace
+
+ConsulHttpOptions MakeConsulHttpOptions(const naming::ConsulConfig& config) {
+  ConsulHttpOptions options;
+  options.tls = config.tls_enable_;
+  options.tcp_keepalive_idle = config.tcp_keepalive_idle_;
+  if (config.request_timeout_ > 0) {
+    options.timeout_ms = config.request_timeout_;
+    // The connect is part of the request, it is only bounded separately if that is tighter than the default
+    options.connect_timeout_ms =
+        std::min<int64_t>(config.request_timeout_, curl_http::CurlHttp::Options().connection_timeout);
+  }
+  if (!options.tls) {
+    options.base_url = "http://" + config.address_;
+    return options;
+  }
+
+  options.ca_file = config.tls_ca_file_;
+  options.cert_file = config.tls_cert_file_;
+  options.key_file = config.tls_key_file_;
+  size_t colon = config.address_.rfind(':');
+  if (config.tls_server_name_.empty() || colon == std::string::npos) {
+    options.base_url = "https://" + config.address_;
+    return options;
+  }
+  // The url carries the server name for SNI and verification, the connection still goes to the address
+  std::string port = config.address_.substr(colon + 1);
+  std::string host = config.address_.substr(0, colon);
+  options.base_url = "https://" + config.tls_server_name_ + ":" + port;
+  options.connect_to = config.tls_server_name_ + ":" + port + ":" + host + ":" + port;
+  return options;
+}
+
+int ConfigureConsulHttp(const ConsulHttpOptions& options, curl_http::CurlHttp* curl_http) {
+  curl_http->SetTcpKeepAlive(options.tcp_keepalive_idle);
+  if (options.timeout_ms > 0) {
+    curl_http->SetTimeout(options.timeout_ms);
+  }
+  if (options.connect_timeout_ms > 0) {
+    curl_http->SetConnectionTimeout(options.connect_timeout_ms);
+  }
+  if (options.tls) {
+    curl_http->SetTls(options.ca_file, options.cert_file, options.key_file);
+    curl_http->SetConnectTo(options.connect_to);
+  }
+  curl_http::CurlHttpShare* share = GetShare();
+  if (share == nullptr) {
+    return -1;
+  }
+  curl_http->SetShare(share);
+  return 0;
+}
+
+void RecordConsulResponse(const ConsulHttpOptions& options, const curl_http::CurlHttpResponse& response) {
+  request_count.fetch_add(1, std::memory_order_relaxed);
+  RoundTripHistograms* histograms = GetHistograms();
+  if (response.num_connects > 0) {
+    connect_count.fetch_add(response.num_connects, std::memory_order_relaxed);
+    histograms->name_lookup_us.Record(response.name_lookup_us);
+    histograms->connect_us.Record(PhaseDuration(response.name_lookup_us, response.connect_us));
+    if (options.tls) {
+      tls_handshake_count.fetch_add(response.num_connects, std::memory_order_relaxed);
+      histograms->tls_handshake_us.Record(PhaseDuration(response.connect_us, response.app_connect_us));
+    }
+  }
+
+  // A failed transfer may have received a status line before, e.g. on a timeout while reading the body, so it can
+  // count as both
+  if (response.code != CURLE_OK) {
+    transport_error_count.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (response.response_code >= 200 && response.response_code < 300) {
+    status_2xx_count.fetch_add(1, std::memory_order_relaxed);
+  } else if (response.response_code >= 400 && response.response_code < 500) {
+    status_4xx_count.fetch_add(1, std::memory_order_relaxed);
+  } else if (response.response_code >= 500) {
+    status_5xx_count.fetch_add(1, std::memory_order_relaxed);
+  } else if (response.response_code > 0) {
+    status_other_count.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  response_bytes.fetch_add(response.size_download, std::memory_order_relaxed);
+  histograms->response_size.Record(response.size_download);
+  if (response.start_transfer_us > 0) {
+    histograms->first_byte_us.Record(PhaseDuration(response.pre_transfer_us, response.start_transfer_us));
+  }
+  histograms->total_us.Record(response.total_us);
+}
+
+void RecordConsulRetry() { retry_count.fetch_add(1, std::memory_order_relaxed); }
+
+void GetConsulHttpStats(ConsulHttpStats* stats) {
+  stats->requests = request_count.load(std::memory_order_relaxed);
+  stats->connects = connect_count.load(std::memory_order_relaxed);
+  stats->tls_handshakes = tls_handshake_count.load(std::memory_order_relaxed);
+  stats->transport_errors = transport_error_count.load(std::memory_order_relaxed);
+  stats->status_2xx = status_2xx_count.load(std::memory_order_relaxed);
+  stats->status_4xx = status_4xx_count.load(std::memory_order_relaxed);
+  stats->status_5xx = status_5xx_count.load(std::memory_order_relaxed);
+  stats->status_other = status_other_count.load(std::memory_order_relaxed);
+  stats->retries = retry_count.load(std::memory_order_relaxed);
+  stats->response_bytes = response_bytes.load(std::memory_order_relaxed);
+  RoundTripHistograms* histograms = GetHistograms();
+  histograms->name_lookup_us.Snapshot(&stats->name_lookup_us);
+  histograms->connect_us.Snapshot(&stats->connect_us);
+  histograms->tls_handshake_us.Snapshot(&stats->tls_handshake_us);
+  histograms->first_byte_us.Snapshot(&stats->first_byte_us);
+  histograms->total_us.Snapshot(&stats->total_us);
+  histograms->response_size.Snapshot(&stats->response_size);
+}
+
+}  // namespace trpc::consul
@@ -0,0 +1,85 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "trpc/naming/consul/config/consul_naming_conf.h"
+#include "trpc/naming/consul/consul_select_metrics.h"
+#include "trpc/transport/common/http/curl_http.h"
+
+namespace trpc::consul {
+
+/// @brief How the HTTP handles of the selector and registry reach the Consul agent.
+struct ConsulHttpOptions {
+  // "http://host:port" or "https://host:port", the requests append their path to it
+  std::string base_url;
+  bool tls{false};
+  std::string ca_file;
+  std::string cert_file;
+  std::string key_file;
+  // Set if the agent is verified against another name than its address, see `curl_http::CurlHttp::SetConnectTo`
+  std::string connect_to;
+  int64_t tcp_keepalive_idle{0};
+  // Bounds of one request in milliseconds, zero keeps the defaults of `curl_http::CurlHttp`
+  int64_t timeout_ms{0};
+  int64_t connect_timeout_ms{0};
+};
+
+struct ConsulHttpStats {
+  // Requests sent to the agent
+  uint64_t requests{0};
+  // New connections, the others reused a pooled connection
+  uint64_t connects{0};
+  // TLS handshakes, full or resumed, one per new HTTPS connection
+  uint64_t tls_handshakes{0};
+  // Requests which got no HTTP response, e.g. connect failures and timeouts
+  uint64_t transport_errors{0};
+  // Responses by HTTP status class, 1xx and 3xx count as other
+  uint64_t status_2xx{0};
+  uint64_t status_4xx{0};
+  uint64_t status_5xx{0};
+  uint64_t status_other{0};
+  // Requests repeated because the response was not usable, e.g. a stale read lagging too far behind the leader
+  uint64_t retries{0};
+  // Body bytes received
+  uint64_t response_bytes{0};
+  // Duration of the phases in microseconds. The name lookup, connect and TLS handshake are only recorded for requests
+  // which made a new connection, the first byte is the wait for the response once the request was sent.
+  HistogramSnapshot name_lookup_us;
+  HistogramSnapshot connect_us;
+  HistogramSnapshot tls_handshake_us;
+  HistogramSnapshot first_byte_us;
+  HistogramSnapshot total_us;
+  HistogramSnapshot response_size;
+};
+
+ConsulHttpOptions MakeConsulHttpOptions(const naming::ConsulConfig& config);
+
+/// @brief Applies `options` to `curl_http`, whose handle joins the share of the process: all handles talking to
+/// the agent share the DNS cache and resume each other's TLS sessions, each keeps its own connection.
+/// @return 0 on success, -1 if the share failed to initialize.
+int ConfigureConsulHttp(const ConsulHttpOptions& options, curl_http::CurlHttp* curl_http);
+
+/// @brief Accounts a response of the agent in the stats of the process: status, size and the timings of libcurl.
+void RecordConsulResponse(const ConsulHttpOptions& options, const curl_http::CurlHttpResponse& response);
+
+/// @brief Accounts a request repeated because its response was not usable.
+void RecordConsulRetry();
+
+/// @brief Stats of all requests to the agent since the start of the process.
+void GetConsulHttpStats(ConsulHttpStats* stats);
+
+}  // namespace trpc::consul
@@ -0,0 +1,113 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#include "trpc/naming/consul/consul_http.h"
+
+#include <memory>
+
+#include "gtest/gtest.h"
+
+namespace trpc::consul {
+
+TEST(ConsulHttpTest, make_options_test) {
+  naming::ConsulConfig config;
+  config.address_ = "10.0.0.1:8501";
+  ConsulHttpOptions options = MakeConsulHttpOptions(config);
+  EXPECT_FALSE(options.tls);
+  EXPECT_EQ("http://10.0.0.1:8501", options.base_url);
+  EXPECT_EQ(3000, options.timeout_ms);
+  EXPECT_EQ(3000, options.connect_timeout_ms);
+
+  // Requests are bounded as a whole, the connect never longer than the request
+  config.request_timeout_ = 500;
+  options = MakeConsulHttpOptions(config);
+  EXPECT_EQ(500, options.timeout_ms);
+  EXPECT_EQ(500, options.connect_timeout_ms);
+  config.request_timeout_ = 0;
+  options = MakeConsulHttpOptions(config);
+  EXPECT_EQ(0, options.timeout_ms);
+
+  config.tls_enable_ = true;
+  config.tls_ca_file_ = "ca.pem";
+  options = MakeConsulHttpOptions(config);
+  EXPECT_TRUE(options.tls);
+  EXPECT_EQ("https://10.0.0.1:8501", options.base_url);
+  EXPECT_EQ("ca.pem", options.ca_file);
+  EXPECT_TRUE(options.connect_to.empty());
+
+  // The server name goes into the url, the connection still goes to the address
+  config.tls_server_name_ = "server.dc1.consul";
+  options = MakeConsulHttpOptions(config);
+  EXPECT_EQ("https://server.dc1.consul:8501", options.base_url);
+  EXPECT_EQ("server.dc1.consul:8501:10.0.0.1:8501", options.connect_to);
+}
+
+TEST(ConsulHttpTest, stats_test) {
+  ConsulHttpOptions options;
+  options.tls = true;
+  auto before = std::make_unique<ConsulHttpStats>();
+  GetConsulHttpStats(before.get());
+
+  curl_http::CurlHttpResponse response;
+  response.code = 0;
+  response.response_code = 200;
+  response.num_connects = 1;
+  response.name_lookup_us = 100;
+  response.connect_us = 300;
+  response.app_connect_us = 1300;
+  response.pre_transfer_us = 1400;
+  response.start_transfer_us = 5400;
+  response.total_us = 5500;
+  response.size_download = 2048;
+  RecordConsulResponse(options, response);
+  // Reused connection, the server answered with an error
+  response.Reset();
+  response.code = 0;
+  response.response_code = 503;
+  response.pre_transfer_us = 50;
+  response.start_transfer_us = 250;
+  response.total_us = 300;
+  RecordConsulResponse(options, response);
+  // No response at all
+  response.Reset();
+  response.code = 7;
+  response.response_code = 0;
+  RecordConsulResponse(options, response);
+  RecordConsulRetry();
+
+  auto after = std::make_unique<ConsulHttpStats>();
+  GetConsulHttpStats(after.get());
+  EXPECT_EQ(3, after->requests - before->requests);
+  EXPECT_EQ(1, after->connects - before->connects);
+  EXPECT_EQ(1, after->tls_handshakes - before->tls_handshakes);
+  EXPECT_EQ(1, after->transport_errors - before->transport_errors);
+  EXPECT_EQ(1, after->status_2xx - before->status_2xx);
+  EXPECT_EQ(1, after->status_5xx - before->status_5xx);
+  EXPECT_EQ(0, after->status_4xx - before->status_4xx);
+  EXPECT_EQ(1, after->retries - before->retries);
+  EXPECT_EQ(2048, after->response_bytes - before->response_bytes);
+
+  // Connection phases only for the new connection, phase durations instead of the libcurl timeline
+  after->connect_us.Subtract(before->connect_us);
+  EXPECT_EQ(1, after->connect_us.count);
+  EXPECT_EQ(200, after->connect_us.sum);
+  after->tls_handshake_us.Subtract(before->tls_handshake_us);
+  EXPECT_EQ(1000, after->tls_handshake_us.sum);
+  after->first_byte_us.Subtract(before->first_byte_us);
+  EXPECT_EQ(2, after->first_byte_us.count);
+  EXPECT_EQ(4200, after->first_byte_us.sum);
+  after->total_us.Subtract(before->total_us);
+  EXPECT_EQ(3, after->total_us.count);
+}
+
+}  // namespace trpc::consul
@@ -0,0 +1,63 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#pragma once
+
+// USDT (user-level statically defined tracing) probes of the consul plugin, provider `trpc_consul`.
+//
+// A probe site is a single nop plus an ELF note naming it, so the probes are compiled in whenever <sys/sdt.h> is
+// available (systemtap-sdt-dev / systemtap-sdt-devel) and cost nothing until a tracer attaches, e.g.
+//   bpftrace -l 'usdt:/path/to/binary:trpc_consul:*'
+// Define TRPC_CONSUL_DISABLE_USDT to compile them out. Sample scripts are in trpc/naming/consul/bpftrace.
+//
+// Probes, string arguments are NUL-terminated callee names or urls:
+//   select_entry(name)                       Select is called
+//   select_return(name, ret)                 Select returns, ret is 0 on success
+//   cache_miss(name, wait_us)                a select found no endpoint snapshot and waited wait_us for a lookup
+//   refresh_start(name)                      lookup of a callee in Consul starts (RefreshEndpointInfoByName)
+//   refresh_end(name, ret)                   lookup ends, ret is 0 on success
+//   publish_lock_wait(name)                  RefreshDomainInfo waits for the refresh mutex of the callee
+//   publish_lock_acquire(name)               RefreshDomainInfo holds the mutex
+//   publish_lock_release(name, ret)          RefreshDomainInfo releases the mutex, ret is 0 on success
+//   curl_perform_start(handle)               a transport hands a request to Consul to libcurl, handle identifies
+//                                            the request until it is done
+//   curl_perform_done(handle, code, status, total_us)
+//                                            it completed with CURLcode code and HTTP status, 0 if none, after
+//                                            total_us as measured by libcurl
+
+#if !defined(TRPC_CONSUL_DISABLE_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define TRPC_CONSUL_USDT_ENABLED 1
+#endif
+#endif
+
+#ifdef TRPC_CONSUL_USDT_ENABLED
+#define TRPC_CONSUL_PROBE1(name, a1) DTRACE_PROBE1(trpc_consul, name, a1)
+#define TRPC_CONSUL_PROBE2(name, a1, a2) DTRACE_PROBE2(trpc_consul, name, a1, a2)
+#define TRPC_CONSUL_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(trpc_consul, name, a1, a2, a3)
+#define TRPC_CONSUL_PROBE4(name, a1, a2, a3, a4) DTRACE_PROBE4(trpc_consul, name, a1, a2, a3, a4)
+#else
+#define TRPC_CONSUL_PROBE1(name, a1) \
+  do {                               \
+  } while (0)
+#define TRPC_CONSUL_PROBE2(name, a1, a2) \
+  do {                                   \
+  } while (0)
+#define TRPC_CONSUL_PROBE3(name, a1, a2, a3) \
+  do {                                       \
+  } while (0)
+#define TRPC_CONSUL_PROBE4(name, a1, a2, a3, a4) \
+  do {                                           \
+  } while (0)
+#endif
@@ -0,0 +1,65 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#include "trpc/naming/consul/consul_refresh_metrics.h"
+
+namespace trpc::consul {
+
+namespace {
+
+std::array<LatencyHistogram, kRefreshStageNum>* GetStageHistograms() {
+  static auto* histograms = new std::array<LatencyHistogram, kRefreshStageNum>();
+  return histograms;
+}
+
+}  // namespace
+
+const char* RefreshStageName(RefreshStage stage) {
+  switch (stage) {
+    case RefreshStage::kFetch:
+      return "fetch";
+    case RefreshStage::kParse:
+      return "parse";
+    case RefreshStage::kAssignIds:
+      return "assign_ids";
+    case RefreshStage::kPublish:
+      return "publish";
+    case RefreshStage::kLoadBalance:
+      return "load_balance";
+    default:
+      return "unknown";
+  }
+}
+
+void RecordRefreshStage(RefreshStage stage, uint64_t duration_us) {
+  (*GetStageHistograms())[static_cast<size_t>(stage)].Record(duration_us);
+}
+
+void GetRefreshStageStats(RefreshStageSnapshot* stats) {
+  auto* histograms = GetStageHistograms();
+  for (size_t i = 0; i < kRefreshStageNum; ++i) {
+    (*histograms)[i].Snapshot(&stats->stage_us[i]);
+  }
+}
+
+void CalleeRefreshMetrics::Snapshot(CalleeRefreshSnapshot* snapshot) const {
+  snapshot->refreshes = refreshes_.load(std::memory_order_relaxed);
+  snapshot->failures = failures_.load(std::memory_order_relaxed);
+  snapshot->changes = changes_.load(std::memory_order_relaxed);
+  snapshot->endpoints_added = endpoints_added_.load(std::memory_order_relaxed);
+  snapshot->endpoints_removed = endpoints_removed_.load(std::memory_order_relaxed);
+  snapshot->status_changes = status_changes_.load(std::memory_order_relaxed);
+  snapshot->last_refresh_us = last_refresh_us_.load(std::memory_order_relaxed);
+}
+
+}  // namespace trpc::consul
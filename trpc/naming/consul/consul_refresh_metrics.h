@@ -0,0 +1,128 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "trpc/naming/consul/consul_endpoint_table.h"
+#include "trpc/naming/consul/consul_select_metrics.h"
+
+namespace trpc::consul {
+
+/// @brief Stages of the refresh of a callee.
+enum class RefreshStage : uint32_t {
+  // Health queries to the agent, including a stale read repeated in default mode
+  kFetch,
+  // Parse of the response body into the endpoint table
+  kParse,
+  // Endpoint id assignment and churn count of a changed table
+  kAssignIds,
+  // Materialization and swap of the new snapshot, and the update of the replicas
+  kPublish,
+  // Update of the default loadbalance
+  kLoadBalance,
+  kNum,
+};
+
+constexpr size_t kRefreshStageNum = static_cast<size_t>(RefreshStage::kNum);
+
+/// @brief Name of `stage` in the exported metrics, e.g. "assign_ids".
+const char* RefreshStageName(RefreshStage stage);
+
+/// @brief Durations of the refresh stages of all callees of the process, in microseconds.
+struct RefreshStageSnapshot {
+  std::array<HistogramSnapshot, kRefreshStageNum> stage_us;
+};
+
+void RecordRefreshStage(RefreshStage stage, uint64_t duration_us);
+
+void GetRefreshStageStats(RefreshStageSnapshot* stats);
+
+/// @brief Records the time from its construction to its destruction as the duration of `stage`.
+class RefreshStageTimer {
+ public:
+  explicit RefreshStageTimer(RefreshStage stage) : stage_(stage), start_(std::chrono::steady_clock::now()) {}
+
+  ~RefreshStageTimer() {
+    auto duration = std::chrono::steady_clock::now() - start_;
+    RecordRefreshStage(stage_, std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+  }
+
+  RefreshStageTimer(const RefreshStageTimer&) = delete;
+  RefreshStageTimer& operator=(const RefreshStageTimer&) = delete;
+
+ private:
+  RefreshStage stage_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+/// @brief Refresh metrics and staleness of one callee.
+struct CalleeRefreshSnapshot {
+  std::string name;
+  // Lookups of the callee, in Consul or the shared cache, and those which failed
+  uint64_t refreshes{0};
+  uint64_t failures{0};
+  // Refreshes which published a changed table, and the endpoint churn they brought
+  uint64_t changes{0};
+  uint64_t endpoints_added{0};
+  uint64_t endpoints_removed{0};
+  uint64_t status_changes{0};
+  // Duration of the last lookup, in microseconds
+  uint64_t last_refresh_us{0};
+  // Age of the served endpoints, -1 if there are none
+  int64_t snapshot_age_ms{-1};
+  // Lag of the answering server behind the leader at the last lookup, -1 if not reported
+  int64_t last_contact_ms{-1};
+  // Lookups failed since the last success
+  uint32_t consecutive_failures{0};
+  // Time until the next revalidation, -1 if none is scheduled
+  int64_t next_refresh_in_ms{-1};
+};
+
+/// @brief Refresh counters of one callee, updated by its lookups.
+class CalleeRefreshMetrics {
+ public:
+  void RecordRefresh(bool success, uint64_t duration_us) {
+    refreshes_.fetch_add(1, std::memory_order_relaxed);
+    if (!success) {
+      failures_.fetch_add(1, std::memory_order_relaxed);
+    }
+    last_refresh_us_.store(duration_us, std::memory_order_relaxed);
+  }
+
+  void RecordChange(const EndpointChurn& churn) {
+    changes_.fetch_add(1, std::memory_order_relaxed);
+    endpoints_added_.fetch_add(churn.added, std::memory_order_relaxed);
+    endpoints_removed_.fetch_add(churn.removed, std::memory_order_relaxed);
+    status_changes_.fetch_add(churn.status_changed, std::memory_order_relaxed);
+  }
+
+  /// @brief Fills the counters of `snapshot`, the name and staleness are left to the caller.
+  void Snapshot(CalleeRefreshSnapshot* snapshot) const;
+
+ private:
+  std::atomic<uint64_t> refreshes_{0};
+  std::atomic<uint64_t> failures_{0};
+  std::atomic<uint64_t> changes_{0};
+  std::atomic<uint64_t> endpoints_added_{0};
+  std::atomic<uint64_t> endpoints_removed_{0};
+  std::atomic<uint64_t> status_changes_{0};
+  std::atomic<uint64_t> last_refresh_us_{0};
+};
+
+}  // namespace trpc::consul
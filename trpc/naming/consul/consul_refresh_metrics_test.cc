@@ -0,0 +1,65 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#include "trpc/naming/consul/consul_refresh_metrics.h"
+
+#include <memory>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+namespace trpc::consul {
+
+TEST(RefreshMetricsTest, stage_timer_test) {
+  auto before = std::make_unique<RefreshStageSnapshot>();
+  GetRefreshStageStats(before.get());
+  {
+    RefreshStageTimer timer(RefreshStage::kParse);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  RecordRefreshStage(RefreshStage::kLoadBalance, 7);
+
+  auto after = std::make_unique<RefreshStageSnapshot>();
+  GetRefreshStageStats(after.get());
+  auto& parse = after->stage_us[static_cast<size_t>(RefreshStage::kParse)];
+  parse.Subtract(before->stage_us[static_cast<size_t>(RefreshStage::kParse)]);
+  EXPECT_EQ(1, parse.count);
+  EXPECT_GE(parse.sum, 2000);
+  auto& load_balance = after->stage_us[static_cast<size_t>(RefreshStage::kLoadBalance)];
+  load_balance.Subtract(before->stage_us[static_cast<size_t>(RefreshStage::kLoadBalance)]);
+  EXPECT_EQ(7, load_balance.sum);
+  EXPECT_STREQ("assign_ids", RefreshStageName(RefreshStage::kAssignIds));
+}
+
+TEST(RefreshMetricsTest, callee_test) {
+  CalleeRefreshMetrics metrics;
+  metrics.RecordRefresh(true, 1200);
+  metrics.RecordRefresh(false, 3000);
+  EndpointChurn churn;
+  churn.added = 3;
+  churn.removed = 1;
+  churn.status_changed = 2;
+  metrics.RecordChange(churn);
+
+  CalleeRefreshSnapshot snapshot;
+  metrics.Snapshot(&snapshot);
+  EXPECT_EQ(2, snapshot.refreshes);
+  EXPECT_EQ(1, snapshot.failures);
+  EXPECT_EQ(1, snapshot.changes);
+  EXPECT_EQ(3, snapshot.endpoints_added);
+  EXPECT_EQ(1, snapshot.endpoints_removed);
+  EXPECT_EQ(2, snapshot.status_changes);
+  EXPECT_EQ(3000, snapshot.last_refresh_us);
+}
+
+}  // namespace trpc::consul
@@ -0,0 +1,261 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#include "trpc/naming/consul/consul_refresh_worker.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+#include <utility>
+
+#include "rapidjson/document.h"
+
+#include "trpc/naming/consul/consul_refresh_metrics.h"
+#include "trpc/util/log/logging.h"
+
+namespace trpc::consul {
+
+namespace {
+
+using PoolAllocator = rapidjson::MemoryPoolAllocator<rapidjson::CrtAllocator>;
+using PoolDocument = rapidjson::GenericDocument<rapidjson::UTF8<>, PoolAllocator, PoolAllocator>;
+
+// Initial sizes of the allocator buffers, enough for a few hundred endpoints
+constexpr size_t kInitValueBufferSize = 64 * 1024;
+constexpr size_t kInitStackBufferSize = 4 * 1024;
+
+// Chunk size of the allocators once a refresh outgrows the buffers
+constexpr size_t kChunkCapacity = 64 * 1024;
+
+// Grows `buffer` to hold what its allocator used, so the next refresh of the same size is served from the buffer.
+// Must be called after the allocator is destroyed, as the allocator keeps its chunk header in the buffer.
+void GrowBuffer(size_t used_capacity, std::vector<char>* buffer) {
+  if (used_capacity > buffer->size()) {
+    buffer->resize(used_capacity + used_capacity / 4);
+  }
+}
+
+}  // namespace
+
+ConsulConsistency ParseConsulConsistency(const std::string& mode) {
+  if (mode == "stale") {
+    return ConsulConsistency::kStale;
+  }
+  if (mode == "cached") {
+    return ConsulConsistency::kCached;
+  }
+  if (!mode.empty() && mode != "default") {
+    TRPC_LOG_ERROR("unknown consul consistency mode " << mode << ", use default");
+  }
+  return ConsulConsistency::kDefault;
+}
+
+int ConsulRefreshWorker::Init(const ConsulQueryOptions& options, ConsulTransportPtr transport) {
+  options_ = options;
+  transport_ = transport != nullptr ? std::move(transport) : std::make_unique<CurlEasyTransport>();
+  if (transport_->Init(options_.http) != 0) {
+    return -1;
+  }
+  if (options_.consistency == ConsulConsistency::kCached && options_.cache_max_age_s > 0) {
+    transport_->SetRequestHeader("Cache-Control", "max-age=" + std::to_string(options_.cache_max_age_s));
+  }
+  value_buffer_.resize(kInitValueBufferSize);
+  stack_buffer_.resize(kInitStackBufferSize);
+  return 0;
+}
+
+void ConsulRefreshWorker::Destroy() {
+  if (transport_ != nullptr) {
+    transport_->Destroy();
+  }
+}
+
+int ConsulRefreshWorker::Query(const std::string& service_name, ConsulConsistency consistency) {
+  // assigned in place to reuse the capacity of the previous url
+  url_.assign(options_.http.base_url).append("/v1/health/service/").append(service_name);
+  if (consistency == ConsulConsistency::kStale) {
+    url_.append("?stale");
+  } else if (consistency == ConsulConsistency::kCached) {
+    url_.append("?cached");
+  }
+  transport_->Get(url_, &response_);
+  RecordConsulResponse(options_.http, response_);
+  if (response_.response_code != curl_http::kHttpStatusCode200) {
+    TRPC_LOG_ERROR("consul resp errcode:" << response_.response_code << ", err:" << response_.err_msg);
+    return -1;
+  }
+
+  // The header values are followed by CRLF in the header buffer, so strtoll stops inside it
+  meta_ = ConsulQueryMeta();
+  std::string_view value;
+  if (response_.GetHeader("X-Consul-LastContact", &value)) {
+    meta_.last_contact_ms = strtoll(value.data(), nullptr, 10);
+  }
+  if (response_.GetHeader("X-Consul-KnownLeader", &value)) {
+    meta_.known_leader = value != "false";
+  }
+  if (response_.GetHeader("X-Cache", &value)) {
+    meta_.cache_hit = value == "HIT";
+  }
+  if (response_.GetHeader("Age", &value)) {
+    meta_.cache_age_s = strtoll(value.data(), nullptr, 10);
+  }
+  return 0;
+}
+
+int ConsulRefreshWorker::Refresh(const std::string& service_name, HostInterner* interner) {
+  {
+    RefreshStageTimer timer(RefreshStage::kFetch);
+    if (Query(service_name, options_.consistency) != 0) {
+      return -1;
+    }
+    // A stale read is repeated on the leader if it lags further behind than configured. Without a known leader it is
+    // taken as is, the leader could not answer, that is what stale reads are for.
+    if (options_.consistency == ConsulConsistency::kStale && options_.max_stale_ms > 0 &&
+        meta_.last_contact_ms > static_cast<int64_t>(options_.max_stale_ms)) {
+      TRPC_LOG_WARN("stale read of " << service_name << " lags " << meta_.last_contact_ms
+                    << "ms behind the leader, query the leader");
+      RecordConsulRetry();
+      ConsulQueryMeta stale_meta = meta_;
+      stale_body_.swap(response_.body);
+      if (Query(service_name, ConsulConsistency::kDefault) == 0) {
+        meta_.requeried = true;
+      } else {
+        TRPC_LOG_WARN("query of the leader for " << service_name << " failed, use the stale read");
+        response_.body.swap(stale_body_);
+        meta_ = stale_meta;
+        meta_.stale = true;
+      }
+    }
+  }
+
+  RefreshStageTimer timer(RefreshStage::kParse);
+  return ParseResponse(service_name, interner);
+}
+
+int ConsulRefreshWorker::ParseResponse(const std::string& service_name, HostInterner* interner) {
+  table_.Clear();
+
+  int ret = 0;
+  size_t value_capacity = 0;
+  size_t stack_capacity = 0;
+  {
+    PoolAllocator value_allocator(value_buffer_.data(), value_buffer_.size(), kChunkCapacity,
+                                  &base_allocator_);
+    PoolAllocator stack_allocator(stack_buffer_.data(), stack_buffer_.size(), kChunkCapacity,
+                                  &base_allocator_);
+    PoolDocument resp_body(&value_allocator, stack_buffer_.size() / 2, &stack_allocator);
+    // Strings of the document point into the body instead of being copied
+    if (resp_body.ParseInsitu(&response_.body[0]).HasParseError()) {
+      TRPC_LOG_ERROR("parse response body err");
+      ret = -1;
+    } else if (!resp_body.IsArray()) {
+      TRPC_LOG_ERROR("resp body is not array");
+      ret = -1;
+    } else {
+      const auto& nodes = resp_body.GetArray();
+      table_.Reserve(nodes.Size());
+      for (auto it = nodes.Begin(); it != nodes.End(); ++it) {
+        auto node = it->GetObject();
+        if (!node.HasMember("Service") || !node["Service"].IsObject()) {
+          TRPC_LOG_ERROR("Service not exist or is not object");
+          ret = -1;
+          break;
+        }
+        if (!node["Service"].HasMember("Address") || !node["Service"]["Address"].IsString() ||
+            !node["Service"].HasMember("Port") || !node["Service"]["Port"].IsInt()) {
+          TRPC_LOG_ERROR("Address or Port fmt err");
+          ret = -1;
+          break;
+        }
+        // Get IP:Port
+        const auto& address = node["Service"]["Address"];
+        std::string_view host(address.GetString(), address.GetStringLength());
+        int port = node["Service"]["Port"].GetInt();
+        // Get health status
+        if (!node.HasMember("Checks") || !node["Checks"].IsArray()) {
+          TRPC_LOG_ERROR("Checks not exist or is not Array");
+          ret = -1;
+          break;
+        }
+        int endpoint_status = 0;
+        const auto& checks = node["Checks"].GetArray();
+        for (auto check_it = checks.Begin(); check_it != checks.End(); ++check_it) {
+          auto check = check_it->GetObject();
+          if (!check.HasMember("Name") || !check["Name"].IsString() || !check.HasMember("Status") ||
+              !check["Status"].IsString()) {
+            continue;
+          }
+          if (service_name != check["Name"].GetString()) {  // Skip the check information of the agent itself.
+            continue;
+          }
+          // If the node's health status is abnormal, assign a value of -1 to the status.
+          endpoint_status = (strcmp(check["Status"].GetString(), "passing") == 0) ? 0 : -1;
+        }
+
+        if (!table_.Add(host, port, endpoint_status, interner)) {
+          TRPC_LOG_ERROR("Port of " << host << " out of range:" << port);
+          ret = -1;
+          break;
+        }
+      }
+    }
+    value_capacity = value_allocator.Capacity();
+    stack_capacity = stack_allocator.Capacity();
+  }
+  GrowBuffer(value_capacity, &value_buffer_);
+  GrowBuffer(stack_capacity, &stack_buffer_);
+
+  if (ret != 0) {
+    table_.Clear();
+    return -1;
+  }
+  if (table_.Empty()) {
+    TRPC_LOG_ERROR("Response body contains no endpoints");
+    return -1;
+  }
+  return 0;
+}
+
+ConsulRefreshWorkerPool::WorkerPtr ConsulRefreshWorkerPool::Acquire() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!idle_workers_.empty()) {
+      ConsulRefreshWorker* worker = idle_workers_.back().release();
+      idle_workers_.pop_back();
+      return WorkerPtr(worker, Releaser{this});
+    }
+  }
+
+  auto worker = std::make_unique<ConsulRefreshWorker>();
+  if (worker->Init(options_, transport_factory_ ? transport_factory_() : nullptr) != 0) {
+    TRPC_LOG_ERROR("init consul refresh worker failed");
+    return WorkerPtr(nullptr, Releaser{this});
+  }
+  return WorkerPtr(worker.release(), Releaser{this});
+}
+
+void ConsulRefreshWorkerPool::Release(ConsulRefreshWorker* worker) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  idle_workers_.emplace_back(worker);
+}
+
+void ConsulRefreshWorkerPool::Destroy() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& worker : idle_workers_) {
+    worker->Destroy();
+  }
+  idle_workers_.clear();
+}
+
+}  // namespace trpc::consul
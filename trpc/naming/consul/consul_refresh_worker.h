@@ -0,0 +1,162 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "rapidjson/allocators.h"
+
+#include "trpc/naming/consul/consul_endpoint_table.h"
+#include "trpc/naming/consul/consul_http.h"
+#include "trpc/naming/consul/consul_transport.h"
+#include "trpc/transport/common/http/curl_http.h"
+
+namespace trpc::consul {
+
+/// @brief Consistency mode of the health queries.
+enum class ConsulConsistency {
+  // Served by the leader
+  kDefault,
+  // Served by any server, `X-Consul-LastContact` tells how far it may lag behind the leader
+  kStale,
+  // Served from the memory of the local agent, refreshed by it in the background
+  kCached,
+};
+
+/// @brief Parses "default", "stale" or "cached", anything else is the default mode.
+ConsulConsistency ParseConsulConsistency(const std::string& mode);
+
+struct ConsulQueryOptions {
+  ConsulHttpOptions http;
+  ConsulConsistency consistency{ConsulConsistency::kDefault};
+  // Stale reads lagging more than this behind the leader, in milliseconds, are repeated in default mode, zero means
+  // any lag is accepted
+  uint32_t max_stale_ms{0};
+  // Cached reads older than this, in seconds, are refreshed by the agent first, zero leaves it to the agent
+  uint32_t cache_max_age_s{0};
+};
+
+/// @brief Freshness of the last refresh, taken from the response headers.
+struct ConsulQueryMeta {
+  // X-Consul-LastContact: milliseconds since the answering server heard from the leader, -1 if not reported
+  int64_t last_contact_ms{-1};
+  // X-Consul-KnownLeader
+  bool known_leader{true};
+  // X-Cache: HIT or MISS of the agent cache, only reported for cached reads
+  bool cache_hit{false};
+  // Age: seconds since the agent cache entry was refreshed, -1 if not reported
+  int64_t cache_age_s{-1};
+  // The stale read lagged too far behind and was repeated in default mode
+  bool requeried{false};
+  // The repeated read failed, the stale answer was used nevertheless
+  bool stale{false};
+};
+
+/// @brief Arena of one refresh: the transport, response buffer, rapidjson allocator buffers and endpoint table
+/// are all reused across refreshes, so a steady-state refresh does close to zero heap allocations.
+/// @note Not thread-safe, a worker is used by one refresh at a time, see `ConsulRefreshWorkerPool`.
+class ConsulRefreshWorker {
+ public:
+  /// @param transport sends the health queries, a `CurlEasyTransport` if nullptr.
+  int Init(const ConsulQueryOptions& options = ConsulQueryOptions(), ConsulTransportPtr transport = nullptr);
+
+  void Destroy();
+
+  /// @brief Queries the health of `service_name` from the Consul agent and parses it into `Table()`.
+  /// @return 0 on success, -1 on HTTP or parse error, or if Consul returned no endpoints.
+  int Refresh(const std::string& service_name, HostInterner* interner);
+
+  /// @brief Freshness of the last successful refresh.
+  const ConsulQueryMeta& Meta() const { return meta_; }
+
+  /// @brief Parses the body held by `MutableResponse()` into `Table()`. The body is parsed in situ and destroyed.
+  int ParseResponse(const std::string& service_name, HostInterner* interner);
+
+  curl_http::CurlHttpResponse* MutableResponse() { return &response_; }
+
+  /// @brief Endpoints of the last successful refresh, valid until the next one.
+  const ConsulEndpointTable& Table() const { return table_; }
+
+  /// @brief Bytes reserved for the rapidjson value and parse stack allocators.
+  size_t ArenaCapacity() const { return value_buffer_.size() + stack_buffer_.size(); }
+
+ private:
+  // Sends the health query of `service_name` in `consistency` mode and records the freshness headers
+  int Query(const std::string& service_name, ConsulConsistency consistency);
+
+  ConsulTransportPtr transport_;
+
+  curl_http::CurlHttpResponse response_;
+
+  // Body of a lagging stale read while it is repeated in default mode, kept in case the repeat fails
+  std::string stale_body_;
+
+  std::string url_;
+
+  ConsulQueryOptions options_;
+
+  ConsulQueryMeta meta_;
+
+  // Backing buffers of the rapidjson allocators, grown to the peak usage of the previous refreshes
+  std::vector<char> value_buffer_;
+  std::vector<char> stack_buffer_;
+
+  // Base allocator of the pool allocators for the rare refresh that outgrows the buffers
+  rapidjson::CrtAllocator base_allocator_;
+
+  ConsulEndpointTable table_;
+};
+
+/// @brief Pool of refresh workers. Concurrent refreshes each get their own worker, so the transport is never
+/// shared between threads and the arenas of the workers stay warm.
+class ConsulRefreshWorkerPool {
+ public:
+  struct Releaser {
+    ConsulRefreshWorkerPool* pool;
+    void operator()(ConsulRefreshWorker* worker) const { pool->Release(worker); }
+  };
+
+  using WorkerPtr = std::unique_ptr<ConsulRefreshWorker, Releaser>;
+
+  ~ConsulRefreshWorkerPool() { Destroy(); }
+
+  /// @brief Query options of the workers created from now on, set before the first `Acquire`.
+  void SetQueryOptions(const ConsulQueryOptions& options) { options_ = options; }
+
+  /// @brief Creates the transports of the workers created from now on, nullptr means `CurlEasyTransport`.
+  void SetTransportFactory(ConsulTransportFactory factory) { transport_factory_ = std::move(factory); }
+
+  /// @brief Returns an idle worker, or a new one if all are busy. The worker goes back to the pool when released.
+  /// @return nullptr if a new worker failed to initialize.
+  WorkerPtr Acquire();
+
+  /// @brief Destroys the idle workers, must not be called while workers are acquired.
+  void Destroy();
+
+ private:
+  void Release(ConsulRefreshWorker* worker);
+
+ private:
+  std::vector<std::unique_ptr<ConsulRefreshWorker>> idle_workers_;
+  std::mutex mutex_;
+
+  ConsulQueryOptions options_;
+
+  ConsulTransportFactory transport_factory_;
+};
+
+}  // namespace trpc::consul
@@ -0,0 +1,239 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#include "trpc/naming/consul/consul_refresh_worker.h"
+
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+// Counts the allocations of the current thread while `counting` is set
+thread_local bool counting = false;
+thread_local size_t allocation_count = 0;
+
+}  // namespace
+
+void* operator new(size_t size) {
+  if (counting) {
+    ++allocation_count;
+  }
+  void* ptr = malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept { free(ptr); }
+
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+
+namespace trpc::consul {
+
+namespace {
+
+constexpr char kServiceName[] = "testconfig";
+
+std::string MakeHealthResponse(int endpoint_num) {
+  std::string body = "[";
+  for (int i = 0; i < endpoint_num; ++i) {
+    if (i > 0) body += ",";
+    body += R"({"Node":{"Node":"node)" + std::to_string(i) + R"(","Address":"127.0.0.1"},)";
+    body += R"("Service":{"ID":"testconfig-)" + std::to_string(i) + R"(","Service":"testconfig",)";
+    body += R"("Address":"10.0.)" + std::to_string(i / 256) + "." + std::to_string(i % 256) + R"(",)";
+    body += R"("Port":)" + std::to_string(8000 + i % 1000) + "},";
+    body += R"("Checks":[{"Name":"Serf Health Status","Status":"passing"},)";
+    body += R"({"Name":"testconfig","Status":")" + std::string(i % 10 == 0 ? "critical" : "passing") + R"("}]})";
+  }
+  body += "]";
+  return body;
+}
+
+}  // namespace
+
+TEST(ConsulRefreshWorkerTest, parse_test) {
+  ConsulRefreshWorker worker;
+  ASSERT_EQ(0, worker.Init());
+  HostInterner interner;
+
+  worker.MutableResponse()->body = MakeHealthResponse(20);
+  ASSERT_EQ(0, worker.ParseResponse(kServiceName, &interner));
+  const ConsulEndpointTable& table = worker.Table();
+  ASSERT_EQ(20, table.Size());
+  EXPECT_EQ(-1, table.Status(0));
+  EXPECT_EQ(0, table.Status(1));
+
+  std::vector<TrpcEndpointInfo> endpoints;
+  table.Materialize(interner, &endpoints);
+  EXPECT_EQ("10.0.0.1", endpoints[1].host);
+  EXPECT_EQ(8001, endpoints[1].port);
+
+  // negative cases
+  worker.MutableResponse()->body = "[]";
+  EXPECT_NE(0, worker.ParseResponse(kServiceName, &interner));
+  worker.MutableResponse()->body = "{}";
+  EXPECT_NE(0, worker.ParseResponse(kServiceName, &interner));
+  worker.MutableResponse()->body = "[{\"Service\":";
+  EXPECT_NE(0, worker.ParseResponse(kServiceName, &interner));
+  worker.MutableResponse()->body = R"([{"Service":{"Address":"10.0.0.1","Port":80}}])";
+  EXPECT_NE(0, worker.ParseResponse(kServiceName, &interner));
+  EXPECT_TRUE(worker.Table().Empty());
+
+  worker.Destroy();
+}
+
+TEST(ConsulRefreshWorkerTest, steady_state_allocation_test) {
+  ConsulRefreshWorker worker;
+  ASSERT_EQ(0, worker.Init());
+  HostInterner interner;
+
+  // Large enough to outgrow the initial arena, the first parses grow it to the peak usage
+  const std::string payload = MakeHealthResponse(2000);
+  std::string& body = worker.MutableResponse()->body;
+  for (int i = 0; i < 2; ++i) {
+    body.assign(payload);
+    ASSERT_EQ(0, worker.ParseResponse(kServiceName, &interner));
+  }
+  size_t arena_capacity = worker.ArenaCapacity();
+
+  // Overflow chunks of the rapidjson allocators come from malloc and are not counted, but they would grow the arena
+  for (int i = 0; i < 10; ++i) {
+    // Refill the body in place, as the transfer into the reserved body does
+    body.assign(payload);
+    allocation_count = 0;
+    counting = true;
+    int ret = worker.ParseResponse(kServiceName, &interner);
+    counting = false;
+    ASSERT_EQ(0, ret);
+    EXPECT_EQ(0, allocation_count);
+    EXPECT_EQ(2000, worker.Table().Size());
+  }
+  EXPECT_EQ(arena_capacity, worker.ArenaCapacity());
+
+  worker.Destroy();
+}
+
+TEST(ConsulRefreshWorkerTest, transport_test) {
+  // The stale read lags behind the leader first, so the refresh queries the leader again
+  std::vector<std::string> urls;
+  ConsulQueryOptions options;
+  options.http.base_url = "http://consul";
+  options.consistency = ConsulConsistency::kStale;
+  options.max_stale_ms = 1000;
+  auto transport = std::make_unique<InMemoryTransport>(
+      [&urls](const std::string& method, const std::string& url, const std::string& body,
+              curl_http::CurlHttpResponse* response) {
+        urls.push_back(url);
+        if (urls.size() == 3) {
+          response->response_code = 500;
+          return;
+        }
+        response->headers = urls.size() == 1 ? "X-Consul-LastContact: 5000\r\n" : "X-Consul-LastContact: 0\r\n";
+        response->body = MakeHealthResponse(3);
+      });
+  ConsulRefreshWorker worker;
+  ASSERT_EQ(0, worker.Init(options, std::move(transport)));
+  HostInterner interner;
+
+  ASSERT_EQ(0, worker.Refresh(kServiceName, &interner));
+  EXPECT_EQ(3, worker.Table().Size());
+  EXPECT_TRUE(worker.Meta().requeried);
+  ASSERT_EQ(2, urls.size());
+  EXPECT_EQ("http://consul/v1/health/service/testconfig?stale", urls[0]);
+  EXPECT_EQ("http://consul/v1/health/service/testconfig", urls[1]);
+
+  EXPECT_NE(0, worker.Refresh(kServiceName, &interner));
+  worker.Destroy();
+}
+
+TEST(ConsulRefreshWorkerTest, stale_fallback_test) {
+  // Stale reads without a known leader are taken as is, a failed query of the leader keeps the lagging stale read
+  std::vector<std::string> urls;
+  ConsulQueryOptions options;
+  options.http.base_url = "http://consul";
+  options.consistency = ConsulConsistency::kStale;
+  options.max_stale_ms = 1000;
+  auto transport = std::make_unique<InMemoryTransport>(
+      [&urls](const std::string& method, const std::string& url, const std::string& body,
+              curl_http::CurlHttpResponse* response) {
+        urls.push_back(url);
+        if (url.find("?stale") == std::string::npos) {
+          response->response_code = 500;
+          return;
+        }
+        response->headers = urls.size() == 1 ? "X-Consul-KnownLeader: false\r\nX-Consul-LastContact: 200\r\n"
+                                             : "X-Consul-KnownLeader: false\r\nX-Consul-LastContact: 5000\r\n";
+        response->body = MakeHealthResponse(urls.size() == 1 ? 2 : 3);
+      });
+  ConsulRefreshWorker worker;
+  ASSERT_EQ(0, worker.Init(options, std::move(transport)));
+  HostInterner interner;
+
+  ASSERT_EQ(0, worker.Refresh(kServiceName, &interner));
+  EXPECT_EQ(1, urls.size());
+  EXPECT_EQ(2, worker.Table().Size());
+  EXPECT_FALSE(worker.Meta().known_leader);
+  EXPECT_FALSE(worker.Meta().stale);
+
+  ASSERT_EQ(0, worker.Refresh(kServiceName, &interner));
+  ASSERT_EQ(3, urls.size());
+  EXPECT_EQ("http://consul/v1/health/service/testconfig", urls[2]);
+  EXPECT_EQ(3, worker.Table().Size());
+  EXPECT_TRUE(worker.Meta().stale);
+  EXPECT_FALSE(worker.Meta().requeried);
+  EXPECT_EQ(5000, worker.Meta().last_contact_ms);
+  worker.Destroy();
+}
+
+TEST(ConsulRefreshWorkerTest, consistency_test) {
+  EXPECT_EQ(ConsulConsistency::kDefault, ParseConsulConsistency("default"));
+  EXPECT_EQ(ConsulConsistency::kDefault, ParseConsulConsistency(""));
+  EXPECT_EQ(ConsulConsistency::kDefault, ParseConsulConsistency("consistent"));
+  EXPECT_EQ(ConsulConsistency::kStale, ParseConsulConsistency("stale"));
+  EXPECT_EQ(ConsulConsistency::kCached, ParseConsulConsistency("cached"));
+}
+
+TEST(ConsulRefreshWorkerTest, pool_test) {
+  ConsulRefreshWorkerPool pool;
+  ConsulRefreshWorker* first = nullptr;
+  {
+    auto worker = pool.Acquire();
+    ASSERT_TRUE(worker != nullptr);
+    first = worker.get();
+    // Concurrent refreshes get different workers
+    auto other = pool.Acquire();
+    ASSERT_TRUE(other != nullptr);
+    EXPECT_NE(first, other.get());
+  }
+
+  // Released workers are reused without allocating
+  allocation_count = 0;
+  counting = true;
+  {
+    auto worker = pool.Acquire();
+    counting = false;
+    EXPECT_TRUE(worker.get() != nullptr);
+  }
+  counting = false;
+  EXPECT_EQ(0, allocation_count);
+
+  pool.Destroy();
+}
+
+}  // namespace trpc::consul
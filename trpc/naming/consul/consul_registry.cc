@@ -13,6 +13,10 @@
 
 #include "trpc/naming/consul/consul_registry.h"
 
+#include <chrono>
+#include <string>
+#include <thread>
+
 #include "rapidjson/stringbuffer.h"
 #include "rapidjson/writer.h"
 #include "rapidjson/document.h"
@@ -20,6 +24,7 @@
 #include "trpc/common/config/trpc_config.h"
 #include "trpc/naming/consul/config/consul_naming_conf.h"
 #include "trpc/naming/consul/consul.h"
+#include "trpc/naming/consul/consul_traffic_shaper.h"
 
 namespace trpc {
 
@@ -31,11 +36,21 @@ int ConsulRegistry::Init() noexcept {
     return -1;
   }
   config.Display();
+  return Init(config);
+}
 
-  consul_config_ = std::any_cast<trpc::naming::ConsulConfig>(config);
+int ConsulRegistry::Init(const naming::ConsulConfig& config,
+                         consul::ConsulTransportFactory transport_factory) noexcept {
+  consul_config_ = config;
+  consul::ConsulTrafficShaper::GetInstance()->Init(consul_config_.rate_limit_, consul_config_.rate_burst_,
+                                                    consul_config_.rate_limit_configured_);
 
-  int ret = curl_http_.Init();
-  if (ret != trpc::curl_http::kOk) {
+  if (transport_factory == nullptr) {
+    transport_factory = consul::MakeConsulTransportFactory(consul_config_.transport_);
+  }
+  transport_ = transport_factory();
+  http_options_ = consul::MakeConsulHttpOptions(consul_config_);
+  if (transport_ == nullptr || transport_->Init(http_options_) != 0) {
     return -1;
   }
   init_ = true;
@@ -48,6 +63,7 @@ void ConsulRegistry::Destroy() noexcept {
     return;
   }
 
+  transport_->Destroy();
   init_ = false;
 }
 
@@ -56,30 +72,59 @@ int ConsulRegistry::Register(const trpc::RegistryInfo* info) {
     TRPC_FMT_ERROR("registryInfo is null");
     return -1;
   }
-  std::string registerPath = "http://" + consul_config_.address_ + "/v1/agent/service/register";
+  if (!init_) {
+    TRPC_FMT_ERROR("No init yet");
+    return -1;
+  }
+  std::string registerPath = http_options_.base_url + "/v1/agent/service/register";
   std::string body = ConstructRegisterJson(info);
-  trpc::curl_http::CurlHttpResponsePtr response = curl_http_.Put(registerPath, body);
-  if (response->response_code != trpc::curl_http::kHttpStatusCode200) {
-    TRPC_FMT_ERROR("register service err ret code{}", response->response_code);
+  PaceRequest();
+  trpc::curl_http::CurlHttpResponse response;
+  transport_->Put(registerPath, body, &response);
+  consul::RecordConsulResponse(http_options_, response);
+  if (response.response_code != trpc::curl_http::kHttpStatusCode200) {
+    TRPC_FMT_ERROR("register service err ret code{}", response.response_code);
     return -1;
   }
   return 0;
 }
 
 int ConsulRegistry::Unregister(const trpc::RegistryInfo* info) {
-  std::string deregister_path = "http://" + consul_config_.address_ + "/v1/agent/service/deregister/" + info->name;
-  trpc::curl_http::CurlHttpResponsePtr response = curl_http_.Put(deregister_path, "");
-  if (response->response_code != trpc::curl_http::kHttpStatusCode200) {
-    TRPC_FMT_ERROR("unregister service err ret code{}", response->response_code);
+  if (!init_) {
+    TRPC_FMT_ERROR("No init yet");
+    return -1;
+  }
+  std::string deregister_path = http_options_.base_url + "/v1/agent/service/deregister/" + InstanceId(info);
+  PaceRequest();
+  trpc::curl_http::CurlHttpResponse response;
+  transport_->Put(deregister_path, "", &response);
+  consul::RecordConsulResponse(http_options_, response);
+  if (response.response_code != trpc::curl_http::kHttpStatusCode200) {
+    TRPC_FMT_ERROR("unregister service err ret code{}", response.response_code);
     return -1;
   }
   return 0;
 }
 
+void ConsulRegistry::PaceRequest() {
+  // Registrations are not dropped, they are spread out when many processes start or stop at once
+  uint64_t wait_ms = consul::ConsulTrafficShaper::GetInstance()->Acquire();
+  if (wait_ms > 0) {
+    TRPC_FMT_DEBUG("wait {}ms for the consul request rate limit", wait_ms);
+    std::this_thread::sleep_for(std::chrono::milliseconds(wait_ms));
+  }
+}
+
+std::string ConsulRegistry::InstanceId(const trpc::RegistryInfo* info) {
+  return info->name + "-" + info->host + ":" + std::to_string(info->port);
+}
+
 std::string ConsulRegistry::ConstructRegisterJson(const trpc::RegistryInfo* info) const {
   rapidjson::Document d;
   d.SetObject();
 
+  std::string id = InstanceId(info);
+  d.AddMember(::rapidjson::StringRef("ID"), ::rapidjson::StringRef(id.c_str()), d.GetAllocator());
   d.AddMember(::rapidjson::StringRef("name"), ::rapidjson::StringRef(info->name.c_str()), d.GetAllocator());
   d.AddMember(::rapidjson::StringRef("Address"), ::rapidjson::StringRef(info->host.c_str()), d.GetAllocator());
   d.AddMember(::rapidjson::StringRef("Port"), info->port, d.GetAllocator());
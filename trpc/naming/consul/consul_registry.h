@@ -19,6 +19,8 @@
 #include <unordered_map>
 
 #include "trpc/naming/consul/consul.h"
+#include "trpc/naming/consul/consul_http.h"
+#include "trpc/naming/consul/consul_transport.h"
 #include "trpc/naming/consul/config/consul_naming_conf.h"
 #include "trpc/naming/registry.h"
 #include "trpc/transport/common/http/curl_http.h"
@@ -34,6 +36,10 @@ class ConsulRegistry : public Registry {
 
   int Init() noexcept override;
 
+  /// @brief Initializes from `config` instead of the plugin config of the framework, e.g. in tests.
+  /// @param transport_factory creates the transport of the registry, the one named by `config.transport_` if nullptr.
+  int Init(const naming::ConsulConfig& config, consul::ConsulTransportFactory transport_factory = nullptr) noexcept;
+
   void Start() noexcept override {}
 
   void Stop() noexcept override {}
@@ -53,13 +59,21 @@ class ConsulRegistry : public Registry {
 
   std::string ConstructRegisterJson(const trpc::RegistryInfo* info) const;
 
+  // ID of the instance in Consul, unique per address, so that instances of one service do not replace each other
+  static std::string InstanceId(const trpc::RegistryInfo* info);
+
+  // Waits for the share of the request to the Consul rate limit of the process
+  void PaceRequest();
+
  private:
   bool init_{false};
   uint64_t heartbeat_interval_;
   uint64_t heartbeat_timeout_;
-  trpc::curl_http::CurlHttp curl_http_;
+  consul::ConsulTransportPtr transport_;
 
   trpc::naming::ConsulConfig consul_config_;
+
+  consul::ConsulHttpOptions http_options_;
 };
 
 
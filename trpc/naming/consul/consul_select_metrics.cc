@@ -0,0 +1,111 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#include "trpc/naming/consul/consul_select_metrics.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace trpc::consul {
+
+uint64_t ShardedCounter::Value() const {
+  uint64_t value = 0;
+  for (const auto& shard : shards_) {
+    value += shard.value.load(std::memory_order_relaxed);
+  }
+  return value;
+}
+
+size_t ShardedCounter::ShardIndex() {
+  static std::atomic<size_t> next_shard{0};
+  thread_local size_t shard = next_shard.fetch_add(1, std::memory_order_relaxed) % kShardNum;
+  return shard;
+}
+
+uint32_t HistogramSnapshot::BucketIndex(uint64_t value) {
+  if (value < kSubBucketNum) {
+    return static_cast<uint32_t>(value);
+  }
+  uint32_t msb = 63 - __builtin_clzll(value);
+  uint32_t shift = msb - kSubBucketBits;
+  uint32_t sub_bucket = static_cast<uint32_t>(value >> shift) & (kSubBucketNum - 1);
+  return (shift + 1) * kSubBucketNum + sub_bucket;
+}
+
+uint64_t HistogramSnapshot::BucketUpperBound(uint32_t index) {
+  if (index < 2 * kSubBucketNum) {
+    return index;
+  }
+  uint32_t shift = index / kSubBucketNum - 1;
+  uint64_t lower = static_cast<uint64_t>(kSubBucketNum + index % kSubBucketNum) << shift;
+  return lower + ((1ULL << shift) - 1);
+}
+
+uint64_t HistogramSnapshot::Percentile(double percentile) const {
+  if (count == 0) {
+    return 0;
+  }
+  uint64_t rank = static_cast<uint64_t>(std::ceil(static_cast<double>(count) * percentile / 100));
+  rank = std::clamp<uint64_t>(rank, 1, count);
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < kBucketNum; ++i) {
+    seen += buckets[i];
+    if (seen >= rank) {
+      return std::min(BucketUpperBound(i), max);
+    }
+  }
+  return max;
+}
+
+void HistogramSnapshot::Subtract(const HistogramSnapshot& earlier) {
+  for (uint32_t i = 0; i < kBucketNum; ++i) {
+    buckets[i] -= std::min(buckets[i], earlier.buckets[i]);
+  }
+  count -= std::min(count, earlier.count);
+  sum -= std::min(sum, earlier.sum);
+}
+
+void LatencyHistogram::Record(uint64_t value) {
+  buckets_[HistogramSnapshot::BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+  uint64_t max = max_.load(std::memory_order_relaxed);
+  while (value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+  }
+}
+
+void LatencyHistogram::Snapshot(HistogramSnapshot* snapshot) const {
+  // Not atomic as a whole, a value recorded meanwhile may be missing from some of the fields
+  for (uint32_t i = 0; i < HistogramSnapshot::kBucketNum; ++i) {
+    snapshot->buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+  }
+  snapshot->count = count_.load(std::memory_order_relaxed);
+  snapshot->sum = sum_.load(std::memory_order_relaxed);
+  snapshot->max = max_.load(std::memory_order_relaxed);
+}
+
+bool CalleeSelectMetrics::SampleLatency() {
+  thread_local uint32_t select_count = 0;
+  return ++select_count % kLatencySampleRate == 0;
+}
+
+void CalleeSelectMetrics::Snapshot(CalleeMetricsSnapshot* snapshot) const {
+  snapshot->selects = selects_.Value();
+  snapshot->batch_selects = batch_selects_.Value();
+  snapshot->cache_misses = cache_misses_.Value();
+  snapshot->failures = failures_.Value();
+  select_latency_ns_.Snapshot(&snapshot->select_latency_ns);
+  cold_lookup_latency_us_.Snapshot(&snapshot->cold_lookup_latency_us);
+}
+
+}  // namespace trpc::consul
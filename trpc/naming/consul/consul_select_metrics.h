@@ -0,0 +1,139 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace trpc::consul {
+
+/// @brief Counter sharded over cache lines, so that threads selecting concurrently do not contend on one line.
+/// @note Each thread always adds to the same shard, the value is only summed up when read.
+class ShardedCounter {
+ public:
+  static constexpr size_t kShardNum = 16;
+
+  void Add(uint64_t value = 1) { shards_[ShardIndex()].value.fetch_add(value, std::memory_order_relaxed); }
+
+  uint64_t Value() const;
+
+  /// @brief Shard of the calling thread, threads are spread over the shards in the order of their first use.
+  static size_t ShardIndex();
+
+ private:
+  struct alignas(64) Shard {
+    std::atomic<uint64_t> value{0};
+  };
+
+  std::array<Shard, kShardNum> shards_;
+};
+
+/// @brief Read-only copy of a `LatencyHistogram`.
+struct HistogramSnapshot {
+  // Log-linear buckets: 8 sub-buckets per power of two, so a bucket is at most 12.5% wide
+  static constexpr uint32_t kSubBucketBits = 3;
+  static constexpr uint32_t kSubBucketNum = 1 << kSubBucketBits;
+  static constexpr uint32_t kBucketNum = (64 - kSubBucketBits + 1) * kSubBucketNum;
+
+  std::array<uint64_t, kBucketNum> buckets{};
+  uint64_t count{0};
+  uint64_t sum{0};
+  uint64_t max{0};
+
+  /// @brief Value at `percentile` (0-100), the upper bound of its bucket. Zero if empty.
+  uint64_t Percentile(double percentile) const;
+
+  uint64_t Mean() const { return count > 0 ? sum / count : 0; }
+
+  /// @brief Removes the values of an earlier snapshot of the same histogram, leaving those recorded in between.
+  /// `max` keeps the maximum of all values.
+  void Subtract(const HistogramSnapshot& earlier);
+
+  static uint32_t BucketIndex(uint64_t value);
+
+  /// @brief Largest value falling into `index`.
+  static uint64_t BucketUpperBound(uint32_t index);
+};
+
+/// @brief HDR-style latency histogram with bounded relative error over the whole uint64_t range.
+/// @note Recording is lock-free. It is not sharded, so it is meant for sampled or infrequent values.
+class LatencyHistogram {
+ public:
+  void Record(uint64_t value);
+
+  void Snapshot(HistogramSnapshot* snapshot) const;
+
+ private:
+  std::array<std::atomic<uint64_t>, HistogramSnapshot::kBucketNum> buckets_{};
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> sum_{0};
+  std::atomic<uint64_t> max_{0};
+};
+
+/// @brief Aggregated select metrics of one callee.
+struct CalleeMetricsSnapshot {
+  std::string name;
+  // Select calls, and SelectBatch / SelectBatchShared calls
+  uint64_t selects{0};
+  uint64_t batch_selects{0};
+  // Selects which found no endpoint snapshot and had to wait for a lookup, or the negative cache
+  uint64_t cache_misses{0};
+  // Selects which returned an error
+  uint64_t failures{0};
+  // Select latency in nanoseconds, sampled
+  HistogramSnapshot select_latency_ns;
+  // Wait of the selects which missed the cache, in microseconds
+  HistogramSnapshot cold_lookup_latency_us;
+  // Age of the served endpoints, -1 if there are none
+  int64_t snapshot_age_ms{-1};
+};
+
+/// @brief Select-path instrumentation of one callee.
+class CalleeSelectMetrics {
+ public:
+  // One select in this many per thread has its latency recorded
+  static constexpr uint32_t kLatencySampleRate = 64;
+
+  /// @brief Returns true if the caller should time this select and pass the latency to `RecordSelectLatency`.
+  static bool SampleLatency();
+
+  void RecordSelect(bool batch) { (batch ? batch_selects_ : selects_).Add(); }
+
+  /// @brief Adds selects which were counted elsewhere, like on the snapshot replicas.
+  void RecordSelects(uint64_t count) { selects_.Add(count); }
+
+  void RecordCacheMiss(uint64_t wait_us) {
+    cache_misses_.Add();
+    cold_lookup_latency_us_.Record(wait_us);
+  }
+
+  void RecordFailure() { failures_.Add(); }
+
+  void RecordSelectLatency(uint64_t latency_ns) { select_latency_ns_.Record(latency_ns); }
+
+  /// @brief Sums up the shards into `snapshot`, the name and snapshot age are left to the caller.
+  void Snapshot(CalleeMetricsSnapshot* snapshot) const;
+
+ private:
+  ShardedCounter selects_;
+  ShardedCounter batch_selects_;
+  ShardedCounter cache_misses_;
+  ShardedCounter failures_;
+  LatencyHistogram select_latency_ns_;
+  LatencyHistogram cold_lookup_latency_us_;
+};
+
+}  // namespace trpc::consul
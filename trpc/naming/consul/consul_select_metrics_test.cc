@@ -0,0 +1,113 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#include "trpc/naming/consul/consul_select_metrics.h"
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace trpc::consul {
+
+TEST(ShardedCounterTest, concurrent_add_test) {
+  ShardedCounter counter;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 8; ++i) {
+    threads.emplace_back([&counter]() {
+      for (int j = 0; j < 10000; ++j) {
+        counter.Add();
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(80000, counter.Value());
+  EXPECT_LT(ShardedCounter::ShardIndex(), ShardedCounter::kShardNum);
+}
+
+TEST(LatencyHistogramTest, bucket_test) {
+  // Small values are exact, every value falls into a bucket whose bounds enclose it
+  for (uint64_t value = 0; value < 16; ++value) {
+    EXPECT_EQ(value, HistogramSnapshot::BucketUpperBound(HistogramSnapshot::BucketIndex(value)));
+  }
+  for (uint64_t value : std::vector<uint64_t>{17, 1000, 123456789, 1ULL << 40, UINT64_MAX}) {
+    uint32_t index = HistogramSnapshot::BucketIndex(value);
+    ASSERT_LT(index, HistogramSnapshot::kBucketNum);
+    uint64_t upper = HistogramSnapshot::BucketUpperBound(index);
+    EXPECT_GE(upper, value);
+    EXPECT_LE(upper - value, value / HistogramSnapshot::kSubBucketNum);
+    EXPECT_LT(HistogramSnapshot::BucketUpperBound(index - 1), value);
+  }
+}
+
+TEST(LatencyHistogramTest, percentile_test) {
+  auto histogram = std::make_unique<LatencyHistogram>();
+  HistogramSnapshot empty;
+  histogram->Snapshot(&empty);
+  EXPECT_EQ(0, empty.Percentile(99));
+
+  for (uint64_t value = 1; value <= 1000; ++value) {
+    histogram->Record(value * 1000);
+  }
+  auto snapshot = std::make_unique<HistogramSnapshot>();
+  histogram->Snapshot(snapshot.get());
+  EXPECT_EQ(1000, snapshot->count);
+  EXPECT_EQ(1000000, snapshot->max);
+  EXPECT_EQ(500500, snapshot->Mean());
+  // Within the bucket width of the exact value
+  EXPECT_GE(snapshot->Percentile(50), 500000);
+  EXPECT_LE(snapshot->Percentile(50), 500000 * 9 / 8);
+  EXPECT_GE(snapshot->Percentile(99), 990000);
+  EXPECT_LE(snapshot->Percentile(99), 1000000);
+  EXPECT_EQ(1000000, snapshot->Percentile(100));
+
+  // Only the values recorded after the earlier snapshot remain
+  for (int i = 0; i < 10; ++i) {
+    histogram->Record(5);
+  }
+  auto later = std::make_unique<HistogramSnapshot>();
+  histogram->Snapshot(later.get());
+  later->Subtract(*snapshot);
+  EXPECT_EQ(10, later->count);
+  EXPECT_EQ(5, later->Percentile(99));
+}
+
+TEST(CalleeSelectMetricsTest, snapshot_test) {
+  auto metrics = std::make_unique<CalleeSelectMetrics>();
+  metrics->RecordSelect(false);
+  metrics->RecordSelect(false);
+  metrics->RecordSelect(true);
+  metrics->RecordCacheMiss(1500);
+  metrics->RecordFailure();
+  metrics->RecordSelectLatency(80);
+
+  auto snapshot = std::make_unique<CalleeMetricsSnapshot>();
+  metrics->Snapshot(snapshot.get());
+  EXPECT_EQ(2, snapshot->selects);
+  EXPECT_EQ(1, snapshot->batch_selects);
+  EXPECT_EQ(1, snapshot->cache_misses);
+  EXPECT_EQ(1, snapshot->failures);
+  EXPECT_EQ(1500, snapshot->cold_lookup_latency_us.max);
+  EXPECT_EQ(1, snapshot->select_latency_ns.count);
+
+  int sampled = 0;
+  for (uint32_t i = 0; i < CalleeSelectMetrics::kLatencySampleRate * 4; ++i) {
+    sampled += CalleeSelectMetrics::SampleLatency();
+  }
+  EXPECT_EQ(4, sampled);
+}
+
+}  // namespace trpc::consul
@@ -13,8 +13,14 @@
 
 #include "trpc/naming/consul/consul_selector.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <future>
 #include <map>
 #include <memory>
+#include <set>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -28,6 +34,8 @@
 #include "trpc/naming/load_balance_factory.h"
 #include "trpc/naming/common/util/loadbalance/polling/polling_load_balance.h"
 #include "trpc/naming/consul/config/consul_naming_conf.h"
+#include "trpc/naming/consul/consul_probes.h"
+#include "trpc/metrics/trpc_metrics_report.h"
 #include "trpc/runtime/common/periphery_task_scheduler.h"
 #include "trpc/util/time.h"
 #include "trpc/util/log/logging.h"
@@ -35,12 +43,72 @@
 
 namespace trpc {
 
-int ConsulSelector::Init() noexcept {
-  // Update the cache every 10 seconds
-  dn_update_interval_ = 10 * 1000;
+namespace {
 
-  task_id_ = 0;
+// Threads running the cold lookups of callers which gave up waiting
+constexpr size_t kColdLookupThreadNum = 2;
+
+// Followers of the shared cache check for a new table of their callees this often
+constexpr uint64_t kSharedCachePollMs = 1000;
+
+// Poll step of a cold lookup waiting for the leader of the shared cache
+constexpr uint64_t kSharedCacheWaitStepMs = 5;
+
+// Resolution of the callee access stamps
+constexpr uint64_t kAccessEpochMs = 1000;
+
+// Picks of a ramping endpoint skipped at most per select, bounds the extra loadbalance work while endpoints ramp
+constexpr uint32_t kSlowStartMaxSkips = 3;
+
+// Access epoch of `now_ms`, never zero
+uint32_t AccessEpoch(uint64_t now_ms) { return static_cast<uint32_t>(now_ms / kAccessEpochMs) + 1; }
+
+// Parses "host:port" or "[ipv6]:port"
+bool ParseHostPort(const std::string& address, std::string* host, int* port) {
+  size_t colon = address.rfind(':');
+  if (colon == std::string::npos || colon == 0 || colon + 1 == address.size()) {
+    return false;
+  }
+  *host = address.substr(0, colon);
+  if (host->size() > 2 && host->front() == '[' && host->back() == ']') {
+    *host = host->substr(1, host->size() - 2);
+  }
+  char* end = nullptr;
+  long value = std::strtol(address.c_str() + colon + 1, &end, 10);
+  if (*end != '\0' || value <= 0 || value > 65535) {
+    return false;
+  }
+  *port = static_cast<int>(value);
+  return true;
+}
+
+void ReportMetric(const std::string& plugin, const std::string& name, const std::string& dimension,
+                  MetricsPolicy policy, double value) {
+  TrpcSingleAttrMetricsInfo info;
+  info.plugin_name = plugin;
+  info.single_attr_info.name = name;
+  info.single_attr_info.dimension = dimension;
+  info.single_attr_info.policy = policy;
+  info.single_attr_info.value = value;
+  metrics::SingleAttrReport(std::move(info));
+}
+
+// p99 of the values recorded into `current` since `last`
+double IntervalP99(consul::HistogramSnapshot current, const consul::HistogramSnapshot& last) {
+  current.Subtract(last);
+  return static_cast<double>(current.Percentile(99));
+}
+
+}  // namespace
 
+ConsulSelector::~ConsulSelector() {
+  if (warmup_thread_.joinable()) {
+    warmup_thread_.join();
+  }
+  StopColdLookup();
+}
+
+int ConsulSelector::Init() noexcept {
   trpc::naming::ConsulConfig config;
   if (!trpc::TrpcConfig::GetInstance()->GetPluginConfig<trpc::naming::ConsulConfig>(
         "selector", "consul", config)) {
@@ -48,15 +116,89 @@ int ConsulSelector::Init() noexcept {
     return -1;
   }
   config.Display();
-  consul_config_ = std::any_cast<trpc::naming::ConsulConfig>(config);
+  return Init(config);
+}
+
+int ConsulSelector::Init(const naming::ConsulConfig& config,
+                         consul::ConsulTransportFactory transport_factory) noexcept {
+  // Update the cache every 10 seconds
+  dn_update_interval_ = 10 * 1000;
+
+  task_id_ = 0;
+
+  consul_config_ = config;
 
   default_load_balance_ = MakeRefCounted<PollingLoadBalance>();
 
-  return curl_http_.Init();
+  access_epoch_.store(AccessEpoch(trpc::time::GetMilliSeconds()), std::memory_order_relaxed);
+
+  flap_damping_.half_life_ms = consul_config_.flap_half_life_;
+  flap_damping_.suppress_threshold = consul_config_.flap_suppress_threshold_;
+  flap_damping_.reuse_threshold = consul_config_.flap_reuse_threshold_;
+  flap_damping_.min_up_ms = consul_config_.min_up_dwell_;
+  flap_damping_.min_down_ms = consul_config_.min_down_dwell_;
+
+  consul::ConsulTrafficShaper::GetInstance()->Init(consul_config_.rate_limit_, consul_config_.rate_burst_,
+                                                    consul_config_.rate_limit_configured_);
+
+  if (consul_config_.shm_cache_enable_) {
+    if (shm_cache_.Init(consul_config_.shm_cache_path_, consul_config_.shm_cache_slots_,
+                        consul_config_.shm_cache_slot_endpoints_) == 0) {
+      TRPC_LOG_INFO("consul selector shares endpoints through " << consul_config_.shm_cache_path_
+                    << ", leader:" << shm_cache_.IsLeader());
+    } else {
+      TRPC_LOG_ERROR("shared endpoint cache unavailable, this process looks its callees up in Consul itself");
+    }
+  }
+
+  if (consul_config_.replicate_snapshot_) {
+    replicas_.Init(consul_config_.snapshot_replica_num_);
+    TRPC_LOG_INFO("consul selector replicates endpoint snapshots, replica num:" << replicas_.Size());
+  }
+
+  for (const auto& [name, addresses] : consul_config_.static_endpoints_) {
+    consul::ConsulEndpointTable& table = static_tables_[name];
+    for (const auto& address : addresses) {
+      std::string host;
+      int port = 0;
+      if (!ParseHostPort(address, &host, &port) || !table.Add(host, port, 0, &host_interner_)) {
+        TRPC_LOG_ERROR("invalid static endpoint " << address << " of " << name);
+      }
+    }
+    if (table.Empty()) {
+      static_tables_.erase(name);
+    }
+  }
+
+  if (cold_lookup_threads_.empty()) {
+    cold_lookup_stopped_ = false;
+    for (size_t i = 0; i < kColdLookupThreadNum; ++i) {
+      cold_lookup_threads_.emplace_back([this]() { ColdLookupLoop(); });
+    }
+  }
+
+  consul::ConsulQueryOptions query_options;
+  query_options.http = consul::MakeConsulHttpOptions(consul_config_);
+  query_options.consistency = consul::ParseConsulConsistency(consul_config_.consistency_mode_);
+  query_options.max_stale_ms = consul_config_.max_stale_;
+  query_options.cache_max_age_s = consul_config_.cache_max_age_;
+  refresh_workers_.SetQueryOptions(query_options);
+  refresh_workers_.SetTransportFactory(transport_factory != nullptr
+                                           ? std::move(transport_factory)
+                                           : consul::MakeConsulTransportFactory(consul_config_.transport_));
+
+  // Create the first refresh worker up front, so that the first select does not pay for it
+  return refresh_workers_.Acquire() != nullptr ? 0 : -1;
 }
 
 void ConsulSelector::Destroy() noexcept {
-    curl_http_.Destroy();
+    if (warmup_thread_.joinable()) {
+      warmup_thread_.join();
+    }
+    StopColdLookup();
+    // Gives up the leadership of the shared cache, another process takes over at its next periodic task
+    shm_cache_.Close();
+    refresh_workers_.Destroy();
     return;
 }
 
@@ -66,10 +208,54 @@ int ConsulSelector::Select(const SelectorInfo* info, TrpcEndpointInfo* endpoint)
     return -1;
   }
 
-  if (!InitEndpointInfo(info)) {
+  TRPC_CONSUL_PROBE1(select_entry, info->name.c_str());
+  // Only every few selects are timed, reading the clock twice would cost more than the counters
+  bool timed = consul::CalleeSelectMetrics::SampleLatency();
+  auto begin_time = timed ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+  // Replicated mode serves the default loadbalance from the replica of the calling thread. The select is counted on
+  // the copy of the replica and merged into the metrics of the callee by `GetSelectMetrics`.
+  bool replica_select = consul_config_.replicate_snapshot_ && info->load_balance_name.empty();
+  if (replica_select && SelectFromReplica(info->name, endpoint, CurrentAccessEpoch(), true)) {
+    replica_selects_.Add();
+    if (timed) {
+      auto latency = std::chrono::steady_clock::now() - begin_time;
+      CalleeEntryPtr entry = FindCallee(info->name);
+      if (entry != nullptr) {
+        entry->metrics.RecordSelectLatency(std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count());
+      }
+    }
+    TRPC_CONSUL_PROBE2(select_return, info->name.c_str(), 0);
+    return 0;
+  }
+
+  CalleeEntryPtr entry;
+  int ret = SelectEndpoint(info, endpoint, replica_select, &entry);
+  entry->metrics.RecordSelect(false);
+  if (ret != 0) {
+    entry->metrics.RecordFailure();
+  }
+  if (timed) {
+    auto latency = std::chrono::steady_clock::now() - begin_time;
+    entry->metrics.RecordSelectLatency(std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count());
+  }
+  TRPC_CONSUL_PROBE2(select_return, info->name.c_str(), ret);
+  return ret;
+}
+
+int ConsulSelector::SelectEndpoint(const SelectorInfo* info, TrpcEndpointInfo* endpoint, bool replica_select,
+                                   CalleeEntryPtr* entry) {
+  if (!InitEndpointInfo(info, entry)) {
     return -1;
   }
 
+  if (replica_select) {
+    if (!SelectFromReplica(info->name, endpoint, 0, false)) {
+      TRPC_LOG_ERROR("Do load balance of " << info->name << " failed");
+      return -1;
+    }
+    return 0;
+  }
+
   LoadBalanceResult load_balance_result;
   load_balance_result.info = info;
   auto lb = GetLoadBalance(info->load_balance_name);
@@ -77,12 +263,33 @@ int ConsulSelector::Select(const SelectorInfo* info, TrpcEndpointInfo* endpoint)
     TRPC_LOG_ERROR("get loadbalance err");
     return -1;
   }
-  if (lb->Next(load_balance_result)) {
-    TRPC_LOG_ERROR("Do load balance of " << info->name << " failed");
-    return -1;
+  // The polling loadbalance ignores the weights, the slow-start ramp is applied by skipping some of its picks.
+  // Other loadbalances are expected to use the weights themselves.
+  bool thin_picks = consul_config_.slow_start_window_ > 0 && lb == default_load_balance_.get();
+  for (uint32_t attempt = 0;; ++attempt) {
+    if (lb->Next(load_balance_result)) {
+      TRPC_LOG_ERROR("Do load balance of " << info->name << " failed");
+      return -1;
+    }
+    *endpoint = std::any_cast<TrpcEndpointInfo>(load_balance_result.result);
+    if (!thin_picks || attempt == kSlowStartMaxSkips || consul::AcceptSlowStartPick(*endpoint)) {
+      return 0;
+    }
+  }
+}
+
+bool ConsulSelector::SelectFromReplica(const std::string& name, TrpcEndpointInfo* endpoint, uint32_t access_epoch,
+                                       bool count) {
+  for (uint32_t attempt = 0;; ++attempt) {
+    // The picks skipped by the slow-start ramp are part of the same select
+    if (!replicas_.SelectOne(name, endpoint, access_epoch, count && attempt == 0)) {
+      return false;
+    }
+    if (consul_config_.slow_start_window_ == 0 || attempt == kSlowStartMaxSkips ||
+        consul::AcceptSlowStartPick(*endpoint)) {
+      return true;
+    }
   }
-  *endpoint = std::any_cast<TrpcEndpointInfo>(load_balance_result.result);
-  return 0;
 }
 
 Future<TrpcEndpointInfo> ConsulSelector::AsyncSelect(const SelectorInfo* info) {
@@ -104,21 +311,19 @@ int ConsulSelector::SelectBatch(const SelectorInfo* info, std::vector<TrpcEndpoi
     return -1;
   }
 
-  if (!InitEndpointInfo(info)) {
-    return -1;
-  }
-
-  std::string callee = info->name;
-  std::shared_lock<std::shared_mutex> lock(mutex_);
-  auto iter = targets_map_.find(callee);
-  if (iter == targets_map_.end()) {
-    TRPC_LOG_ERROR("router info of " << callee << " no found");
+  CalleeEntryPtr entry;
+  bool ready = InitEndpointInfo(info, &entry);
+  entry->metrics.RecordSelect(true);
+  ConsulEndpointListPtr endpoint_list = ready ? GetEndpointList(info->name) : nullptr;
+  if (endpoint_list == nullptr) {
+    TRPC_LOG_ERROR("router info of " << info->name << " no found");
+    entry->metrics.RecordFailure();
     return -1;
   }
   if (info->policy == SelectorPolicy::MULTIPLE) {
-    SelectMultiple(iter->second.endpoints, endpoints, info->select_num);
+    SelectMultiple(*endpoint_list, endpoints, info->select_num);
   } else {
-    *endpoints = iter->second.endpoints;
+    *endpoints = *endpoint_list;
   }
   return 0;
 }
@@ -136,171 +341,938 @@ Future<std::vector<TrpcEndpointInfo>> ConsulSelector::AsyncSelectBatch(const Sel
   return MakeReadyFuture<std::vector<TrpcEndpointInfo>>(std::move(endpoints));
 }
 
-int ConsulSelector::ReportInvokeResult(const InvokeResult* result) {
-    if (nullptr == result) {
-    TRPC_LOG_ERROR("Invalid parameter: invoke result is empty");
+int ConsulSelector::SelectBatchShared(const SelectorInfo* info, ConsulEndpointListPtr* endpoints) {
+  if (nullptr == info || nullptr == endpoints) {
+    TRPC_LOG_ERROR("Invalid parameter");
+    return -1;
+  }
+
+  CalleeEntryPtr entry;
+  bool ready = InitEndpointInfo(info, &entry);
+  entry->metrics.RecordSelect(true);
+  *endpoints = ready ? GetEndpointList(info->name) : nullptr;
+  if (*endpoints == nullptr) {
+    TRPC_LOG_ERROR("router info of " << info->name << " no found");
+    entry->metrics.RecordFailure();
     return -1;
   }
   return 0;
 }
 
-bool ConsulSelector::ParseResponse(const rapidjson::Document& resp_body, const std::string& service_name,
-                                   std::vector<TrpcEndpointInfo>& endpoints) {
-  const auto& nodes = resp_body.GetArray();
-  for (auto it = nodes.Begin(); it != nodes.End(); ++it) {
-    auto node = it->GetObject();
-    if (!node.HasMember("Service") || !node["Service"].IsObject()) {
-      TRPC_LOG_ERROR("Service not exist or is not object");
-      return false;
-    }
-    if (!node["Service"].HasMember("Address") || !node["Service"]["Address"].IsString() ||
-        !node["Service"].HasMember("Port") || !node["Service"]["Port"].IsInt()) {
-          TRPC_LOG_ERROR("Address or Port fmt err");
-          return false;
-    }
-    // Get IP:Port
-    TrpcEndpointInfo endpoint;
-    endpoint.host = node["Service"]["Address"].GetString();
-    endpoint.port = node["Service"]["Port"].GetInt();
-    endpoint.is_ipv6 = (endpoint.host.find(':') != std::string::npos);
-    // Get health status
-    if (!node.HasMember("Checks") || !node["Checks"].IsArray()) {
-      TRPC_LOG_ERROR("Checks not exist or is not Array");
-      return false;
-    }
-    const auto& checks = node["Checks"].GetArray();
-    for (auto it = checks.Begin(); it != checks.End(); ++it) {
-        auto check = it->GetObject();
-        if (!check.HasMember("Name") || !check["Name"].IsString() ||
-           !check.HasMember("Status") || !check["Status"].IsString()) {
-          continue;
-        }
-        std::string checkName = check["Name"].GetString();
-        if (checkName != service_name) {  // Skip the check information of the agent itself.
-          continue;
-        }
-        const std::string& status = check["Status"].GetString();
-        // If the node's health status is abnormal, assign a value of -1 to the status.
-        endpoint.status = (status == "passing") ? 0 : -1;
-    }
+Future<ConsulEndpointListPtr> ConsulSelector::AsyncSelectBatchShared(const SelectorInfo* info) {
+  ConsulEndpointListPtr endpoints;
+  int ret = SelectBatchShared(info, &endpoints);
+  if (ret != 0) {
+    return MakeExceptionFuture<ConsulEndpointListPtr>(CommonException("AsyncSelectBatchShared error"));
+  }
+  return MakeReadyFuture<ConsulEndpointListPtr>(std::move(endpoints));
+}
 
-    TRPC_LOG_DEBUG("host:" << endpoint.host << ",port:" << endpoint.port);
-    TRPC_LOG_DEBUG("is_ipv6:" << endpoint.is_ipv6 << ",status:" << endpoint.status);
-    endpoints.emplace_back(endpoint);
+ConsulEndpointListPtr ConsulSelector::GetEndpointList(const std::string& name) {
+  if (consul_config_.replicate_snapshot_) {
+    return replicas_.Get(name);
   }
 
-  if (endpoints.size() > 0) {
-    return true;
+  CalleeEntryPtr entry = FindCallee(name);
+  if (entry == nullptr) {
+    return nullptr;
+  }
+  EndpointSnapshotPtr snapshot = std::atomic_load(&entry->snapshot);
+  if (snapshot == nullptr) {
+    return nullptr;
+  }
+  if (snapshot->endpoints != nullptr) {
+    return snapshot->endpoints;
   }
 
-  TRPC_LOG_ERROR("Response body contains no endpoints");
-  return false;
+  // First batch selection of the callee: later refreshes materialize the list when publishing. The current snapshot
+  // is replaced by one sharing its table, unless a refresh published another snapshot meanwhile.
+  entry->batch_selected.store(true, std::memory_order_relaxed);
+  auto endpoints = std::make_shared<std::vector<TrpcEndpointInfo>>();
+  snapshot->table->Materialize(host_interner_, endpoints.get());
+  auto materialized = std::make_shared<EndpointSnapshot>();
+  materialized->table = snapshot->table;
+  // A running slow-start ramp stays with the snapshot, so that the periodic task keeps advancing it
+  materialized->ramp = snapshot->ramp;
+  if (snapshot->ramp != nullptr) {
+    snapshot->ramp->ApplyWeights(trpc::time::GetMilliSeconds(), endpoints.get());
+  }
+  materialized->endpoints = endpoints;
+  std::atomic_compare_exchange_strong(&entry->snapshot, &snapshot, EndpointSnapshotPtr(std::move(materialized)));
+  return endpoints;
 }
 
-int ConsulSelector::RefreshEndpointInfoByName(const SelectorInfo* info, DomainEndpointInfo& endpointInfo) {
-  std::string deregister_path = "http://" + consul_config_.address_ + "/v1/health/service/" + info->name;
-  trpc::curl_http::CurlHttpResponsePtr response = curl_http_.Get(deregister_path);
-  if (response->response_code != trpc::curl_http::kHttpStatusCode200) {
-    TRPC_LOG_ERROR("consul resp errcode:" << response->response_code);
-    return -1;
+ConsulSelector::CalleeEntryPtr ConsulSelector::FindCallee(const std::string& name) const {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  auto iter = targets_map_.find(name);
+  return iter != targets_map_.end() ? iter->second : nullptr;
+}
+
+ConsulSelector::CalleeEntryPtr ConsulSelector::GetOrCreateCallee(const std::string& name) {
+  CalleeEntryPtr entry = FindCallee(name);
+  if (entry != nullptr) {
+    return entry;
   }
-  rapidjson::Document resp_body;
-  if (resp_body.Parse(response->body.c_str()).HasParseError()) {
-    TRPC_LOG_ERROR("parse response body err");
-    return -1;
+  std::unique_lock<std::shared_mutex> uniq_lock(mutex_);
+  CalleeEntryPtr& slot = targets_map_[name];
+  if (slot == nullptr) {
+    slot = std::make_shared<CalleeEntry>();
+    slot->domain_name = name;
+    slot->access_epoch.store(CurrentAccessEpoch(), std::memory_order_relaxed);
   }
-  if (!resp_body.IsArray()) {
-    TRPC_LOG_ERROR("resp body is not array");
-    return -1;
+  return slot;
+}
+
+uint32_t ConsulSelector::LastAccessEpoch(const CalleeEntry& entry) const {
+  uint32_t last = entry.access_epoch.load(std::memory_order_relaxed);
+  if (consul_config_.replicate_snapshot_) {
+    last = std::max(last, replicas_.LastAccessEpoch(entry.domain_name));
   }
+  return last;
+}
 
-  std::vector<TrpcEndpointInfo> endpoints;
-  if (ParseResponse(resp_body, info->name, endpoints)) {
-    endpointInfo.domain_name = info->name;
-    endpointInfo.endpoints.swap(endpoints);
+size_t ConsulSelector::EvictCallees(uint64_t now) {
+  uint32_t epoch = AccessEpoch(now);
+  if (epoch > CurrentAccessEpoch()) {
+    access_epoch_.store(epoch, std::memory_order_relaxed);
+  }
+  uint32_t idle_ttl = consul_config_.idle_ttl_;
+  uint32_t max_callees = consul_config_.max_callees_;
+  if (idle_ttl == 0 && max_callees == 0) {
+    return 0;
+  }
+  std::vector<CalleeEntryPtr> entries;
+  {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    if (idle_ttl == 0 && targets_map_.size() <= max_callees) {
+      return 0;
+    }
+    entries.reserve(targets_map_.size());
+    for (const auto& item : targets_map_) {
+      entries.push_back(item.second);
+    }
+  }
+
+  // Stamps are only compared at epoch resolution, a callee is idle once a whole ttl passed since its last epoch
+  uint32_t idle_epochs = static_cast<uint32_t>((idle_ttl + kAccessEpochMs - 1) / kAccessEpochMs);
+  std::vector<CalleeEntryPtr> evicted;
+  std::vector<std::pair<uint32_t, CalleeEntryPtr>> kept;
+  kept.reserve(entries.size());
+  for (auto& entry : entries) {
+    uint32_t last = LastAccessEpoch(*entry);
+    if (idle_ttl > 0 && epoch > last + idle_epochs) {
+      evicted.push_back(std::move(entry));
+    } else {
+      kept.emplace_back(last, std::move(entry));
+    }
+  }
+  if (max_callees > 0 && kept.size() > max_callees) {
+    size_t excess = kept.size() - max_callees;
+    std::partial_sort(kept.begin(), kept.begin() + excess, kept.end(),
+                      [](const auto& a, const auto& b) { return a.first < b.first; });
+    for (size_t i = 0; i < excess && kept[i].first < epoch; ++i) {
+      evicted.push_back(std::move(kept[i].second));
+    }
+  }
+  if (evicted.empty()) {
     return 0;
   }
 
-  return -1;
+  for (const auto& entry : evicted) {
+    // From now on a lookup still running for the entry does not publish, see PublishTableLocked
+    std::lock_guard<std::mutex> refresh_lock(entry->refresh_mutex);
+    entry->evicted = true;
+    NotifyRemovedLocked(*entry, std::atomic_load(&entry->snapshot));
+  }
+  {
+    // A select creating the callee anew waits for the map lock, so it publishes after the old state was dropped
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    LoadBalanceInfo lb_info;
+    std::vector<TrpcEndpointInfo> no_endpoints;
+    lb_info.endpoints = &no_endpoints;
+    for (const auto& entry : evicted) {
+      auto iter = targets_map_.find(entry->domain_name);
+      if (iter == targets_map_.end() || iter->second != entry) {
+        continue;
+      }
+      targets_map_.erase(iter);
+      if (consul_config_.replicate_snapshot_) {
+        replicas_.Remove(entry->domain_name);
+      }
+      // The loadbalance has no removal, an empty list releases the endpoints it holds
+      SelectorInfo selector_info;
+      selector_info.name = entry->domain_name;
+      lb_info.info = &selector_info;
+      default_load_balance_->Update(&lb_info);
+    }
+  }
+  for (const auto& entry : evicted) {
+    reported_metrics_.erase(entry->domain_name);
+    reported_refresh_metrics_.erase(entry->domain_name);
+  }
+  evicted_callees_.fetch_add(evicted.size(), std::memory_order_relaxed);
+  TRPC_LOG_INFO("consul selector dropped " << evicted.size() << " idle callees, e.g. " << evicted[0]->domain_name);
+  return evicted.size();
+}
+
+int ConsulSelector::ReportInvokeResult(const InvokeResult* result) {
+    if (nullptr == result) {
+    TRPC_LOG_ERROR("Invalid parameter: invoke result is empty");
+    return -1;
+  }
+  return 0;
+}
+
+int ConsulSelector::RefreshEndpointInfoByName(const SelectorInfo* info, consul::ConsulRefreshWorker* worker) {
+  if (worker == nullptr) {
+    TRPC_LOG_ERROR("no refresh worker available");
+    return -1;
+  }
+  TRPC_CONSUL_PROBE1(refresh_start, info->name.c_str());
+  int ret = worker->Refresh(info->name, &host_interner_);
+  TRPC_CONSUL_PROBE2(refresh_end, info->name.c_str(), ret);
+  return ret;
 }
 
-int ConsulSelector::RefreshDomainInfo(const SelectorInfo* info, ConsulSelector::DomainEndpointInfo& dn_endpointInfo) {
-  if (nullptr == info) {
+int ConsulSelector::RefreshDomainInfo(const SelectorInfo* info, CalleeEntry* entry,
+                                      const consul::ConsulEndpointTable& table) {
+  if (nullptr == info || nullptr == entry) {
     TRPC_LOG_ERROR("Invalid parameter");
     return -1;
   }
-  std::unique_lock<std::shared_mutex> uniq_lock(mutex_);
-  auto iter = targets_map_.find(info->name);
-  if (iter != targets_map_.end()) {
-    dn_endpointInfo.id_generator = std::move(iter->second.id_generator);
+  // Everything but the final pointer swap happens under the callee's own refresh mutex, selects are not blocked
+  TRPC_CONSUL_PROBE1(publish_lock_wait, info->name.c_str());
+  std::lock_guard<std::mutex> refresh_lock(entry->refresh_mutex);
+  TRPC_CONSUL_PROBE1(publish_lock_acquire, info->name.c_str());
+  int ret = PublishTableLocked(info, entry, table);
+  TRPC_CONSUL_PROBE2(publish_lock_release, info->name.c_str(), ret);
+  return ret;
+}
+
+int ConsulSelector::PublishTableLocked(const SelectorInfo* info, CalleeEntry* entry,
+                                       const consul::ConsulEndpointTable& reported_table) {
+  if (entry->evicted) {
+    // Dropped by EvictCallees meanwhile, a new entry of the callee publishes for itself
+    return 0;
+  }
+  uint64_t now = trpc::time::GetMilliSeconds();
+  // Status changes of flapping endpoints are held back here, so that the refreshes reporting them find the table
+  // unchanged below. The damped copy is only made if a status is held back.
+  consul::ConsulEndpointTable damped_table;
+  const consul::ConsulEndpointTable* damped = &reported_table;
+  if (flap_damping_.Enabled()) {
+    uint64_t held = entry->flap_damper.HeldChanges();
+    damped = &entry->flap_damper.Apply(reported_table, flap_damping_, now, &damped_table);
+    damped_status_changes_.fetch_add(entry->flap_damper.HeldChanges() - held, std::memory_order_relaxed);
+  }
+  const consul::ConsulEndpointTable& table = *damped;
+  EndpointSnapshotPtr current = std::atomic_load(&entry->snapshot);
+  if (current != nullptr && current->table->Equals(table)) {
+    // Nothing changed, keep the published snapshot and loadbalance state without allocating
+    return 0;
+  }
+  // The worker keeps its table for the next refresh, only a changed table is copied out
+  std::shared_ptr<consul::ConsulEndpointTable> new_table;
+  SubscriptionListPtr subscriptions;
+  consul::EndpointChangeIndexes change_indexes;
+  std::shared_ptr<const consul::SlowStartRamp> ramp;
+  {
+    consul::RefreshStageTimer timer(consul::RefreshStage::kAssignIds);
+    new_table = std::make_shared<consul::ConsulEndpointTable>(table);
+    new_table->AssignIds(&entry->id_generator);
+    // The positions of the changes are only collected if someone uses them. The endpoints of the first table are
+    // not ramped, they are not new to the callee but to the caller.
+    subscriptions = GetSubscriptions(info->name);
+    bool slow_start = consul_config_.slow_start_window_ > 0 && current != nullptr;
+    // Bound by reference, a conditional with a temporary would copy the whole previous table
+    static const consul::ConsulEndpointTable kEmptyTable;
+    const consul::ConsulEndpointTable& previous = current != nullptr ? *current->table : kEmptyTable;
+    consul::EndpointChurn churn =
+        new_table->Diff(previous, subscriptions != nullptr || slow_start ? &change_indexes : nullptr);
+    if (slow_start) {
+      ramp = consul::SlowStartRamp::Build(*new_table, change_indexes, current->ramp.get(),
+                                          consul_config_.slow_start_window_, consul_config_.slow_start_min_weight_,
+                                          now);
+    }
+    entry->refresh_metrics.RecordChange(churn);
+    TRPC_LOG_DEBUG("endpoints of " << info->name << " changed, size:" << new_table->Size() << ", added:"
+                   << churn.added << ", removed:" << churn.removed << ", status changed:" << churn.status_changed);
+  }
+
+  PublishSnapshotLocked(info, entry, new_table, std::move(ramp), now);
+
+  if (subscriptions != nullptr && !change_indexes.Empty()) {
+    consul::EndpointChangeEvent event;
+    event.name = info->name;
+    auto materialize = [this](const consul::ConsulEndpointTable& from, const std::vector<uint32_t>& indexes,
+                              std::vector<TrpcEndpointInfo>* to) {
+      to->resize(indexes.size());
+      for (size_t i = 0; i < indexes.size(); ++i) {
+        from.MaterializeOne(host_interner_, indexes[i], &(*to)[i]);
+      }
+    };
+    materialize(*new_table, change_indexes.added, &event.added);
+    materialize(*new_table, change_indexes.status_changed, &event.updated);
+    if (current != nullptr) {
+      materialize(*current->table, change_indexes.removed, &event.removed);
+    }
+    NotifyEndpointChanges(subscriptions, event);
   }
-  for (auto& item : dn_endpointInfo.endpoints) {
-    std::string endpoint = item.host + ":" + std::to_string(item.port);
-    item.id = dn_endpointInfo.id_generator.GetEndpointId(endpoint);
+  return 0;
+}
+
+void ConsulSelector::PublishSnapshotLocked(const SelectorInfo* info, CalleeEntry* entry,
+                                           std::shared_ptr<const consul::ConsulEndpointTable> table,
+                                           std::shared_ptr<const consul::SlowStartRamp> ramp, uint64_t now) {
+  // TrpcEndpointInfo is only materialized for the loadbalance, and kept if the callee is used for batch selection
+  auto endpoints = std::make_shared<std::vector<TrpcEndpointInfo>>();
+  {
+    consul::RefreshStageTimer timer(consul::RefreshStage::kPublish);
+    table->Materialize(host_interner_, endpoints.get());
+    if (ramp != nullptr) {
+      ramp->ApplyWeights(now, endpoints.get());
+    }
+    entry->ramp_step_ms.store(ramp != nullptr ? ramp->NextStepMs(now) : UINT64_MAX, std::memory_order_relaxed);
+
+    auto snapshot = std::make_shared<EndpointSnapshot>();
+    snapshot->table = std::move(table);
+    snapshot->ramp = std::move(ramp);
+    if (consul_config_.replicate_snapshot_ || entry->batch_selected.load(std::memory_order_relaxed)) {
+      snapshot->endpoints = endpoints;
+    }
+    // Publish, the previous snapshot stays valid for callers still holding it
+    std::atomic_store(&entry->snapshot, EndpointSnapshotPtr(std::move(snapshot)));
+    if (consul_config_.replicate_snapshot_) {
+      replicas_.Publish(info->name, endpoints);
+    }
   }
-  targets_map_[info->name] = dn_endpointInfo;
-  uniq_lock.unlock();
+
   // update loadbalance cache
+  consul::RefreshStageTimer timer(consul::RefreshStage::kLoadBalance);
   LoadBalanceInfo lb_info;
   lb_info.info = info;
-  lb_info.endpoints = &dn_endpointInfo.endpoints;
+  lb_info.endpoints = endpoints.get();
   default_load_balance_->Update(&lb_info);
-  return 0;
 }
 
-bool ConsulSelector::InitEndpointInfo(const SelectorInfo* info) {
-  // If this service is selected first time, and it does not exist in the cache, it needs to be retrieved from Consul.
-  bool queryed = false;
-  std::unique_lock<std::shared_mutex> uniq_lock(mutex_);
-  auto iter = targets_map_.find(info->name);
-  if (iter != targets_map_.end()) {
-    queryed = true;
-  }
-  uniq_lock.unlock();
-  if (!queryed) {
-    ConsulSelector::DomainEndpointInfo endpointInfo;
-    if (!RefreshEndpointInfoByName(info, endpointInfo)) {
-      int ret = RefreshDomainInfo(info, endpointInfo);
-      if (ret != 0) {
-        TRPC_LOG_ERROR("refresh domain info err:" << ret);
-        return false;
+void ConsulSelector::AdvanceSlowStart(CalleeEntry* entry, uint64_t now) {
+  std::lock_guard<std::mutex> refresh_lock(entry->refresh_mutex);
+  EndpointSnapshotPtr current = std::atomic_load(&entry->snapshot);
+  if (entry->evicted || current == nullptr || current->ramp == nullptr) {
+    entry->ramp_step_ms.store(UINT64_MAX, std::memory_order_relaxed);
+    return;
+  }
+  if (now < entry->ramp_step_ms.load(std::memory_order_relaxed)) {
+    // A refresh published meanwhile
+    return;
+  }
+  // Same endpoints with the weights of the next step, a finished ramp is dropped from the snapshot
+  SelectorInfo selector_info;
+  selector_info.name = entry->domain_name;
+  PublishSnapshotLocked(&selector_info, entry, current->table, current->ramp->Active(now) ? current->ramp : nullptr,
+                        now);
+}
+
+uint64_t ConsulSelector::SubscribeEndpointChanges(const std::string& name, consul::EndpointChangeListener listener) {
+  std::lock_guard<std::mutex> lock(subscription_mutex_);
+  SubscriptionListPtr current = std::atomic_load(&subscriptions_);
+  auto subscriptions = current != nullptr ? std::make_shared<std::vector<Subscription>>(*current)
+                                          : std::make_shared<std::vector<Subscription>>();
+  uint64_t id = next_subscription_id_++;
+  subscriptions->push_back(Subscription{id, name, std::move(listener)});
+  std::atomic_store(&subscriptions_, SubscriptionListPtr(std::move(subscriptions)));
+  return id;
+}
+
+void ConsulSelector::UnsubscribeEndpointChanges(uint64_t id) {
+  std::lock_guard<std::mutex> lock(subscription_mutex_);
+  SubscriptionListPtr current = std::atomic_load(&subscriptions_);
+  if (current == nullptr) {
+    return;
+  }
+  auto subscriptions = std::make_shared<std::vector<Subscription>>();
+  for (const auto& subscription : *current) {
+    if (subscription.id != id) {
+      subscriptions->push_back(subscription);
+    }
+  }
+  std::atomic_store(&subscriptions_, subscriptions->empty() ? SubscriptionListPtr()
+                                                            : SubscriptionListPtr(std::move(subscriptions)));
+}
+
+ConsulSelector::SubscriptionListPtr ConsulSelector::GetSubscriptions(const std::string& name) const {
+  SubscriptionListPtr subscriptions = std::atomic_load(&subscriptions_);
+  if (subscriptions == nullptr) {
+    return nullptr;
+  }
+  for (const auto& subscription : *subscriptions) {
+    if (subscription.name.empty() || subscription.name == name) {
+      return subscriptions;
+    }
+  }
+  return nullptr;
+}
+
+void ConsulSelector::NotifyEndpointChanges(const SubscriptionListPtr& subscriptions,
+                                           const consul::EndpointChangeEvent& event) {
+  for (const auto& subscription : *subscriptions) {
+    if (!subscription.name.empty() && subscription.name != event.name) {
+      continue;
+    }
+    try {
+      subscription.listener(event);
+    } catch (const std::exception& e) {
+      TRPC_LOG_ERROR("endpoint change listener of " << event.name << " failed: " << e.what());
+    }
+  }
+}
+
+void ConsulSelector::NotifyRemovedLocked(const CalleeEntry& entry, const EndpointSnapshotPtr& snapshot) {
+  if (snapshot == nullptr || snapshot->table->Size() == 0) {
+    return;
+  }
+  SubscriptionListPtr subscriptions = GetSubscriptions(entry.domain_name);
+  if (subscriptions == nullptr) {
+    return;
+  }
+  consul::EndpointChangeEvent event;
+  event.name = entry.domain_name;
+  snapshot->table->Materialize(host_interner_, &event.removed);
+  NotifyEndpointChanges(subscriptions, event);
+}
+
+bool ConsulSelector::LookupCallee(const SelectorInfo* info, CalleeEntry* entry, consul::ConsulRefreshWorker* worker,
+                                  uint64_t now) {
+  auto start = std::chrono::steady_clock::now();
+  bool found = DoLookupCallee(info, entry, worker, now);
+  auto duration = std::chrono::steady_clock::now() - start;
+  entry->refresh_metrics.RecordRefresh(found, std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+  return found;
+}
+
+bool ConsulSelector::DoLookupCallee(const SelectorInfo* info, CalleeEntry* entry, consul::ConsulRefreshWorker* worker,
+                                    uint64_t now) {
+  if (SharedCacheFollower()) {
+    bool found = false;
+    if (LookupSharedCallee(info, entry, now, &found)) {
+      return found;
+    }
+  }
+  if (RefreshEndpointInfoByName(info, worker) == 0 && RefreshDomainInfo(info, entry, worker->Table()) == 0) {
+    const consul::ConsulQueryMeta& meta = worker->Meta();
+    entry->last_contact_ms.store(meta.last_contact_ms, std::memory_order_relaxed);
+    entry->cache_hit.store(meta.cache_hit, std::memory_order_relaxed);
+    TRPC_LOG_DEBUG("lookup of " << info->name << " last contact:" << meta.last_contact_ms << "ms, cache hit:"
+                   << meta.cache_hit << ", cache age:" << meta.cache_age_s << "s, requeried:" << meta.requeried
+                   << ", stale:" << meta.stale);
+    entry->failure_count.store(0, std::memory_order_relaxed);
+    entry->refresh_time_ms.store(now, std::memory_order_relaxed);
+    // Randomized, so that the refreshes of processes started together do not stay aligned
+    uint64_t interval = consul::ConsulTrafficShaper::Jitter(dn_update_interval_, consul_config_.refresh_jitter_);
+    entry->next_refresh_ms.store(now + interval, std::memory_order_relaxed);
+    entry->negative_expire_ms.store(0, std::memory_order_relaxed);
+    if (shm_cache_.IsLeader()) {
+      shm_cache_.Write(info->name, worker->Table(), host_interner_, now);
+    }
+    return true;
+  }
+  // An unknown or empty service is not asked for again until the ttl expires. A callee with a snapshot keeps
+  // serving it, and is revalidated with exponential backoff starting at the ttl.
+  entry->negative_expire_ms.store(now + consul_config_.negative_cache_ttl_, std::memory_order_relaxed);
+  uint32_t failures = entry->failure_count.fetch_add(1, std::memory_order_relaxed) + 1;
+  if (shm_cache_.IsLeader() && std::atomic_load(&entry->snapshot) == nullptr) {
+    shm_cache_.WriteNotFound(info->name, now);
+  }
+  if (std::atomic_load(&entry->snapshot) != nullptr) {
+    uint64_t delay = consul::ConsulTrafficShaper::Backoff(failures, consul_config_.negative_cache_ttl_,
+                                                          consul_config_.max_backoff_);
+    entry->next_refresh_ms.store(now + delay, std::memory_order_relaxed);
+    consul::ConsulTrafficShaper::GetInstance()->RecordBackoff();
+  }
+  return false;
+}
+
+bool ConsulSelector::LookupSharedCallee(const SelectorInfo* info, CalleeEntry* entry, uint64_t now, bool* found) {
+  thread_local consul::ConsulEndpointTable table;
+  bool cold = std::atomic_load(&entry->snapshot) == nullptr;
+  uint64_t known_version = cold ? 0 : entry->shared_version.load(std::memory_order_relaxed);
+  uint64_t deadline = now + (consul_config_.cold_lookup_timeout_ > 0 ? consul_config_.cold_lookup_timeout_ : 1000);
+  // The leader revalidates every update interval, a table twice as old is not revalidated any more
+  uint64_t max_age = 2 * static_cast<uint64_t>(dn_update_interval_);
+  consul::ShmEndpointCache::ReadMeta meta;
+  consul::ShmEndpointCache::ReadResult result;
+  bool requested = false;
+  while (true) {
+    result = shm_cache_.Read(info->name, known_version, &table, &host_interner_, &meta);
+    if (result == consul::ShmEndpointCache::ReadResult::kOverflow) {
+      return false;
+    }
+    if (result == consul::ShmEndpointCache::ReadResult::kFound && meta.refresh_ms + max_age > now) {
+      break;
+    }
+    // Missing or outdated, the leader may not know the callee (any more)
+    if (!requested) {
+      requested = shm_cache_.Request(info->name);
+    }
+    if (result != consul::ShmEndpointCache::ReadResult::kMiss || !cold || now >= deadline) {
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(kSharedCacheWaitStepMs));
+    now = trpc::time::GetMilliSeconds();
+  }
+
+  *found = false;
+  if (result == consul::ShmEndpointCache::ReadResult::kFound) {
+    if ((cold || meta.version != known_version) && RefreshDomainInfo(info, entry, table) != 0) {
+      return true;
+    }
+    entry->shared_version.store(meta.version, std::memory_order_relaxed);
+    // Staleness is measured from the lookup of the leader
+    entry->refresh_time_ms.store(meta.refresh_ms, std::memory_order_relaxed);
+    entry->failure_count.store(0, std::memory_order_relaxed);
+    entry->negative_expire_ms.store(0, std::memory_order_relaxed);
+    *found = meta.refresh_ms + max_age > now;
+  } else {
+    entry->negative_expire_ms.store(now + consul_config_.negative_cache_ttl_, std::memory_order_relaxed);
+  }
+  if (std::atomic_load(&entry->snapshot) != nullptr) {
+    entry->next_refresh_ms.store(now + kSharedCachePollMs, std::memory_order_relaxed);
+  }
+  return true;
+}
+
+void ConsulSelector::SyncSharedCache(uint64_t now) {
+  if (shm_cache_.TryLead()) {
+    // The former leader is gone, from now on this process looks its callees up in Consul and shares them
+    TRPC_LOG_INFO("consul selector took over the shared endpoint cache");
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    for (const auto& item : targets_map_) {
+      if (std::atomic_load(&item.second->snapshot) != nullptr) {
+        item.second->next_refresh_ms.store(now, std::memory_order_relaxed);
       }
     }
   }
+  if (!shm_cache_.IsLeader()) {
+    return;
+  }
+  std::vector<std::string> names;
+  shm_cache_.DrainRequests(&names);
+  for (const auto& name : names) {
+    CalleeEntryPtr entry = GetOrCreateCallee(name);
+    // Callees the leader knows are shared at their next refresh, failed ones once the negative cache expired
+    if (now >= entry->negative_expire_ms.load(std::memory_order_relaxed)) {
+      QueueColdLookup(entry);
+    }
+  }
+}
+
+void ConsulSelector::ExpireSnapshot(CalleeEntry* entry, uint64_t now) {
+  std::lock_guard<std::mutex> refresh_lock(entry->refresh_mutex);
+  TRPC_LOG_ERROR("endpoints of " << entry->domain_name << " not revalidated for "
+                 << now - entry->refresh_time_ms.load(std::memory_order_relaxed) << "ms, stop serving them");
+  EndpointSnapshotPtr expired = std::atomic_exchange(&entry->snapshot, EndpointSnapshotPtr());
+  if (consul_config_.replicate_snapshot_) {
+    // The entry stays, so the selects counted on the replicas must not go away with them
+    entry->metrics.RecordSelects(replicas_.Remove(entry->domain_name));
+  }
+  NotifyRemovedLocked(*entry, expired);
+  // Without a snapshot the next select looks the callee up again, the periodic task leaves it alone
+  entry->next_refresh_ms.store(UINT64_MAX, std::memory_order_relaxed);
+  entry->negative_expire_ms.store(0, std::memory_order_relaxed);
+}
 
+bool ConsulSelector::PublishStaticEndpoints(const SelectorInfo* info, CalleeEntry* entry, uint64_t now) {
+  auto iter = static_tables_.find(entry->domain_name);
+  if (iter == static_tables_.end()) {
+    return false;
+  }
+  std::lock_guard<std::mutex> refresh_lock(entry->refresh_mutex);
+  // A lookup finishing meanwhile wins over the static endpoints
+  if (std::atomic_load(&entry->snapshot) != nullptr) {
+    return true;
+  }
+  if (PublishTableLocked(info, entry, iter->second) != 0) {
+    return false;
+  }
+  TRPC_LOG_WARN("serve static endpoints of " << entry->domain_name << " until Consul answers");
+  // Revalidated like a snapshot whose refresh failed, the first successful lookup replaces it
+  entry->refresh_time_ms.store(now, std::memory_order_relaxed);
+  entry->next_refresh_ms.store(now + consul_config_.negative_cache_ttl_, std::memory_order_relaxed);
   return true;
 }
 
-bool ConsulSelector::NeedUpdate() {
-  uint64_t current_time = trpc::time::GetMilliSeconds();
-  uint64_t next_refresh_time = last_update_time_ + dn_update_interval_;
-  if (next_refresh_time < current_time) {
-    last_update_time_ = current_time;
+void ConsulSelector::RunColdLookup(const CalleeEntryPtr& entry, bool pace) {
+  // Lookups on behalf of callers are never throttled, they take their token from the background refreshes.
+  // Followers of the shared cache do not send any request.
+  if (!SharedCacheFollower()) {
+    uint64_t wait_ms = consul::ConsulTrafficShaper::GetInstance()->Acquire();
+    if (pace && wait_ms > 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(wait_ms));
+    }
+  }
+  auto worker = refresh_workers_.Acquire();
+  SelectorInfo info;
+  info.name = entry->domain_name;
+  if (worker == nullptr || !LookupCallee(&info, entry.get(), worker.get(), trpc::time::GetMilliSeconds())) {
+    TRPC_LOG_ERROR("lookup of " << entry->domain_name << " failed, cache the failure for "
+                   << consul_config_.negative_cache_ttl_ << "ms");
+  }
+  {
+    std::lock_guard<std::mutex> lock(entry->lookup_mutex);
+    entry->lookup_in_flight = false;
+  }
+  entry->lookup_done.notify_all();
+}
+
+void ConsulSelector::ColdLookupLoop() {
+  while (true) {
+    CalleeEntryPtr entry;
+    {
+      std::unique_lock<std::mutex> lock(cold_lookup_mutex_);
+      cold_lookup_cond_.wait(lock, [this]() { return cold_lookup_stopped_ || !cold_lookup_queue_.empty(); });
+      if (cold_lookup_stopped_) {
+        break;
+      }
+      entry = std::move(cold_lookup_queue_.front());
+      cold_lookup_queue_.pop_front();
+    }
+    RunColdLookup(entry, false);
+  }
+}
+
+void ConsulSelector::StopColdLookup() {
+  {
+    std::lock_guard<std::mutex> lock(cold_lookup_mutex_);
+    cold_lookup_stopped_ = true;
+  }
+  cold_lookup_cond_.notify_all();
+  for (auto& thread : cold_lookup_threads_) {
+    thread.join();
+  }
+  cold_lookup_threads_.clear();
+  // Lookups which never ran release their waiters
+  std::deque<CalleeEntryPtr> pending;
+  {
+    std::lock_guard<std::mutex> lock(cold_lookup_mutex_);
+    pending.swap(cold_lookup_queue_);
+  }
+  for (const auto& entry : pending) {
+    {
+      std::lock_guard<std::mutex> lock(entry->lookup_mutex);
+      entry->lookup_in_flight = false;
+    }
+    entry->lookup_done.notify_all();
+  }
+}
+
+void ConsulSelector::QueueColdLookup(const CalleeEntryPtr& entry) {
+  {
+    std::lock_guard<std::mutex> lock(entry->lookup_mutex);
+    if (entry->lookup_in_flight || std::atomic_load(&entry->snapshot) != nullptr) {
+      return;
+    }
+    entry->lookup_in_flight = true;
+  }
+  std::lock_guard<std::mutex> queue_lock(cold_lookup_mutex_);
+  cold_lookup_queue_.push_back(entry);
+  cold_lookup_cond_.notify_one();
+}
+
+bool ConsulSelector::ResolveCallee(const SelectorInfo* info, const CalleeEntryPtr& entry, uint32_t timeout_ms) {
+  std::unique_lock<std::mutex> lock(entry->lookup_mutex);
+  if (!entry->lookup_in_flight) {
+    // A lookup may have finished since the caller checked
+    if (std::atomic_load(&entry->snapshot) != nullptr) {
+      return true;
+    }
+    entry->lookup_in_flight = true;
+    if (timeout_ms == 0) {
+      // Nobody gives up waiting, no need to hand the lookup over to another thread, which may wait for its token
+      lock.unlock();
+      RunColdLookup(entry, true);
+      lock.lock();
+    } else {
+      std::lock_guard<std::mutex> queue_lock(cold_lookup_mutex_);
+      cold_lookup_queue_.push_back(entry);
+      cold_lookup_cond_.notify_one();
+    }
+  }
+  auto lookup_finished = [&entry]() { return !entry->lookup_in_flight; };
+  if (timeout_ms == 0) {
+    entry->lookup_done.wait(lock, lookup_finished);
+  } else if (!entry->lookup_done.wait_for(lock, std::chrono::milliseconds(timeout_ms), lookup_finished)) {
+    TRPC_LOG_WARN("lookup of " << entry->domain_name << " not finished in " << timeout_ms
+                  << "ms, continue in the background");
+  }
+  lock.unlock();
+
+  if (std::atomic_load(&entry->snapshot) != nullptr) {
     return true;
   }
-  return false;
+  return PublishStaticEndpoints(info, entry.get(), trpc::time::GetMilliSeconds());
+}
+
+bool ConsulSelector::InitEndpointInfo(const SelectorInfo* info, CalleeEntryPtr* entry) {
+  // Fast path: a published snapshot is served as is, even while it is being revalidated in the background
+  *entry = FindCallee(info->name);
+  if (*entry != nullptr) {
+    (*entry)->Touch(CurrentAccessEpoch());
+    if (std::atomic_load(&(*entry)->snapshot) != nullptr) {
+      return true;
+    }
+  }
+
+  auto begin_time = std::chrono::steady_clock::now();
+  bool ready = ResolveMissingCallee(info, entry);
+  auto wait_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin_time);
+  (*entry)->metrics.RecordCacheMiss(wait_us.count());
+  TRPC_CONSUL_PROBE2(cache_miss, info->name.c_str(), wait_us.count());
+  return ready;
+}
+
+bool ConsulSelector::ResolveMissingCallee(const SelectorInfo* info, CalleeEntryPtr* entry) {
+  uint64_t now = trpc::time::GetMilliSeconds();
+  if (*entry == nullptr) {
+    *entry = GetOrCreateCallee(info->name);
+  } else if (now < (*entry)->negative_expire_ms.load(std::memory_order_relaxed)) {
+    TRPC_LOG_DEBUG("lookup of " << info->name << " failed recently, skip it until the negative cache expires");
+    return PublishStaticEndpoints(info, entry->get(), now);
+  }
+
+  // If this service is selected first time, or its last lookup failed, it needs to be retrieved from Consul. The
+  // caller waits no longer than its own timeout, then gets the static endpoints if there are any.
+  uint32_t timeout_ms = info->context != nullptr ? info->context->GetTimeout() : 0;
+  uint32_t max_timeout_ms = consul_config_.cold_lookup_timeout_;
+  if (max_timeout_ms > 0 && (timeout_ms == 0 || timeout_ms > max_timeout_ms)) {
+    timeout_ms = max_timeout_ms;
+  }
+  return ResolveCallee(info, *entry, timeout_ms);
 }
 
 int ConsulSelector::UpdateEndpointInfo() {
+  // Only the handles of the due callees are collected under the lock, the refreshes work on the entries themselves
+  uint64_t now = trpc::time::GetMilliSeconds();
+  if (shm_cache_.Enabled()) {
+    SyncSharedCache(now);
+  }
+  if (!consul_config_.metrics_plugin_.empty() && now >= next_metrics_report_ms_) {
+    ReportSelectMetrics();
+    ReportRefreshMetrics();
+    next_metrics_report_ms_ = now + consul_config_.metrics_report_interval_;
+  }
+  EvictCallees(now);
+  std::vector<CalleeEntryPtr> entries;
+  std::vector<CalleeEntryPtr> ramping_entries;
   std::shared_lock<std::shared_mutex> lock(mutex_);
-  auto targets_map = targets_map_;  // copy-modify-update
+  for (const auto& item : targets_map_) {
+    if (item.second->next_refresh_ms.load(std::memory_order_relaxed) <= now) {
+      entries.push_back(item.second);
+    }
+    if (item.second->ramp_step_ms.load(std::memory_order_relaxed) <= now) {
+      ramping_entries.push_back(item.second);
+    }
+  }
   lock.unlock();
-  int targets_count = targets_map_.size();
+  for (const auto& entry : ramping_entries) {
+    AdvanceSlowStart(entry.get(), now);
+  }
+  if (entries.empty()) {
+    return 0;
+  }
   int success_count = 0;
+  int throttled_count = 0;
 
-  for (auto item : targets_map) {
-    ConsulSelector::DomainEndpointInfo endpointInfo;
-    SelectorInfo selectorInfo;
-    selectorInfo.name = item.second.domain_name;
-    if (!RefreshEndpointInfoByName(&selectorInfo, endpointInfo)) {
-      TRPC_LOG_DEBUG("Update endpointInfo of " << item.first << ":" << item.second.domain_name << " success");
-      SelectorInfo selector_info;
-      selector_info.name = item.first;
-      RefreshDomainInfo(&selector_info, endpointInfo);
+  auto worker = refresh_workers_.Acquire();
+  auto* traffic_shaper = consul::ConsulTrafficShaper::GetInstance();
+  bool follower = SharedCacheFollower();
+  for (const auto& entry : entries) {
+    if (!follower && !traffic_shaper->TryAcquire()) {
+      // Over the request rate of the process, try again about a second later
+      entry->next_refresh_ms.store(now + consul::ConsulTrafficShaper::Jitter(1000, 0.5), std::memory_order_relaxed);
+      throttled_count++;
+      continue;
+    }
+    SelectorInfo selector_info;
+    selector_info.name = entry->domain_name;
+    if (LookupCallee(&selector_info, entry.get(), worker.get(), now)) {
+      TRPC_LOG_DEBUG("Update endpointInfo of " << entry->domain_name << " success");
       success_count++;
+      continue;
     }
+    // Stale-while-revalidate: the last good snapshot is served until it is older than the update interval plus the
+    // configured maximum staleness
+    uint64_t stale_time = entry->refresh_time_ms.load(std::memory_order_relaxed) + dn_update_interval_;
+    if (consul_config_.max_staleness_ > 0 && now >= stale_time + consul_config_.max_staleness_) {
+      ExpireSnapshot(entry.get(), now);
+    } else {
+      TRPC_LOG_WARN("revalidate endpoints of " << entry->domain_name << " failed, keep serving the last good ones");
+    }
+  }
+  if (throttled_count > 0) {
+    consul::TrafficShaperStats stats = traffic_shaper->GetStats();
+    TRPC_LOG_INFO("postponed " << throttled_count << " of " << entries.size() << " consul refreshes over the rate limit"
+                  << ", total requests:" << stats.requests << ", throttled:" << stats.throttled
+                  << ", paced:" << stats.paced_ms << "ms, backoffs:" << stats.backoffs);
+  }
+  return success_count > 0 ? 0 : -1;
+}
+
+void ConsulSelector::GetSelectMetrics(std::vector<consul::CalleeMetricsSnapshot>* metrics) const {
+  std::vector<CalleeEntryPtr> entries;
+  {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    entries.reserve(targets_map_.size());
+    for (const auto& item : targets_map_) {
+      entries.push_back(item.second);
+    }
+  }
+  uint64_t now = trpc::time::GetMilliSeconds();
+  metrics->resize(entries.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    consul::CalleeMetricsSnapshot& snapshot = (*metrics)[i];
+    snapshot.name = entries[i]->domain_name;
+    entries[i]->metrics.Snapshot(&snapshot);
+    if (consul_config_.replicate_snapshot_) {
+      snapshot.selects += replicas_.SelectCount(snapshot.name);
+    }
+    uint64_t refresh_time = entries[i]->refresh_time_ms.load(std::memory_order_relaxed);
+    snapshot.snapshot_age_ms = std::atomic_load(&entries[i]->snapshot) != nullptr && refresh_time <= now
+                                   ? static_cast<int64_t>(now - refresh_time)
+                                   : -1;
+  }
+}
+
+void ConsulSelector::GetRefreshMetrics(std::vector<consul::CalleeRefreshSnapshot>* metrics) const {
+  std::vector<CalleeEntryPtr> entries;
+  {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    entries.reserve(targets_map_.size());
+    for (const auto& item : targets_map_) {
+      entries.push_back(item.second);
+    }
+  }
+  uint64_t now = trpc::time::GetMilliSeconds();
+  metrics->resize(entries.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const CalleeEntry& entry = *entries[i];
+    consul::CalleeRefreshSnapshot& snapshot = (*metrics)[i];
+    snapshot.name = entry.domain_name;
+    entry.refresh_metrics.Snapshot(&snapshot);
+    uint64_t refresh_time = entry.refresh_time_ms.load(std::memory_order_relaxed);
+    snapshot.snapshot_age_ms = std::atomic_load(&entry.snapshot) != nullptr && refresh_time <= now
+                                   ? static_cast<int64_t>(now - refresh_time)
+                                   : -1;
+    snapshot.last_contact_ms = entry.last_contact_ms.load(std::memory_order_relaxed);
+    snapshot.consecutive_failures = entry.failure_count.load(std::memory_order_relaxed);
+    uint64_t next_refresh = entry.next_refresh_ms.load(std::memory_order_relaxed);
+    if (next_refresh == UINT64_MAX) {
+      snapshot.next_refresh_in_ms = -1;
+    } else {
+      snapshot.next_refresh_in_ms = next_refresh > now ? static_cast<int64_t>(next_refresh - now) : 0;
+    }
+  }
+}
+
+void ConsulSelector::ReportSelectMetrics() {
+  const std::string& plugin = consul_config_.metrics_plugin_;
+  std::vector<consul::CalleeMetricsSnapshot> metrics;
+  GetSelectMetrics(&metrics);
+  for (auto& current : metrics) {
+    // Counters are reported as the increase since the last report, latencies as the percentiles of the interval
+    consul::CalleeMetricsSnapshot& last = reported_metrics_[current.name];
+    ReportMetric(plugin, "consul_selector_selects", current.name, MetricsPolicy::SUM, current.selects - last.selects);
+    ReportMetric(plugin, "consul_selector_batch_selects", current.name, MetricsPolicy::SUM,
+                 current.batch_selects - last.batch_selects);
+    ReportMetric(plugin, "consul_selector_cache_misses", current.name, MetricsPolicy::SUM,
+                 current.cache_misses - last.cache_misses);
+    ReportMetric(plugin, "consul_selector_failures", current.name, MetricsPolicy::SUM,
+                 current.failures - last.failures);
+    ReportMetric(plugin, "consul_selector_select_latency_p99_ns", current.name, MetricsPolicy::SET,
+                 IntervalP99(current.select_latency_ns, last.select_latency_ns));
+    ReportMetric(plugin, "consul_selector_cold_lookup_latency_p99_us", current.name, MetricsPolicy::SET,
+                 IntervalP99(current.cold_lookup_latency_us, last.cold_lookup_latency_us));
+    ReportMetric(plugin, "consul_selector_snapshot_age_ms", current.name, MetricsPolicy::SET,
+                 current.snapshot_age_ms);
+    last = std::move(current);
+  }
+}
+
+void ConsulSelector::ReportRefreshMetrics() {
+  const std::string& plugin = consul_config_.metrics_plugin_;
+  if (reported_http_stats_ == nullptr) {
+    reported_http_stats_ = std::make_unique<consul::ConsulHttpStats>();
+    reported_stage_stats_ = std::make_unique<consul::RefreshStageSnapshot>();
+  }
+
+  // Round trips to the agent of the whole process, the registry included, with the agent as dimension
+  auto http = std::make_unique<consul::ConsulHttpStats>();
+  consul::GetConsulHttpStats(http.get());
+  const consul::ConsulHttpStats& last_http = *reported_http_stats_;
+  const std::string& agent = consul_config_.address_;
+  ReportMetric(plugin, "consul_http_requests", agent, MetricsPolicy::SUM, http->requests - last_http.requests);
+  ReportMetric(plugin, "consul_http_connects", agent, MetricsPolicy::SUM, http->connects - last_http.connects);
+  ReportMetric(plugin, "consul_http_transport_errors", agent, MetricsPolicy::SUM,
+               http->transport_errors - last_http.transport_errors);
+  ReportMetric(plugin, "consul_http_status_2xx", agent, MetricsPolicy::SUM, http->status_2xx - last_http.status_2xx);
+  ReportMetric(plugin, "consul_http_status_4xx", agent, MetricsPolicy::SUM, http->status_4xx - last_http.status_4xx);
+  ReportMetric(plugin, "consul_http_status_5xx", agent, MetricsPolicy::SUM, http->status_5xx - last_http.status_5xx);
+  ReportMetric(plugin, "consul_http_retries", agent, MetricsPolicy::SUM, http->retries - last_http.retries);
+  ReportMetric(plugin, "consul_http_response_bytes", agent, MetricsPolicy::SUM,
+               http->response_bytes - last_http.response_bytes);
+  ReportMetric(plugin, "consul_http_name_lookup_p99_us", agent, MetricsPolicy::SET,
+               IntervalP99(http->name_lookup_us, last_http.name_lookup_us));
+  ReportMetric(plugin, "consul_http_connect_p99_us", agent, MetricsPolicy::SET,
+               IntervalP99(http->connect_us, last_http.connect_us));
+  ReportMetric(plugin, "consul_http_tls_handshake_p99_us", agent, MetricsPolicy::SET,
+               IntervalP99(http->tls_handshake_us, last_http.tls_handshake_us));
+  ReportMetric(plugin, "consul_http_first_byte_p99_us", agent, MetricsPolicy::SET,
+               IntervalP99(http->first_byte_us, last_http.first_byte_us));
+  ReportMetric(plugin, "consul_http_total_p99_us", agent, MetricsPolicy::SET,
+               IntervalP99(http->total_us, last_http.total_us));
+  reported_http_stats_ = std::move(http);
+
+  // Refresh stages with the stage as dimension
+  auto stages = std::make_unique<consul::RefreshStageSnapshot>();
+  consul::GetRefreshStageStats(stages.get());
+  for (size_t i = 0; i < consul::kRefreshStageNum; ++i) {
+    const char* stage = consul::RefreshStageName(static_cast<consul::RefreshStage>(i));
+    ReportMetric(plugin, "consul_refresh_stage_p99_us", stage, MetricsPolicy::SET,
+                 IntervalP99(stages->stage_us[i], reported_stage_stats_->stage_us[i]));
+  }
+  reported_stage_stats_ = std::move(stages);
+
+  // Shaping of the Consul traffic of the process
+  consul::TrafficShaperStats shaper = consul::ConsulTrafficShaper::GetInstance()->GetStats();
+  ReportMetric(plugin, "consul_shaper_requests", agent, MetricsPolicy::SUM,
+               shaper.requests - reported_shaper_stats_.requests);
+  ReportMetric(plugin, "consul_shaper_throttled", agent, MetricsPolicy::SUM,
+               shaper.throttled - reported_shaper_stats_.throttled);
+  ReportMetric(plugin, "consul_shaper_paced_ms", agent, MetricsPolicy::SUM,
+               shaper.paced_ms - reported_shaper_stats_.paced_ms);
+  ReportMetric(plugin, "consul_shaper_backoffs", agent, MetricsPolicy::SUM,
+               shaper.backoffs - reported_shaper_stats_.backoffs);
+  reported_shaper_stats_ = shaper;
+
+  std::vector<consul::CalleeRefreshSnapshot> metrics;
+  GetRefreshMetrics(&metrics);
+  for (auto& current : metrics) {
+    consul::CalleeRefreshSnapshot& last = reported_refresh_metrics_[current.name];
+    ReportMetric(plugin, "consul_selector_refreshes", current.name, MetricsPolicy::SUM,
+                 current.refreshes - last.refreshes);
+    ReportMetric(plugin, "consul_selector_refresh_failures", current.name, MetricsPolicy::SUM,
+                 current.failures - last.failures);
+    ReportMetric(plugin, "consul_selector_endpoint_changes", current.name, MetricsPolicy::SUM,
+                 current.changes - last.changes);
+    ReportMetric(plugin, "consul_selector_endpoints_added", current.name, MetricsPolicy::SUM,
+                 current.endpoints_added - last.endpoints_added);
+    ReportMetric(plugin, "consul_selector_endpoints_removed", current.name, MetricsPolicy::SUM,
+                 current.endpoints_removed - last.endpoints_removed);
+    ReportMetric(plugin, "consul_selector_endpoint_status_changes", current.name, MetricsPolicy::SUM,
+                 current.status_changes - last.status_changes);
+    ReportMetric(plugin, "consul_selector_last_contact_ms", current.name, MetricsPolicy::SET,
+                 current.last_contact_ms);
+    last = std::move(current);
   }
-  return (targets_count == 0 || success_count > 0) ? 0 : -1;
 }
 
 LoadBalance* ConsulSelector::GetLoadBalance(const std::string& name) {
@@ -327,23 +1299,79 @@ int ConsulSelector::SetEndpoints(const RouterInfo* info) {
   std::string dn_name = info->info[0].host;
   SelectorInfo selector_info;
   selector_info.name = info->info[0].host;
-  ConsulSelector::DomainEndpointInfo endpointInfo;
-  if (0 != RefreshEndpointInfoByName(&selector_info, endpointInfo)) {
+  auto worker = refresh_workers_.Acquire();
+  CalleeEntryPtr entry = GetOrCreateCallee(dn_name);
+  entry->Touch(CurrentAccessEpoch());
+  if (!LookupCallee(&selector_info, entry.get(), worker.get(), trpc::time::GetMilliSeconds())) {
     TRPC_LOG_ERROR("RefreshEndpointInfoByName of name" << dn_name << " failed");
     return -1;
   }
-  RefreshDomainInfo(&selector_info, endpointInfo);
   return 0;
 }
 
+std::vector<std::string> ConsulSelector::GetWarmUpNames() const {
+  std::set<std::string> names(consul_config_.prefetch_services_.begin(), consul_config_.prefetch_services_.end());
+  for (const auto& service : trpc::TrpcConfig::GetInstance()->GetClientConfig().service_proxy_config) {
+    if (service.selector_name != kConsulPluginName) {
+      continue;
+    }
+    // Selects are made by the target of the service, which defaults to its name
+    names.insert(service.target.empty() ? service.name : service.target);
+  }
+  names.erase("");
+  return std::vector<std::string>(names.begin(), names.end());
+}
+
+void ConsulSelector::WarmUp(const std::vector<std::string>& names) {
+  uint64_t begin_time = trpc::time::GetMilliSeconds();
+  std::atomic<size_t> next_index{0};
+  std::atomic<size_t> ready_count{0};
+  auto lookup = [&]() {
+    for (size_t i = next_index.fetch_add(1); i < names.size(); i = next_index.fetch_add(1)) {
+      SelectorInfo info;
+      info.name = names[i];
+      // No deadline, the warm-up threads run the lookups themselves
+      if (ResolveCallee(&info, GetOrCreateCallee(info.name), 0)) {
+        ready_count.fetch_add(1);
+      }
+    }
+  };
+
+  size_t thread_num = std::min<size_t>(names.size(), std::max<uint32_t>(consul_config_.warmup_concurrency_, 1));
+  std::vector<std::thread> threads;
+  threads.reserve(thread_num - 1);
+  for (size_t i = 1; i < thread_num; ++i) {
+    threads.emplace_back(lookup);
+  }
+  lookup();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  TRPC_LOG_INFO("consul selector warmed up " << ready_count.load() << "/" << names.size() << " callees in "
+                << trpc::time::GetMilliSeconds() - begin_time << "ms");
+}
+
 void ConsulSelector::Start() noexcept {
   TRPC_LOG_DEBUG("Start consul selector task");
+  std::vector<std::string> names = GetWarmUpNames();
+  if (!names.empty() && !warmup_thread_.joinable()) {
+    // The callees are resolved concurrently, so that the first request to each of them does not wait for Consul
+    auto done = std::make_shared<std::promise<void>>();
+    std::future<void> warmed_up = done->get_future();
+    warmup_thread_ = std::thread([this, names = std::move(names), done]() {
+      WarmUp(names);
+      done->set_value();
+    });
+    if (consul_config_.warmup_wait_ &&
+        warmed_up.wait_for(std::chrono::milliseconds(consul_config_.warmup_timeout_)) != std::future_status::ready) {
+      TRPC_LOG_WARN("consul selector warm-up not finished in " << consul_config_.warmup_timeout_
+                    << "ms, continue in the background");
+    }
+  }
   if (task_id_ == 0) {
     task_id_ = PeripheryTaskScheduler::GetInstance()->SubmitInnerPeriodicalTask(
         [this]() {
-          if (NeedUpdate()) {
-            UpdateEndpointInfo();
-          }
+          UpdateEndpointInfo();
           TRPC_LOG_TRACE("SelectorDomainTask Running");
         },
         200, "ConsulSelector");
@@ -355,6 +1383,9 @@ void ConsulSelector::Stop() noexcept {
     PeripheryTaskScheduler::GetInstance()->StopInnerTask(task_id_);
     task_id_ = 0;
   }
+  if (warmup_thread_.joinable()) {
+    warmup_thread_.join();
+  }
 }
 
 }  // namespace trpc
@@ -14,35 +14,53 @@
 #pragma once
 
 #include <any>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <shared_mutex>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
-#include "rapidjson/document.h"
-#include "rapidjson/stringbuffer.h"
-#include "rapidjson/writer.h"
-
 #include "trpc/naming/common/util/utils_help.h"
 #include "trpc/naming/consul/consul.h"
+#include "trpc/naming/consul/consul_endpoint_table.h"
+#include "trpc/naming/consul/consul_flap_damping.h"
+#include "trpc/naming/consul/consul_refresh_metrics.h"
+#include "trpc/naming/consul/consul_refresh_worker.h"
+#include "trpc/naming/consul/consul_select_metrics.h"
+#include "trpc/naming/consul/consul_shm_cache.h"
+#include "trpc/naming/consul/consul_slow_start.h"
+#include "trpc/naming/consul/consul_snapshot_replicas.h"
+#include "trpc/naming/consul/consul_traffic_shaper.h"
+#include "trpc/naming/consul/consul_transport.h"
 #include "trpc/naming/consul/config/consul_naming_conf.h"
 #include "trpc/naming/load_balance.h"
 #include "trpc/naming/selector.h"
-#include "trpc/transport/common/http/curl_http.h"
 
 namespace trpc {
 
 /// @brief Consul service discovery plugin
 class ConsulSelector : public Selector {
  public:
+  ~ConsulSelector() override;
+
   std::string Name() const override { return kConsulPluginName; }
 
   std::string Version() const override { return kConsulSDKVersion; }
 
   int Init() noexcept override;
 
+  /// @brief Initializes from `config` instead of the plugin config of the framework, e.g. in tests and benchmarks.
+  /// @param transport_factory creates the transport of each refresh worker, the one named by `config.transport_`
+  ///        if nullptr.
+  int Init(const naming::ConsulConfig& config, consul::ConsulTransportFactory transport_factory = nullptr) noexcept;
+
   void Start() noexcept override;
 
   void Stop() noexcept override;
@@ -57,34 +75,236 @@ class ConsulSelector : public Selector {
 
   Future<std::vector<TrpcEndpointInfo>> AsyncSelectBatch(const SelectorInfo* info) override;
 
+  /// @brief Batch selection without copying: hands out the cached endpoint list of the callee by reference count.
+  /// @note The list always holds all endpoints of the callee (`info->policy` is not applied) and must not be modified.
+  ///       A later refresh publishes a new list and leaves the one handed out untouched.
+  int SelectBatchShared(const SelectorInfo* info, ConsulEndpointListPtr* endpoints);
+
+  Future<ConsulEndpointListPtr> AsyncSelectBatchShared(const SelectorInfo* info);
+
   int ReportInvokeResult(const InvokeResult* result) override;
 
   int SetEndpoints(const RouterInfo* info) override;
 
+  /// @brief Aggregates the select metrics of all callees, the counters and histograms count from the first select.
+  void GetSelectMetrics(std::vector<consul::CalleeMetricsSnapshot>* metrics) const;
+
+  /// @brief Selects served from the NUMA replicas without touching the callee. They are also part of the `selects`
+  /// of their callees.
+  uint64_t GetReplicaSelectCount() const { return replica_selects_.Value(); }
+
+  /// @brief Refresh counters, endpoint churn and staleness of all callees. The round trips to Consul and the refresh
+  /// stages are measured for the whole process, see `consul::GetConsulHttpStats` and `consul::GetRefreshStageStats`.
+  void GetRefreshMetrics(std::vector<consul::CalleeRefreshSnapshot>* metrics) const;
+
+  /// @brief Drops the callees not selected within `idle_ttl_`, then the least recently selected ones beyond
+  /// `max_callees_`. Dropped callees are no longer refreshed, a later select looks them up like a new callee.
+  /// @note Run by the periodic task, which passes the current time in milliseconds. Callees selected within the
+  ///       current second are never dropped for `max_callees_`, so the bound may be exceeded briefly.
+  /// @return number of dropped callees
+  size_t EvictCallees(uint64_t now);
+
+  /// @brief Callees dropped by `EvictCallees` so far.
+  uint64_t GetEvictedCalleeCount() const { return evicted_callees_.load(std::memory_order_relaxed); }
+
+  /// @brief Status changes of flapping endpoints held back by the damping so far, see `flap_half_life_`,
+  /// `min_up_dwell_` and `min_down_dwell_`.
+  uint64_t GetDampedStatusChangeCount() const { return damped_status_changes_.load(std::memory_order_relaxed); }
+
+  /// @brief Calls `listener` with the endpoints added, removed and changed in status each time a refresh publishes
+  /// new endpoints of the callee `name`, or of any callee if `name` is empty. The diff is computed once per refresh
+  /// and shared by all listeners of the callee. A callee which stops being served, because it expired or was
+  /// dropped, reports all its endpoints as removed.
+  /// @note Listeners run on the refreshing thread while it holds the refresh mutex of the callee, so the events of
+  ///       one callee arrive in order, but a listener must be quick and must not call back into the selector. The
+  ///       current endpoints are not replayed, take them from `SelectBatchShared` after subscribing; an endpoint
+  ///       may then be reported as added although it is already in the baseline.
+  /// @return id of the subscription, for `UnsubscribeEndpointChanges`
+  uint64_t SubscribeEndpointChanges(const std::string& name, consul::EndpointChangeListener listener);
+
+  /// @brief Removes a subscription. A delivery already running may still call its listener once.
+  void UnsubscribeEndpointChanges(uint64_t id);
+
  private:
-  bool InitEndpointInfo(const SelectorInfo* info);
+  // Refreshes the callees whose revalidation is due, called by the periodic task
+  int UpdateEndpointInfo();
 
-  bool NeedUpdate();
+  struct Subscription {
+    uint64_t id;
+    // Called service, empty for all
+    std::string name;
+    consul::EndpointChangeListener listener;
+  };
 
-  int UpdateEndpointInfo();
+  using SubscriptionListPtr = std::shared_ptr<const std::vector<Subscription>>;
+
+  // Immutable endpoint state of a callee, a refresh publishes a new snapshot instead of modifying it
+  struct EndpointSnapshot {
+    // Compact endpoint table of the called service
+    std::shared_ptr<const consul::ConsulEndpointTable> table;
+    // TrpcEndpointInfo view of `table`, only set for callees used by batch selection
+    ConsulEndpointListPtr endpoints;
+    // Endpoints within their slow-start window, nullptr if there are none
+    std::shared_ptr<const consul::SlowStartRamp> ramp;
+  };
 
-  struct DomainEndpointInfo {
+  using EndpointSnapshotPtr = std::shared_ptr<const EndpointSnapshot>;
+
+  // Per-callee handle, created on first use and never moved, so the refresh path works on it without the map lock
+  struct CalleeEntry {
     // Domain name of the called service
     std::string domain_name;
-    // Port of the called service
-    int port;
-    // Endpoint info of the called service
-    std::vector<TrpcEndpointInfo> endpoints;
+    // Serializes the refreshes of the callee and guards `id_generator` and `flap_damper`
+    std::mutex refresh_mutex;
     // id generator for endpoint
-    EndpointIdGenerator id_generator;
+    consul::CompactEndpointIdGenerator id_generator;
+    // Status history of the endpoints, only used if flap damping is configured
+    consul::EndpointFlapDamper flap_damper;
+    // Published snapshot, nullptr before the first successful refresh. Only accessed by std::atomic_load/store,
+    // publishing is a pointer swap
+    EndpointSnapshotPtr snapshot;
+    // Set by the first batch selection, from then on refreshes publish the materialized endpoint list as well
+    std::atomic<bool> batch_selected{false};
+    // Consecutive failed lookups, drives the backoff of the revalidation
+    std::atomic<uint32_t> failure_count{0};
+    // Freshness reported by Consul for the last successful lookup, see `consul::ConsulQueryMeta`
+    std::atomic<int64_t> last_contact_ms{-1};
+    std::atomic<bool> cache_hit{false};
+    // Time of the last successful lookup, in milliseconds
+    std::atomic<uint64_t> refresh_time_ms{0};
+    // The periodic task revalidates the snapshot from then on, only set while a snapshot is published
+    std::atomic<uint64_t> next_refresh_ms{UINT64_MAX};
+    // Lookups fail without asking Consul until then, set when a lookup found nothing
+    std::atomic<uint64_t> negative_expire_ms{0};
+    // The periodic task republishes the weights of the slow-start ramp then, only set while endpoints are ramping
+    std::atomic<uint64_t> ramp_step_ms{UINT64_MAX};
+    // Guards `lookup_in_flight`, `lookup_done` is notified when the cold lookup finished
+    std::mutex lookup_mutex;
+    std::condition_variable lookup_done;
+    // A cold lookup is running, concurrent cold selects wait for it instead of starting their own
+    bool lookup_in_flight{false};
+    // Version of the shared cache slot the snapshot was read from, followers of the shared cache only
+    std::atomic<uint64_t> shared_version{0};
+    // Select-path counters and histograms, see `GetSelectMetrics`
+    consul::CalleeSelectMetrics metrics;
+    // Refresh counters and endpoint churn, see `GetRefreshMetrics`
+    consul::CalleeRefreshMetrics refresh_metrics;
+    // Access epoch of the last select, see `Touch`
+    std::atomic<uint32_t> access_epoch{0};
+    // Set under `refresh_mutex` when the callee is dropped by `EvictCallees`, lookups still running for it do not
+    // publish any more
+    bool evicted{false};
+
+    // Stamps the callee as used in `epoch`. Only the first select of an epoch writes, the others just read the
+    // stamp, so the cache line stays shared between the selecting threads.
+    void Touch(uint32_t epoch) {
+      if (access_epoch.load(std::memory_order_relaxed) != epoch) {
+        access_epoch.store(epoch, std::memory_order_relaxed);
+      }
+    }
   };
 
-  bool ParseResponse(const rapidjson::Document& resp_body, const std::string& service_name,
-                     std::vector<TrpcEndpointInfo>& endpoints);
+  using CalleeEntryPtr = std::shared_ptr<CalleeEntry>;
+
+  // Makes sure the callee has an endpoint snapshot, `entry` is set to the callee in any case
+  bool InitEndpointInfo(const SelectorInfo* info, CalleeEntryPtr* entry);
+
+  // Slow path of InitEndpointInfo, for a callee without snapshot
+  bool ResolveMissingCallee(const SelectorInfo* info, CalleeEntryPtr* entry);
+
+  int SelectEndpoint(const SelectorInfo* info, TrpcEndpointInfo* endpoint, bool replica_select, CalleeEntryPtr* entry);
+
+  CalleeEntryPtr FindCallee(const std::string& name) const;
+
+  uint32_t CurrentAccessEpoch() const { return access_epoch_.load(std::memory_order_relaxed); }
+
+  // Last access epoch of the callee, including the selects served by the snapshot replicas
+  uint32_t LastAccessEpoch(const CalleeEntry& entry) const;
+
+  CalleeEntryPtr GetOrCreateCallee(const std::string& name);
+
+  int RefreshEndpointInfoByName(const SelectorInfo* info, consul::ConsulRefreshWorker* worker);
+
+  int RefreshDomainInfo(const SelectorInfo* info, CalleeEntry* entry, const consul::ConsulEndpointTable& table);
+
+  // Publishes `table` as the new snapshot of the callee, with the statuses of flapping endpoints damped,
+  // `entry->refresh_mutex` must be held
+  int PublishTableLocked(const SelectorInfo* info, CalleeEntry* entry, const consul::ConsulEndpointTable& table);
+
+  // Materializes `table` with the weights of `ramp` at `now`, then publishes it to the snapshot, the replicas and the
+  // loadbalance, `entry->refresh_mutex` must be held
+  void PublishSnapshotLocked(const SelectorInfo* info, CalleeEntry* entry,
+                             std::shared_ptr<const consul::ConsulEndpointTable> table,
+                             std::shared_ptr<const consul::SlowStartRamp> ramp, uint64_t now);
+
+  // Republishes the endpoints of the callee with the weights of the next slow-start step, called by the periodic task
+  void AdvanceSlowStart(CalleeEntry* entry, uint64_t now);
+
+  // Picks an endpoint from the replica of the calling thread, thinning the picks of ramping endpoints. If `count` is
+  // set, the select is counted on the replica for the metrics of the callee.
+  bool SelectFromReplica(const std::string& name, TrpcEndpointInfo* endpoint, uint32_t access_epoch, bool count);
+
+  // Resolves a callee without snapshot, waiting at most `timeout_ms` for the lookup, zero means until it finished.
+  // Concurrent callers share one lookup, which keeps running in the background if the wait times out.
+  bool ResolveCallee(const SelectorInfo* info, const CalleeEntryPtr& entry, uint32_t timeout_ms);
+
+  // Runs the cold lookup of `entry` and wakes up the callers waiting for it. If `pace` is set, it waits for its
+  // share of the Consul request rate first.
+  void RunColdLookup(const CalleeEntryPtr& entry, bool pace);
+
+  void ColdLookupLoop();
 
-  int RefreshEndpointInfoByName(const SelectorInfo *info, DomainEndpointInfo& dn_endpointInfo);
+  void StopColdLookup();
 
-  int RefreshDomainInfo(const SelectorInfo *info, DomainEndpointInfo& dn_endpointInfo);
+  // Publishes the configured static endpoints of a callee which still has no snapshot
+  // @return false if there are none
+  bool PublishStaticEndpoints(const SelectorInfo* info, CalleeEntry* entry, uint64_t now);
+
+  // Looks the callee up in Consul and publishes the result, a failure is cached for `negative_cache_ttl_`
+  bool LookupCallee(const SelectorInfo* info, CalleeEntry* entry, consul::ConsulRefreshWorker* worker, uint64_t now);
+
+  // LookupCallee without the refresh metrics
+  bool DoLookupCallee(const SelectorInfo* info, CalleeEntry* entry, consul::ConsulRefreshWorker* worker, uint64_t now);
+
+  // Queues a background lookup of a callee without snapshot, unless one is running already
+  void QueueColdLookup(const CalleeEntryPtr& entry);
+
+  bool SharedCacheFollower() const { return shm_cache_.Enabled() && !shm_cache_.IsLeader(); }
+
+  // Reads the callee from the shared cache instead of Consul. `found` is set if a table revalidated by the leader
+  // was read. A callee without snapshot waits up to `cold_lookup_timeout_` for the leader to look it up.
+  // @return false if the shared cache cannot hold the callee, it has to be looked up in Consul
+  bool LookupSharedCallee(const SelectorInfo* info, CalleeEntry* entry, uint64_t now, bool* found);
+
+  // Takes over the shared cache if its leader is gone, and as the leader looks up the callees requested by followers
+  void SyncSharedCache(uint64_t now);
+
+  // Stops serving the snapshot of a callee which could not be revalidated within `max_staleness_`
+  void ExpireSnapshot(CalleeEntry* entry, uint64_t now);
+
+  // Subscriptions matching the callee, nullptr if there are none
+  SubscriptionListPtr GetSubscriptions(const std::string& name) const;
+
+  // Delivers the changes of the callee to `subscriptions`, `entry->refresh_mutex` must be held
+  void NotifyEndpointChanges(const SubscriptionListPtr& subscriptions, const consul::EndpointChangeEvent& event);
+
+  // Reports all endpoints of `snapshot` as removed, `entry->refresh_mutex` must be held
+  void NotifyRemovedLocked(const CalleeEntry& entry, const EndpointSnapshotPtr& snapshot);
+
+  ConsulEndpointListPtr GetEndpointList(const std::string& name);
+
+  // Reports the select metrics accumulated since the last report to `metrics_plugin_`
+  void ReportSelectMetrics();
+
+  // Reports the Consul round trips, traffic shaping, refresh stages and per-callee refresh metrics since the last
+  // report
+  void ReportRefreshMetrics();
+
+  // Names of the client services using the consul selector and the configured prefetch services, deduplicated
+  std::vector<std::string> GetWarmUpNames() const;
+
+  // Looks all `names` up with `warmup_concurrency_` threads
+  void WarmUp(const std::vector<std::string>& names);
 
   LoadBalance* GetLoadBalance(const std::string& name);
 
@@ -93,18 +313,64 @@ class ConsulSelector : public Selector {
   LoadBalancePtr default_load_balance_;
 
   uint64_t timeout_;
-  curl_http::CurlHttp curl_http_;
 
-  naming::ConsulConfig consul_config_;
+  // Each refresh runs on its own worker, which owns the HTTP handle and the reusable parse buffers
+  consul::ConsulRefreshWorkerPool refresh_workers_;
 
-  uint64_t last_update_time_;
+  naming::ConsulConfig consul_config_;
 
   int dn_update_interval_;
 
   uint64_t task_id_{0};
 
-  std::unordered_map<std::string, DomainEndpointInfo> targets_map_;
-  mutable std::shared_mutex mutex_;  // mutex for targets_map_
+  // Runs the warm-up started by Start, joined by Stop
+  std::thread warmup_thread_;
+
+  // Hosts of all callees which are not IP literals
+  consul::HostInterner host_interner_;
+
+  // Per NUMA node copies of the endpoint lists, only used if `replicate_snapshot_` is configured
+  consul::SnapshotReplicas replicas_;
+
+  // Endpoint tables shared with the other processes of the host, only mapped if `shm_cache_enable_` is configured
+  consul::ShmEndpointCache shm_cache_;
+
+  // Fallback endpoints of the callees, parsed from `static_endpoints_`
+  std::unordered_map<std::string, consul::ConsulEndpointTable> static_tables_;
+
+  // Cold lookups run on these threads, so that they outlive the callers giving up at their deadline
+  std::vector<std::thread> cold_lookup_threads_;
+  std::deque<CalleeEntryPtr> cold_lookup_queue_;
+  std::mutex cold_lookup_mutex_;
+  std::condition_variable cold_lookup_cond_;
+  bool cold_lookup_stopped_{false};
+
+  consul::ShardedCounter replica_selects_;
+
+  // Flap damping of the endpoint statuses, from `consul_config_`
+  consul::FlapDampingOptions flap_damping_;
+  std::atomic<uint64_t> damped_status_changes_{0};
+
+  // Coarse clock of the callee access stamps, advanced by the periodic task, see `EvictCallees`
+  std::atomic<uint32_t> access_epoch_{1};
+  std::atomic<uint64_t> evicted_callees_{0};
+
+  // Endpoint change subscriptions, copied on write and only accessed by std::atomic_load/store, so the refresh path
+  // checks for subscribers without locking
+  SubscriptionListPtr subscriptions_;
+  std::mutex subscription_mutex_;
+  uint64_t next_subscription_id_{1};
+
+  // Metrics of the last report, only used by the periodic task
+  std::unordered_map<std::string, consul::CalleeMetricsSnapshot> reported_metrics_;
+  std::unordered_map<std::string, consul::CalleeRefreshSnapshot> reported_refresh_metrics_;
+  std::unique_ptr<consul::ConsulHttpStats> reported_http_stats_;
+  std::unique_ptr<consul::RefreshStageSnapshot> reported_stage_stats_;
+  consul::TrafficShaperStats reported_shaper_stats_;
+  uint64_t next_metrics_report_ms_{0};
+
+  std::unordered_map<std::string, CalleeEntryPtr> targets_map_;
+  mutable std::shared_mutex mutex_;  // mutex for the structure of targets_map_, not for the entries
 };
 
 }  // namespace trpc
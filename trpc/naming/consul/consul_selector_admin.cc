@@ -0,0 +1,148 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#include "trpc/naming/consul/consul_selector_admin.h"
+
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "trpc/naming/consul/consul_http.h"
+#include "trpc/naming/consul/consul_traffic_shaper.h"
+#include "trpc/naming/selector_factory.h"
+
+namespace trpc {
+
+namespace {
+
+rapidjson::Value HistogramToJson(const consul::HistogramSnapshot& histogram,
+                                 rapidjson::Document::AllocatorType& alloc) {
+  rapidjson::Value value(rapidjson::kObjectType);
+  value.AddMember("count", histogram.count, alloc);
+  value.AddMember("mean", histogram.Mean(), alloc);
+  value.AddMember("p50", histogram.Percentile(50), alloc);
+  value.AddMember("p90", histogram.Percentile(90), alloc);
+  value.AddMember("p99", histogram.Percentile(99), alloc);
+  value.AddMember("p999", histogram.Percentile(99.9), alloc);
+  value.AddMember("max", histogram.max, alloc);
+  return value;
+}
+
+rapidjson::Value HttpStatsToJson(const consul::ConsulHttpStats& stats, rapidjson::Document::AllocatorType& alloc) {
+  rapidjson::Value value(rapidjson::kObjectType);
+  value.AddMember("requests", stats.requests, alloc);
+  value.AddMember("connects", stats.connects, alloc);
+  value.AddMember("tls_handshakes", stats.tls_handshakes, alloc);
+  value.AddMember("transport_errors", stats.transport_errors, alloc);
+  value.AddMember("status_2xx", stats.status_2xx, alloc);
+  value.AddMember("status_4xx", stats.status_4xx, alloc);
+  value.AddMember("status_5xx", stats.status_5xx, alloc);
+  value.AddMember("status_other", stats.status_other, alloc);
+  value.AddMember("retries", stats.retries, alloc);
+  value.AddMember("response_bytes", stats.response_bytes, alloc);
+  value.AddMember("name_lookup_us", HistogramToJson(stats.name_lookup_us, alloc), alloc);
+  value.AddMember("connect_us", HistogramToJson(stats.connect_us, alloc), alloc);
+  value.AddMember("tls_handshake_us", HistogramToJson(stats.tls_handshake_us, alloc), alloc);
+  value.AddMember("first_byte_us", HistogramToJson(stats.first_byte_us, alloc), alloc);
+  value.AddMember("total_us", HistogramToJson(stats.total_us, alloc), alloc);
+  value.AddMember("response_size", HistogramToJson(stats.response_size, alloc), alloc);
+  return value;
+}
+
+}  // namespace
+
+ConsulSelectorAdminHandler::ConsulSelectorAdminHandler(ConsulSelector* selector) : selector_(selector) {
+  description_ = "[GET /cmds/consul/selector] select and refresh metrics of the consul selector per callee";
+}
+
+void ConsulSelectorAdminHandler::CommandHandle(http::HttpRequestPtr req, rapidjson::Value& result,
+                                               rapidjson::Document::AllocatorType& alloc) {
+  ConsulSelector* selector = selector_;
+  SelectorPtr registered;
+  if (selector == nullptr) {
+    registered = SelectorFactory::GetInstance()->Get(kConsulPluginName);
+    selector = static_cast<ConsulSelector*>(registered.get());
+  }
+  if (selector == nullptr) {
+    result.AddMember("errorcode", -1, alloc);
+    result.AddMember("message", "consul selector not registered", alloc);
+    return;
+  }
+
+  std::vector<consul::CalleeMetricsSnapshot> metrics;
+  selector->GetSelectMetrics(&metrics);
+  std::vector<consul::CalleeRefreshSnapshot> refresh_metrics;
+  selector->GetRefreshMetrics(&refresh_metrics);
+  std::unordered_map<std::string_view, const consul::CalleeRefreshSnapshot*> refresh_by_name;
+  for (const auto& callee : refresh_metrics) {
+    refresh_by_name.emplace(callee.name, &callee);
+  }
+
+  rapidjson::Value callees(rapidjson::kArrayType);
+  for (const auto& callee : metrics) {
+    rapidjson::Value value(rapidjson::kObjectType);
+    value.AddMember("name", rapidjson::Value(callee.name.c_str(), alloc), alloc);
+    value.AddMember("selects", callee.selects, alloc);
+    value.AddMember("batch_selects", callee.batch_selects, alloc);
+    value.AddMember("cache_misses", callee.cache_misses, alloc);
+    value.AddMember("failures", callee.failures, alloc);
+    value.AddMember("select_latency_ns", HistogramToJson(callee.select_latency_ns, alloc), alloc);
+    value.AddMember("cold_lookup_latency_us", HistogramToJson(callee.cold_lookup_latency_us, alloc), alloc);
+    value.AddMember("snapshot_age_ms", callee.snapshot_age_ms, alloc);
+    auto iter = refresh_by_name.find(callee.name);
+    if (iter != refresh_by_name.end()) {
+      const consul::CalleeRefreshSnapshot& refresh = *iter->second;
+      rapidjson::Value refresh_value(rapidjson::kObjectType);
+      refresh_value.AddMember("refreshes", refresh.refreshes, alloc);
+      refresh_value.AddMember("failures", refresh.failures, alloc);
+      refresh_value.AddMember("consecutive_failures", refresh.consecutive_failures, alloc);
+      refresh_value.AddMember("last_refresh_us", refresh.last_refresh_us, alloc);
+      refresh_value.AddMember("last_contact_ms", refresh.last_contact_ms, alloc);
+      refresh_value.AddMember("next_refresh_in_ms", refresh.next_refresh_in_ms, alloc);
+      refresh_value.AddMember("changes", refresh.changes, alloc);
+      refresh_value.AddMember("endpoints_added", refresh.endpoints_added, alloc);
+      refresh_value.AddMember("endpoints_removed", refresh.endpoints_removed, alloc);
+      refresh_value.AddMember("status_changes", refresh.status_changes, alloc);
+      value.AddMember("refresh", refresh_value, alloc);
+    }
+    callees.PushBack(value, alloc);
+  }
+
+  auto http_stats = std::make_unique<consul::ConsulHttpStats>();
+  consul::GetConsulHttpStats(http_stats.get());
+  auto stage_stats = std::make_unique<consul::RefreshStageSnapshot>();
+  consul::GetRefreshStageStats(stage_stats.get());
+  rapidjson::Value stages(rapidjson::kObjectType);
+  for (size_t i = 0; i < consul::kRefreshStageNum; ++i) {
+    rapidjson::Value stage_name(rapidjson::StringRef(consul::RefreshStageName(static_cast<consul::RefreshStage>(i))));
+    stages.AddMember(stage_name, HistogramToJson(stage_stats->stage_us[i], alloc), alloc);
+  }
+
+  result.AddMember("errorcode", 0, alloc);
+  result.AddMember("message", "", alloc);
+  result.AddMember("replica_selects", selector->GetReplicaSelectCount(), alloc);
+  result.AddMember("consul_http", HttpStatsToJson(*http_stats, alloc), alloc);
+  consul::TrafficShaperStats shaper_stats = consul::ConsulTrafficShaper::GetInstance()->GetStats();
+  rapidjson::Value shaper(rapidjson::kObjectType);
+  shaper.AddMember("rate_limit", consul::ConsulTrafficShaper::GetInstance()->RateLimit(), alloc);
+  shaper.AddMember("requests", shaper_stats.requests, alloc);
+  shaper.AddMember("throttled", shaper_stats.throttled, alloc);
+  shaper.AddMember("paced_ms", shaper_stats.paced_ms, alloc);
+  shaper.AddMember("backoffs", shaper_stats.backoffs, alloc);
+  result.AddMember("traffic_shaper", shaper, alloc);
+  result.AddMember("refresh_stages_us", stages, alloc);
+  result.AddMember("callees", callees, alloc);
+}
+
+}  // namespace trpc
@@ -0,0 +1,38 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#pragma once
+
+#include "trpc/admin/admin_handler.h"
+#include "trpc/naming/consul/consul_selector.h"
+
+namespace trpc {
+
+/// @brief Admin command showing the select and refresh metrics of the consul selector per callee, with their
+/// staleness, and the round trips to Consul and refresh stage durations of the process.
+///
+/// Registered by the application, e.g. in `TrpcApp::RegisterPlugins`:
+///   RegisterCmd(http::OperationType::GET, "/cmds/consul/selector", std::make_shared<ConsulSelectorAdminHandler>());
+class ConsulSelectorAdminHandler : public AdminHandlerBase {
+ public:
+  /// @param selector selector to show, the registered consul selector if nullptr.
+  explicit ConsulSelectorAdminHandler(ConsulSelector* selector = nullptr);
+
+  void CommandHandle(http::HttpRequestPtr req, rapidjson::Value& result,
+                     rapidjson::Document::AllocatorType& alloc) override;
+
+ private:
+  ConsulSelector* selector_;
+};
+
+}  // namespace trpc
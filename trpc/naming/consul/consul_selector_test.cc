@@ -137,13 +137,98 @@ TEST(ConsulSelectorTest, select_batch_test) {
   EXPECT_EQ(0, ret);
   EXPECT_TRUE(endpoints.size() > 0);
 
+  // shared list is handed out without copying, repeated calls see the same list until the next refresh
+  ConsulEndpointListPtr shared_endpoints;
+  ret = ptr->SelectBatchShared(&select_info, &shared_endpoints);
+  EXPECT_EQ(0, ret);
+  ASSERT_TRUE(shared_endpoints != nullptr);
+  EXPECT_TRUE(shared_endpoints->size() > 0);
+  ConsulEndpointListPtr shared_endpoints_again;
+  ret = ptr->SelectBatchShared(&select_info, &shared_endpoints_again);
+  EXPECT_EQ(0, ret);
+  EXPECT_EQ(shared_endpoints.get(), shared_endpoints_again.get());
+
+  auto fut = ptr->AsyncSelectBatchShared(&select_info).Then([](Future<ConsulEndpointListPtr>&& fut) {
+    ConsulEndpointListPtr endpoints = fut.GetValue0();
+    EXPECT_TRUE(endpoints != nullptr && endpoints->size() > 0);
+    return MakeReadyFuture<>();
+  });
+  trpc::future::BlockingGet(std::move(fut));
+
   // negtive case
   select_info.name = "baidu1";
   ret = ptr->SelectBatch(&select_info, &endpoints);
   EXPECT_NE(0, ret);
+  ret = ptr->SelectBatchShared(&select_info, &shared_endpoints);
+  EXPECT_NE(0, ret);
 
   ptr->Stop();
   ptr->Destroy();
 }
 
+TEST(ConsulSelectorTest, negative_cache_test) {
+  auto ret = trpc::TrpcConfig::GetInstance()->Init("./trpc/naming/consul/testing/consul_test.yaml");
+  EXPECT_TRUE(ret == 0);
+  std::shared_ptr<ConsulSelector> ptr = std::make_shared<ConsulSelector>();
+  ptr->Init();
+
+  SelectorInfo select_info;
+  select_info.name = "unknown_service";
+  select_info.context = trpc::MakeRefCounted<trpc::ClientContext>();
+  TrpcEndpointInfo endpoint;
+  EXPECT_NE(0, ptr->Select(&select_info, &endpoint));
+  // The failure is cached, later selects within the ttl fail without asking Consul
+  EXPECT_NE(0, ptr->Select(&select_info, &endpoint));
+  ConsulEndpointListPtr shared_endpoints;
+  EXPECT_NE(0, ptr->SelectBatchShared(&select_info, &shared_endpoints));
+
+  // Known services are not affected
+  select_info.name = kServiceName;
+  EXPECT_EQ(0, ptr->Select(&select_info, &endpoint));
+
+  ptr->Destroy();
+}
+
+TEST(ConsulSelectorTest, warmup_test) {
+  auto ret = trpc::TrpcConfig::GetInstance()->Init("./trpc/naming/consul/testing/consul_test.yaml");
+  EXPECT_TRUE(ret == 0);
+  PeripheryTaskScheduler::GetInstance()->Init();
+  PeripheryTaskScheduler::GetInstance()->Start();
+
+  std::shared_ptr<ConsulSelector> ptr = std::make_shared<ConsulSelector>();
+  ptr->Init();
+  // testconfig is in the prefetch list and the warm-up is waited for, so the first select is served from the cache
+  ptr->Start();
+
+  ConsulEndpointListPtr shared_endpoints;
+  SelectorInfo select_info;
+  select_info.name = kServiceName;
+  select_info.context = trpc::MakeRefCounted<trpc::ClientContext>();
+  EXPECT_EQ(0, ptr->SelectBatchShared(&select_info, &shared_endpoints));
+  ASSERT_TRUE(shared_endpoints != nullptr);
+  EXPECT_TRUE(shared_endpoints->size() > 0);
+
+  ptr->Stop();
+  ptr->Destroy();
+}
+
+TEST(ConsulSelectorTest, static_endpoints_test) {
+  auto ret = trpc::TrpcConfig::GetInstance()->Init("./trpc/naming/consul/testing/consul_test.yaml");
+  EXPECT_TRUE(ret == 0);
+  std::shared_ptr<ConsulSelector> ptr = std::make_shared<ConsulSelector>();
+  ptr->Init();
+
+  // Consul does not know the service, the static endpoints are served instead
+  SelectorInfo select_info;
+  select_info.name = "static_service";
+  select_info.context = trpc::MakeRefCounted<trpc::ClientContext>();
+  TrpcEndpointInfo endpoint;
+  EXPECT_EQ(0, ptr->Select(&select_info, &endpoint));
+  EXPECT_EQ("127.0.0.1", endpoint.host);
+  EXPECT_EQ(8080, endpoint.port);
+  EXPECT_TRUE(endpoint.id != kInvalidEndpointId);
+
+  ptr->Destroy();
+}
+
 }  // namespace trpc
@@ -0,0 +1,429 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#include "trpc/naming/consul/consul_shm_cache.h"
+
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "trpc/util/log/logging.h"
+
+namespace trpc::consul {
+
+namespace {
+
+constexpr uint64_t kSegmentMagic = 0x4c555343434d4853ULL;  // "SHMCCSUL"
+constexpr uint32_t kLayoutVersion = 1;
+
+// Number of requests which can be pending at once
+constexpr uint32_t kRequestNum = 64;
+
+// Reads of a slot retried this often while a write is in progress, before the reader gives up for now
+constexpr int kMaxReadRetries = 64;
+
+constexpr uint32_t kSlotFound = 1;
+constexpr uint32_t kSlotOverflow = 2;
+
+constexpr uint32_t kRequestFree = 0;
+constexpr uint32_t kRequestWriting = 1;
+constexpr uint32_t kRequestPosted = 2;
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free,
+              "atomics in shared memory have to be lock free");
+
+size_t RoundUp(size_t value, size_t alignment) { return (value + alignment - 1) / alignment * alignment; }
+
+// FNV-1a, unlike std::hash it is the same in all processes, whatever they were built with
+uint64_t HashName(std::string_view name) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (char c : name) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+bool NameEquals(const char* stored, std::string_view name) {
+  return strnlen(stored, ShmEndpointCache::kMaxNameLength) == name.size() &&
+         memcmp(stored, name.data(), name.size()) == 0;
+}
+
+void CopyName(char* stored, std::string_view name) {
+  memcpy(stored, name.data(), name.size());
+  stored[name.size()] = '\0';
+}
+
+}  // namespace
+
+struct ShmEndpointCache::Header {
+  uint64_t magic;
+  uint32_t layout_version;
+  uint32_t slot_num;
+  uint32_t slot_capacity;
+  uint32_t request_num;
+  // Informational, for tools looking at the segment
+  std::atomic<uint32_t> leader_pid;
+  std::atomic<uint32_t> leader_term;
+};
+
+struct ShmEndpointCache::RequestSlot {
+  std::atomic<uint32_t> state;
+  char name[kMaxNameLength];
+};
+
+struct ShmEndpoint {
+  char host[ShmEndpointCache::kMaxHostLength];
+  int32_t port;
+  int32_t status;
+};
+
+// Seqlock: the writer makes `seq` odd, writes the slot and makes it even again. A reader copies the slot out and
+// only uses the copy if `seq` was even and did not change meanwhile. Zero means the slot was never claimed.
+struct ShmEndpointCache::Slot {
+  std::atomic<uint64_t> seq;
+  uint32_t flags;
+  uint32_t count;
+  uint64_t refresh_ms;
+  char name[kMaxNameLength];
+
+  ShmEndpoint* Endpoints() { return reinterpret_cast<ShmEndpoint*>(this + 1); }
+};
+
+ShmEndpointCache::~ShmEndpointCache() { Close(); }
+
+int ShmEndpointCache::Init(const std::string& path, uint32_t slot_num, uint32_t slot_capacity) {
+  Close();
+  if (slot_num == 0 || slot_capacity == 0) {
+    TRPC_LOG_ERROR("invalid layout of shared endpoint cache " << path);
+    return -1;
+  }
+  slot_num_ = slot_num;
+  slot_capacity_ = slot_capacity;
+  size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  slots_offset_ = RoundUp(sizeof(Header) + kRequestNum * sizeof(RequestSlot), page_size);
+  slot_size_ = RoundUp(sizeof(Slot) + slot_capacity * sizeof(ShmEndpoint), alignof(Slot));
+  size_t size = RoundUp(slots_offset_ + slot_num * slot_size_, page_size);
+
+  fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    TRPC_LOG_ERROR("open shared endpoint cache " << path << " failed: " << strerror(errno));
+    return -1;
+  }
+  // The first process creates the layout, the others wait for it
+  if (flock(fd_, LOCK_EX) != 0) {
+    TRPC_LOG_ERROR("lock shared endpoint cache " << path << " failed: " << strerror(errno));
+    Close();
+    return -1;
+  }
+  struct stat st;
+  bool created = fstat(fd_, &st) == 0 && st.st_size == 0;
+  if (created && ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+    TRPC_LOG_ERROR("resize shared endpoint cache " << path << " failed: " << strerror(errno));
+    Close();
+    return -1;
+  }
+  if (!created && static_cast<size_t>(st.st_size) != size) {
+    TRPC_LOG_ERROR("shared endpoint cache " << path << " has another layout, size:" << st.st_size
+                   << ", expected:" << size);
+    Close();
+    return -1;
+  }
+  void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (base == MAP_FAILED) {
+    TRPC_LOG_ERROR("map shared endpoint cache " << path << " failed: " << strerror(errno));
+    Close();
+    return -1;
+  }
+  base_ = static_cast<char*>(base);
+  size_ = size;
+
+  Header* header = GetHeader();
+  if (created) {
+    header->layout_version = kLayoutVersion;
+    header->slot_num = slot_num_;
+    header->slot_capacity = slot_capacity_;
+    header->request_num = kRequestNum;
+    header->magic = kSegmentMagic;
+  }
+  bool compatible = header->magic == kSegmentMagic && header->layout_version == kLayoutVersion &&
+                    header->slot_num == slot_num_ && header->slot_capacity == slot_capacity_ &&
+                    header->request_num == kRequestNum;
+  flock(fd_, LOCK_UN);
+  if (!compatible) {
+    TRPC_LOG_ERROR("shared endpoint cache " << path << " has another layout");
+    Close();
+    return -1;
+  }
+
+  lock_fd_ = open((path + ".lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (lock_fd_ < 0 || ProtectSlots(false) != 0) {
+    TRPC_LOG_ERROR("init leader election of shared endpoint cache " << path << " failed: " << strerror(errno));
+    Close();
+    return -1;
+  }
+  stuck_requests_.assign(kRequestNum, false);
+  TryLead();
+  return 0;
+}
+
+void ShmEndpointCache::Close() {
+  if (base_ != nullptr) {
+    munmap(base_, size_);
+    base_ = nullptr;
+  }
+  // Closing the lock file releases the leadership
+  if (lock_fd_ >= 0) {
+    close(lock_fd_);
+    lock_fd_ = -1;
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+  leader_.store(false, std::memory_order_release);
+}
+
+ShmEndpointCache::Header* ShmEndpointCache::GetHeader() const { return reinterpret_cast<Header*>(base_); }
+
+ShmEndpointCache::RequestSlot* ShmEndpointCache::GetRequest(uint32_t index) const {
+  return reinterpret_cast<RequestSlot*>(base_ + sizeof(Header)) + index;
+}
+
+ShmEndpointCache::Slot* ShmEndpointCache::GetSlot(uint32_t index) const {
+  return reinterpret_cast<Slot*>(base_ + slots_offset_ + index * slot_size_);
+}
+
+int ShmEndpointCache::ProtectSlots(bool writable) {
+  return mprotect(base_ + slots_offset_, size_ - slots_offset_, writable ? PROT_READ | PROT_WRITE : PROT_READ);
+}
+
+bool ShmEndpointCache::TryLead() {
+  if (base_ == nullptr || IsLeader()) {
+    return false;
+  }
+  if (flock(lock_fd_, LOCK_EX | LOCK_NB) != 0) {
+    return false;
+  }
+  if (ProtectSlots(true) != 0) {
+    TRPC_LOG_ERROR("map shared endpoint cache writable failed: " << strerror(errno));
+    flock(lock_fd_, LOCK_UN);
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    RecoverSlots();
+  }
+  GetHeader()->leader_pid.store(static_cast<uint32_t>(getpid()), std::memory_order_relaxed);
+  uint32_t term = GetHeader()->leader_term.fetch_add(1, std::memory_order_relaxed) + 1;
+  TRPC_LOG_INFO("process " << getpid() << " leads the shared endpoint cache, term:" << term);
+  leader_.store(true, std::memory_order_release);
+  return true;
+}
+
+void ShmEndpointCache::RecoverSlots() {
+  for (uint32_t i = 0; i < slot_num_; ++i) {
+    Slot* slot = GetSlot(i);
+    uint64_t seq = slot->seq.load(std::memory_order_relaxed);
+    if ((seq & 1) == 0) {
+      continue;
+    }
+    // The name may be half written as well, the slot is closed as an unused one
+    slot->flags = 0;
+    slot->count = 0;
+    slot->refresh_ms = 0;
+    memset(slot->name, 0, sizeof(slot->name));
+    slot->seq.store(seq + 1, std::memory_order_release);
+  }
+}
+
+ShmEndpointCache::ReadResult ShmEndpointCache::Read(std::string_view name, uint64_t known_version,
+                                                    ConsulEndpointTable* table, HostInterner* interner,
+                                                    ReadMeta* meta) const {
+  if (base_ == nullptr || name.size() >= kMaxNameLength) {
+    return ReadResult::kOverflow;
+  }
+  thread_local std::vector<ShmEndpoint> endpoints;
+  uint32_t start = static_cast<uint32_t>(HashName(name) % slot_num_);
+  for (uint32_t probe = 0; probe < slot_num_; ++probe) {
+    Slot* slot = GetSlot((start + probe) % slot_num_);
+    bool matched = false;
+    bool consistent = false;
+    for (int retry = 0; retry < kMaxReadRetries && !consistent; ++retry) {
+      uint64_t seq = slot->seq.load(std::memory_order_acquire);
+      if (seq == 0) {
+        return ReadResult::kMiss;
+      }
+      if (seq & 1) {
+        sched_yield();
+        continue;
+      }
+      matched = NameEquals(slot->name, name);
+      uint32_t flags = slot->flags;
+      uint32_t count = std::min(slot->count, slot_capacity_);
+      uint64_t refresh_ms = slot->refresh_ms;
+      bool copied = matched && seq != known_version;
+      if (copied) {
+        endpoints.resize(count);
+        memcpy(endpoints.data(), slot->Endpoints(), count * sizeof(ShmEndpoint));
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot->seq.load(std::memory_order_relaxed) != seq) {
+        continue;
+      }
+      consistent = true;
+      if (!matched) {
+        continue;
+      }
+      meta->version = seq;
+      meta->refresh_ms = refresh_ms;
+      if (refresh_ms == 0) {
+        return ReadResult::kMiss;
+      }
+      if (flags & kSlotOverflow) {
+        return ReadResult::kOverflow;
+      }
+      if (!(flags & kSlotFound)) {
+        return ReadResult::kNotFound;
+      }
+      if (copied) {
+        table->Clear();
+        table->Reserve(count);
+        for (const auto& endpoint : endpoints) {
+          std::string_view host(endpoint.host, strnlen(endpoint.host, kMaxHostLength));
+          table->Add(host, endpoint.port, endpoint.status, interner);
+        }
+      }
+      return ReadResult::kFound;
+    }
+    if (!consistent) {
+      // Busy, the caller tries again later
+      return ReadResult::kMiss;
+    }
+  }
+  return ReadResult::kMiss;
+}
+
+ShmEndpointCache::Slot* ShmEndpointCache::FindSlot(std::string_view name, bool create) {
+  uint32_t start = static_cast<uint32_t>(HashName(name) % slot_num_);
+  for (uint32_t probe = 0; probe < slot_num_; ++probe) {
+    Slot* slot = GetSlot((start + probe) % slot_num_);
+    // Only the leader writes the slots, no seqlock needed to read them here
+    if (slot->seq.load(std::memory_order_relaxed) == 0) {
+      return create ? slot : nullptr;
+    }
+    if (NameEquals(slot->name, name)) {
+      return slot;
+    }
+  }
+  return nullptr;
+}
+
+int ShmEndpointCache::WriteSlot(std::string_view name, uint32_t flags, const ConsulEndpointTable* table,
+                                const HostInterner* interner, uint64_t refresh_ms) {
+  if (!IsLeader() || name.size() >= kMaxNameLength) {
+    return -1;
+  }
+  std::lock_guard<std::mutex> lock(write_mutex_);
+  Slot* slot = FindSlot(name, true);
+  if (slot == nullptr) {
+    TRPC_LOG_ERROR("shared endpoint cache is full, " << name << " is not shared");
+    return -1;
+  }
+  uint32_t count = 0;
+  TrpcEndpointInfo endpoint;
+  if (table != nullptr) {
+    if (table->Size() > slot_capacity_) {
+      flags |= kSlotOverflow;
+    }
+    for (size_t i = 0; i < table->Size() && !(flags & kSlotOverflow); ++i) {
+      table->MaterializeOne(*interner, i, &endpoint);
+      if (endpoint.host.size() >= kMaxHostLength) {
+        flags |= kSlotOverflow;
+      }
+    }
+  }
+
+  uint64_t seq = slot->seq.load(std::memory_order_relaxed);
+  slot->seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  if (seq == 0) {
+    CopyName(slot->name, name);
+  }
+  if (table != nullptr && !(flags & kSlotOverflow)) {
+    ShmEndpoint* endpoints = slot->Endpoints();
+    for (size_t i = 0; i < table->Size(); ++i, ++count) {
+      table->MaterializeOne(*interner, i, &endpoint);
+      memset(endpoints[i].host, 0, kMaxHostLength);
+      memcpy(endpoints[i].host, endpoint.host.data(), endpoint.host.size());
+      endpoints[i].port = endpoint.port;
+      endpoints[i].status = endpoint.status;
+    }
+  }
+  slot->flags = flags;
+  slot->count = count;
+  slot->refresh_ms = refresh_ms;
+  slot->seq.store(seq + 2, std::memory_order_release);
+  return 0;
+}
+
+int ShmEndpointCache::Write(std::string_view name, const ConsulEndpointTable& table, const HostInterner& interner,
+                            uint64_t refresh_ms) {
+  return WriteSlot(name, kSlotFound, &table, &interner, refresh_ms);
+}
+
+int ShmEndpointCache::WriteNotFound(std::string_view name, uint64_t refresh_ms) {
+  return WriteSlot(name, 0, nullptr, nullptr, refresh_ms);
+}
+
+bool ShmEndpointCache::Request(std::string_view name) {
+  if (base_ == nullptr || name.size() >= kMaxNameLength) {
+    return false;
+  }
+  for (uint32_t i = 0; i < kRequestNum; ++i) {
+    RequestSlot* request = GetRequest(i);
+    uint32_t state = kRequestFree;
+    if (request->state.compare_exchange_strong(state, kRequestWriting, std::memory_order_acquire)) {
+      CopyName(request->name, name);
+      request->state.store(kRequestPosted, std::memory_order_release);
+      return true;
+    }
+  }
+  return false;
+}
+
+void ShmEndpointCache::DrainRequests(std::vector<std::string>* names) {
+  if (!IsLeader()) {
+    return;
+  }
+  for (uint32_t i = 0; i < kRequestNum; ++i) {
+    RequestSlot* request = GetRequest(i);
+    uint32_t state = request->state.load(std::memory_order_acquire);
+    if (state == kRequestPosted) {
+      names->emplace_back(request->name, strnlen(request->name, kMaxNameLength));
+      request->state.store(kRequestFree, std::memory_order_release);
+    } else if (state == kRequestWriting && stuck_requests_[i]) {
+      request->state.compare_exchange_strong(state, kRequestFree, std::memory_order_relaxed);
+    }
+    stuck_requests_[i] = state == kRequestWriting;
+  }
+}
+
+}  // namespace trpc::consul
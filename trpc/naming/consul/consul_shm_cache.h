@@ -0,0 +1,139 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "trpc/naming/consul/consul_endpoint_table.h"
+
+namespace trpc::consul {
+
+/// @brief Endpoint tables shared by all processes of a host through a memory mapped file.
+///
+/// One process, the holder of an flock on `<path>.lock`, is the leader: it looks the callees up in Consul and
+/// writes their tables into the segment. All other processes map the tables read-only and read them under the
+/// seqlock of each slot, without any request to Consul. A follower asks the leader for a callee it does not find by
+/// posting its name into a small request ring, which is the only part of the segment it writes. When the leader
+/// exits the kernel drops its lock, and the next follower trying to lock takes over.
+///
+/// Segment layout: a header and the request ring, then `slot_num` fixed-size slots found by open addressing on the
+/// callee name. Slots are never freed, a name keeps its slot for the lifetime of the file.
+class ShmEndpointCache {
+ public:
+  // Longest callee name and endpoint host which fit into a slot, including the terminating zero
+  static constexpr size_t kMaxNameLength = 128;
+  static constexpr size_t kMaxHostLength = 64;
+
+  enum class ReadResult {
+    // The segment has nothing about the callee yet
+    kMiss,
+    // The table of the callee was read
+    kFound,
+    // The leader looked the callee up and Consul had no endpoints
+    kNotFound,
+    // The callee does not fit into the segment, it has to be looked up by the process itself
+    kOverflow,
+  };
+
+  struct ReadMeta {
+    // Changes with every write of the slot
+    uint64_t version{0};
+    // Time of the lookup of the leader which wrote the slot, in milliseconds
+    uint64_t refresh_ms{0};
+  };
+
+  ShmEndpointCache() = default;
+  ~ShmEndpointCache();
+
+  ShmEndpointCache(const ShmEndpointCache&) = delete;
+  ShmEndpointCache& operator=(const ShmEndpointCache&) = delete;
+
+  /// @brief Maps the segment at `path`, creating it if it does not exist, and tries to become the leader.
+  /// @return -1 if the segment cannot be mapped or was created with another layout.
+  int Init(const std::string& path, uint32_t slot_num, uint32_t slot_capacity);
+
+  /// @brief Unmaps the segment and gives up the leadership.
+  void Close();
+
+  bool Enabled() const { return base_ != nullptr; }
+
+  bool IsLeader() const { return leader_.load(std::memory_order_acquire); }
+
+  /// @brief Tries to become the leader, cheap enough to be called periodically.
+  /// @return true if this call made the process the leader.
+  bool TryLead();
+
+  /// @brief Reads the slot of `name`. If its version is still `known_version`, only `meta` is filled and `table` is
+  ///        left alone, otherwise `table` is cleared and refilled.
+  ReadResult Read(std::string_view name, uint64_t known_version, ConsulEndpointTable* table, HostInterner* interner,
+                  ReadMeta* meta) const;
+
+  /// @brief Writes the table of `name`, leader only.
+  /// @return -1 if the segment is full or the process is not the leader.
+  int Write(std::string_view name, const ConsulEndpointTable& table, const HostInterner& interner,
+            uint64_t refresh_ms);
+
+  /// @brief Records that Consul has no endpoints of `name`, leader only.
+  int WriteNotFound(std::string_view name, uint64_t refresh_ms);
+
+  /// @brief Asks the leader to look `name` up.
+  /// @return false if the request ring is full, the request should be repeated later.
+  bool Request(std::string_view name);
+
+  /// @brief Takes the posted requests out of the ring, leader only.
+  void DrainRequests(std::vector<std::string>* names);
+
+ private:
+  struct Header;
+  struct RequestSlot;
+  struct Slot;
+
+  Header* GetHeader() const;
+  RequestSlot* GetRequest(uint32_t index) const;
+  Slot* GetSlot(uint32_t index) const;
+
+  // Finds the slot of `name`, or claims an empty one if `create` is set. Writers only.
+  Slot* FindSlot(std::string_view name, bool create);
+
+  // Writes a slot under its seqlock
+  int WriteSlot(std::string_view name, uint32_t flags, const ConsulEndpointTable* table, const HostInterner* interner,
+                uint64_t refresh_ms);
+
+  // Closes the slots a crashed leader left in the middle of a write
+  void RecoverSlots();
+
+  int ProtectSlots(bool writable);
+
+  int fd_{-1};
+  int lock_fd_{-1};
+  char* base_{nullptr};
+  size_t size_{0};
+  size_t slots_offset_{0};
+  size_t slot_size_{0};
+  uint32_t slot_num_{0};
+  uint32_t slot_capacity_{0};
+
+  std::atomic<bool> leader_{false};
+  // Serializes the writers of the leader process
+  std::mutex write_mutex_;
+  // Request slots seen half written by the last drain, a poster which died in between never finishes them
+  std::vector<bool> stuck_requests_;
+};
+
+}  // namespace trpc::consul
@@ -0,0 +1,209 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#include "trpc/naming/consul/consul_shm_cache.h"
+
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace trpc::consul {
+
+namespace {
+
+class ShmEndpointCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    path_ = ::testing::TempDir() + "/consul_shm_cache_test." + std::to_string(getpid());
+    unlink(path_.c_str());
+    unlink((path_ + ".lock").c_str());
+  }
+
+  void TearDown() override {
+    unlink(path_.c_str());
+    unlink((path_ + ".lock").c_str());
+  }
+
+  ConsulEndpointTable MakeTable(int endpoint_num, int port) {
+    ConsulEndpointTable table;
+    for (int i = 0; i < endpoint_num; ++i) {
+      table.Add("10.0.0." + std::to_string(i), port, 0, &interner_);
+    }
+    return table;
+  }
+
+  std::string path_;
+  HostInterner interner_;
+};
+
+}  // namespace
+
+TEST_F(ShmEndpointCacheTest, leader_election_test) {
+  ShmEndpointCache leader;
+  ASSERT_EQ(0, leader.Init(path_, 16, 8));
+  EXPECT_TRUE(leader.IsLeader());
+
+  ShmEndpointCache follower;
+  ASSERT_EQ(0, follower.Init(path_, 16, 8));
+  EXPECT_FALSE(follower.IsLeader());
+  EXPECT_FALSE(follower.TryLead());
+
+  // Another layout on the same file is refused
+  ShmEndpointCache other;
+  EXPECT_EQ(-1, other.Init(path_, 32, 8));
+  EXPECT_FALSE(other.Enabled());
+
+  leader.Close();
+  EXPECT_TRUE(follower.TryLead());
+  EXPECT_TRUE(follower.IsLeader());
+}
+
+TEST_F(ShmEndpointCacheTest, write_and_read_test) {
+  ShmEndpointCache leader;
+  ASSERT_EQ(0, leader.Init(path_, 16, 8));
+  ShmEndpointCache follower;
+  ASSERT_EQ(0, follower.Init(path_, 16, 8));
+
+  ConsulEndpointTable table;
+  ShmEndpointCache::ReadMeta meta;
+  EXPECT_EQ(ShmEndpointCache::ReadResult::kMiss, follower.Read("testconfig", 0, &table, &interner_, &meta));
+
+  // Followers never write the tables
+  EXPECT_EQ(-1, follower.Write("testconfig", MakeTable(3, 8000), interner_, 100));
+
+  ASSERT_EQ(0, leader.Write("testconfig", MakeTable(3, 8000), interner_, 100));
+  ASSERT_EQ(ShmEndpointCache::ReadResult::kFound, follower.Read("testconfig", 0, &table, &interner_, &meta));
+  EXPECT_TRUE(table.Equals(MakeTable(3, 8000)));
+  EXPECT_EQ(100, meta.refresh_ms);
+
+  // Unchanged version, the table is not read again
+  ConsulEndpointTable untouched;
+  ShmEndpointCache::ReadMeta same_meta;
+  EXPECT_EQ(ShmEndpointCache::ReadResult::kFound,
+            follower.Read("testconfig", meta.version, &untouched, &interner_, &same_meta));
+  EXPECT_EQ(meta.version, same_meta.version);
+  EXPECT_TRUE(untouched.Empty());
+
+  ASSERT_EQ(0, leader.Write("testconfig", MakeTable(2, 9000), interner_, 200));
+  ASSERT_EQ(ShmEndpointCache::ReadResult::kFound, follower.Read("testconfig", meta.version, &table, &interner_,
+                                                                &meta));
+  EXPECT_TRUE(table.Equals(MakeTable(2, 9000)));
+  EXPECT_EQ(200, meta.refresh_ms);
+
+  ASSERT_EQ(0, leader.WriteNotFound("unknown", 300));
+  EXPECT_EQ(ShmEndpointCache::ReadResult::kNotFound, follower.Read("unknown", 0, &table, &interner_, &meta));
+
+  // More endpoints than a slot holds, and a name longer than a slot holds
+  ASSERT_EQ(0, leader.Write("large", MakeTable(9, 8000), interner_, 400));
+  EXPECT_EQ(ShmEndpointCache::ReadResult::kOverflow, follower.Read("large", 0, &table, &interner_, &meta));
+  std::string long_name(ShmEndpointCache::kMaxNameLength, 'a');
+  EXPECT_EQ(ShmEndpointCache::ReadResult::kOverflow, follower.Read(long_name, 0, &table, &interner_, &meta));
+}
+
+TEST_F(ShmEndpointCacheTest, full_segment_test) {
+  ShmEndpointCache leader;
+  ASSERT_EQ(0, leader.Init(path_, 4, 8));
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_EQ(0, leader.Write("service" + std::to_string(i), MakeTable(1, 8000), interner_, 100));
+  }
+  EXPECT_EQ(-1, leader.Write("service4", MakeTable(1, 8000), interner_, 100));
+
+  ConsulEndpointTable table;
+  ShmEndpointCache::ReadMeta meta;
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_EQ(ShmEndpointCache::ReadResult::kFound,
+              leader.Read("service" + std::to_string(i), 0, &table, &interner_, &meta));
+  }
+  EXPECT_EQ(ShmEndpointCache::ReadResult::kMiss, leader.Read("service4", 0, &table, &interner_, &meta));
+}
+
+TEST_F(ShmEndpointCacheTest, request_test) {
+  ShmEndpointCache leader;
+  ASSERT_EQ(0, leader.Init(path_, 16, 8));
+  ShmEndpointCache follower;
+  ASSERT_EQ(0, follower.Init(path_, 16, 8));
+
+  EXPECT_TRUE(follower.Request("service1"));
+  EXPECT_TRUE(follower.Request("service2"));
+
+  // Only the leader takes requests out
+  std::vector<std::string> names;
+  follower.DrainRequests(&names);
+  EXPECT_TRUE(names.empty());
+  leader.DrainRequests(&names);
+  ASSERT_EQ(2, names.size());
+  EXPECT_EQ("service1", names[0]);
+  EXPECT_EQ("service2", names[1]);
+
+  names.clear();
+  leader.DrainRequests(&names);
+  EXPECT_TRUE(names.empty());
+
+  // The ring is bounded
+  int posted = 0;
+  while (follower.Request("service") && posted < 1000) {
+    ++posted;
+  }
+  EXPECT_LT(posted, 1000);
+  leader.DrainRequests(&names);
+  EXPECT_EQ(posted, names.size());
+}
+
+TEST_F(ShmEndpointCacheTest, concurrent_read_test) {
+  ShmEndpointCache leader;
+  ASSERT_EQ(0, leader.Init(path_, 16, 64));
+  ShmEndpointCache follower;
+  ASSERT_EQ(0, follower.Init(path_, 16, 64));
+  ASSERT_EQ(0, leader.Write("testconfig", MakeTable(64, 1), interner_, 1));
+
+  // Every write uses one port for all endpoints, a torn read would mix them
+  std::atomic<bool> stop{false};
+  std::atomic<int> torn{0};
+  std::atomic<int> reads{0};
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 4; ++i) {
+    readers.emplace_back([&]() {
+      HostInterner interner;
+      ConsulEndpointTable table;
+      ShmEndpointCache::ReadMeta meta;
+      while (!stop.load()) {
+        if (follower.Read("testconfig", 0, &table, &interner, &meta) != ShmEndpointCache::ReadResult::kFound) {
+          continue;
+        }
+        reads.fetch_add(1);
+        std::vector<TrpcEndpointInfo> endpoints;
+        table.Materialize(interner, &endpoints);
+        if (endpoints.size() != 64 || endpoints.front().port != static_cast<int>(meta.refresh_ms) ||
+            endpoints.back().port != static_cast<int>(meta.refresh_ms)) {
+          torn.fetch_add(1);
+        }
+      }
+    });
+  }
+  for (int port = 2; port < 2000; ++port) {
+    ASSERT_EQ(0, leader.Write("testconfig", MakeTable(64, port), interner_, port));
+  }
+  stop = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  EXPECT_GT(reads.load(), 0);
+  EXPECT_EQ(0, torn.load());
+}
+
+}  // namespace trpc::consul
@@ -0,0 +1,123 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+
+#include "trpc/naming/consul/consul_slow_start.h"
+
+#include <algorithm>
+#include <random>
+
+namespace trpc::consul {
+
+std::shared_ptr<const SlowStartRamp> SlowStartRamp::Build(const ConsulEndpointTable& table,
+                                                          const EndpointChangeIndexes& changes,
+                                                          const SlowStartRamp* previous, uint32_t window_ms,
+                                                          uint32_t min_weight, uint64_t now) {
+  if (window_ms == 0) {
+    return nullptr;
+  }
+  std::shared_ptr<SlowStartRamp> ramp(new SlowStartRamp(window_ms, std::min<uint32_t>(min_weight, 100)));
+  for (uint32_t index : changes.added) {
+    ramp->starts_.emplace_back(table.Id(index), now);
+  }
+  for (uint32_t index : changes.status_changed) {
+    if (table.Status(index) == 0) {
+      ramp->starts_.emplace_back(table.Id(index), now);
+    }
+  }
+  // Endpoints still ramping keep their start, unless they restarted above. The previous ramp is small, so each
+  // endpoint of the table is looked up in it rather than the other way round.
+  if (previous != nullptr && previous->Active(now)) {
+    size_t restarted = ramp->starts_.size();
+    std::sort(ramp->starts_.begin(), ramp->starts_.end());
+    for (size_t i = 0; i < table.Size(); ++i) {
+      const uint64_t* start = previous->FindStart(table.Id(i));
+      if (start == nullptr || now >= *start + window_ms) {
+        continue;
+      }
+      auto pos = std::lower_bound(ramp->starts_.begin(), ramp->starts_.begin() + restarted,
+                                  std::make_pair(table.Id(i), uint64_t{0}));
+      if (pos == ramp->starts_.begin() + restarted || pos->first != table.Id(i)) {
+        ramp->starts_.emplace_back(table.Id(i), *start);
+      }
+    }
+  }
+  if (ramp->starts_.empty()) {
+    return nullptr;
+  }
+  std::sort(ramp->starts_.begin(), ramp->starts_.end());
+  for (const auto& item : ramp->starts_) {
+    ramp->end_ms_ = std::max(ramp->end_ms_, item.second + window_ms);
+  }
+  return ramp;
+}
+
+uint64_t SlowStartRamp::NextStepMs(uint64_t now) const {
+  uint64_t step_ms = std::max<uint64_t>(window_ms_ / kSteps, 1);
+  uint64_t next = UINT64_MAX;
+  for (const auto& item : starts_) {
+    uint64_t end = item.second + window_ms_;
+    if (now >= end) {
+      continue;
+    }
+    uint64_t step = now >= item.second ? (now - item.second) / step_ms + 1 : 0;
+    next = std::min(next, std::min(end, item.second + step * step_ms));
+  }
+  return next;
+}
+
+const uint64_t* SlowStartRamp::FindStart(uint64_t id) const {
+  auto pos = std::lower_bound(starts_.begin(), starts_.end(), std::make_pair(id, uint64_t{0}));
+  if (pos == starts_.end() || pos->first != id) {
+    return nullptr;
+  }
+  return &pos->second;
+}
+
+uint32_t SlowStartRamp::WeightPercent(uint64_t id, uint64_t now) const {
+  const uint64_t* start = FindStart(id);
+  if (start == nullptr || now >= *start + window_ms_) {
+    return 100;
+  }
+  uint64_t elapsed = now > *start ? now - *start : 0;
+  uint64_t step = elapsed * kSteps / window_ms_;
+  return min_weight_ + static_cast<uint32_t>((100 - min_weight_) * step / kSteps);
+}
+
+void SlowStartRamp::ApplyWeights(uint64_t now, std::vector<TrpcEndpointInfo>* endpoints) const {
+  if (!Active(now)) {
+    return;
+  }
+  for (auto& endpoint : *endpoints) {
+    uint32_t percent = WeightPercent(endpoint.id, now);
+    if (percent < 100) {
+      endpoint.weight = std::max<uint32_t>(static_cast<uint32_t>(uint64_t{endpoint.weight} * percent / 100), 1);
+    }
+  }
+}
+
+uint32_t FullEndpointWeight() {
+  static const uint32_t weight = TrpcEndpointInfo().weight;
+  return weight;
+}
+
+bool AcceptSlowStartPick(const TrpcEndpointInfo& endpoint) {
+  uint32_t full = FullEndpointWeight();
+  if (endpoint.weight >= full) {
+    return true;
+  }
+  thread_local std::minstd_rand random(std::random_device{}());
+  return random() % full < endpoint.weight;
+}
+
+}  // namespace trpc::consul
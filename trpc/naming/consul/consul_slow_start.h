@@ -0,0 +1,81 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "trpc/naming/consul/consul_endpoint_table.h"
+
+namespace trpc::consul {
+
+/// @brief Slow-start ramp of the endpoints of one callee.
+///
+/// Endpoints joining the callee, or turning healthy again, start at `min_weight` percent of the full weight and
+/// reach it at the end of the window. The weight grows in `kSteps` steps, so the endpoint list of a ramping callee
+/// is only republished a few times per window. Immutable once built and shared by the snapshot of the callee.
+class SlowStartRamp {
+ public:
+  static constexpr uint32_t kSteps = 10;
+
+  /// @brief Builds the ramp of `table`, whose ids are assigned and compared to the previous table into `changes`.
+  /// The endpoints at `changes.added`, and those at `changes.status_changed` which are healthy, start ramping at
+  /// `now`, the others keep the ramp they had in `previous`.
+  /// @param min_weight weight at the start of the window, in percent
+  /// @return nullptr if no endpoint of `table` is ramping
+  static std::shared_ptr<const SlowStartRamp> Build(const ConsulEndpointTable& table,
+                                                    const EndpointChangeIndexes& changes,
+                                                    const SlowStartRamp* previous, uint32_t window_ms,
+                                                    uint32_t min_weight, uint64_t now);
+
+  bool Active(uint64_t now) const { return now < end_ms_; }
+
+  /// @brief Time the weights change next, UINT64_MAX once the ramp is over.
+  uint64_t NextStepMs(uint64_t now) const;
+
+  /// @brief Weight of endpoint `id` at `now`, in percent of the full weight, 100 if the endpoint is not ramping.
+  uint32_t WeightPercent(uint64_t id, uint64_t now) const;
+
+  /// @brief Scales the weights of the ramping endpoints in `endpoints` to `now`.
+  void ApplyWeights(uint64_t now, std::vector<TrpcEndpointInfo>* endpoints) const;
+
+  /// @brief Number of ramping endpoints.
+  size_t Size() const { return starts_.size(); }
+
+ private:
+  SlowStartRamp(uint32_t window_ms, uint32_t min_weight) : window_ms_(window_ms), min_weight_(min_weight) {}
+
+  // Start of the ramp of `id`, nullptr if it is not ramping
+  const uint64_t* FindStart(uint64_t id) const;
+
+  uint32_t window_ms_;
+  uint32_t min_weight_;
+  // (id, start of the ramp) of the ramping endpoints, sorted by id
+  std::vector<std::pair<uint64_t, uint64_t>> starts_;
+  // End of the last ramp
+  uint64_t end_ms_{0};
+};
+
+/// @brief Weight of an endpoint outside the slow-start window. Consul weights are not used, all endpoints have the
+/// default weight.
+uint32_t FullEndpointWeight();
+
+/// @brief Thins the picks of a balancer ignoring the weights, such as round robin: a pick of `endpoint` is kept with
+/// probability weight / full weight. Endpoints at full weight are kept without drawing a random number.
+bool AcceptSlowStartPick(const TrpcEndpointInfo& endpoint);
+
+}  // namespace trpc::consul
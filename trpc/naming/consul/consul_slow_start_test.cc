@@ -0,0 +1,119 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+
+#include "trpc/naming/consul/consul_slow_start.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace trpc::consul {
+
+namespace {
+
+constexpr uint32_t kWindowMs = 10000;
+
+class SlowStartRampTest : public ::testing::Test {
+ protected:
+  // Publishes `hosts` with `statuses` as the next table of the callee, returns the ramp built at `now`
+  std::shared_ptr<const SlowStartRamp> Publish(const std::vector<int>& hosts, const std::vector<int>& statuses,
+                                               uint64_t now) {
+    ConsulEndpointTable table;
+    for (size_t i = 0; i < hosts.size(); ++i) {
+      table.Add("10.0.0." + std::to_string(hosts[i]), 8000, statuses[i], &interner_);
+    }
+    table.AssignIds(&id_generator_);
+    EndpointChangeIndexes changes;
+    table.Diff(table_, &changes);
+    ramp_ = SlowStartRamp::Build(table, changes, ramp_.get(), kWindowMs, 10, now);
+    table_ = table;
+    return ramp_;
+  }
+
+  HostInterner interner_;
+  CompactEndpointIdGenerator id_generator_;
+  ConsulEndpointTable table_;
+  std::shared_ptr<const SlowStartRamp> ramp_;
+};
+
+}  // namespace
+
+TEST_F(SlowStartRampTest, ramp_test) {
+  // The endpoints of the first table are all new to the callee, the selector starts without a ramp then
+  ASSERT_NE(nullptr, Publish({1, 2}, {0, 0}, 1000));
+  ramp_ = nullptr;
+  ASSERT_EQ(nullptr, Publish({1, 2}, {0, 0}, 1000));
+
+  auto ramp = Publish({1, 2, 3}, {0, 0, 0}, 2000);
+  ASSERT_NE(nullptr, ramp);
+  EXPECT_EQ(1, ramp->Size());
+  uint64_t new_id = table_.Id(2);
+  EXPECT_EQ(10, ramp->WeightPercent(new_id, 2000));
+  EXPECT_EQ(10, ramp->WeightPercent(new_id, 2999));
+  EXPECT_EQ(19, ramp->WeightPercent(new_id, 3000));
+  EXPECT_EQ(91, ramp->WeightPercent(new_id, 11999));
+  EXPECT_EQ(100, ramp->WeightPercent(new_id, 12000));
+  EXPECT_EQ(100, ramp->WeightPercent(table_.Id(0), 2000));
+  EXPECT_EQ(3000, ramp->NextStepMs(2000));
+  EXPECT_EQ(3000, ramp->NextStepMs(2999));
+  EXPECT_EQ(12000, ramp->NextStepMs(11500));
+  EXPECT_EQ(UINT64_MAX, ramp->NextStepMs(12000));
+  EXPECT_TRUE(ramp->Active(11999));
+  EXPECT_FALSE(ramp->Active(12000));
+
+  std::vector<TrpcEndpointInfo> endpoints;
+  table_.Materialize(interner_, &endpoints);
+  ramp->ApplyWeights(7000, &endpoints);
+  EXPECT_EQ(FullEndpointWeight(), endpoints[0].weight);
+  EXPECT_EQ(FullEndpointWeight(), endpoints[1].weight);
+  EXPECT_EQ(FullEndpointWeight() * 55 / 100, endpoints[2].weight);
+}
+
+TEST_F(SlowStartRampTest, keep_and_restart_test) {
+  Publish({1, 2}, {0, 0}, 1000);
+  ramp_ = nullptr;
+  Publish({1, 2, 3}, {0, 0, 0}, 2000);
+  uint64_t id3 = table_.Id(2);
+
+  // A later refresh keeps the start of the ramping endpoint, and starts the ramp of an endpoint turning healthy
+  auto ramp = Publish({1, 2, 3}, {-1, 0, 0}, 4000);
+  EXPECT_EQ(1, ramp->Size());
+  ramp = Publish({1, 2, 3}, {0, 0, 0}, 5000);
+  ASSERT_EQ(2, ramp->Size());
+  EXPECT_EQ(37, ramp->WeightPercent(id3, 5000));
+  EXPECT_EQ(10, ramp->WeightPercent(table_.Id(0), 5000));
+  EXPECT_EQ(6000, ramp->NextStepMs(5000));
+  EXPECT_TRUE(ramp->Active(14000));
+
+  // Removed endpoints and finished ramps are dropped
+  ramp = Publish({1, 2}, {0, 0}, 12000);
+  EXPECT_EQ(1, ramp->Size());
+  EXPECT_EQ(nullptr, Publish({1, 2}, {0, 0}, 15000));
+}
+
+TEST(SlowStartPickTest, accept_test) {
+  TrpcEndpointInfo endpoint;
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_TRUE(AcceptSlowStartPick(endpoint));
+  }
+  endpoint.weight = FullEndpointWeight() / 4;
+  int accepted = 0;
+  for (int i = 0; i < 10000; ++i) {
+    accepted += AcceptSlowStartPick(endpoint);
+  }
+  EXPECT_GT(accepted, 2000);
+  EXPECT_LT(accepted, 3000);
+}
+
+}  // namespace trpc::consul
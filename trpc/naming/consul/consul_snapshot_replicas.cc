@@ -0,0 +1,245 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#include "trpc/naming/consul/consul_snapshot_replicas.h"
+
+#include <sched.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+namespace trpc::consul {
+
+namespace {
+
+// Re-read the CPU of the thread every so many selects, in case the thread migrated
+constexpr uint32_t kCpuRefreshInterval = 256;
+
+// Parses a sysfs cpu list like "0-3,8-11" and calls `fn` for each cpu.
+void ForEachCpu(const std::string& cpu_list, const std::function<void(uint32_t)>& fn) {
+  std::stringstream ss(cpu_list);
+  std::string range;
+  while (std::getline(ss, range, ',')) {
+    if (range.empty()) continue;
+    size_t dash = range.find('-');
+    uint32_t first = std::stoul(range.substr(0, dash));
+    uint32_t last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+    for (uint32_t cpu = first; cpu <= last; ++cpu) {
+      fn(cpu);
+    }
+  }
+}
+
+// Maps each cpu to its NUMA node ordinal, returns the number of nodes or zero if the topology is unknown.
+uint32_t ReadNumaTopology(uint32_t cpu_num, std::vector<uint32_t>* cpu_to_node) {
+  std::ifstream online("/sys/devices/system/node/online");
+  std::string node_list;
+  if (!online || !std::getline(online, node_list)) {
+    return 0;
+  }
+  uint32_t node_num = 0;
+  try {
+    ForEachCpu(node_list, [&](uint32_t node) {
+      std::ifstream cpus("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+      std::string cpu_list;
+      if (cpus && std::getline(cpus, cpu_list)) {
+        ForEachCpu(cpu_list, [&](uint32_t cpu) {
+          if (cpu < cpu_num) (*cpu_to_node)[cpu] = node_num;
+        });
+      }
+      ++node_num;
+    });
+  } catch (...) {
+    return 0;
+  }
+  return node_num;
+}
+
+struct ThreadReplicaCache {
+  uint32_t replica{0};
+  uint32_t countdown{0};
+};
+
+thread_local ThreadReplicaCache thread_replica_cache;
+
+// Round robin cursor of the thread, started at a per-thread offset so threads do not move in lockstep
+thread_local uint32_t thread_cursor =
+    static_cast<uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id()));
+
+void StampAccess(std::atomic<uint32_t>* stamp, uint32_t access_epoch) {
+  if (access_epoch != 0 && stamp->load(std::memory_order_relaxed) != access_epoch) {
+    stamp->store(access_epoch, std::memory_order_relaxed);
+  }
+}
+
+}  // namespace
+
+void SnapshotReplicas::Init(uint32_t replica_num) {
+  long cpus = sysconf(_SC_NPROCESSORS_CONF);
+  uint32_t cpu_num = cpus > 0 ? static_cast<uint32_t>(cpus) : 1;
+  cpu_to_replica_.assign(cpu_num, 0);
+
+  if (replica_num == 0) {
+    replica_num = ReadNumaTopology(cpu_num, &cpu_to_replica_);
+  } else {
+    // Contiguous groups of cpus, like the scheduling groups of the fiber runtime
+    for (uint32_t cpu = 0; cpu < cpu_num; ++cpu) {
+      cpu_to_replica_[cpu] = static_cast<uint32_t>(static_cast<uint64_t>(cpu) * replica_num / cpu_num);
+    }
+  }
+  if (replica_num == 0) {
+    replica_num = 1;
+    cpu_to_replica_.assign(cpu_num, 0);
+  }
+
+  replicas_.clear();
+  for (uint32_t i = 0; i < replica_num; ++i) {
+    replicas_.emplace_back(std::make_unique<Replica>());
+  }
+}
+
+uint32_t SnapshotReplicas::CurrentReplica() const {
+  if (replicas_.size() <= 1) {
+    return 0;
+  }
+  ThreadReplicaCache& cache = thread_replica_cache;
+  if (cache.countdown == 0) {
+    int cpu = sched_getcpu();
+    cache.replica = (cpu >= 0 && static_cast<size_t>(cpu) < cpu_to_replica_.size()) ? cpu_to_replica_[cpu] : 0;
+    cache.countdown = kCpuRefreshInterval;
+  }
+  --cache.countdown;
+  return cache.replica;
+}
+
+void SnapshotReplicas::Publish(const std::string& name, ConsulEndpointListPtr endpoints) {
+  {
+    std::unique_lock<std::shared_mutex> lock(master_mutex_);
+    master_[name] = std::move(endpoints);
+  }
+  // Copies are dropped, the next select on each replica takes a fresh copy. Their access stamps are kept.
+  for (auto& replica : replicas_) {
+    std::unique_lock<std::shared_mutex> lock(replica->mutex);
+    auto iter = replica->copies.find(name);
+    if (iter != replica->copies.end()) {
+      iter->second.endpoints = nullptr;
+    }
+  }
+}
+
+uint64_t SnapshotReplicas::Remove(const std::string& name) {
+  {
+    std::unique_lock<std::shared_mutex> lock(master_mutex_);
+    master_.erase(name);
+  }
+  uint64_t selects = 0;
+  for (auto& replica : replicas_) {
+    std::unique_lock<std::shared_mutex> lock(replica->mutex);
+    auto iter = replica->copies.find(name);
+    if (iter != replica->copies.end()) {
+      selects += iter->second.selects.Value();
+      replica->copies.erase(iter);
+    }
+  }
+  return selects;
+}
+
+ConsulEndpointListPtr SnapshotReplicas::Get(const std::string& name, uint32_t access_epoch) {
+  return Lookup(name, access_epoch, false);
+}
+
+ConsulEndpointListPtr SnapshotReplicas::Lookup(const std::string& name, uint32_t access_epoch, bool count) {
+  if (replicas_.empty()) {
+    return nullptr;
+  }
+  Replica& replica = *replicas_[CurrentReplica()];
+  {
+    std::shared_lock<std::shared_mutex> lock(replica.mutex);
+    auto iter = replica.copies.find(name);
+    if (iter != replica.copies.end() && iter->second.endpoints != nullptr) {
+      StampAccess(&iter->second.access_epoch, access_epoch);
+      if (count && !iter->second.endpoints->empty()) {
+        iter->second.selects.Add();
+      }
+      return iter->second.endpoints;
+    }
+  }
+
+  ConsulEndpointListPtr master;
+  {
+    std::shared_lock<std::shared_mutex> lock(master_mutex_);
+    auto iter = master_.find(name);
+    if (iter == master_.end()) {
+      return nullptr;
+    }
+    master = iter->second;
+  }
+  // Copied by a thread of this replica, so the list is allocated on the node of its readers
+  auto copy = std::make_shared<const std::vector<TrpcEndpointInfo>>(*master);
+  std::unique_lock<std::shared_mutex> lock(replica.mutex);
+  // A publish in between dropped the copies, only install ours if the master is still the one we copied
+  std::shared_lock<std::shared_mutex> master_lock(master_mutex_);
+  auto iter = master_.find(name);
+  if (iter != master_.end() && iter->second == master) {
+    Copy& installed = replica.copies[name];
+    installed.endpoints = copy;
+    StampAccess(&installed.access_epoch, access_epoch);
+  }
+  // Counted on the copy a publish in between left in place, if any
+  auto counted = replica.copies.find(name);
+  if (count && !copy->empty() && counted != replica.copies.end()) {
+    counted->second.selects.Add();
+  }
+  return copy;
+}
+
+bool SnapshotReplicas::SelectOne(const std::string& name, TrpcEndpointInfo* endpoint, uint32_t access_epoch,
+                                 bool count) {
+  ConsulEndpointListPtr endpoints = Lookup(name, access_epoch, count);
+  if (endpoints == nullptr || endpoints->empty()) {
+    return false;
+  }
+  *endpoint = (*endpoints)[thread_cursor++ % endpoints->size()];
+  return true;
+}
+
+uint32_t SnapshotReplicas::LastAccessEpoch(const std::string& name) const {
+  uint32_t last = 0;
+  for (const auto& replica : replicas_) {
+    std::shared_lock<std::shared_mutex> lock(replica->mutex);
+    auto iter = replica->copies.find(name);
+    if (iter != replica->copies.end()) {
+      last = std::max(last, iter->second.access_epoch.load(std::memory_order_relaxed));
+    }
+  }
+  return last;
+}
+
+uint64_t SnapshotReplicas::SelectCount(const std::string& name) const {
+  uint64_t selects = 0;
+  for (const auto& replica : replicas_) {
+    std::shared_lock<std::shared_mutex> lock(replica->mutex);
+    auto iter = replica->copies.find(name);
+    if (iter != replica->copies.end()) {
+      selects += iter->second.selects.Value();
+    }
+  }
+  return selects;
+}
+
+}  // namespace trpc::consul
@@ -0,0 +1,94 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "trpc/naming/consul/consul_endpoint_table.h"
+#include "trpc/naming/consul/consul_select_metrics.h"
+
+namespace trpc::consul {
+
+/// @brief Read-only endpoint lists replicated per NUMA node or scheduling group.
+///
+/// Each replica has its own lock and map, and the endpoint list of a callee is copied into a replica by the first
+/// select running on it after a publish, so the copy is allocated on the node of its readers. Selecting threads
+/// only touch the replica of the CPU they run on and keep their round robin cursor to themselves, which avoids
+/// cross-socket cache line traffic on the select path.
+class SnapshotReplicas {
+ public:
+  /// @brief Creates `replica_num` replicas, or one per NUMA node if zero.
+  void Init(uint32_t replica_num);
+
+  uint32_t Size() const { return static_cast<uint32_t>(replicas_.size()); }
+
+  /// @brief Publishes a new endpoint list of `name` and invalidates the copies held by the replicas.
+  void Publish(const std::string& name, ConsulEndpointListPtr endpoints);
+
+  /// @brief Drops `name` from the master and all replicas.
+  /// @return the selects counted on the dropped copies, see `SelectCount`.
+  uint64_t Remove(const std::string& name);
+
+  /// @brief Returns the endpoint list of `name` held by the replica of the calling thread, nullptr if unknown.
+  /// @param access_epoch if not zero, stamped on the copy of the replica as the last access of `name`, see
+  ///        `LastAccessEpoch`
+  ConsulEndpointListPtr Get(const std::string& name, uint32_t access_epoch = 0);
+
+  /// @brief Round robin selection on the replica of the calling thread, with a cursor private to the thread.
+  /// @param count if true, the select is counted on the copy of the replica, see `SelectCount`
+  /// @return false if `name` is unknown or has no endpoints.
+  bool SelectOne(const std::string& name, TrpcEndpointInfo* endpoint, uint32_t access_epoch = 0, bool count = false);
+
+  /// @brief Selects of `name` counted by `SelectOne` in all replicas since it was first published or last removed.
+  uint64_t SelectCount(const std::string& name) const;
+
+  /// @brief Latest access epoch stamped on a copy of `name` by `Get` or `SelectOne` in any replica, zero if none.
+  uint32_t LastAccessEpoch(const std::string& name) const;
+
+  /// @brief Index of the replica serving the calling thread.
+  uint32_t CurrentReplica() const;
+
+ private:
+  ConsulEndpointListPtr Lookup(const std::string& name, uint32_t access_epoch, bool count);
+
+  struct Copy {
+    ConsulEndpointListPtr endpoints;
+    // Only stored when it changes, so that the cache line stays shared between the readers of the replica
+    std::atomic<uint32_t> access_epoch{0};
+    // Kept across publishes. Sharded, so counting does not dirty the line of `endpoints`
+    ShardedCounter selects;
+  };
+
+  struct alignas(64) Replica {
+    mutable std::shared_mutex mutex;
+    std::unordered_map<std::string, Copy> copies;
+  };
+
+  // Lists published by the refresh path, only read when a replica misses
+  std::unordered_map<std::string, ConsulEndpointListPtr> master_;
+  mutable std::shared_mutex master_mutex_;
+
+  std::vector<std::unique_ptr<Replica>> replicas_;
+
+  // Replica of each CPU
+  std::vector<uint32_t> cpu_to_replica_;
+};
+
+}  // namespace trpc::consul
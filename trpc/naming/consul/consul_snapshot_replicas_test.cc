@@ -0,0 +1,132 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#include "trpc/naming/consul/consul_snapshot_replicas.h"
+
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace trpc::consul {
+
+namespace {
+
+ConsulEndpointListPtr MakeEndpoints(int endpoint_num) {
+  auto endpoints = std::make_shared<std::vector<TrpcEndpointInfo>>();
+  for (int i = 0; i < endpoint_num; ++i) {
+    TrpcEndpointInfo endpoint;
+    endpoint.host = "10.0.0." + std::to_string(i);
+    endpoint.port = 8000;
+    endpoint.id = i;
+    endpoints->push_back(std::move(endpoint));
+  }
+  return endpoints;
+}
+
+}  // namespace
+
+TEST(SnapshotReplicasTest, publish_and_get_test) {
+  SnapshotReplicas replicas;
+  replicas.Init(2);
+  ASSERT_EQ(2, replicas.Size());
+  EXPECT_LT(replicas.CurrentReplica(), replicas.Size());
+  EXPECT_EQ(nullptr, replicas.Get("unknown"));
+
+  ConsulEndpointListPtr endpoints = MakeEndpoints(3);
+  replicas.Publish("testconfig", endpoints);
+  ConsulEndpointListPtr copy = replicas.Get("testconfig");
+  ASSERT_TRUE(copy != nullptr);
+  // The replica holds its own copy, and serves it until the next publish
+  EXPECT_NE(endpoints.get(), copy.get());
+  EXPECT_EQ(3, copy->size());
+  EXPECT_EQ(copy.get(), replicas.Get("testconfig").get());
+
+  replicas.Publish("testconfig", MakeEndpoints(5));
+  EXPECT_EQ(5, replicas.Get("testconfig")->size());
+
+  replicas.Remove("testconfig");
+  EXPECT_EQ(nullptr, replicas.Get("testconfig"));
+}
+
+TEST(SnapshotReplicasTest, select_one_test) {
+  SnapshotReplicas replicas;
+  // Zero falls back to a single replica without NUMA topology
+  replicas.Init(0);
+  ASSERT_GE(replicas.Size(), 1);
+
+  TrpcEndpointInfo endpoint;
+  EXPECT_FALSE(replicas.SelectOne("testconfig", &endpoint));
+  replicas.Publish("testconfig", MakeEndpoints(0));
+  EXPECT_FALSE(replicas.SelectOne("testconfig", &endpoint));
+
+  replicas.Publish("testconfig", MakeEndpoints(4));
+  std::set<uint64_t> ids;
+  for (int i = 0; i < 4; ++i) {
+    ASSERT_TRUE(replicas.SelectOne("testconfig", &endpoint));
+    ids.insert(endpoint.id);
+  }
+  EXPECT_EQ(4, ids.size());
+}
+
+TEST(SnapshotReplicasTest, access_epoch_test) {
+  SnapshotReplicas replicas;
+  replicas.Init(2);
+  EXPECT_EQ(0, replicas.LastAccessEpoch("testconfig"));
+
+  replicas.Publish("testconfig", MakeEndpoints(2));
+  TrpcEndpointInfo endpoint;
+  // Zero does not stamp
+  ASSERT_TRUE(replicas.SelectOne("testconfig", &endpoint));
+  EXPECT_EQ(0, replicas.LastAccessEpoch("testconfig"));
+  ASSERT_TRUE(replicas.SelectOne("testconfig", &endpoint, 3));
+  EXPECT_EQ(3, replicas.LastAccessEpoch("testconfig"));
+  ASSERT_TRUE(replicas.Get("testconfig", 5) != nullptr);
+  EXPECT_EQ(5, replicas.LastAccessEpoch("testconfig"));
+
+  // A publish keeps the stamps, a removal drops them
+  replicas.Publish("testconfig", MakeEndpoints(3));
+  EXPECT_EQ(5, replicas.LastAccessEpoch("testconfig"));
+  ASSERT_TRUE(replicas.SelectOne("testconfig", &endpoint, 6));
+  EXPECT_EQ(6, replicas.LastAccessEpoch("testconfig"));
+  EXPECT_EQ(3, replicas.Get("testconfig")->size());
+  replicas.Remove("testconfig");
+  EXPECT_EQ(0, replicas.LastAccessEpoch("testconfig"));
+}
+
+TEST(SnapshotReplicasTest, select_count_test) {
+  SnapshotReplicas replicas;
+  replicas.Init(2);
+  TrpcEndpointInfo endpoint;
+  EXPECT_FALSE(replicas.SelectOne("testconfig", &endpoint, 0, true));
+  EXPECT_EQ(0, replicas.SelectCount("testconfig"));
+
+  replicas.Publish("testconfig", MakeEndpoints(2));
+  ASSERT_TRUE(replicas.SelectOne("testconfig", &endpoint, 0, true));
+  ASSERT_TRUE(replicas.SelectOne("testconfig", &endpoint, 0, true));
+  // Only counted if asked for
+  ASSERT_TRUE(replicas.SelectOne("testconfig", &endpoint));
+  ASSERT_TRUE(replicas.Get("testconfig") != nullptr);
+  EXPECT_EQ(2, replicas.SelectCount("testconfig"));
+
+  // A publish keeps the count, a removal returns it
+  replicas.Publish("testconfig", MakeEndpoints(3));
+  ASSERT_TRUE(replicas.SelectOne("testconfig", &endpoint, 0, true));
+  EXPECT_EQ(3, replicas.SelectCount("testconfig"));
+  EXPECT_EQ(3, replicas.Remove("testconfig"));
+  EXPECT_EQ(0, replicas.SelectCount("testconfig"));
+}
+
+}  // namespace trpc::consul
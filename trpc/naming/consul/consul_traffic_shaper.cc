@@ -0,0 +1,170 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#include "trpc/naming/consul/consul_traffic_shaper.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <random>
+#include <thread>
+
+namespace trpc::consul {
+
+namespace {
+
+uint64_t NowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+std::mt19937_64& ThreadRandom() {
+  // Seeded per thread, so that processes started at the same moment do not share their sequence
+  thread_local std::mt19937_64 random(std::random_device{}() ^
+                                      std::hash<std::thread::id>()(std::this_thread::get_id()));
+  return random;
+}
+
+}  // namespace
+
+void TokenBucket::Reset(uint32_t rate, uint32_t burst, uint64_t now_ms) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  rate_ = rate;
+  burst_ = std::max<uint32_t>(burst, 1);
+  tokens_ = burst_;
+  last_refill_ms_ = now_ms;
+}
+
+void TokenBucket::SetLimits(uint32_t rate, uint32_t burst, uint64_t now_ms) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  // The tokens up to now are refilled at the previous rate
+  RefillLocked(now_ms);
+  rate_ = rate;
+  burst_ = std::max<uint32_t>(burst, 1);
+  tokens_ = std::min(tokens_, burst_);
+}
+
+void TokenBucket::RefillLocked(uint64_t now_ms) {
+  if (now_ms > last_refill_ms_) {
+    tokens_ = std::min(burst_, tokens_ + static_cast<double>(now_ms - last_refill_ms_) * rate_ / 1000);
+    last_refill_ms_ = now_ms;
+  }
+}
+
+bool TokenBucket::TryAcquire(uint64_t now_ms) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (rate_ == 0) {
+    return true;
+  }
+  RefillLocked(now_ms);
+  if (tokens_ < 1) {
+    return false;
+  }
+  tokens_ -= 1;
+  return true;
+}
+
+uint64_t TokenBucket::Acquire(uint64_t now_ms) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (rate_ == 0) {
+    return 0;
+  }
+  RefillLocked(now_ms);
+  tokens_ -= 1;
+  if (tokens_ >= 0) {
+    return 0;
+  }
+  return static_cast<uint64_t>(std::ceil(-tokens_ * 1000 / rate_));
+}
+
+void ConsulTrafficShaper::Init(uint32_t rate_limit, uint32_t burst, bool configured) {
+  std::lock_guard<std::mutex> lock(init_mutex_);
+  if (!initialized_) {
+    rate_limit_ = rate_limit;
+    burst_ = burst;
+    configured_ = configured;
+    initialized_ = true;
+    bucket_.Reset(rate_limit_, burst_, NowMs());
+    return;
+  }
+  if (configured_ && !configured) {
+    return;
+  }
+  if (configured && !configured_) {
+    rate_limit_ = rate_limit;
+    burst_ = burst;
+    configured_ = true;
+  } else if (rate_limit != 0 && (rate_limit_ == 0 || rate_limit < rate_limit_)) {
+    rate_limit_ = rate_limit;
+    burst_ = burst;
+  } else if (rate_limit == rate_limit_) {
+    burst_ = std::min(burst_, burst);
+  }
+  // Tokens already taken stay taken, the second plugin must not refill the bucket
+  bucket_.SetLimits(rate_limit_, burst_, NowMs());
+}
+
+uint32_t ConsulTrafficShaper::RateLimit() const {
+  std::lock_guard<std::mutex> lock(init_mutex_);
+  return rate_limit_;
+}
+
+bool ConsulTrafficShaper::TryAcquire() {
+  if (!bucket_.TryAcquire(NowMs())) {
+    throttled_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  requests_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+uint64_t ConsulTrafficShaper::Acquire() {
+  uint64_t wait_ms = bucket_.Acquire(NowMs());
+  requests_.fetch_add(1, std::memory_order_relaxed);
+  if (wait_ms > 0) {
+    paced_ms_.fetch_add(wait_ms, std::memory_order_relaxed);
+  }
+  return wait_ms;
+}
+
+TrafficShaperStats ConsulTrafficShaper::GetStats() const {
+  TrafficShaperStats stats;
+  stats.requests = requests_.load(std::memory_order_relaxed);
+  stats.throttled = throttled_.load(std::memory_order_relaxed);
+  stats.paced_ms = paced_ms_.load(std::memory_order_relaxed);
+  stats.backoffs = backoffs_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+uint64_t ConsulTrafficShaper::Jitter(uint64_t interval_ms, double ratio) {
+  if (ratio <= 0 || interval_ms == 0) {
+    return interval_ms;
+  }
+  ratio = std::min(ratio, 1.0);
+  std::uniform_real_distribution<double> distribution(1 - ratio, 1 + ratio);
+  return static_cast<uint64_t>(interval_ms * distribution(ThreadRandom()));
+}
+
+uint64_t ConsulTrafficShaper::Backoff(uint32_t failures, uint64_t base_ms, uint64_t max_ms) {
+  uint64_t delay_ms = std::max<uint64_t>(base_ms, 1);
+  for (uint32_t i = 1; i < failures && delay_ms < max_ms; ++i) {
+    delay_ms *= 2;
+  }
+  delay_ms = std::min(delay_ms, std::max(max_ms, base_ms));
+  // Equal jitter: at least half of the delay, so that retries still back off
+  std::uniform_int_distribution<uint64_t> distribution(0, delay_ms / 2);
+  return delay_ms - delay_ms / 2 + distribution(ThreadRandom());
+}
+
+}  // namespace trpc::consul
@@ -0,0 +1,116 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+namespace trpc::consul {
+
+/// @brief Token bucket, `rate` tokens per second up to `burst` tokens.
+/// @note Thread-safe. A zero rate disables the limit.
+class TokenBucket {
+ public:
+  void Reset(uint32_t rate, uint32_t burst, uint64_t now_ms);
+
+  /// @brief Changes the limits, keeping the tokens taken so far.
+  void SetLimits(uint32_t rate, uint32_t burst, uint64_t now_ms);
+
+  /// @brief Takes a token if one is available.
+  bool TryAcquire(uint64_t now_ms);
+
+  /// @brief Takes a token even if none is available, running into debt which later refills pay back first.
+  /// @return Milliseconds until the token is covered, the time a caller which can wait should wait.
+  uint64_t Acquire(uint64_t now_ms);
+
+ private:
+  void RefillLocked(uint64_t now_ms);
+
+  std::mutex mutex_;
+  uint32_t rate_{0};
+  double burst_{0};
+  double tokens_{0};
+  uint64_t last_refill_ms_{0};
+};
+
+struct TrafficShaperStats {
+  // Requests which got a token
+  uint64_t requests{0};
+  // Background refreshes postponed for lack of a token
+  uint64_t throttled{0};
+  // Total time foreground requests waited for a token, in milliseconds
+  uint64_t paced_ms{0};
+  // Refreshes rescheduled with backoff after a failure
+  uint64_t backoffs{0};
+};
+
+/// @brief Shapes the Consul traffic of the process: a token bucket shared by the selector and registry plugins,
+/// randomized refresh phases and per-callee exponential backoff with jitter.
+///
+/// Background refreshes are throttled when the bucket is empty, requests on behalf of callers always get a token,
+/// possibly running the bucket into debt, so that they slow down the background traffic instead of failing.
+class ConsulTrafficShaper {
+ public:
+  static ConsulTrafficShaper* GetInstance() {
+    static ConsulTrafficShaper instance;
+    return &instance;
+  }
+
+  /// @brief Sets the request rate limit in requests per second, zero means unlimited.
+  /// @param configured false if the limits are the defaults of a plugin which does not configure them.
+  /// @note The selector and registry plugins share the bucket and both initialize it. The stricter of the limits
+  ///       applies: the lower non-zero rate with its burst, the lower burst of equal rates. Configured limits
+  ///       replace defaults, defaults never replace configured limits. Only the first call fills the bucket.
+  void Init(uint32_t rate_limit, uint32_t burst, bool configured = true);
+
+  /// @brief Rate limit in effect, zero if unlimited.
+  uint32_t RateLimit() const;
+
+  /// @brief Token of a background request.
+  /// @return false if the request should be postponed.
+  bool TryAcquire();
+
+  /// @brief Token of a foreground request.
+  /// @return Milliseconds the caller should wait before sending if it can, zero if within the limit.
+  uint64_t Acquire();
+
+  void RecordBackoff() { backoffs_.fetch_add(1, std::memory_order_relaxed); }
+
+  TrafficShaperStats GetStats() const;
+
+  /// @brief Randomizes `interval_ms` uniformly within +/- `ratio` of it.
+  static uint64_t Jitter(uint64_t interval_ms, double ratio);
+
+  /// @brief Delay before the retry after `failures` consecutive failures: `base_ms` doubled per failure up to
+  /// `max_ms`, of which the upper half is randomized.
+  static uint64_t Backoff(uint32_t failures, uint64_t base_ms, uint64_t max_ms);
+
+ private:
+  TokenBucket bucket_;
+
+  // Limits merged from all Init calls, see Init
+  mutable std::mutex init_mutex_;
+  bool initialized_{false};
+  bool configured_{false};
+  uint32_t rate_limit_{0};
+  uint32_t burst_{0};
+
+  std::atomic<uint64_t> requests_{0};
+  std::atomic<uint64_t> throttled_{0};
+  std::atomic<uint64_t> paced_ms_{0};
+  std::atomic<uint64_t> backoffs_{0};
+};
+
+}  // namespace trpc::consul
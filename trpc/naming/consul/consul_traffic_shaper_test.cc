@@ -0,0 +1,136 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#include "trpc/naming/consul/consul_traffic_shaper.h"
+
+#include "gtest/gtest.h"
+
+namespace trpc::consul {
+
+TEST(TokenBucketTest, try_acquire_test) {
+  TokenBucket bucket;
+  // 10 tokens per second, burst of 2
+  bucket.Reset(10, 2, 1000);
+  EXPECT_TRUE(bucket.TryAcquire(1000));
+  EXPECT_TRUE(bucket.TryAcquire(1000));
+  EXPECT_FALSE(bucket.TryAcquire(1000));
+  EXPECT_FALSE(bucket.TryAcquire(1050));
+  EXPECT_TRUE(bucket.TryAcquire(1100));
+  // Refill is capped by the burst
+  EXPECT_TRUE(bucket.TryAcquire(5000));
+  EXPECT_TRUE(bucket.TryAcquire(5000));
+  EXPECT_FALSE(bucket.TryAcquire(5000));
+
+  // No limit
+  bucket.Reset(0, 0, 0);
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_TRUE(bucket.TryAcquire(0));
+  }
+}
+
+TEST(TokenBucketTest, acquire_test) {
+  TokenBucket bucket;
+  bucket.Reset(10, 1, 1000);
+  EXPECT_EQ(0, bucket.Acquire(1000));
+  // Debt of one and two tokens, 100ms per token
+  EXPECT_EQ(100, bucket.Acquire(1000));
+  EXPECT_EQ(200, bucket.Acquire(1000));
+  // Background requests wait until the debt is paid back
+  EXPECT_FALSE(bucket.TryAcquire(1250));
+  EXPECT_TRUE(bucket.TryAcquire(1300));
+}
+
+TEST(ConsulTrafficShaperTest, jitter_test) {
+  EXPECT_EQ(10000, ConsulTrafficShaper::Jitter(10000, 0));
+  bool randomized = false;
+  for (int i = 0; i < 100; ++i) {
+    uint64_t interval = ConsulTrafficShaper::Jitter(10000, 0.2);
+    EXPECT_GE(interval, 8000);
+    EXPECT_LE(interval, 12000);
+    randomized = randomized || interval != 10000;
+  }
+  EXPECT_TRUE(randomized);
+}
+
+TEST(ConsulTrafficShaperTest, backoff_test) {
+  for (int i = 0; i < 100; ++i) {
+    uint64_t first = ConsulTrafficShaper::Backoff(1, 1000, 60000);
+    EXPECT_GE(first, 500);
+    EXPECT_LE(first, 1000);
+    uint64_t third = ConsulTrafficShaper::Backoff(3, 1000, 60000);
+    EXPECT_GE(third, 2000);
+    EXPECT_LE(third, 4000);
+    uint64_t capped = ConsulTrafficShaper::Backoff(100, 1000, 60000);
+    EXPECT_GE(capped, 30000);
+    EXPECT_LE(capped, 60000);
+  }
+}
+
+TEST(ConsulTrafficShaperTest, stats_test) {
+  ConsulTrafficShaper shaper;
+  shaper.Init(1, 1);
+  EXPECT_TRUE(shaper.TryAcquire());
+  EXPECT_FALSE(shaper.TryAcquire());
+  EXPECT_GT(shaper.Acquire(), 0);
+  shaper.RecordBackoff();
+
+  TrafficShaperStats stats = shaper.GetStats();
+  EXPECT_EQ(2, stats.requests);
+  EXPECT_EQ(1, stats.throttled);
+  EXPECT_GT(stats.paced_ms, 0);
+  EXPECT_EQ(1, stats.backoffs);
+}
+
+TEST(ConsulTrafficShaperTest, merge_init_test) {
+  // The registry and the selector both configure the shared bucket, the stricter limits win
+  ConsulTrafficShaper shaper;
+  shaper.Init(10, 3);
+  EXPECT_TRUE(shaper.TryAcquire());
+  EXPECT_TRUE(shaper.TryAcquire());
+  shaper.Init(5, 1);
+  EXPECT_EQ(5, shaper.RateLimit());
+  // The second Init does not refill the bucket
+  EXPECT_TRUE(shaper.TryAcquire());
+  EXPECT_FALSE(shaper.TryAcquire());
+
+  // A higher limit or unlimited does not loosen the stricter one
+  shaper.Init(20, 40);
+  EXPECT_EQ(5, shaper.RateLimit());
+  shaper.Init(0, 0);
+  EXPECT_EQ(5, shaper.RateLimit());
+  EXPECT_FALSE(shaper.TryAcquire());
+}
+
+TEST(ConsulTrafficShaperTest, merge_default_init_test) {
+  // A plugin left on the default limits does not override the limits configured by the other
+  ConsulTrafficShaper registry_first;
+  registry_first.Init(20, 40, false);
+  registry_first.Init(50, 60, true);
+  EXPECT_EQ(50, registry_first.RateLimit());
+
+  ConsulTrafficShaper selector_first;
+  selector_first.Init(50, 60, true);
+  selector_first.Init(20, 40, false);
+  EXPECT_EQ(50, selector_first.RateLimit());
+
+  // An explicit zero turns limiting off unless the other plugin configures a limit
+  ConsulTrafficShaper unlimited;
+  unlimited.Init(20, 40, false);
+  unlimited.Init(0, 0, true);
+  EXPECT_EQ(0, unlimited.RateLimit());
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_TRUE(unlimited.TryAcquire());
+  }
+}
+
+}  // namespace trpc::consul
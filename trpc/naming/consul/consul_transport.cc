@@ -0,0 +1,95 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#include "trpc/naming/consul/consul_transport.h"
+
+#include <utility>
+
+#include "trpc/naming/consul/consul_curl_multi_transport.h"
+#include "trpc/naming/consul/consul_probes.h"
+#include "trpc/util/log/logging.h"
+
+namespace trpc::consul {
+
+Future<curl_http::CurlHttpResponsePtr> ConsulTransport::AsyncGet(const std::string& url) {
+  auto response = std::make_shared<curl_http::CurlHttpResponse>();
+  Get(url, response.get());
+  return MakeReadyFuture<curl_http::CurlHttpResponsePtr>(std::move(response));
+}
+
+Future<curl_http::CurlHttpResponsePtr> ConsulTransport::AsyncPut(const std::string& url, const std::string& body) {
+  auto response = std::make_shared<curl_http::CurlHttpResponse>();
+  Put(url, body, response.get());
+  return MakeReadyFuture<curl_http::CurlHttpResponsePtr>(std::move(response));
+}
+
+int CurlEasyTransport::Init(const ConsulHttpOptions& options) {
+  if (curl_http_.Init() != curl_http::kOk) {
+    return -1;
+  }
+  return ConfigureConsulHttp(options, &curl_http_);
+}
+
+int CurlEasyTransport::Get(const std::string& url, curl_http::CurlHttpResponse* response) {
+  return Trace(response, [&]() { return curl_http_.Get(url, response); });
+}
+
+int CurlEasyTransport::Put(const std::string& url, const std::string& body, curl_http::CurlHttpResponse* response) {
+  return Trace(response, [&]() { return curl_http_.Put(url, body, response); });
+}
+
+template <typename Request>
+int CurlEasyTransport::Trace(curl_http::CurlHttpResponse* response, Request&& request) {
+  // The CURL handle is private to the CurlHttp, whose address identifies the request as well
+  TRPC_CONSUL_PROBE1(curl_perform_start, &curl_http_);
+  int ret = request();
+  TRPC_CONSUL_PROBE4(curl_perform_done, &curl_http_, response->code, response->response_code, response->total_us);
+  return ret;
+}
+
+int InMemoryTransport::Get(const std::string& url, curl_http::CurlHttpResponse* response) {
+  return Serve("GET", url, "", response);
+}
+
+int InMemoryTransport::Put(const std::string& url, const std::string& body, curl_http::CurlHttpResponse* response) {
+  return Serve("PUT", url, body, response);
+}
+
+int InMemoryTransport::Serve(const char* method, const std::string& url, const std::string& body,
+                             curl_http::CurlHttpResponse* response) {
+  response->Reset();
+  // A 200 response unless the handler says otherwise, it may set `code` to fail in the transport
+  response->code = CURLE_OK;
+  response->response_code = curl_http::kHttpStatusCode200;
+  handler_(method, url, body, response);
+  response->size_download = response->body.size();
+  return response->code == CURLE_OK ? curl_http::kOk : curl_http::kError;
+}
+
+ConsulTransportFactory MakeConsulTransportFactory(const std::string& name) {
+  if (name == "curl_multi") {
+    return MakeCurlMultiTransportFactory();
+  }
+  if (!name.empty() && name != "curl") {
+    TRPC_LOG_ERROR("unknown consul transport " << name << ", use curl");
+  }
+  return []() -> ConsulTransportPtr { return std::make_unique<CurlEasyTransport>(); };
+}
+
+ConsulTransportFactory MakeInMemoryTransportFactory(InMemoryTransport::Handler handler) {
+  return [handler = std::move(handler)]() -> ConsulTransportPtr {
+    return std::make_unique<InMemoryTransport>(handler);
+  };
+}
+
+}  // namespace trpc::consul
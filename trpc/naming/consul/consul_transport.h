@@ -0,0 +1,121 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "trpc/future/future.h"
+#include "trpc/naming/consul/consul_http.h"
+#include "trpc/transport/common/http/curl_http.h"
+
+namespace trpc::consul {
+
+/// @brief How the selector and registry send their requests to the Consul agent.
+///
+/// A request succeeds if an HTTP response was received, whatever its status; the caller checks `response_code`.
+/// On a transport error `code` of the response is not zero and `err_msg` tells why, as with `curl_http::CurlHttp`.
+/// @note A transport is used by one thread at a time, the selector creates one per refresh worker.
+class ConsulTransport {
+ public:
+  virtual ~ConsulTransport() = default;
+
+  /// @brief Called once before the first request.
+  virtual int Init(const ConsulHttpOptions& options) = 0;
+
+  virtual void Destroy() {}
+
+  /// @brief Sets a header sent with all following requests.
+  virtual void SetRequestHeader(const std::string& name, const std::string& value) = 0;
+
+  /// @brief Sends a request into `response`, which is reset first and can be reused across requests.
+  /// @return 0 if a response was received, -1 on transport error.
+  virtual int Get(const std::string& url, curl_http::CurlHttpResponse* response) = 0;
+
+  virtual int Put(const std::string& url, const std::string& body, curl_http::CurlHttpResponse* response) = 0;
+
+  /// @brief Sends a request without waiting for the response. The future fails only if the request could not be
+  /// sent at all, a transport error is reported in the response like in the blocking methods.
+  /// @note The default implementation sends the blocking request and returns a ready future.
+  virtual Future<curl_http::CurlHttpResponsePtr> AsyncGet(const std::string& url);
+
+  virtual Future<curl_http::CurlHttpResponsePtr> AsyncPut(const std::string& url, const std::string& body);
+};
+
+using ConsulTransportPtr = std::unique_ptr<ConsulTransport>;
+
+/// @brief Creates a transport, called once by the registry and once per refresh worker of the selector.
+using ConsulTransportFactory = std::function<ConsulTransportPtr()>;
+
+/// @brief Blocking requests on a libcurl easy handle, which joins the share of the process: all handles talking to
+/// the agent share the DNS cache and resume each other's TLS sessions, each keeps its own connection.
+class CurlEasyTransport : public ConsulTransport {
+ public:
+  int Init(const ConsulHttpOptions& options) override;
+
+  void Destroy() override { curl_http_.Destroy(); }
+
+  void SetRequestHeader(const std::string& name, const std::string& value) override {
+    curl_http_.SetRequestHeader(name, value);
+  }
+
+  int Get(const std::string& url, curl_http::CurlHttpResponse* response) override;
+
+  int Put(const std::string& url, const std::string& body, curl_http::CurlHttpResponse* response) override;
+
+ private:
+  // Fires the probes of a request around it
+  template <typename Request>
+  int Trace(curl_http::CurlHttpResponse* response, Request&& request);
+
+ private:
+  curl_http::CurlHttp curl_http_;
+};
+
+/// @brief Responses produced by a function in the calling thread, without sockets, e.g. to benchmark the parse and
+/// refresh path deterministically or to test error handling.
+class InMemoryTransport : public ConsulTransport {
+ public:
+  /// @brief Fills the status, headers and body of the response to a request. `method` is "GET" or "PUT", the
+  /// response is reset before.
+  using Handler = std::function<void(const std::string& method, const std::string& url, const std::string& body,
+                                     curl_http::CurlHttpResponse* response)>;
+
+  explicit InMemoryTransport(Handler handler) : handler_(std::move(handler)) {}
+
+  int Init(const ConsulHttpOptions& /*options*/) override { return 0; }
+
+  void SetRequestHeader(const std::string& /*name*/, const std::string& /*value*/) override {}
+
+  int Get(const std::string& url, curl_http::CurlHttpResponse* response) override;
+
+  int Put(const std::string& url, const std::string& body, curl_http::CurlHttpResponse* response) override;
+
+ private:
+  int Serve(const char* method, const std::string& url, const std::string& body, curl_http::CurlHttpResponse* response);
+
+ private:
+  Handler handler_;
+};
+
+/// @brief Factory of the transport named by `naming::ConsulConfig::transport_`, "curl" or "curl_multi". An unknown
+/// name falls back to "curl".
+ConsulTransportFactory MakeConsulTransportFactory(const std::string& name);
+
+/// @brief Factory of in-memory transports sharing `handler`, which must be thread-safe if the transports are used
+/// concurrently.
+ConsulTransportFactory MakeInMemoryTransportFactory(InMemoryTransport::Handler handler);
+
+}  // namespace trpc::consul
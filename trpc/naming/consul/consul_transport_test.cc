@@ -0,0 +1,170 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#include "trpc/naming/consul/consul_transport.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "trpc/future/future_utility.h"
+#include "trpc/naming/consul/consul_curl_multi_transport.h"
+#include "trpc/naming/consul/testing/fake_consul_server.h"
+
+namespace trpc::consul {
+
+namespace {
+
+constexpr char kService[] = "trpc.test.transport.Greeter";
+
+class ConsulTransportTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_EQ(0, server_.Start());
+    server_.AddInstances(kService, 3);
+    options_.base_url = "http://" + server_.Address();
+  }
+
+  void TearDown() override { server_.Stop(); }
+
+  // Health query, register and deregister through `transport`
+  void CheckRoundTrips(ConsulTransport* transport) {
+    ASSERT_EQ(0, transport->Init(options_));
+    curl_http::CurlHttpResponse response;
+    ASSERT_EQ(curl_http::kOk, transport->Get(options_.base_url + "/v1/health/service/" + kService, &response));
+    EXPECT_EQ(200, response.response_code);
+    EXPECT_NE(std::string::npos, response.body.find(std::string(kService) + "-2"));
+    std::string_view index;
+    EXPECT_TRUE(response.GetHeader("X-Consul-Index", &index));
+
+    ASSERT_EQ(curl_http::kOk, transport->Put(options_.base_url + "/v1/agent/service/register",
+                                             R"({"Name":"trpc.test.transport.Greeter","ID":"extra","Port":1})",
+                                             &response));
+    EXPECT_EQ(200, response.response_code);
+    EXPECT_EQ(4, server_.InstanceCount(kService));
+    transport->Put(options_.base_url + "/v1/agent/service/deregister/unknown", "", &response);
+    EXPECT_EQ(404, response.response_code);
+
+    auto pending = transport->AsyncGet(options_.base_url + "/v1/health/service/" + kService);
+    curl_http::CurlHttpResponsePtr async_response = future::BlockingGet(std::move(pending)).GetValue0();
+    ASSERT_NE(nullptr, async_response);
+    EXPECT_EQ(200, async_response->response_code);
+  }
+
+  FakeConsulServer server_;
+  ConsulHttpOptions options_;
+};
+
+}  // namespace
+
+TEST_F(ConsulTransportTest, curl_easy_test) {
+  CurlEasyTransport transport;
+  CheckRoundTrips(&transport);
+  transport.Destroy();
+}
+
+TEST_F(ConsulTransportTest, curl_multi_test) {
+  ConsulTransportFactory factory = MakeConsulTransportFactory("curl_multi");
+  ConsulTransportPtr transport = factory();
+  CheckRoundTrips(transport.get());
+}
+
+TEST_F(ConsulTransportTest, curl_multi_concurrency_test) {
+  // Blocking queries waiting for a change run side by side on the loop thread, instead of one thread each
+  ConsulTransportFactory factory = MakeCurlMultiTransportFactory();
+  constexpr int kQueryNum = 8;
+  std::string url =
+      options_.base_url + "/v1/health/service/" + kService + "?wait=300ms&index=" + std::to_string(server_.Index());
+  std::vector<std::thread> threads;
+  std::vector<int> codes(kQueryNum, 0);
+  auto begin = std::chrono::steady_clock::now();
+  for (int i = 0; i < kQueryNum; ++i) {
+    threads.emplace_back([&, i]() {
+      ConsulTransportPtr transport = factory();
+      ASSERT_EQ(0, transport->Init(options_));
+      curl_http::CurlHttpResponse response;
+      transport->Get(url, &response);
+      codes[i] = response.response_code;
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_LT(std::chrono::steady_clock::now() - begin, std::chrono::milliseconds(300 * kQueryNum / 2));
+  for (int code : codes) {
+    EXPECT_EQ(200, code);
+  }
+  EXPECT_EQ(kQueryNum, server_.GetStats().blocking_queries);
+}
+
+TEST_F(ConsulTransportTest, curl_multi_stop_test) {
+  auto loop = std::make_shared<CurlMultiLoop>();
+  CurlMultiTransport transport(loop);
+  ASSERT_EQ(0, transport.Init(options_));
+
+  // Stopping the loop fails the request in flight instead of leaving its caller waiting for the blocking query
+  std::thread stopper([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    loop->Stop();
+  });
+  curl_http::CurlHttpResponse response;
+  std::string url =
+      options_.base_url + "/v1/health/service/" + kService + "?wait=10s&index=" + std::to_string(server_.Index());
+  EXPECT_EQ(curl_http::kError, transport.Get(url, &response));
+  EXPECT_EQ("consul transport stopped", response.err_msg);
+  stopper.join();
+  EXPECT_EQ(curl_http::kError, transport.Get(url, &response));
+}
+
+TEST_F(ConsulTransportTest, in_memory_test) {
+  int requests = 0;
+  ConsulTransportFactory factory = MakeInMemoryTransportFactory(
+      [&](const std::string& method, const std::string& url, const std::string& body,
+          curl_http::CurlHttpResponse* response) {
+        ++requests;
+        if (url.find("/broken") != std::string::npos) {
+          response->code = CURLE_COULDNT_CONNECT;
+          return;
+        }
+        if (method == "PUT") {
+          response->response_code = 400;
+          return;
+        }
+        response->headers = "X-Consul-Index: 7\r\n";
+        response->body = "[]";
+      });
+  ConsulTransportPtr transport = factory();
+  ASSERT_EQ(0, transport->Init(options_));
+
+  curl_http::CurlHttpResponse response;
+  ASSERT_EQ(curl_http::kOk, transport->Get("http://consul/v1/health/service/x", &response));
+  EXPECT_EQ(200, response.response_code);
+  EXPECT_EQ("[]", response.body);
+  EXPECT_EQ(2, response.size_download);
+  std::string_view index;
+  ASSERT_TRUE(response.GetHeader("X-Consul-Index", &index));
+  EXPECT_EQ("7", index);
+
+  EXPECT_EQ(curl_http::kOk, transport->Put("http://consul/v1/agent/service/register", "{}", &response));
+  EXPECT_EQ(400, response.response_code);
+  EXPECT_EQ(curl_http::kError, transport->Get("http://consul/broken", &response));
+  EXPECT_EQ(3, requests);
+  // Nothing was sent
+  EXPECT_EQ(0, server_.GetStats().requests);
+}
+
+}  // namespace trpc::consul
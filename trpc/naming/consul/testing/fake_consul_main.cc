@@ -0,0 +1,110 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+// Standalone fake Consul agent for load tests on one box, e.g.
+//   fake_consul --port=8500 --service=trpc.test.helloworld.Greeter:1000 --churn_interval_ms=1000
+
+#include <signal.h>
+
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "gflags/gflags.h"
+
+#include "trpc/naming/consul/testing/fake_consul_server.h"
+
+DEFINE_uint32(port, 8500, "port to listen on, zero picks a free one");
+DEFINE_string(ip, "127.0.0.1", "ip to listen on");
+DEFINE_string(service, "", "services registered at start, comma separated name:count[:port]");
+DEFINE_uint32(min_latency_ms, 0, "minimum delay of every response");
+DEFINE_uint32(max_latency_ms, 0, "maximum delay of every response");
+DEFINE_double(error_rate, 0, "share of the requests answered with --error_status");
+DEFINE_int32(error_status, 500, "status of the injected errors");
+DEFINE_double(drop_rate, 0, "share of the requests whose connection is closed without response");
+DEFINE_uint32(churn_interval_ms, 0, "interval of the instance churn, zero disables it");
+DEFINE_double(churn_fraction, 0.01, "share of the instances of every service changed per interval");
+DEFINE_bool(churn_replace, false, "replace churned instances instead of flipping their health");
+
+namespace {
+
+// "name:count[:port]"
+bool AddServices(const std::string& services, trpc::consul::FakeConsulServer* server) {
+  std::stringstream stream(services);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    if (item.empty()) {
+      continue;
+    }
+    size_t first = item.find(':');
+    if (first == std::string::npos || first == 0) {
+      return false;
+    }
+    size_t second = item.find(':', first + 1);
+    uint32_t count = strtoul(item.substr(first + 1, second - first - 1).c_str(), nullptr, 10);
+    int port = second == std::string::npos ? 8000 : atoi(item.c_str() + second + 1);
+    server->AddInstances(item.substr(0, first), count, port);
+    std::cout << "registered " << count << " instances of " << item.substr(0, first) << std::endl;
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  // Blocks the signals before starting the threads, so that only sigwait receives them
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  trpc::consul::FakeConsulServer server;
+  if (server.Start(FLAGS_port, FLAGS_ip) != 0) {
+    std::cerr << "cannot listen on " << FLAGS_ip << ":" << FLAGS_port << std::endl;
+    return -1;
+  }
+  if (!AddServices(FLAGS_service, &server)) {
+    std::cerr << "invalid --service, expected name:count[:port]" << std::endl;
+    return -1;
+  }
+
+  trpc::consul::FakeConsulFaults faults;
+  faults.min_latency_ms = FLAGS_min_latency_ms;
+  faults.max_latency_ms = FLAGS_max_latency_ms;
+  faults.error_rate = FLAGS_error_rate;
+  faults.error_status = FLAGS_error_status;
+  faults.drop_rate = FLAGS_drop_rate;
+  server.SetFaults(faults);
+
+  trpc::consul::FakeConsulChurn churn;
+  churn.interval_ms = FLAGS_churn_interval_ms;
+  churn.fraction = FLAGS_churn_fraction;
+  churn.replace = FLAGS_churn_replace;
+  server.SetChurn(churn);
+
+  std::cout << "fake consul listening on " << server.Address() << std::endl;
+  int signal = 0;
+  sigwait(&signals, &signal);
+
+  trpc::consul::FakeConsulStats stats = server.GetStats();
+  server.Stop();
+  std::cout << "requests:" << stats.requests << ", health queries:" << stats.health_queries
+            << ", blocking:" << stats.blocking_queries << ", registrations:" << stats.registrations
+            << ", deregistrations:" << stats.deregistrations << ", check updates:" << stats.check_updates
+            << ", injected errors:" << stats.injected_errors << ", dropped:" << stats.dropped << std::endl;
+  return 0;
+}
@@ -0,0 +1,753 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#include "trpc/naming/consul/testing/fake_consul_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <utility>
+
+#include "rapidjson/document.h"
+
+namespace trpc::consul {
+
+namespace {
+
+// Limit of the request head, a longer one is rejected
+constexpr size_t kMaxHeadSize = 64 * 1024;
+
+// Blocking queries wait this long without `wait`, and at most the maximum, as in Consul
+constexpr uint64_t kDefaultWaitMs = 5 * 60 * 1000;
+constexpr uint64_t kMaxWaitMs = 10 * 60 * 1000;
+
+bool WriteAll(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+const char* StatusReason(int status) {
+  switch (status) {
+    case 200:
+      return "OK";
+    case 400:
+      return "Bad Request";
+    case 404:
+      return "Not Found";
+    case 405:
+      return "Method Not Allowed";
+    case 429:
+      return "Too Many Requests";
+    case 500:
+      return "Internal Server Error";
+    case 503:
+      return "Service Unavailable";
+    default:
+      return "Unknown";
+  }
+}
+
+void AppendJsonString(std::string_view value, std::string* out) {
+  out->push_back('"');
+  for (char c : value) {
+    switch (c) {
+      case '"':
+        out->append("\\\"");
+        break;
+      case '\\':
+        out->append("\\\\");
+        break;
+      case '\n':
+        out->append("\\n");
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          char buf[8];
+          snprintf(buf, sizeof(buf), "\\u%04x", c);
+          out->append(buf);
+        } else {
+          out->push_back(c);
+        }
+    }
+  }
+  out->push_back('"');
+}
+
+// "10s", "500ms" or "1m", zero if malformed
+uint64_t ParseWaitMs(const std::string& wait) {
+  char* end = nullptr;
+  uint64_t value = strtoull(wait.c_str(), &end, 10);
+  std::string_view unit(end);
+  if (unit == "ms") return value;
+  if (unit == "s" || unit.empty()) return value * 1000;
+  if (unit == "m") return value * 60 * 1000;
+  return 0;
+}
+
+// Member of a JSON object by case-insensitive name, as Consul decodes the request bodies
+const rapidjson::Value* FindMember(const rapidjson::Value& object, const char* name) {
+  for (auto it = object.MemberBegin(); it != object.MemberEnd(); ++it) {
+    if (strcasecmp(it->name.GetString(), name) == 0) {
+      return &it->value;
+    }
+  }
+  return nullptr;
+}
+
+std::string GetString(const rapidjson::Value& object, const char* name) {
+  const rapidjson::Value* value = FindMember(object, name);
+  return value != nullptr && value->IsString() ? std::string(value->GetString(), value->GetStringLength()) : "";
+}
+
+bool IsKnownStatus(const std::string& status) {
+  return status == "passing" || status == "warning" || status == "critical";
+}
+
+}  // namespace
+
+FakeConsulServer::~FakeConsulServer() { Stop(); }
+
+int FakeConsulServer::Start(uint16_t port, const std::string& ip) {
+  listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd_ < 0) {
+    return -1;
+  }
+  int reuse = 1;
+  setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  socklen_t len = sizeof(addr);
+  if (inet_pton(AF_INET, ip.c_str(), &addr.sin_addr) != 1 ||
+      bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listen_fd_, 1024) != 0 ||
+      getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
+    close(listen_fd_);
+    listen_fd_ = -1;
+    return -1;
+  }
+  ip_ = ip;
+  port_ = ntohs(addr.sin_port);
+  running_ = true;
+  accept_thread_ = std::thread([this]() { AcceptLoop(); });
+  churn_thread_ = std::thread([this]() { ChurnLoop(); });
+  return 0;
+}
+
+void FakeConsulServer::Stop() {
+  if (!running_.exchange(false)) {
+    return;
+  }
+  shutdown(listen_fd_, SHUT_RDWR);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    changed_.notify_all();
+    churn_changed_.notify_all();
+  }
+  accept_thread_.join();
+  churn_thread_.join();
+  close(listen_fd_);
+  listen_fd_ = -1;
+
+  // The connection threads close their sockets themselves, shutting them down only wakes them up
+  std::unique_lock<std::mutex> lock(connection_mutex_);
+  for (int fd : connection_fds_) {
+    shutdown(fd, SHUT_RDWR);
+  }
+  connection_done_.wait(lock, [this]() { return connection_num_ == 0; });
+}
+
+std::string FakeConsulServer::Address() const { return ip_ + ":" + std::to_string(port_); }
+
+void FakeConsulServer::SetFaults(const FakeConsulFaults& faults) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  faults_ = faults;
+}
+
+void FakeConsulServer::FailNextRequests(uint32_t count, int status) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  fail_next_count_ = count;
+  fail_next_status_ = status;
+}
+
+void FakeConsulServer::SetChurn(const FakeConsulChurn& churn) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  churn_ = churn;
+  churn_changed_.notify_all();
+}
+
+void FakeConsulServer::Register(const FakeConsulInstance& instance) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  TouchLocked(RegisterLocked(instance));
+}
+
+bool FakeConsulServer::Deregister(const std::string& id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Service* service = DeregisterLocked(id);
+  if (service == nullptr) {
+    return false;
+  }
+  TouchLocked(service);
+  return true;
+}
+
+bool FakeConsulServer::SetStatus(const std::string& id, const std::string& status) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto iter = instance_services_.find(id);
+  if (iter == instance_services_.end()) {
+    return false;
+  }
+  Service& service = services_[iter->second];
+  service.instances[id].status = status;
+  TouchLocked(&service);
+  return true;
+}
+
+void FakeConsulServer::AddInstances(const std::string& service, uint32_t count, int port) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Service* changed = &services_[service];
+  for (uint32_t i = 0; i < count; ++i) {
+    changed = RegisterLocked(MakeInstanceLocked(service, port));
+  }
+  TouchLocked(changed);
+}
+
+void FakeConsulServer::RemoveService(const std::string& service) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto iter = services_.find(service);
+  if (iter == services_.end()) {
+    return;
+  }
+  for (const auto& item : iter->second.instances) {
+    instance_services_.erase(item.first);
+  }
+  iter->second.instances.clear();
+  TouchLocked(&iter->second);
+}
+
+size_t FakeConsulServer::InstanceCount(const std::string& service) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto iter = services_.find(service);
+  return iter != services_.end() ? iter->second.instances.size() : 0;
+}
+
+uint64_t FakeConsulServer::Index() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return index_;
+}
+
+FakeConsulStats FakeConsulServer::GetStats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void FakeConsulServer::AcceptLoop() {
+  while (running_) {
+    int fd = accept(listen_fd_, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      break;
+    }
+    int nodelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    {
+      std::lock_guard<std::mutex> lock(connection_mutex_);
+      connection_fds_.push_back(fd);
+      connection_num_++;
+    }
+    std::thread([this, fd]() { ServeConnection(fd); }).detach();
+  }
+}
+
+void FakeConsulServer::ServeConnection(int fd) {
+  std::string buffer;
+  char chunk[16 * 1024];
+  bool open = true;
+  while (open && running_) {
+    ssize_t n = read(fd, chunk, sizeof(chunk));
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    buffer.append(chunk, n);
+
+    Request request;
+    int ret;
+    while (open && (ret = ParseRequest(&buffer, &request)) == 0) {
+      Response response = Handle(request);
+      if (response.drop) {
+        open = false;
+        break;
+      }
+      uint32_t latency_ms = 0;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (faults_.max_latency_ms > 0) {
+          uint32_t min = std::min(faults_.min_latency_ms, faults_.max_latency_ms);
+          latency_ms = std::uniform_int_distribution<uint32_t>(min, faults_.max_latency_ms)(random_);
+        }
+      }
+      if (latency_ms > 0) {
+        // Cut short by Stop, so that a stalled agent does not hold up the end of a test
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait_for(lock, std::chrono::milliseconds(latency_ms), [this]() { return !running_; });
+      }
+      const std::string& body = response.shared_body != nullptr ? *response.shared_body : response.body;
+      std::string head = "HTTP/1.1 " + std::to_string(response.status) + " " + StatusReason(response.status) +
+                         "\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(body.size()) +
+                         "\r\nX-Consul-Index: " + std::to_string(response.index) +
+                         "\r\nX-Consul-KnownLeader: true\r\nX-Consul-LastContact: 0\r\n";
+      head.append(request.keep_alive ? "\r\n" : "Connection: close\r\n\r\n");
+      open = WriteAll(fd, head.data(), head.size()) && WriteAll(fd, body.data(), body.size()) && request.keep_alive;
+    }
+    if (open && ret < 0) {
+      static const char kBadRequest[] = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+      WriteAll(fd, kBadRequest, sizeof(kBadRequest) - 1);
+      break;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(connection_mutex_);
+  connection_fds_.erase(std::find(connection_fds_.begin(), connection_fds_.end(), fd));
+  close(fd);
+  connection_num_--;
+  connection_done_.notify_all();
+}
+
+int FakeConsulServer::ParseRequest(std::string* buffer, Request* request) {
+  size_t head_end = buffer->find("\r\n\r\n");
+  if (head_end == std::string::npos) {
+    return buffer->size() > kMaxHeadSize ? -1 : 1;
+  }
+  std::string_view head(buffer->data(), head_end);
+  size_t line_end = head.find("\r\n");
+  std::string_view request_line = head.substr(0, line_end);
+  size_t method_end = request_line.find(' ');
+  size_t target_end = request_line.rfind(' ');
+  if (method_end == std::string_view::npos || target_end <= method_end) {
+    return -1;
+  }
+  std::string_view target = request_line.substr(method_end + 1, target_end - method_end - 1);
+  std::string_view version = request_line.substr(target_end + 1);
+
+  size_t content_length = 0;
+  bool keep_alive = version == "HTTP/1.1";
+  size_t pos = line_end == std::string_view::npos ? head.size() : line_end + 2;
+  while (pos < head.size()) {
+    size_t end = head.find("\r\n", pos);
+    std::string_view line = head.substr(pos, end == std::string_view::npos ? std::string_view::npos : end - pos);
+    pos = end == std::string_view::npos ? head.size() : end + 2;
+    size_t colon = line.find(':');
+    if (colon == std::string_view::npos) {
+      continue;
+    }
+    std::string name(line.substr(0, colon));
+    std::string_view value = line.substr(colon + 1);
+    while (!value.empty() && value.front() == ' ') value.remove_prefix(1);
+    if (strcasecmp(name.c_str(), "Content-Length") == 0) {
+      content_length = strtoull(std::string(value).c_str(), nullptr, 10);
+    } else if (strcasecmp(name.c_str(), "Connection") == 0) {
+      keep_alive = strncasecmp(value.data(), "close", 5) != 0 &&
+                   (keep_alive || strncasecmp(value.data(), "keep-alive", 10) == 0);
+    }
+  }
+  if (buffer->size() < head_end + 4 + content_length) {
+    return 1;
+  }
+
+  request->method.assign(request_line.substr(0, method_end));
+  size_t question = target.find('?');
+  request->path.assign(target.substr(0, question));
+  request->query.clear();
+  if (question != std::string_view::npos) {
+    std::string_view query = target.substr(question + 1);
+    while (!query.empty()) {
+      size_t amp = query.find('&');
+      std::string_view item = query.substr(0, amp);
+      size_t eq = item.find('=');
+      request->query[std::string(item.substr(0, eq))] =
+          eq == std::string_view::npos ? "" : std::string(item.substr(eq + 1));
+      query = amp == std::string_view::npos ? std::string_view() : query.substr(amp + 1);
+    }
+  }
+  request->body.assign(*buffer, head_end + 4, content_length);
+  request->keep_alive = keep_alive;
+  buffer->erase(0, head_end + 4 + content_length);
+  return 0;
+}
+
+bool FakeConsulServer::InjectFault(Response* response) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats_.requests++;
+  int status = 0;
+  bool fail = false;
+  if (fail_next_count_ > 0) {
+    fail_next_count_--;
+    status = fail_next_status_;
+    fail = true;
+  } else {
+    std::uniform_real_distribution<double> distribution(0, 1);
+    if (faults_.drop_rate > 0 && distribution(random_) < faults_.drop_rate) {
+      fail = true;
+    } else if (faults_.error_rate > 0 && distribution(random_) < faults_.error_rate) {
+      status = faults_.error_status;
+      fail = true;
+    }
+  }
+  if (!fail) {
+    return false;
+  }
+  if (status == 0) {
+    stats_.dropped++;
+    response->drop = true;
+  } else {
+    stats_.injected_errors++;
+    response->status = status;
+    response->body = "fake consul error";
+    response->index = index_;
+  }
+  return true;
+}
+
+FakeConsulServer::Response FakeConsulServer::Handle(const Request& request) {
+  Response response;
+  if (InjectFault(&response)) {
+    return response;
+  }
+
+  constexpr std::string_view kHealthPrefix = "/v1/health/service/";
+  constexpr std::string_view kDeregisterPrefix = "/v1/agent/service/deregister/";
+  constexpr std::string_view kCheckPrefix = "/v1/agent/check/";
+  std::string_view path = request.path;
+  bool read = request.method == "GET";
+  bool write = request.method == "PUT" || request.method == "POST";
+  if (path.substr(0, kHealthPrefix.size()) == kHealthPrefix && read) {
+    return HandleHealth(request, path.substr(kHealthPrefix.size()));
+  }
+  if (path == "/v1/agent/service/register" && write) {
+    return HandleRegister(request);
+  }
+  if (path.substr(0, kDeregisterPrefix.size()) == kDeregisterPrefix && write) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Service* service = DeregisterLocked(std::string(path.substr(kDeregisterPrefix.size())));
+    response.index = index_;
+    if (service == nullptr) {
+      response.status = 404;
+      response.body = "Unknown service ID";
+      return response;
+    }
+    stats_.deregistrations++;
+    TouchLocked(service);
+    return response;
+  }
+  if (path.substr(0, kCheckPrefix.size()) == kCheckPrefix && write) {
+    std::string_view rest = path.substr(kCheckPrefix.size());
+    size_t slash = rest.find('/');
+    if (slash != std::string_view::npos) {
+      return HandleCheck(rest.substr(0, slash), rest.substr(slash + 1), request);
+    }
+  }
+  response.status = read || write ? 404 : 405;
+  return response;
+}
+
+FakeConsulServer::Response FakeConsulServer::HandleHealth(const Request& request, std::string_view service) {
+  std::string name(service);
+  bool passing_only = request.query.count("passing") > 0;
+  uint64_t known_index = 0;
+  auto index_iter = request.query.find("index");
+  if (index_iter != request.query.end()) {
+    known_index = strtoull(index_iter->second.c_str(), nullptr, 10);
+  }
+
+  Response response;
+  std::unique_lock<std::mutex> lock(mutex_);
+  stats_.health_queries++;
+  if (known_index > 0 && ServiceIndexLocked(name) <= known_index) {
+    // Blocking query: answered once the service changed or the wait is over
+    stats_.blocking_queries++;
+    uint64_t wait_ms = kDefaultWaitMs;
+    auto wait_iter = request.query.find("wait");
+    if (wait_iter != request.query.end()) {
+      wait_ms = std::min(ParseWaitMs(wait_iter->second), kMaxWaitMs);
+    }
+    changed_.wait_for(lock, std::chrono::milliseconds(wait_ms),
+                      [&]() { return !running_ || ServiceIndexLocked(name) > known_index; });
+  }
+  response.index = ServiceIndexLocked(name);
+  auto iter = services_.find(name);
+  if (iter == services_.end()) {
+    response.body = "[]";
+  } else {
+    response.shared_body = BodyLocked(&iter->second, passing_only);
+  }
+  return response;
+}
+
+FakeConsulServer::Response FakeConsulServer::HandleRegister(const Request& request) {
+  Response response;
+  rapidjson::Document document;
+  if (document.Parse(request.body.c_str()).HasParseError() || !document.IsObject()) {
+    response.status = 400;
+    response.body = "Request decode failed";
+    return response;
+  }
+
+  FakeConsulInstance instance;
+  instance.service = GetString(document, "name");
+  if (instance.service.empty()) {
+    response.status = 400;
+    response.body = "Missing service name";
+    return response;
+  }
+  instance.id = GetString(document, "id");
+  if (instance.id.empty()) {
+    instance.id = instance.service;
+  }
+  instance.address = GetString(document, "address");
+  if (instance.address.empty()) {
+    instance.address = "127.0.0.1";
+  }
+  const rapidjson::Value* port = FindMember(document, "port");
+  instance.port = port != nullptr && port->IsInt() ? port->GetInt() : 0;
+  const rapidjson::Value* meta = FindMember(document, "meta");
+  if (meta != nullptr && meta->IsObject()) {
+    for (auto it = meta->MemberBegin(); it != meta->MemberEnd(); ++it) {
+      if (it->value.IsString()) {
+        instance.meta[it->name.GetString()] = it->value.GetString();
+      }
+    }
+  }
+  // Without a check the instance is healthy, a new check starts critical unless it brings its status, as in Consul
+  const rapidjson::Value* check = FindMember(document, "check");
+  const rapidjson::Value* checks = FindMember(document, "checks");
+  if (checks != nullptr && checks->IsArray() && checks->Size() > 0) {
+    check = checks->Begin();
+  }
+  instance.status.clear();
+  if (check != nullptr && check->IsObject()) {
+    std::string status = GetString(*check, "status");
+    instance.status = IsKnownStatus(status) ? status : "critical";
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats_.registrations++;
+  TouchLocked(RegisterLocked(instance));
+  response.index = index_;
+  return response;
+}
+
+FakeConsulServer::Response FakeConsulServer::HandleCheck(std::string_view action, std::string_view check_id,
+                                                         const Request& request) {
+  Response response;
+  std::string status;
+  if (action == "pass") {
+    status = "passing";
+  } else if (action == "warn") {
+    status = "warning";
+  } else if (action == "fail") {
+    status = "critical";
+  } else if (action == "update") {
+    rapidjson::Document document;
+    if (!document.Parse(request.body.c_str()).HasParseError() && document.IsObject()) {
+      status = GetString(document, "status");
+    }
+    if (!IsKnownStatus(status)) {
+      response.status = 400;
+      response.body = "Invalid check status";
+      return response;
+    }
+  } else {
+    response.status = 404;
+    return response;
+  }
+
+  constexpr std::string_view kServiceCheckPrefix = "service:";
+  std::lock_guard<std::mutex> lock(mutex_);
+  response.index = index_;
+  auto iter = check_id.substr(0, kServiceCheckPrefix.size()) == kServiceCheckPrefix
+                  ? instance_services_.find(std::string(check_id.substr(kServiceCheckPrefix.size())))
+                  : instance_services_.end();
+  if (iter == instance_services_.end()) {
+    response.status = 404;
+    response.body = "Unknown check ID";
+    return response;
+  }
+  stats_.check_updates++;
+  Service& service = services_[iter->second];
+  FakeConsulInstance& instance = service.instances[iter->first];
+  if (instance.status != status) {
+    instance.status = status;
+    TouchLocked(&service);
+  }
+  return response;
+}
+
+void FakeConsulServer::ChurnLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  std::vector<std::string> ids;
+  while (running_) {
+    if (churn_.interval_ms == 0) {
+      churn_changed_.wait(lock);
+      continue;
+    }
+    if (churn_changed_.wait_for(lock, std::chrono::milliseconds(churn_.interval_ms)) == std::cv_status::no_timeout) {
+      // Woken up by a new setting or Stop
+      continue;
+    }
+    for (auto& [name, service] : services_) {
+      if (service.instances.empty()) {
+        continue;
+      }
+      ids.clear();
+      for (const auto& item : service.instances) {
+        ids.push_back(item.first);
+      }
+      size_t count = std::max<size_t>(1, static_cast<size_t>(churn_.fraction * ids.size()));
+      count = std::min(count, ids.size());
+      // Partial Fisher-Yates shuffle, the first `count` ids are the churned ones
+      for (size_t i = 0; i < count; ++i) {
+        std::swap(ids[i], ids[std::uniform_int_distribution<size_t>(i, ids.size() - 1)(random_)]);
+        FakeConsulInstance& instance = service.instances[ids[i]];
+        if (churn_.replace) {
+          int port = instance.port;
+          DeregisterLocked(ids[i]);
+          RegisterLocked(MakeInstanceLocked(name, port));
+        } else {
+          instance.status = instance.status == "passing" ? "critical" : "passing";
+        }
+      }
+      TouchLocked(&service);
+    }
+  }
+}
+
+uint64_t FakeConsulServer::ServiceIndexLocked(const std::string& service) const {
+  // An unknown service reports the index of the agent, a query blocking on it wakes up at the next change
+  auto iter = services_.find(service);
+  return iter != services_.end() ? iter->second.modify_index : index_;
+}
+
+FakeConsulInstance FakeConsulServer::MakeInstanceLocked(const std::string& service, int port) {
+  uint64_t number = next_instance_++;
+  FakeConsulInstance instance;
+  instance.id = service + "-" + std::to_string(number);
+  instance.service = service;
+  instance.address = "10." + std::to_string((number >> 16) & 0xFF) + "." + std::to_string((number >> 8) & 0xFF) +
+                     "." + std::to_string(number & 0xFF);
+  instance.port = port;
+  return instance;
+}
+
+FakeConsulServer::Service* FakeConsulServer::RegisterLocked(const FakeConsulInstance& instance) {
+  FakeConsulInstance stored = instance;
+  if (stored.id.empty()) {
+    stored.id = stored.service;
+  }
+  auto [iter, inserted] = instance_services_.try_emplace(stored.id, stored.service);
+  if (!inserted && iter->second != stored.service) {
+    // Registered again under another service
+    Service& previous = services_[iter->second];
+    previous.instances.erase(stored.id);
+    TouchLocked(&previous);
+    iter->second = stored.service;
+  }
+  Service& service = services_[stored.service];
+  std::string id = stored.id;
+  service.instances[id] = std::move(stored);
+  return &service;
+}
+
+FakeConsulServer::Service* FakeConsulServer::DeregisterLocked(const std::string& id) {
+  auto iter = instance_services_.find(id);
+  if (iter == instance_services_.end()) {
+    return nullptr;
+  }
+  Service& service = services_[iter->second];
+  service.instances.erase(id);
+  instance_services_.erase(iter);
+  return &service;
+}
+
+void FakeConsulServer::TouchLocked(Service* service) {
+  service->modify_index = ++index_;
+  service->all_body.reset();
+  service->passing_body.reset();
+  changed_.notify_all();
+}
+
+std::shared_ptr<const std::string> FakeConsulServer::BodyLocked(Service* service, bool passing_only) {
+  std::shared_ptr<const std::string>& body = passing_only ? service->passing_body : service->all_body;
+  if (body == nullptr) {
+    body = std::make_shared<const std::string>(SerializeInstances(*service, passing_only));
+  }
+  return body;
+}
+
+std::string FakeConsulServer::SerializeInstances(const Service& service, bool passing_only) {
+  std::string body = "[";
+  for (const auto& [id, instance] : service.instances) {
+    if (passing_only && !instance.status.empty() && instance.status != "passing") {
+      continue;
+    }
+    if (body.size() > 1) {
+      body.push_back(',');
+    }
+    body.append(R"({"Node":{"Node":"fake-consul","Address":"127.0.0.1"},"Service":{"ID":)");
+    AppendJsonString(instance.id, &body);
+    body.append(R"(,"Service":)");
+    AppendJsonString(instance.service, &body);
+    body.append(R"(,"Address":)");
+    AppendJsonString(instance.address, &body);
+    body.append(R"(,"Port":)").append(std::to_string(instance.port)).append(R"(,"Meta":{)");
+    bool first = true;
+    for (const auto& [key, value] : instance.meta) {
+      if (!first) body.push_back(',');
+      first = false;
+      AppendJsonString(key, &body);
+      body.push_back(':');
+      AppendJsonString(value, &body);
+    }
+    body.append(R"(}},"Checks":[{"Node":"fake-consul","CheckID":"serfHealth","Name":"Serf Health Status",)"
+                R"("Status":"passing","ServiceID":"","ServiceName":""})");
+    if (!instance.status.empty()) {
+      body.append(R"(,{"Node":"fake-consul","CheckID":)");
+      AppendJsonString("service:" + instance.id, &body);
+      body.append(R"(,"Name":)");
+      AppendJsonString(instance.service, &body);
+      body.append(R"(,"Status":)");
+      AppendJsonString(instance.status, &body);
+      body.append(R"(,"ServiceID":)");
+      AppendJsonString(instance.id, &body);
+      body.append(R"(,"ServiceName":)");
+      AppendJsonString(instance.service, &body);
+      body.push_back('}');
+    }
+    body.append("]}");
+  }
+  body.push_back(']');
+  return body;
+}
+
+}  // namespace trpc::consul
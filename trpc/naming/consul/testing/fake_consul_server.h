@@ -0,0 +1,234 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace trpc::consul {
+
+/// @brief Service instance held by the fake agent.
+struct FakeConsulInstance {
+  // Defaults to the service name, as in Consul
+  std::string id;
+  std::string service;
+  std::string address;
+  int port{0};
+  std::map<std::string, std::string> meta;
+  // Status of the service check, "passing", "warning" or "critical". Empty if the instance has no check.
+  std::string status{"passing"};
+};
+
+/// @brief Faults injected into the responses.
+struct FakeConsulFaults {
+  // Delay of every response, uniformly distributed between the two, in milliseconds
+  uint32_t min_latency_ms{0};
+  uint32_t max_latency_ms{0};
+  // Share of the requests answered with `error_status`
+  double error_rate{0};
+  int error_status{500};
+  // Share of the requests whose connection is closed without a response
+  double drop_rate{0};
+};
+
+/// @brief Background changes of the registered instances.
+struct FakeConsulChurn {
+  // Zero disables the churn
+  uint32_t interval_ms{0};
+  // Share of the instances of every service changed per interval, at least one
+  double fraction{0.01};
+  // Churned instances are replaced by new ones on another address, instead of flipping between passing and critical
+  bool replace{false};
+};
+
+struct FakeConsulStats {
+  uint64_t requests{0};
+  uint64_t health_queries{0};
+  // Health queries which waited for a change
+  uint64_t blocking_queries{0};
+  uint64_t registrations{0};
+  uint64_t deregistrations{0};
+  uint64_t check_updates{0};
+  uint64_t injected_errors{0};
+  uint64_t dropped{0};
+};
+
+/// @brief In-process fake of the HTTP API of a Consul agent, for hermetic tests and load tests on one box.
+///
+/// Implements the endpoints used by the consul selector and registry:
+///   GET /v1/health/service/<service>   with `passing`, and blocking queries by `index` and `wait`
+///   PUT /v1/agent/service/register
+///   PUT /v1/agent/service/deregister/<id>
+///   PUT /v1/agent/check/pass|warn|fail/<check id>, PUT /v1/agent/check/update/<check id>
+/// Responses carry `X-Consul-Index`, `X-Consul-KnownLeader` and `X-Consul-LastContact`. The health response of a
+/// service is serialized once per change, so services with tens of thousands of instances are cheap to query.
+///
+/// The check of an instance has the id "service:<instance id>" and the name of the service, which is how the selector
+/// tells it from the node checks.
+class FakeConsulServer {
+ public:
+  FakeConsulServer() = default;
+  ~FakeConsulServer();
+
+  FakeConsulServer(const FakeConsulServer&) = delete;
+  FakeConsulServer& operator=(const FakeConsulServer&) = delete;
+
+  /// @brief Listens on `ip:port`, a zero port picks a free one.
+  /// @return -1 if the address cannot be bound.
+  int Start(uint16_t port = 0, const std::string& ip = "127.0.0.1");
+
+  /// @brief Closes all connections, wakes up the blocking queries and joins the threads.
+  void Stop();
+
+  /// @brief "ip:port", the address to configure in `naming::ConsulConfig::address_`.
+  std::string Address() const;
+
+  uint16_t Port() const { return port_; }
+
+  void SetFaults(const FakeConsulFaults& faults);
+
+  /// @brief Answers the next `count` requests with `status`, zero closes their connections instead.
+  void FailNextRequests(uint32_t count, int status);
+
+  /// @brief Starts, changes or stops (zero interval) the background churn.
+  void SetChurn(const FakeConsulChurn& churn);
+
+  /// @brief Adds or replaces an instance, as the register endpoint does.
+  void Register(const FakeConsulInstance& instance);
+
+  /// @return false if there is no instance `id`.
+  bool Deregister(const std::string& id);
+
+  /// @brief Sets the check status of instance `id`.
+  /// @return false if there is no instance `id`.
+  bool SetStatus(const std::string& id, const std::string& status);
+
+  /// @brief Registers `count` passing instances of `service` on consecutive addresses in 10.0.0.0/8, in one change.
+  void AddInstances(const std::string& service, uint32_t count, int port = 8000);
+
+  void RemoveService(const std::string& service);
+
+  size_t InstanceCount(const std::string& service) const;
+
+  /// @brief Index of the last change.
+  uint64_t Index() const;
+
+  FakeConsulStats GetStats() const;
+
+ private:
+  struct Request {
+    std::string method;
+    std::string path;
+    std::map<std::string, std::string> query;
+    std::string body;
+    bool keep_alive{true};
+  };
+
+  struct Response {
+    int status{200};
+    std::string body;
+    // Shared serialized body, sent instead of `body` if set
+    std::shared_ptr<const std::string> shared_body;
+    uint64_t index{0};
+    // Close the connection without sending anything
+    bool drop{false};
+  };
+
+  struct Service {
+    // Ordered by id, so that the health response is stable
+    std::map<std::string, FakeConsulInstance> instances;
+    uint64_t modify_index{0};
+    // Serialized health responses of all and of the passing instances, rebuilt on the first query after a change
+    std::shared_ptr<const std::string> all_body;
+    std::shared_ptr<const std::string> passing_body;
+  };
+
+  void AcceptLoop();
+
+  void ServeConnection(int fd);
+
+  // Parses the first complete request of `buffer` and removes it.
+  // @return 0 if a request was parsed, 1 if more data is needed, -1 on a malformed request.
+  static int ParseRequest(std::string* buffer, Request* request);
+
+  Response Handle(const Request& request);
+
+  Response HandleHealth(const Request& request, std::string_view service);
+
+  Response HandleRegister(const Request& request);
+
+  Response HandleCheck(std::string_view action, std::string_view check_id, const Request& request);
+
+  // Faults scripted for the next request, `response` is set if the request is not handled normally
+  bool InjectFault(Response* response);
+
+  void ChurnLoop();
+
+  // Locked helpers, `mutex_` must be held
+  uint64_t ServiceIndexLocked(const std::string& service) const;
+  FakeConsulInstance MakeInstanceLocked(const std::string& service, int port);
+  // Register and deregister return the changed service, which the caller touches once done with it
+  Service* RegisterLocked(const FakeConsulInstance& instance);
+  Service* DeregisterLocked(const std::string& id);
+  // Records a change of `service` and wakes up the blocking queries
+  void TouchLocked(Service* service);
+  std::shared_ptr<const std::string> BodyLocked(Service* service, bool passing_only);
+
+  static std::string SerializeInstances(const Service& service, bool passing_only);
+
+  std::string ip_;
+  uint16_t port_{0};
+  int listen_fd_{-1};
+  std::atomic<bool> running_{false};
+  std::thread accept_thread_;
+
+  // Connection threads are detached and counted, Stop waits for them
+  std::mutex connection_mutex_;
+  std::condition_variable connection_done_;
+  std::vector<int> connection_fds_;
+  size_t connection_num_{0};
+
+  mutable std::mutex mutex_;
+  // Notified on every change, wakes up the blocking queries
+  std::condition_variable changed_;
+  std::map<std::string, Service> services_;
+  // Service of each instance id
+  std::unordered_map<std::string, std::string> instance_services_;
+  uint64_t index_{1};
+  // Numbers the addresses and ids of the generated instances
+  uint64_t next_instance_{0};
+
+  FakeConsulFaults faults_;
+  uint32_t fail_next_count_{0};
+  int fail_next_status_{0};
+  std::mt19937_64 random_{std::random_device{}()};
+
+  FakeConsulChurn churn_;
+  std::thread churn_thread_;
+  std::condition_variable churn_changed_;
+
+  FakeConsulStats stats_;
+};
+
+}  // namespace trpc::consul
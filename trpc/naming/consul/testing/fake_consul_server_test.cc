@@ -0,0 +1,186 @@
+//
+//
+// Tencent is pleased to support the open source community by making tRPC available.
+//
+// Copyright (C) 2024 THL A29 Limited, a Tencent company.
+// All rights reserved.
+//
+// If you have downloaded a copy of the tRPC source code from Tencent,
+// please note that tRPC source code is licensed under the  Apache 2.0 License,
+// A copy of the Apache 2.0 License is included in this file.
+//
+//
+
+#include "trpc/naming/consul/testing/fake_consul_server.h"
+
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+#include "trpc/transport/common/http/curl_http.h"
+
+namespace trpc::consul {
+
+namespace {
+
+constexpr char kService[] = "trpc.test.fake.Greeter";
+
+class FakeConsulServerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_EQ(0, server_.Start());
+    ASSERT_EQ(curl_http::kOk, http_.Init());
+    base_url_ = "http://" + server_.Address();
+  }
+
+  void TearDown() override { server_.Stop(); }
+
+  uint64_t ResponseIndex(const curl_http::CurlHttpResponse& response) {
+    std::string_view value;
+    EXPECT_TRUE(response.GetHeader("X-Consul-Index", &value));
+    return std::stoull(std::string(value));
+  }
+
+  FakeConsulServer server_;
+  curl_http::CurlHttp http_;
+  std::string base_url_;
+};
+
+}  // namespace
+
+TEST_F(FakeConsulServerTest, health_test) {
+  server_.AddInstances(kService, 3, 9000);
+  ASSERT_EQ(3, server_.InstanceCount(kService));
+  ASSERT_TRUE(server_.SetStatus(std::string(kService) + "-0", "critical"));
+
+  curl_http::CurlHttpResponse response;
+  http_.Get(base_url_ + "/v1/health/service/" + kService, &response);
+  ASSERT_EQ(200, response.response_code);
+  EXPECT_EQ(server_.Index(), ResponseIndex(response));
+  EXPECT_NE(std::string::npos, response.body.find(R"("Address":"10.0.0.2","Port":9000)"));
+  EXPECT_NE(std::string::npos, response.body.find(R"("Status":"critical")"));
+
+  http_.Get(base_url_ + "/v1/health/service/" + kService + "?passing", &response);
+  ASSERT_EQ(200, response.response_code);
+  EXPECT_EQ(std::string::npos, response.body.find(R"("Status":"critical")"));
+  EXPECT_EQ(std::string::npos, response.body.find(std::string(kService) + "-0\""));
+
+  http_.Get(base_url_ + "/v1/health/service/unknown", &response);
+  EXPECT_EQ(200, response.response_code);
+  EXPECT_EQ("[]", response.body);
+
+  http_.Get(base_url_ + "/v1/unknown", &response);
+  EXPECT_EQ(404, response.response_code);
+  EXPECT_EQ(4, server_.GetStats().requests);
+}
+
+TEST_F(FakeConsulServerTest, blocking_query_test) {
+  server_.AddInstances(kService, 1);
+  std::string url = base_url_ + "/v1/health/service/" + kService + "?index=" + std::to_string(server_.Index());
+
+  // Nothing changes, the query returns the same index after the wait
+  curl_http::CurlHttpResponse response;
+  auto begin = std::chrono::steady_clock::now();
+  http_.Get(url + "&wait=100ms", &response);
+  EXPECT_GE(std::chrono::steady_clock::now() - begin, std::chrono::milliseconds(100));
+  ASSERT_EQ(200, response.response_code);
+  EXPECT_EQ(server_.Index(), ResponseIndex(response));
+
+  // A change wakes the query up long before its wait is over
+  std::thread changer([this]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    server_.SetStatus(std::string(kService) + "-0", "warning");
+  });
+  begin = std::chrono::steady_clock::now();
+  http_.Get(url + "&wait=10s", &response);
+  changer.join();
+  EXPECT_LT(std::chrono::steady_clock::now() - begin, std::chrono::seconds(5));
+  ASSERT_EQ(200, response.response_code);
+  EXPECT_EQ(server_.Index(), ResponseIndex(response));
+  EXPECT_NE(std::string::npos, response.body.find(R"("Status":"warning")"));
+  EXPECT_EQ(2, server_.GetStats().blocking_queries);
+}
+
+TEST_F(FakeConsulServerTest, register_test) {
+  curl_http::CurlHttpResponse response;
+  http_.Put(base_url_ + "/v1/agent/service/register",
+            R"({"name":"trpc.test.fake.Greeter","Address":"127.0.0.1","Port":10001,"meta":{"set":"a"}})", &response);
+  ASSERT_EQ(200, response.response_code);
+  ASSERT_EQ(1, server_.InstanceCount(kService));
+
+  http_.Get(base_url_ + "/v1/health/service/" + kService, &response);
+  EXPECT_NE(std::string::npos, response.body.find(R"("ID":"trpc.test.fake.Greeter")"));
+  EXPECT_NE(std::string::npos, response.body.find(R"("Meta":{"set":"a"})"));
+
+  // With a check the instance starts critical until it is passed
+  http_.Put(base_url_ + "/v1/agent/service/register",
+            R"({"ID":"greeter-2","Name":"trpc.test.fake.Greeter","Port":10002,"Check":{"TTL":"10s"}})", &response);
+  ASSERT_EQ(200, response.response_code);
+  http_.Get(base_url_ + "/v1/health/service/" + std::string(kService) + "?passing", &response);
+  EXPECT_EQ(std::string::npos, response.body.find("greeter-2"));
+  http_.Put(base_url_ + "/v1/agent/check/pass/service:greeter-2", "", &response);
+  ASSERT_EQ(200, response.response_code);
+  http_.Get(base_url_ + "/v1/health/service/" + std::string(kService) + "?passing", &response);
+  EXPECT_NE(std::string::npos, response.body.find("greeter-2"));
+
+  http_.Put(base_url_ + "/v1/agent/service/deregister/greeter-2", "", &response);
+  EXPECT_EQ(200, response.response_code);
+  http_.Put(base_url_ + "/v1/agent/service/deregister/greeter-2", "", &response);
+  EXPECT_EQ(404, response.response_code);
+  http_.Put(base_url_ + "/v1/agent/service/register", "{", &response);
+  EXPECT_EQ(400, response.response_code);
+  EXPECT_EQ(1, server_.InstanceCount(kService));
+}
+
+TEST_F(FakeConsulServerTest, fault_test) {
+  server_.AddInstances(kService, 1);
+  std::string url = base_url_ + "/v1/health/service/" + kService;
+  curl_http::CurlHttpResponse response;
+
+  server_.FailNextRequests(1, 503);
+  http_.Get(url, &response);
+  EXPECT_EQ(503, response.response_code);
+  http_.Get(url, &response);
+  EXPECT_EQ(200, response.response_code);
+
+  // A dropped request fails in the transport. libcurl retries a request once on a new connection if the reused one
+  // was closed without response, so both attempts are dropped.
+  server_.FailNextRequests(2, 0);
+  EXPECT_NE(curl_http::kOk, http_.Get(url, &response));
+
+  FakeConsulFaults faults;
+  faults.min_latency_ms = 50;
+  faults.max_latency_ms = 50;
+  server_.SetFaults(faults);
+  auto begin = std::chrono::steady_clock::now();
+  http_.Get(url, &response);
+  EXPECT_GE(std::chrono::steady_clock::now() - begin, std::chrono::milliseconds(50));
+  EXPECT_EQ(200, response.response_code);
+
+  FakeConsulStats stats = server_.GetStats();
+  EXPECT_EQ(1, stats.injected_errors);
+  EXPECT_EQ(2, stats.dropped);
+}
+
+TEST_F(FakeConsulServerTest, churn_test) {
+  server_.AddInstances(kService, 10);
+  uint64_t index = server_.Index();
+
+  FakeConsulChurn churn;
+  churn.interval_ms = 10;
+  churn.replace = true;
+  server_.SetChurn(churn);
+  for (int i = 0; i < 200 && server_.Index() == index; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  churn.interval_ms = 0;
+  server_.SetChurn(churn);
+  EXPECT_LT(index, server_.Index());
+  // Replacing keeps the number of instances
+  EXPECT_EQ(10, server_.InstanceCount(kService));
+}
+
+}  // namespace trpc::consul
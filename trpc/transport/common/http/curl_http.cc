@@ -13,10 +13,71 @@
 
 #include "trpc/transport/common/http/curl_http.h"
 
+#include <strings.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <exception>
 #include <utility>
 
 namespace trpc::curl_http {
 
+namespace {
+
+// Content-Length is only a hint, a bogus one must not make a response allocate more than this up front
+constexpr uint64_t kMaxReservedBodySize = 64 * 1024 * 1024;
+
+}  // namespace
+
+bool CurlHttpResponse::GetHeader(std::string_view name, std::string_view* value) const {
+  bool found = false;
+  std::string_view rest(headers);
+  while (!rest.empty()) {
+    size_t line_end = rest.find('\n');
+    std::string_view line = rest.substr(0, line_end);
+    rest = line_end == std::string_view::npos ? std::string_view() : rest.substr(line_end + 1);
+    if (line.size() <= name.size() || line[name.size()] != ':' ||
+        strncasecmp(line.data(), name.data(), name.size()) != 0) {
+      continue;
+    }
+    std::string_view header_value = line.substr(name.size() + 1);
+    size_t begin = header_value.find_first_not_of(" \t");
+    size_t end = header_value.find_last_not_of(" \t\r");
+    *value = begin == std::string_view::npos ? std::string_view() : header_value.substr(begin, end - begin + 1);
+    found = true;
+  }
+  return found;
+}
+
+CurlHttpShare::~CurlHttpShare() {
+  if (share_) {
+    curl_share_cleanup(share_);
+    share_ = nullptr;
+  }
+}
+
+int CurlHttpShare::Init() {
+  if (share_) return kOk;
+
+  share_ = curl_share_init();
+  if (!share_) return kError;
+
+  curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, CurlHttpShare::Lock);
+  curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, CurlHttpShare::Unlock);
+  curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+  curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+  return kOk;
+}
+
+void CurlHttpShare::Lock(CURL* /*handle*/, curl_lock_data data, curl_lock_access /*access*/, void* userptr) {
+  static_cast<CurlHttpShare*>(userptr)->mutexes_[data].lock();
+}
+
+void CurlHttpShare::Unlock(CURL* /*handle*/, curl_lock_data data, void* userptr) {
+  static_cast<CurlHttpShare*>(userptr)->mutexes_[data].unlock();
+}
+
 CurlHttp::CurlHttp() : curl_(nullptr), curl_err_buf_(nullptr) {
   curl_options_.connection_timeout = 3000L;
   curl_options_.timeout = 10000L;
@@ -37,21 +98,77 @@ int CurlHttp::CurlWriteCallback(char* src, size_t size, size_t nmemb, std::strin
   return total_size;
 }
 
+size_t CurlHttp::CurlHeaderCallback(char* src, size_t size, size_t nmemb, CurlHttpResponse* dst) {
+  size_t total_size = size * nmemb;
+  if (!dst) return total_size;
+
+  static constexpr char kContentLength[] = "Content-Length:";
+  static constexpr size_t kContentLengthSize = sizeof(kContentLength) - 1;
+  try {
+    if (total_size > kContentLengthSize && strncasecmp(src, kContentLength, kContentLengthSize) == 0) {
+      // The header line ends with CRLF, so strtoull stops inside the buffer
+      uint64_t content_length = strtoull(src + kContentLengthSize, nullptr, 10);
+      if (content_length > 0) {
+        dst->body.reserve(dst->body.size() + std::min(content_length, kMaxReservedBodySize));
+      }
+    }
+    dst->headers.append(src, total_size);
+  } catch (const std::exception&) {
+    // Nothing may unwind through libcurl, taking less than given aborts the transfer instead
+    return 0;
+  }
+
+  return total_size;
+}
+
 int CurlHttp::Init() {
   if (!curl_) {
     curl_ = curl_easy_init();
     if (!curl_) return kError;
+    if (share_) curl_easy_setopt(curl_, CURLOPT_SHARE, share_->Get());
+    // A new handle has none of the options yet
+    options_changed_ = true;
+    headers_changed_ = true;
+    bound_response_ = nullptr;
+    url_.clear();
+    method_ = Method::kNone;
   }
 
   return kOk;
 }
 
+void CurlHttp::SetShare(CurlHttpShare* share) {
+  share_ = share;
+  // Set once instead of per request, attaching a handle to a share is not free
+  if (curl_) curl_easy_setopt(curl_, CURLOPT_SHARE, share_ ? share_->Get() : nullptr);
+}
+
+void CurlHttp::SetConnectTo(const std::string& connect_to) {
+  curl_options_.connect_to = connect_to;
+  if (connect_to_) {
+    curl_slist_free_all(connect_to_);
+    connect_to_ = nullptr;
+  }
+  if (!connect_to.empty()) connect_to_ = curl_slist_append(nullptr, connect_to.c_str());
+  options_changed_ = true;
+}
+
 void CurlHttp::Destroy() {
   if (curl_) {
     curl_easy_cleanup(curl_);
     curl_ = nullptr;
   }
 
+  if (connect_to_) {
+    curl_slist_free_all(connect_to_);
+    connect_to_ = nullptr;
+  }
+
+  if (request_headers_) {
+    curl_slist_free_all(request_headers_);
+    request_headers_ = nullptr;
+  }
+
   if (curl_err_buf_) {
     delete[] curl_err_buf_;
     curl_err_buf_ = nullptr;
@@ -64,93 +181,107 @@ CurlHttpResponsePtr CurlHttp::Get(const std::string& url) {
   if (!curl_) return nullptr;
 
   CurlHttpResponsePtr response = std::make_shared<CurlHttpResponse>();
+  Get(url, response.get());
+  return response;
+}
 
-  // Set default options of curl_easy.
-  DoCurlEasySetOption();
-
-  // Set http request headers
-  CurlHttpSList* headers = CreateCurlSList(curl_options_.request_headers);
-  if (headers) curl_easy_setopt(curl_, CURLOPT_HTTPHEADER, headers);
-
-  // Set write callback
-  curl_easy_setopt(curl_, CURLOPT_WRITEFUNCTION, CurlHttp::CurlWriteCallback);
-  curl_easy_setopt(curl_, CURLOPT_WRITEDATA, &(response->body));
+int CurlHttp::Get(const std::string& url, CurlHttpResponse* response) {
+  if (!curl_ || !response) return kError;
 
-  // Set target url
-  curl_easy_setopt(curl_, CURLOPT_URL, url.c_str());
+  SetCurlOption(url, response);
+  SetMethod(Method::kGet, nullptr);
+  return Perform(response);
+}
 
-  // Do curl http://xxx.com/yy/to/path
-  CURLcode curl_code = curl_easy_perform(curl_);
-  response->code = static_cast<int>(curl_code);
+CurlHttpResponsePtr CurlHttp::Post(const std::string& url, const std::string& body) {
+  if (!curl_) return nullptr;
 
-  //
-  // Get response code of HTTP
-  // The stored value will be zero if no server response code has been received.
-  // Note that a proxy's CONNECT response should be read with CURLINFO_HTTP_CONNECTCODE
-  // -- and not this.
-  //
-  curl_easy_getinfo(curl_, CURLINFO_RESPONSE_CODE, &(response->response_code));
+  CurlHttpResponsePtr response = std::make_shared<CurlHttpResponse>();
+  Post(url, body, response.get());
+  return response;
+}
 
-  if (CURLE_OK != curl_code) {
-    response->err_msg.append(curl_err_buf_);
-  }
+int CurlHttp::Post(const std::string& url, const std::string& body, CurlHttpResponse* response) {
+  if (!curl_ || !response) return kError;
 
-  curl_slist_free_all(headers);
-  return response;
+  SetCurlOption(url, response);
+  SetMethod(Method::kPost, &body);
+  return Perform(response);
 }
 
-CurlHttpResponsePtr CurlHttp::Post(const std::string& url, const std::string& body) {
+CurlHttpResponsePtr CurlHttp::Put(const std::string& url, const std::string& body) {
   if (!curl_) return nullptr;
 
   CurlHttpResponsePtr response = std::make_shared<CurlHttpResponse>();
+  Put(url, body, response.get());
+  return response;
+}
 
-  CurlHttpSList* headers = CreateCurlSList(curl_options_.request_headers);
-  SetCurlOption(url, response, headers);
+int CurlHttp::Put(const std::string& url, const std::string& body, CurlHttpResponse* response) {
+  if (!curl_ || !response) return kError;
 
-  // Set method to HTTP POST
-  curl_easy_setopt(curl_, CURLOPT_POST, 1L);
+  SetCurlOption(url, response);
+  SetMethod(Method::kPut, &body);
+  return Perform(response);
+}
 
-  // Set post body
-  curl_easy_setopt(curl_, CURLOPT_POSTFIELDS, body.c_str());
-  curl_easy_setopt(curl_, CURLOPT_POSTFIELDSIZE, body.size());
+CURL* CurlHttp::PrepareGet(const std::string& url, CurlHttpResponse* response) {
+  if (!curl_ || !response) return nullptr;
 
-  // Do curl http://xxx.com/yy/to/path
-  CURLcode curl_code = curl_easy_perform(curl_);
-  response->code = static_cast<int>(curl_code);
+  SetCurlOption(url, response);
+  SetMethod(Method::kGet, nullptr);
+  return curl_;
+}
 
-  //
-  // Get response code of HTTP
-  // The stored value will be zero if no server response code has been received.
-  // Note that a proxy's CONNECT response should be read with CURLINFO_HTTP_CONNECTCODE
-  // -- and not this.
-  //
-  curl_easy_getinfo(curl_, CURLINFO_RESPONSE_CODE, &(response->response_code));
+CURL* CurlHttp::PreparePost(const std::string& url, const std::string& body, CurlHttpResponse* response) {
+  if (!curl_ || !response) return nullptr;
 
-  if (CURLE_OK != curl_code) {
-    response->err_msg.append(curl_err_buf_);
-  }
-
-  curl_slist_free_all(headers);
-  return response;
+  SetCurlOption(url, response);
+  SetMethod(Method::kPost, &body);
+  return curl_;
 }
 
-CurlHttpResponsePtr CurlHttp::Put(const std::string& url, const std::string& body) {
-  if (!curl_) return nullptr;
-
-  CurlHttpResponsePtr response = std::make_shared<CurlHttpResponse>();
+CURL* CurlHttp::PreparePut(const std::string& url, const std::string& body, CurlHttpResponse* response) {
+  if (!curl_ || !response) return nullptr;
 
-  CurlHttpSList* headers = CreateCurlSList(curl_options_.request_headers);
-  SetCurlOption(url, response, headers);
+  SetCurlOption(url, response);
+  SetMethod(Method::kPut, &body);
+  return curl_;
+}
 
-  // Set method to HTTP POST
-  curl_easy_setopt(curl_, CURLOPT_CUSTOMREQUEST, "PUT");
+void CurlHttp::SetMethod(Method method, const std::string* body) {
+  if (method != method_) {
+    // Restore the defaults first, the handle may have been used by another method
+    curl_easy_setopt(curl_, CURLOPT_CUSTOMREQUEST, nullptr);
+    switch (method) {
+      case Method::kGet:
+        curl_easy_setopt(curl_, CURLOPT_HTTPGET, 1L);
+        break;
+      case Method::kPost:
+        curl_easy_setopt(curl_, CURLOPT_POST, 1L);
+        break;
+      case Method::kPut:
+        curl_easy_setopt(curl_, CURLOPT_CUSTOMREQUEST, "PUT");
+        break;
+      default:
+        break;
+    }
+    method_ = method;
+  }
 
-  // Set post body
-  curl_easy_setopt(curl_, CURLOPT_POSTFIELDS, body.c_str());
-  curl_easy_setopt(curl_, CURLOPT_POSTFIELDSIZE, body.size());
+  // Set body, not copied by libcurl
+  if (body) {
+    curl_easy_setopt(curl_, CURLOPT_POSTFIELDS, body->c_str());
+    curl_easy_setopt(curl_, CURLOPT_POSTFIELDSIZE, static_cast<long>(body->size()));
+  }
+}
 
+int CurlHttp::Perform(CurlHttpResponse* response) {
   // Do curl http://xxx.com/yy/to/path
-  CURLcode curl_code = curl_easy_perform(curl_);
+  return Finish(curl_easy_perform(curl_), response);
+}
+
+int CurlHttp::Finish(CURLcode curl_code, CurlHttpResponse* response) {
   response->code = static_cast<int>(curl_code);
 
   //
@@ -160,13 +291,25 @@ CurlHttpResponsePtr CurlHttp::Put(const std::string& url, const std::string& bod
   // -- and not this.
   //
   curl_easy_getinfo(curl_, CURLINFO_RESPONSE_CODE, &(response->response_code));
+  long num_connects = 0;
+  curl_easy_getinfo(curl_, CURLINFO_NUM_CONNECTS, &num_connects);
+  response->num_connects = num_connects;
+  curl_off_t value = 0;
+  if (curl_easy_getinfo(curl_, CURLINFO_NAMELOOKUP_TIME_T, &value) == CURLE_OK) response->name_lookup_us = value;
+  if (curl_easy_getinfo(curl_, CURLINFO_CONNECT_TIME_T, &value) == CURLE_OK) response->connect_us = value;
+  if (curl_easy_getinfo(curl_, CURLINFO_APPCONNECT_TIME_T, &value) == CURLE_OK) response->app_connect_us = value;
+  if (curl_easy_getinfo(curl_, CURLINFO_PRETRANSFER_TIME_T, &value) == CURLE_OK) response->pre_transfer_us = value;
+  if (curl_easy_getinfo(curl_, CURLINFO_STARTTRANSFER_TIME_T, &value) == CURLE_OK) {
+    response->start_transfer_us = value;
+  }
+  if (curl_easy_getinfo(curl_, CURLINFO_TOTAL_TIME_T, &value) == CURLE_OK) response->total_us = value;
+  if (curl_easy_getinfo(curl_, CURLINFO_SIZE_DOWNLOAD_T, &value) == CURLE_OK) response->size_download = value;
 
   if (CURLE_OK != curl_code) {
     response->err_msg.append(curl_err_buf_);
   }
 
-  curl_slist_free_all(headers);
-  return response;
+  return CURLE_OK == curl_code ? kOk : kError;
 }
 
 CurlHttpSList* CurlHttp::CreateCurlSList(const CurlHttpHeaders& http_headers) {
@@ -192,13 +335,32 @@ void CurlHttp::DoCurlEasySetOption() {
   if (!curl_) return;
 
   // Set connection timeout.
-  curl_easy_setopt(curl_, CURLOPT_CONNECTTIMEOUT, curl_options_.connection_timeout);
-  curl_easy_setopt(curl_, CURLOPT_TIMEOUT, curl_options_.timeout);
+  curl_easy_setopt(curl_, CURLOPT_CONNECTTIMEOUT_MS, curl_options_.connection_timeout);
+  curl_easy_setopt(curl_, CURLOPT_TIMEOUT_MS, curl_options_.timeout);
 
   // Set flag to indicate checking SSL security or not.
   int64_t ssl_verify_peer = curl_options_.insecure ? 0L : 1L;
   curl_easy_setopt(curl_, CURLOPT_SSL_VERIFYPEER, ssl_verify_peer);
-  curl_easy_setopt(curl_, CURLOPT_SSL_VERIFYHOST, ssl_verify_peer);
+  curl_easy_setopt(curl_, CURLOPT_SSL_VERIFYHOST, ssl_verify_peer ? 2L : 0L);
+
+  // Set TLS files, nullptr restores the defaults.
+  curl_easy_setopt(curl_, CURLOPT_CAINFO, curl_options_.ca_info.empty() ? nullptr : curl_options_.ca_info.c_str());
+  curl_easy_setopt(curl_, CURLOPT_SSLCERT, curl_options_.ssl_cert.empty() ? nullptr : curl_options_.ssl_cert.c_str());
+  curl_easy_setopt(curl_, CURLOPT_SSLKEY, curl_options_.ssl_key.empty() ? nullptr : curl_options_.ssl_key.c_str());
+  curl_easy_setopt(curl_, CURLOPT_CONNECT_TO, connect_to_);
+
+  // Set TCP keep-alive, so that idle connections between requests survive middleboxes.
+  if (curl_options_.tcp_keepalive_idle > 0) {
+    curl_easy_setopt(curl_, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl_, CURLOPT_TCP_KEEPIDLE, static_cast<long>(curl_options_.tcp_keepalive_idle));
+    curl_easy_setopt(curl_, CURLOPT_TCP_KEEPINTVL, static_cast<long>(curl_options_.tcp_keepalive_idle));
+  } else {
+    curl_easy_setopt(curl_, CURLOPT_TCP_KEEPALIVE, 0L);
+  }
+
+  // Set write callback and header callback, which keeps the header lines and reserves the body from Content-Length
+  curl_easy_setopt(curl_, CURLOPT_WRITEFUNCTION, CurlHttp::CurlWriteCallback);
+  curl_easy_setopt(curl_, CURLOPT_HEADERFUNCTION, CurlHttp::CurlHeaderCallback);
 
   // Set error buffer for curl..
   if (curl_err_buf_) curl_easy_setopt(curl_, CURLOPT_ERRORBUFFER, curl_err_buf_);
@@ -223,19 +385,35 @@ void CurlHttp::DoCurlEasySetOption() {
   return;
 }
 
-void CurlHttp::SetCurlOption(const std::string& url, CurlHttpResponsePtr& response, CurlHttpSList* headers) {
-  // Set default options of curl_easy.
-  DoCurlEasySetOption();
+void CurlHttp::SetCurlOption(const std::string& url, CurlHttpResponse* response) {
+  response->Reset();
 
-  // Set http request headers
-  if (headers) curl_easy_setopt(curl_, CURLOPT_HTTPHEADER, headers);
+  // Set default options of curl_easy, only if they changed since the last request.
+  if (options_changed_) {
+    DoCurlEasySetOption();
+    options_changed_ = false;
+  }
 
-  // Set write callback
-  curl_easy_setopt(curl_, CURLOPT_WRITEFUNCTION, CurlHttp::CurlWriteCallback);
-  curl_easy_setopt(curl_, CURLOPT_WRITEDATA, &(response->body));
+  // Set http request headers, the list is kept until the headers change
+  if (headers_changed_) {
+    if (request_headers_) curl_slist_free_all(request_headers_);
+    request_headers_ = CreateCurlSList(curl_options_.request_headers);
+    curl_easy_setopt(curl_, CURLOPT_HTTPHEADER, request_headers_);
+    headers_changed_ = false;
+  }
 
-  // Set target url
-  curl_easy_setopt(curl_, CURLOPT_URL, url.c_str());
+  // Set the buffers of the response
+  if (bound_response_ != response) {
+    curl_easy_setopt(curl_, CURLOPT_WRITEDATA, &(response->body));
+    curl_easy_setopt(curl_, CURLOPT_HEADERDATA, response);
+    bound_response_ = response;
+  }
+
+  // Set target url, libcurl copies it, so an unchanged url is not set again
+  if (url != url_) {
+    url_.assign(url);
+    curl_easy_setopt(curl_, CURLOPT_URL, url_.c_str());
+  }
 }
 
 }  // namespace trpc::curl_http
@@ -18,7 +18,9 @@
 
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
 
 #include "trpc/transport/common/http/core.h"
 
@@ -41,19 +43,93 @@ struct CurlHttpResponse {
   // Body of response
   std::string body{""};
 
+  // Header lines of response as received, each ending with CRLF.
+  std::string headers{""};
+
   // Path of body saved in file.
   std::string body_path{""};
 
+  // Number of new connections the request had to make, zero if it reused one.
+  int64_t num_connects{0};
+
+  //
+  // Timings of the transfer in microseconds, each measured from its start, and the bytes of the body received.
+  // Phases the transfer skipped are zero, e.g. name lookup and connect on a reused connection, or the TLS handshake
+  // of a plain HTTP request.
+  //
+  // Reference: https://curl.se/libcurl/c/curl_easy_getinfo.html#TIMES
+  //
+  int64_t name_lookup_us{0};
+  int64_t connect_us{0};
+  int64_t app_connect_us{0};
+  int64_t pre_transfer_us{0};
+  int64_t start_transfer_us{0};
+  int64_t total_us{0};
+  int64_t size_download{0};
+
   // Flag to indicate body was stored in file.
   unsigned stored_in_file : 1;
 
-  CurlHttpResponse() : code(-1), err_msg(""), response_code(500), body(""), body_path(""), stored_in_file(0) {}
+  CurlHttpResponse()
+      : code(-1), err_msg(""), response_code(500), body(""), headers(""), body_path(""), stored_in_file(0) {}
 
   ~CurlHttpResponse() = default;
+
+  // Reset to the initial state, keeping the capacity of the strings so that the response can be reused.
+  void Reset() {
+    code = -1;
+    err_msg.clear();
+    response_code = 500;
+    body.clear();
+    headers.clear();
+    body_path.clear();
+    num_connects = 0;
+    name_lookup_us = 0;
+    connect_us = 0;
+    app_connect_us = 0;
+    pre_transfer_us = 0;
+    start_transfer_us = 0;
+    total_us = 0;
+    size_download = 0;
+    stored_in_file = 0;
+  }
+
+  // Finds the value of header `name`, case-insensitively, without the surrounding whitespace. If the header occurs
+  // more than once, e.g. in the responses of followed redirections, the last one wins.
+  bool GetHeader(std::string_view name, std::string_view* value) const;
 };
 
 using CurlHttpResponsePtr = std::shared_ptr<CurlHttpResponse>;
 
+//
+// Share handle of libcurl, which shares the DNS cache and TLS sessions between the handles using it, so that a new
+// connection resumes a TLS session of another handle instead of doing a full handshake. Thread-safe, the handles
+// using it may run concurrently. Connections are not shared, libcurl does not support sharing them between
+// concurrent handles, each handle keeps its own.
+//
+// Reference: https://curl.se/libcurl/c/libcurl-share.html
+//
+class CurlHttpShare {
+ public:
+  CurlHttpShare() = default;
+  ~CurlHttpShare();
+
+  CurlHttpShare(const CurlHttpShare&) = delete;
+  CurlHttpShare& operator=(const CurlHttpShare&) = delete;
+
+  int Init();
+
+  CURLSH* Get() const { return share_; }
+
+ private:
+  static void Lock(CURL* handle, curl_lock_data data, curl_lock_access access, void* userptr);
+  static void Unlock(CURL* handle, curl_lock_data data, void* userptr);
+
+ private:
+  CURLSH* share_{nullptr};
+  std::mutex mutexes_[CURL_LOCK_DATA_LAST];
+};
+
 class CurlHttp {
  public:
   struct Options {
@@ -77,6 +153,22 @@ class CurlHttp {
     // A value of 1 means curl verifies; 0 (zero) means it doesn't.
     //
     unsigned int insecure : 1;
+
+    // CA bundle, client certificate and client key in PEM, empty means the default of libcurl.
+    std::string ca_info;
+    std::string ssl_cert;
+    std::string ssl_key;
+
+    //
+    // "HOST:PORT:CONNECT-TO-HOST:CONNECT-TO-PORT", connects to another address than the one of the url, whose host
+    // is still used for SNI and certificate verification.
+    //
+    // Reference: https://curl.se/libcurl/c/CURLOPT_CONNECT_TO.html
+    //
+    std::string connect_to;
+
+    // Idle time in seconds before TCP keep-alive probes are sent, zero disables them.
+    int64_t tcp_keepalive_idle{0};
   };
 
   //
@@ -94,6 +186,19 @@ class CurlHttp {
   //
   static int CurlWriteCallback(char* src, size_t size, size_t nmemb, std::string* dst);
 
+  //
+  // @brief This callback function gets called by libcurl for each header line of the response.
+  // It reserves the body of the response from Content-Length, so that it does not grow chunk by chunk.
+  // @param src points to the header line, which is not null-terminated.
+  // @param nmemb is size of the header line.
+  // @param size is always 1.
+  // @param dst points to the response.
+  // @return size_t, return the number of bytes actually taken care of.
+  //
+  // Reference :https://curl.haxx.se/libcurl/c/CURLOPT_HEADERFUNCTION.html
+  //
+  static size_t CurlHeaderCallback(char* src, size_t size, size_t nmemb, CurlHttpResponse* dst);
+
  public:
   int Init();
   void Destroy();
@@ -101,27 +206,83 @@ class CurlHttp {
   // HTTP GET
   CurlHttpResponsePtr Get(const std::string& url);
 
+  // HTTP GET into a caller supplied response, which is reset first and can be reused across requests.
+  int Get(const std::string& url, CurlHttpResponse* response);
+
   // HTTP POST
   CurlHttpResponsePtr Post(const std::string& url, const std::string& body);
 
+  // HTTP POST into a caller supplied response, see Get.
+  int Post(const std::string& url, const std::string& body, CurlHttpResponse* response);
+
   // HTTP PUT
   CurlHttpResponsePtr Put(const std::string& url, const std::string& body);
 
+  // HTTP PUT into a caller supplied response, see Get.
+  int Put(const std::string& url, const std::string& body, CurlHttpResponse* response);
+
+  //
+  // Prepares the handle for a request into `response` without performing it, so that a multi handle drives the
+  // transfer: the returned handle is added to the multi handle, and Finish is called with the result the multi
+  // handle reports for it. The body is not copied and must stay alive until then.
+  // @return nullptr if the handle is not initialized.
+  //
+  // Reference: https://curl.se/libcurl/c/libcurl-multi.html
+  //
+  CURL* PrepareGet(const std::string& url, CurlHttpResponse* response);
+  CURL* PreparePost(const std::string& url, const std::string& body, CurlHttpResponse* response);
+  CURL* PreparePut(const std::string& url, const std::string& body, CurlHttpResponse* response);
+
+  // Fills the status, timings and error of `response` once the transfer of a prepared request is done.
+  int Finish(CURLcode curl_code, CurlHttpResponse* response);
+
  public:
   CurlHttp();
   ~CurlHttp();
 
-  void SetConnectionTimeout(int64_t timeout) { curl_options_.connection_timeout = timeout; }
+  //
+  // Options and request headers are applied to the handle by the first request after they changed, and kept by the
+  // handle for the following ones. A request with a reused response, from the second request on, only allocates
+  // inside libcurl and for body growth.
+  //
+  void SetConnectionTimeout(int64_t timeout) {
+    curl_options_.connection_timeout = timeout;
+    options_changed_ = true;
+  }
   int64_t GetConnectionTimeout() { return curl_options_.connection_timeout; }
 
-  void SetTimeout(int64_t timeout) { curl_options_.timeout = timeout; }
+  void SetTimeout(int64_t timeout) {
+    curl_options_.timeout = timeout;
+    options_changed_ = true;
+  }
   int64_t GetTimeout() { return curl_options_.timeout; }
 
-  void SetInsecure(unsigned int insecure) { curl_options_.insecure = insecure; }
+  void SetInsecure(unsigned int insecure) {
+    curl_options_.insecure = insecure;
+    options_changed_ = true;
+  }
   unsigned int GetInsecure() { return curl_options_.insecure; }
 
+  void SetTls(const std::string& ca_info, const std::string& ssl_cert, const std::string& ssl_key) {
+    curl_options_.ca_info = ca_info;
+    curl_options_.ssl_cert = ssl_cert;
+    curl_options_.ssl_key = ssl_key;
+    options_changed_ = true;
+  }
+
+  void SetConnectTo(const std::string& connect_to);
+
+  void SetTcpKeepAlive(int64_t idle) {
+    curl_options_.tcp_keepalive_idle = idle;
+    options_changed_ = true;
+  }
+
+  // Uses the share handle from now on, which must outlive this object or a later call with nullptr.
+  void SetShare(CurlHttpShare* share);
+
   void SetRequestHeader(const std::string& name, const std::string& value) {
     curl_options_.request_headers[name] = value;
+    headers_changed_ = true;
   }
   int GetRequestHeader(const std::string& name, std::string* value) {
     if (!value) return kError;
@@ -134,14 +295,28 @@ class CurlHttp {
   }
 
  private:
+  enum class Method { kNone, kGet, kPost, kPut };
+
   CurlHttpSList* CreateCurlSList(const CurlHttpHeaders& http_headers);
   void DoCurlEasySetOption();
-  void SetCurlOption(const std::string& url, CurlHttpResponsePtr& response, CurlHttpSList* headers);
+  void SetCurlOption(const std::string& url, CurlHttpResponse* response);
+  void SetMethod(Method method, const std::string* body);
+  int Perform(CurlHttpResponse* response);
 
  private:
   CURL* curl_;
   CurlHttp::Options curl_options_;
   char* curl_err_buf_;
+  CurlHttpShare* share_{nullptr};
+  CurlHttpSList* connect_to_{nullptr};
+
+  // State the handle holds since the last request, so that unchanged options are not set again
+  CurlHttpSList* request_headers_{nullptr};
+  bool options_changed_{true};
+  bool headers_changed_{true};
+  CurlHttpResponse* bound_response_{nullptr};
+  std::string url_;
+  Method method_{Method::kNone};
 };
 
 using CurlHttpOptions = CurlHttp::Options;